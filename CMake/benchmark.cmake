@@ -0,0 +1,21 @@
+cmake_minimum_required (VERSION 3.2)
+
+if(benchmark_included)
+    return()
+endif (benchmark_included)
+set(benchmark_included TRUE)
+
+include(DownloadProject)
+
+download_project(
+	PROJ benchmark_proj
+	GIT_REPOSITORY https://github.com/google/benchmark.git
+	GIT_TAG v1.7.1
+	UPDATE_DISCONNECTED 1
+	QUIET
+)
+
+set(BENCHMARK_ENABLE_TESTING OFF CACHE "" INTERNAL)
+set(BENCHMARK_ENABLE_GTEST_TESTS OFF CACHE "" INTERNAL)
+set(BENCHMARK_ENABLE_INSTALL OFF CACHE "" INTERNAL)
+add_subdirectory(${benchmark_proj_SOURCE_DIR} ${benchmark_proj_BINARY_DIR})
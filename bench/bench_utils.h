@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <nnp/float16.h>
+#include <nnp/layer.h>
+#include <nnp/network.h>
+#include <nnp/tensor.h>
+
+namespace bench {
+
+// Reduced precision types draw in full precision and round.
+template <typename Float>
+class NormalDistGenerator
+{
+	using Accumulator = nnp::details::Accumulator<Float>;
+
+public:
+	Float operator()() { return static_cast<Float>(m_dis(m_gen)); }
+
+private:
+	std::mt19937 m_gen;
+	std::normal_distribution<Accumulator> m_dis{Accumulator{0}, Accumulator{0.1}};
+};
+
+// dlib keeps fixed size matrices inline, so the larger layers and tensors are allocated on
+// the heap.
+template <typename Float, size_t SIZE, size_t BATCH_SIZE>
+std::unique_ptr<nnp::Tensor<Float, SIZE, BATCH_SIZE>> makeTensor(size_t batchSize)
+{
+	auto tensor = std::make_unique<nnp::Tensor<Float, SIZE, BATCH_SIZE>>();
+	if constexpr (BATCH_SIZE == nnp::RESIZEABLE)
+		tensor->setBatchSize(batchSize);
+	return tensor;
+}
+
+// Returns a tensor of batchSize samples filled with normally distributed values. batchSize
+// must match BATCH_SIZE unless the batch dimension is resizeable.
+template <typename Float, size_t SIZE, size_t BATCH_SIZE>
+std::unique_ptr<nnp::Tensor<Float, SIZE, BATCH_SIZE>> randomTensor(size_t batchSize)
+{
+	auto tensor = makeTensor<Float, SIZE, BATCH_SIZE>(batchSize);
+	NormalDistGenerator<Float> gen;
+	for (auto& f : *tensor)
+		f = gen();
+	return tensor;
+}
+
+// One-hot ground truth with the class of each sample chosen round-robin.
+template <typename Float, size_t SIZE, size_t BATCH_SIZE>
+std::unique_ptr<nnp::Tensor<Float, SIZE, BATCH_SIZE>> oneHot(size_t batchSize)
+{
+	auto tensor = makeTensor<Float, SIZE, BATCH_SIZE>(batchSize);
+	for (size_t ii = 0; ii != batchSize; ++ii)
+		for (size_t jj = 0; jj != SIZE; ++jj)
+			(*tensor)(jj, ii) = jj == ii % SIZE ? Float{1} : Float{0};
+	return tensor;
+}
+
+// The class labels of oneHot(), for losses that take labels.
+template <size_t SIZE, size_t BATCH_SIZE>
+std::unique_ptr<nnp::Tensor<uint32_t, 1, BATCH_SIZE>> labels(size_t batchSize)
+{
+	auto tensor = makeTensor<uint32_t, 1, BATCH_SIZE>(batchSize);
+	for (size_t ii = 0; ii != batchSize; ++ii)
+		(*tensor)(0, ii) = ii % SIZE;
+	return tensor;
+}
+
+// Classifier with 256 inputs, two hidden layers of 256 nodes and 10 outputs.
+template <typename Float>
+using Mlp = nnp::TupleNetwork<
+	nnp::ReluLayer<Float, 256, 256>,
+	nnp::ReluLayer<Float, 256, 256>,
+	nnp::LinearLayer<Float, 10, 256>>;
+
+template <typename Float>
+std::unique_ptr<Mlp<Float>> makeMlp()
+{
+	NormalDistGenerator<Float> gen;
+	return std::make_unique<Mlp<Float>>(
+		nnp::ReluLayer<Float, 256, 256>(gen),
+		nnp::ReluLayer<Float, 256, 256>(gen),
+		nnp::LinearLayer<Float, 10, 256>(gen));
+}
+
+// Benchmarks templated on a batch size read the size of resizeable batches from the first
+// argument.
+template <size_t BATCH_SIZE>
+size_t batchSize(const benchmark::State& state)
+{
+	return BATCH_SIZE == nnp::RESIZEABLE ? static_cast<size_t>(state.range(0)) : BATCH_SIZE;
+}
+
+// Reports the given percentiles of latencies, in nanoseconds, as counters named p50, p99 and
+// so on.
+inline void setLatencyCounters(benchmark::State& state, std::vector<double> latencies)
+{
+	if (latencies.empty())
+		return;
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&latencies](double p) {
+		return latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+	};
+	state.counters["p50"] = percentile(0.5);
+	state.counters["p90"] = percentile(0.9);
+	state.counters["p99"] = percentile(0.99);
+	state.counters["p999"] = percentile(0.999);
+}
+
+inline double nanoseconds(std::chrono::steady_clock::duration duration)
+{
+	return std::chrono::duration<double, std::nano>(duration).count();
+}
+
+} // namespace bench
@@ -0,0 +1,146 @@
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include <nnp/dataset.h>
+#include <nnp/thread_pool.h>
+
+#include "bench_utils.h"
+
+namespace {
+
+constexpr size_t INPUT_C = 256;
+constexpr size_t TARGET_C = 10;
+constexpr size_t SAMPLE_COUNT = 16384;
+constexpr size_t BATCH_SIZE = 256;
+
+using Csv = nnp::CsvSource<float, INPUT_C, TARGET_C>;
+using Binary = nnp::BinarySource<float, INPUT_C, TARGET_C>;
+
+// Writes a CSV and a binary dataset of normally distributed inputs and one-hot targets to
+// the temporary directory the first time they are needed.
+struct Files
+{
+	Files()
+		: csv((std::filesystem::temp_directory_path() / "nnp_bench_dataset.csv").string())
+		, binary((std::filesystem::temp_directory_path() / "nnp_bench_dataset.bin").string())
+	{
+		std::ofstream file(csv);
+		bench::NormalDistGenerator<float> gen;
+		for (size_t ii = 0; ii != SAMPLE_COUNT; ++ii)
+		{
+			for (size_t jj = 0; jj != INPUT_C; ++jj)
+				file << gen() << ',';
+			for (size_t jj = 0; jj != TARGET_C; ++jj)
+				file << (jj == ii % TARGET_C) << (jj + 1 == TARGET_C ? '\n' : ',');
+		}
+		file.close();
+		Csv source(csv);
+		nnp::saveDataset(source, binary);
+		csvBytes = std::filesystem::file_size(csv);
+	}
+
+	~Files()
+	{
+		std::remove(csv.c_str());
+		std::remove(binary.c_str());
+	}
+
+	std::string csv;
+	std::string binary;
+	size_t csvBytes;
+};
+
+const Files& files()
+{
+	static const Files instance;
+	return instance;
+}
+
+// One epoch read on the calling thread.
+template <typename Source>
+void datasetRead(benchmark::State& state, const std::string& path, size_t bytes)
+{
+	Source source(path);
+	typename Source::Batch batch(BATCH_SIZE);
+	for (auto _ : state)
+	{
+		source.rewind();
+		while (source.read(batch))
+			if (batch.size() != BATCH_SIZE)
+				batch = typename Source::Batch(BATCH_SIZE);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * SAMPLE_COUNT);
+	state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+void csvRead(benchmark::State& state)
+{
+	datasetRead<Csv>(state, files().csv, files().csvBytes);
+}
+
+void binaryRead(benchmark::State& state)
+{
+	datasetRead<Binary>(
+		state, files().binary, SAMPLE_COUNT * (INPUT_C + TARGET_C) * sizeof(float));
+}
+
+// Whole file parsed by loadCsv() on the number of threads in the first argument. The
+// bytes_per_second counter is the parsing throughput.
+void csvLoad(benchmark::State& state)
+{
+	nnp::ThreadPool pool(state.range(0));
+	for (auto _ : state)
+	{
+		auto batch = nnp::loadCsv<float, INPUT_C, TARGET_C>(files().csv, pool);
+		benchmark::DoNotOptimize(batch.input.begin());
+	}
+	state.SetItemsProcessed(state.iterations() * SAMPLE_COUNT);
+	state.SetBytesProcessed(state.iterations() * files().csvBytes);
+}
+
+// One epoch of CSV batches through a BatchPrefetcher while the caller sleeps for the number
+// of microseconds in the first argument per batch, standing in for a training step. The
+// overlap counter is the fraction of the loading time hidden behind those steps.
+void prefetchOverlap(benchmark::State& state)
+{
+	const std::chrono::microseconds step(state.range(0));
+	nnp::BatchPrefetcher<Csv> prefetcher(Csv(files().csv), BATCH_SIZE);
+	for (auto _ : state)
+		while (const auto* batch = prefetcher.next())
+		{
+			benchmark::DoNotOptimize(batch->input.begin());
+			std::this_thread::sleep_for(step);
+		}
+	const nnp::PrefetchStats stats = prefetcher.stats();
+	state.SetItemsProcessed(state.iterations() * SAMPLE_COUNT);
+	state.counters["overlap"] = stats.overlap();
+	state.counters["wait_ms"] = stats.waitTime.count() / 1e6 / state.iterations();
+}
+
+} // namespace
+
+BENCHMARK(csvRead)->Unit(benchmark::kMillisecond);
+BENCHMARK(binaryRead)->Unit(benchmark::kMillisecond);
+BENCHMARK(csvLoad)
+	->ArgName("threads")
+	->Arg(1)
+	->Arg(2)
+	->Arg(4)
+	->Arg(8)
+	->Arg(16)
+	->Unit(benchmark::kMillisecond)
+	->UseRealTime();
+BENCHMARK(prefetchOverlap)
+	->ArgName("step_us")
+	->Arg(0)
+	->Arg(500)
+	->Arg(2000)
+	->Unit(benchmark::kMillisecond)
+	->UseRealTime();
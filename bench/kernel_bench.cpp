@@ -0,0 +1,263 @@
+#include <cstdint>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <nnp/details/simd.h>
+
+#include "bench_utils.h"
+
+namespace {
+
+namespace simd = nnp::details::simd;
+
+// Restricts dispatch to the ISA in the first argument for the lifetime of the benchmark.
+// Benchmarks for ISAs the CPU lacks are reported as skipped instead of silently measuring a
+// lower one.
+class IsaScope
+{
+public:
+	explicit IsaScope(benchmark::State& state)
+		: m_previous(simd::isa())
+	{
+		const auto isa = static_cast<simd::Isa>(state.range(0));
+		if (isa > simd::detectIsa())
+			state.SkipWithError("ISA not supported by this CPU");
+		simd::setIsa(isa);
+	}
+
+	IsaScope(const IsaScope&) = delete;
+
+	IsaScope& operator=(const IsaScope&) = delete;
+
+	~IsaScope() { simd::setIsa(m_previous); }
+
+private:
+	simd::Isa m_previous;
+};
+
+std::vector<float> randomVector(size_t size)
+{
+	bench::NormalDistGenerator<float> gen;
+	std::vector<float> v(size);
+	for (auto& f : v)
+		f = gen();
+	return v;
+}
+
+void setBytesProcessed(benchmark::State& state, size_t bytesPerIteration)
+{
+	state.SetBytesProcessed(state.iterations() * bytesPerIteration);
+}
+
+void simdRelu(benchmark::State& state)
+{
+	IsaScope isa(state);
+	const auto input = randomVector(state.range(1));
+	auto v = input;
+	for (auto _ : state)
+	{
+		simd::relu(v.data(), v.data() + v.size());
+		benchmark::ClobberMemory();
+	}
+	setBytesProcessed(state, 2 * v.size() * sizeof(float));
+}
+
+void simdReluBackward(benchmark::State& state)
+{
+	IsaScope isa(state);
+	const auto relu = randomVector(state.range(1));
+	auto gradient = randomVector(state.range(1));
+	for (auto _ : state)
+	{
+		simd::reluBackward(relu.data(), gradient.data(), gradient.data() + gradient.size());
+		benchmark::ClobberMemory();
+	}
+	setBytesProcessed(state, 3 * gradient.size() * sizeof(float));
+}
+
+// The input is restored every iteration so that sigmoid does not converge to a fixed point
+// whose cost differs from that of random data.
+void simdSigmoid(benchmark::State& state)
+{
+	IsaScope isa(state);
+	const auto input = randomVector(state.range(1));
+	auto v = input;
+	for (auto _ : state)
+	{
+		simd::sigmoid(v.data(), v.data() + v.size());
+		benchmark::ClobberMemory();
+		state.PauseTiming();
+		v = input;
+		state.ResumeTiming();
+	}
+	setBytesProcessed(state, 2 * v.size() * sizeof(float));
+}
+
+void simdSoftmax(benchmark::State& state)
+{
+	IsaScope isa(state);
+	const auto input = randomVector(state.range(1));
+	auto v = input;
+	for (auto _ : state)
+	{
+		simd::softmax(v.data(), v.data() + v.size());
+		benchmark::ClobberMemory();
+		state.PauseTiming();
+		v = input;
+		state.ResumeTiming();
+	}
+	setBytesProcessed(state, 2 * v.size() * sizeof(float));
+}
+
+// The range argument is the number of rows and columns of a square matrix.
+void simdGemv(benchmark::State& state)
+{
+	IsaScope isa(state);
+	const size_t size = state.range(1);
+	const auto matrix = randomVector(size * size);
+	const auto x = randomVector(size);
+	const auto bias = randomVector(size);
+	std::vector<float> y(size);
+	for (auto _ : state)
+	{
+		simd::gemv(matrix.data(), x.data(), bias.data(), y.data(), size, size);
+		benchmark::ClobberMemory();
+	}
+	setBytesProcessed(state, matrix.size() * sizeof(float));
+	state.counters["FLOPS"] = benchmark::Counter(
+		2.0 * size * size, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// Same sizes as simdGemv, with 8-bit weights and inputs. The AVX-512 path needs VNNI and
+// runs the AVX2 kernel on CPUs without it.
+void simdGemvU8S8(benchmark::State& state)
+{
+	IsaScope isa(state);
+	const size_t size = state.range(1);
+	std::vector<int8_t> matrix(size * size);
+	std::vector<uint8_t> x(size);
+	for (size_t ii = 0; ii != matrix.size(); ++ii)
+		matrix[ii] = static_cast<int8_t>(static_cast<int>(ii * 37 % 255) - 127);
+	for (size_t ii = 0; ii != x.size(); ++ii)
+		x[ii] = static_cast<uint8_t>(ii * 11);
+	const std::vector<int32_t> bias(size);
+	std::vector<int32_t> y(size);
+	for (auto _ : state)
+	{
+		simd::gemvU8S8(matrix.data(), x.data(), bias.data(), y.data(), size, size);
+		benchmark::ClobberMemory();
+	}
+	setBytesProcessed(state, matrix.size());
+	state.counters["OPS"] = benchmark::Counter(
+		2.0 * size * size, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void simdSumSquares(benchmark::State& state)
+{
+	IsaScope isa(state);
+	const auto data = randomVector(state.range(1));
+	for (auto _ : state)
+		benchmark::DoNotOptimize(simd::sumSquares(data.data(), data.size()));
+	setBytesProcessed(state, data.size() * sizeof(float));
+}
+
+// The optimizer benchmarks use a zero step size so that the parameters stay the same no
+// matter how many iterations are run.
+void simdSgd(benchmark::State& state)
+{
+	IsaScope isa(state);
+	auto params = randomVector(state.range(1));
+	const auto gradient = randomVector(state.range(1));
+	for (auto _ : state)
+	{
+		simd::sgd(params.data(), gradient.data(), params.size(), 0.f, 0.f);
+		benchmark::ClobberMemory();
+	}
+	setBytesProcessed(state, 3 * params.size() * sizeof(float));
+}
+
+void simdMomentum(benchmark::State& state)
+{
+	IsaScope isa(state);
+	auto params = randomVector(state.range(1));
+	const auto gradient = randomVector(state.range(1));
+	std::vector<float> velocity(params.size());
+	for (auto _ : state)
+	{
+		simd::momentum(
+			params.data(), gradient.data(), velocity.data(), params.size(), 0.f, 0.f, 0.9f);
+		benchmark::ClobberMemory();
+	}
+	setBytesProcessed(state, 5 * params.size() * sizeof(float));
+}
+
+void simdRmsProp(benchmark::State& state)
+{
+	IsaScope isa(state);
+	auto params = randomVector(state.range(1));
+	const auto gradient = randomVector(state.range(1));
+	std::vector<float> meanSquare(params.size());
+	for (auto _ : state)
+	{
+		simd::rmsProp(
+			params.data(),
+			gradient.data(),
+			meanSquare.data(),
+			params.size(),
+			0.f,
+			0.f,
+			0.9f,
+			1e-8f);
+		benchmark::ClobberMemory();
+	}
+	setBytesProcessed(state, 5 * params.size() * sizeof(float));
+}
+
+void simdAdam(benchmark::State& state)
+{
+	IsaScope isa(state);
+	auto params = randomVector(state.range(1));
+	const auto gradient = randomVector(state.range(1));
+	std::vector<float> mean(params.size());
+	std::vector<float> variance(params.size());
+	const simd::AdamStep<float> step{0.f, 0.f, 0.f, 0.9f, 0.999f, 1e-8f, 10.f, 1000.f};
+	for (auto _ : state)
+	{
+		simd::adam(
+			params.data(), gradient.data(), mean.data(), variance.data(), params.size(), step);
+		benchmark::ClobberMemory();
+	}
+	setBytesProcessed(state, 7 * params.size() * sizeof(float));
+}
+
+// Runs a kernel on every ISA for sizes that fit in L1, L2 and only in memory.
+void isaSizes(benchmark::internal::Benchmark* b)
+{
+	b->ArgNames({"isa", "size"});
+	for (auto isa : {simd::Isa::SCALAR, simd::Isa::AVX2, simd::Isa::AVX512})
+		for (long size : {1L << 10, 1L << 16, 1L << 22})
+			b->Args({static_cast<long>(isa), size});
+}
+
+void gemvSizes(benchmark::internal::Benchmark* b)
+{
+	b->ArgNames({"isa", "size"});
+	for (auto isa : {simd::Isa::SCALAR, simd::Isa::AVX2, simd::Isa::AVX512})
+		for (long size : {16L, 128L, 1024L})
+			b->Args({static_cast<long>(isa), size});
+}
+
+} // namespace
+
+BENCHMARK(simdRelu)->Apply(isaSizes);
+BENCHMARK(simdReluBackward)->Apply(isaSizes);
+BENCHMARK(simdSigmoid)->Apply(isaSizes);
+BENCHMARK(simdSoftmax)->Apply(isaSizes);
+BENCHMARK(simdGemv)->Apply(gemvSizes);
+BENCHMARK(simdGemvU8S8)->Apply(gemvSizes);
+BENCHMARK(simdSumSquares)->Apply(isaSizes);
+BENCHMARK(simdSgd)->Apply(isaSizes);
+BENCHMARK(simdMomentum)->Apply(isaSizes);
+BENCHMARK(simdRmsProp)->Apply(isaSizes);
+BENCHMARK(simdAdam)->Apply(isaSizes);
@@ -0,0 +1,314 @@
+#include <memory>
+#include <random>
+#include <type_traits>
+
+#include <benchmark/benchmark.h>
+
+#include <nnp/layer.h>
+#include <nnp/sparse.h>
+
+#include "bench_utils.h"
+
+namespace {
+
+template <typename Float, size_t WIDTH, size_t BATCH_SIZE>
+void layerForward(benchmark::State& state)
+{
+	const size_t batchSize = bench::batchSize<BATCH_SIZE>(state);
+	auto layer = std::make_unique<nnp::ReluLayer<Float, WIDTH, WIDTH>>(
+		bench::NormalDistGenerator<Float>());
+	auto input = bench::randomTensor<Float, WIDTH, BATCH_SIZE>(batchSize);
+	auto output = bench::makeTensor<Float, WIDTH, BATCH_SIZE>(batchSize);
+	for (auto _ : state)
+	{
+		layer->forward(*input, *output);
+		benchmark::DoNotOptimize(output->begin());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * batchSize);
+	state.counters["FLOPS"] = benchmark::Counter(
+		2.0 * WIDTH * WIDTH * batchSize, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+template <typename Float, size_t WIDTH, size_t BATCH_SIZE>
+void layerBackward(benchmark::State& state)
+{
+	const size_t batchSize = bench::batchSize<BATCH_SIZE>(state);
+	auto layer = std::make_unique<nnp::ReluLayer<Float, WIDTH, WIDTH>>(
+		bench::NormalDistGenerator<Float>());
+	auto input = bench::randomTensor<Float, WIDTH, BATCH_SIZE>(batchSize);
+	auto output = bench::makeTensor<Float, WIDTH, BATCH_SIZE>(batchSize);
+	auto gradient = bench::randomTensor<Float, WIDTH, BATCH_SIZE>(batchSize);
+	auto inputGradient = bench::makeTensor<Float, WIDTH, BATCH_SIZE>(batchSize);
+	layer->forward(*input, *output);
+	for (auto _ : state)
+	{
+		layer->backward(*output, *gradient, *inputGradient);
+		benchmark::DoNotOptimize(inputGradient->begin());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * batchSize);
+}
+
+// Step size 0 keeps the weights stable over any number of iterations while still doing all
+// of the work.
+template <typename Float, size_t WIDTH, size_t BATCH_SIZE>
+void layerUpdate(benchmark::State& state)
+{
+	const size_t batchSize = bench::batchSize<BATCH_SIZE>(state);
+	auto layer = std::make_unique<nnp::ReluLayer<Float, WIDTH, WIDTH>>(
+		bench::NormalDistGenerator<Float>());
+	auto input = bench::randomTensor<Float, WIDTH, BATCH_SIZE>(batchSize);
+	auto gradient = bench::randomTensor<Float, WIDTH, BATCH_SIZE>(batchSize);
+	for (auto _ : state)
+	{
+		layer->update(*input, *gradient, Float{0}, Float{0});
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * batchSize);
+	state.counters["FLOPS"] = benchmark::Counter(
+		2.0 * WIDTH * WIDTH * batchSize, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// Bias and activation in one pass over the output, as ComputationalLayer does it, against
+// separate passes for the matrix product, the bias and the activation.
+template <bool FUSED>
+void forwardFusion(benchmark::State& state)
+{
+	constexpr size_t WIDTH = 1024;
+	constexpr size_t BATCH_SIZE = 256;
+	auto weights = std::make_unique<nnp::details::BiasedLayerWeights<float, WIDTH, WIDTH>>(
+		bench::NormalDistGenerator<float>());
+	auto input = bench::randomTensor<float, WIDTH, BATCH_SIZE>(BATCH_SIZE);
+	auto output = bench::makeTensor<float, WIDTH, BATCH_SIZE>(BATCH_SIZE);
+	for (auto _ : state)
+	{
+		if constexpr (FUSED)
+			weights->forward(*input, *output, nnp::ReluActivation());
+		else
+		{
+			weights->forward(*input, *output);
+			nnp::ReluActivation::forwardInPlace(*output);
+		}
+		benchmark::DoNotOptimize(output->begin());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+}
+
+// A forward, backward and update pass over a small layer on the unrolled kernels that layers
+// with sizes known at compile time select, against the same dlib expressions on the same
+// weights.
+template <size_t NODE_C, size_t INPUT_C, bool UNROLLED>
+void smallLayerStep(benchmark::State& state)
+{
+	constexpr size_t BATCH_SIZE = 32;
+	auto weights = std::make_unique<nnp::details::LayerWeights<float, NODE_C, INPUT_C>>(
+		bench::NormalDistGenerator<float>());
+	auto input = bench::randomTensor<float, INPUT_C, BATCH_SIZE>(BATCH_SIZE);
+	auto output = bench::makeTensor<float, NODE_C, BATCH_SIZE>(BATCH_SIZE);
+	auto gradient = bench::randomTensor<float, NODE_C, BATCH_SIZE>(BATCH_SIZE);
+	auto inputGradient = bench::makeTensor<float, INPUT_C, BATCH_SIZE>(BATCH_SIZE);
+	for (auto _ : state)
+	{
+		if constexpr (UNROLLED)
+		{
+			weights->template forward<nnp::ReluActivation>(*input, *output, nullptr);
+			weights->backward(*gradient, *inputGradient);
+			weights->update(*input, *gradient, 0.0f, 0.0f);
+		}
+		else
+		{
+			output->data() = weights->weights() * input->data();
+			nnp::ReluActivation::forwardInPlace(*output);
+			inputGradient->data() = trans(weights->weights()) * gradient->data();
+			weights->weights() *= 1.0f;
+			weights->weights() -= 0.0f * gradient->data() * trans(input->data());
+		}
+		benchmark::DoNotOptimize(output->begin());
+		benchmark::DoNotOptimize(inputGradient->begin());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+	state.counters["FLOPS"] = benchmark::Counter(
+		6.0 * NODE_C * INPUT_C * BATCH_SIZE, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// Forward or backward pass of a wide layer with packed weights against the dense layout.
+template <typename Layout, size_t WIDTH, bool BACKWARD>
+void largeLayer(benchmark::State& state)
+{
+	constexpr size_t BATCH_SIZE = 128;
+	auto layer = std::make_unique<nnp::ReluLayer<float, WIDTH, WIDTH, nnp::Sgd, Layout>>(
+		bench::NormalDistGenerator<float>());
+	auto input = bench::randomTensor<float, WIDTH, BATCH_SIZE>(BATCH_SIZE);
+	auto output = bench::makeTensor<float, WIDTH, BATCH_SIZE>(BATCH_SIZE);
+	auto gradient = bench::randomTensor<float, WIDTH, BATCH_SIZE>(BATCH_SIZE);
+	auto inputGradient = bench::makeTensor<float, WIDTH, BATCH_SIZE>(BATCH_SIZE);
+	layer->forward(*input, *output);
+	for (auto _ : state)
+	{
+		if constexpr (BACKWARD)
+		{
+			layer->backward(*output, *gradient, *inputGradient);
+			benchmark::DoNotOptimize(inputGradient->begin());
+		}
+		else
+		{
+			layer->forward(*input, *output);
+			benchmark::DoNotOptimize(output->begin());
+		}
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+	state.counters["FLOPS"] = benchmark::Counter(
+		2.0 * WIDTH * WIDTH * BATCH_SIZE, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// A training step of a wide layer: forward, backward and an update, which for packed weights
+// includes repacking both copies. A step size of 0 would let BLAS skip the update, so the sign
+// of the step alternates instead, which keeps the weights close to where they started.
+template <typename Layout, size_t WIDTH>
+void largeLayerStep(benchmark::State& state)
+{
+	constexpr size_t BATCH_SIZE = 128;
+	auto layer = std::make_unique<nnp::ReluLayer<float, WIDTH, WIDTH, nnp::Sgd, Layout>>(
+		bench::NormalDistGenerator<float>());
+	auto input = bench::randomTensor<float, WIDTH, BATCH_SIZE>(BATCH_SIZE);
+	auto output = bench::makeTensor<float, WIDTH, BATCH_SIZE>(BATCH_SIZE);
+	auto gradient = bench::randomTensor<float, WIDTH, BATCH_SIZE>(BATCH_SIZE);
+	auto inputGradient = bench::makeTensor<float, WIDTH, BATCH_SIZE>(BATCH_SIZE);
+	float stepSize = 1e-3f;
+	for (auto _ : state)
+	{
+		layer->forward(*input, *output);
+		layer->backward(*output, *gradient, *inputGradient);
+		layer->update(*input, *gradient, stepSize, 0.0f);
+		stepSize = -stepSize;
+		benchmark::DoNotOptimize(inputGradient->begin());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+	state.counters["FLOPS"] = benchmark::Counter(
+		6.0 * WIDTH * WIDTH * BATCH_SIZE, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// A forward pass and an update of a layer on inputs with 32 non-zeros per sample. The sparse
+// layer gathers and updates the rows of the non-zero inputs only, the dense layer multiplies
+// the whole input.
+template <size_t INPUT_C, bool SPARSE>
+void sparseLayerStep(benchmark::State& state)
+{
+	constexpr size_t NODE_C = 32;
+	constexpr size_t BATCH_SIZE = 256;
+	constexpr size_t NON_ZERO_C = 32;
+	std::mt19937 gen;
+	nnp::SparseTensor<float, INPUT_C> sparseInput;
+	auto input = bench::makeTensor<float, INPUT_C, nnp::RESIZEABLE>(BATCH_SIZE);
+	for (auto& f : *input)
+		f = 0.0f;
+	for (size_t ii = 0; ii != BATCH_SIZE; ++ii)
+	{
+		uint32_t indices[NON_ZERO_C];
+		for (auto& index : indices)
+		{
+			index = gen() % INPUT_C;
+			(*input)(index, ii) = 1.0f;
+		}
+		sparseInput.addColumn(indices, NON_ZERO_C);
+	}
+	auto output = bench::makeTensor<float, NODE_C, nnp::RESIZEABLE>(BATCH_SIZE);
+	auto gradient = bench::randomTensor<float, NODE_C, nnp::RESIZEABLE>(BATCH_SIZE);
+	using Layer = std::conditional_t<
+		SPARSE,
+		nnp::SparseLayer<nnp::ReluActivation, float, NODE_C, INPUT_C>,
+		nnp::ReluLayer<float, NODE_C, INPUT_C>>;
+	auto layer = std::make_unique<Layer>(bench::NormalDistGenerator<float>());
+	for (auto _ : state)
+	{
+		if constexpr (SPARSE)
+		{
+			layer->forward(sparseInput, *output);
+			layer->update(sparseInput, *gradient, 0.0f, 0.0f);
+		}
+		else
+		{
+			layer->forward(*input, *output);
+			layer->update(*input, *gradient, 0.0f, 0.0f);
+		}
+		benchmark::DoNotOptimize(output->begin());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+}
+
+} // namespace
+
+// Every layer benchmark is run for each width with fixed and resizeable batches of 1, 32 and
+// 256 samples, in single and double precision.
+#define NNP_LAYER_BENCHMARK(NAME, FLOAT, WIDTH)                                             \
+	BENCHMARK_TEMPLATE(NAME, FLOAT, WIDTH, 1);                                              \
+	BENCHMARK_TEMPLATE(NAME, FLOAT, WIDTH, 32);                                             \
+	BENCHMARK_TEMPLATE(NAME, FLOAT, WIDTH, 256);                                            \
+	BENCHMARK_TEMPLATE(NAME, FLOAT, WIDTH, nnp::RESIZEABLE)->Arg(1)->Arg(32)->Arg(256)
+
+#define NNP_LAYER_BENCHMARKS(NAME)                                                          \
+	NNP_LAYER_BENCHMARK(NAME, float, 64);                                                   \
+	NNP_LAYER_BENCHMARK(NAME, float, 256);                                                  \
+	NNP_LAYER_BENCHMARK(NAME, float, 1024);                                                 \
+	NNP_LAYER_BENCHMARK(NAME, double, 64);                                                  \
+	NNP_LAYER_BENCHMARK(NAME, double, 256);                                                 \
+	NNP_LAYER_BENCHMARK(NAME, double, 1024)
+
+// Layers storing activations and weights in 16 bits, against float at the same sizes.
+#define NNP_REDUCED_LAYER_BENCHMARKS(NAME)                                                  \
+	NNP_LAYER_BENCHMARK(NAME, nnp::BFloat16, 256);                                          \
+	NNP_LAYER_BENCHMARK(NAME, nnp::BFloat16, 1024);                                         \
+	NNP_LAYER_BENCHMARK(NAME, nnp::Half, 256);                                              \
+	NNP_LAYER_BENCHMARK(NAME, nnp::Half, 1024)
+
+NNP_LAYER_BENCHMARKS(layerForward);
+NNP_LAYER_BENCHMARKS(layerBackward);
+NNP_LAYER_BENCHMARKS(layerUpdate);
+
+NNP_REDUCED_LAYER_BENCHMARKS(layerForward);
+NNP_REDUCED_LAYER_BENCHMARKS(layerBackward);
+NNP_REDUCED_LAYER_BENCHMARKS(layerUpdate);
+
+BENCHMARK_TEMPLATE(forwardFusion, true)->Name("forwardFusion/fused");
+BENCHMARK_TEMPLATE(forwardFusion, false)->Name("forwardFusion/threePass");
+
+#define NNP_SMALL_LAYER_BENCHMARK(NODE_C, INPUT_C)                                          \
+	BENCHMARK_TEMPLATE(smallLayerStep, NODE_C, INPUT_C, true)                               \
+		->Name("smallLayerStep/unrolled/" #NODE_C "x" #INPUT_C);                            \
+	BENCHMARK_TEMPLATE(smallLayerStep, NODE_C, INPUT_C, false)                              \
+		->Name("smallLayerStep/dlib/" #NODE_C "x" #INPUT_C)
+
+NNP_SMALL_LAYER_BENCHMARK(3, 5);
+NNP_SMALL_LAYER_BENCHMARK(5, 4);
+NNP_SMALL_LAYER_BENCHMARK(16, 16);
+NNP_SMALL_LAYER_BENCHMARK(32, 32);
+NNP_SMALL_LAYER_BENCHMARK(64, 64);
+
+#define NNP_LARGE_LAYER_BENCHMARK(WIDTH)                                                    \
+	BENCHMARK_TEMPLATE(largeLayer, nnp::PackedLayout, WIDTH, false)                         \
+		->Name("largeLayerForward/packed/" #WIDTH);                                         \
+	BENCHMARK_TEMPLATE(largeLayer, nnp::DenseLayout, WIDTH, false)                          \
+		->Name("largeLayerForward/dense/" #WIDTH);                                          \
+	BENCHMARK_TEMPLATE(largeLayer, nnp::PackedLayout, WIDTH, true)                          \
+		->Name("largeLayerBackward/packed/" #WIDTH);                                        \
+	BENCHMARK_TEMPLATE(largeLayer, nnp::DenseLayout, WIDTH, true)                           \
+		->Name("largeLayerBackward/dense/" #WIDTH);                                         \
+	BENCHMARK_TEMPLATE(largeLayerStep, nnp::PackedLayout, WIDTH)                            \
+		->Name("largeLayerStep/packed/" #WIDTH);                                            \
+	BENCHMARK_TEMPLATE(largeLayerStep, nnp::DenseLayout, WIDTH)                             \
+		->Name("largeLayerStep/dense/" #WIDTH)
+
+NNP_LARGE_LAYER_BENCHMARK(2048);
+NNP_LARGE_LAYER_BENCHMARK(4096);
+NNP_LARGE_LAYER_BENCHMARK(8192);
+
+BENCHMARK_TEMPLATE(sparseLayerStep, 1 << 14, false)->Name("sparseLayerStep/dense/16384");
+BENCHMARK_TEMPLATE(sparseLayerStep, 1 << 14, true)->Name("sparseLayerStep/sparse/16384");
+BENCHMARK_TEMPLATE(sparseLayerStep, 1 << 17, true)->Name("sparseLayerStep/sparse/131072");
+BENCHMARK_TEMPLATE(sparseLayerStep, 1 << 20, true)->Name("sparseLayerStep/sparse/1048576");
@@ -0,0 +1,108 @@
+#include <benchmark/benchmark.h>
+
+#include <nnp/loss.h>
+
+#include "bench_utils.h"
+
+namespace {
+
+template <typename Float, size_t CLASS_C, size_t BATCH_SIZE>
+void softmax(benchmark::State& state)
+{
+	const size_t batchSize = bench::batchSize<BATCH_SIZE>(state);
+	auto input = bench::randomTensor<Float, CLASS_C, BATCH_SIZE>(batchSize);
+	auto probs = bench::makeTensor<Float, CLASS_C, BATCH_SIZE>(batchSize);
+	for (auto _ : state)
+	{
+		nnp::softmax(*input, *probs);
+		benchmark::DoNotOptimize(probs->begin());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * batchSize);
+}
+
+template <typename Float, size_t CLASS_C, size_t BATCH_SIZE>
+void crossEntropy(benchmark::State& state)
+{
+	const size_t batchSize = bench::batchSize<BATCH_SIZE>(state);
+	auto probs = bench::randomTensor<Float, CLASS_C, BATCH_SIZE>(batchSize);
+	nnp::softmax(*probs, *probs);
+	auto truth = bench::oneHot<Float, CLASS_C, BATCH_SIZE>(batchSize);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(nnp::crossEntropy(*probs, *truth));
+	state.SetItemsProcessed(state.iterations() * batchSize);
+}
+
+template <typename Float, size_t CLASS_C, size_t BATCH_SIZE>
+void softMaxGradient(benchmark::State& state)
+{
+	const size_t batchSize = bench::batchSize<BATCH_SIZE>(state);
+	auto probs = bench::randomTensor<Float, CLASS_C, BATCH_SIZE>(batchSize);
+	nnp::softmax(*probs, *probs);
+	auto truth = bench::oneHot<Float, CLASS_C, BATCH_SIZE>(batchSize);
+	auto gradient = bench::makeTensor<Float, CLASS_C, BATCH_SIZE>(batchSize);
+	for (auto _ : state)
+	{
+		nnp::SoftMaxLayer<Float>::getGradient(*probs, *truth, *gradient);
+		benchmark::DoNotOptimize(gradient->begin());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * batchSize);
+}
+
+// The loss and gradient of a batch of logits, fused on class labels against the separate
+// softmax, cross-entropy and gradient passes of SoftMaxLayer on one-hot ground truth.
+template <typename Float, size_t CLASS_C, size_t BATCH_SIZE, bool FUSED>
+void lossStep(benchmark::State& state)
+{
+	const size_t batchSize = bench::batchSize<BATCH_SIZE>(state);
+	auto logits = bench::randomTensor<Float, CLASS_C, BATCH_SIZE>(batchSize);
+	auto truth = bench::oneHot<Float, CLASS_C, BATCH_SIZE>(batchSize);
+	auto labels = bench::labels<CLASS_C, BATCH_SIZE>(batchSize);
+	auto gradient = bench::makeTensor<Float, CLASS_C, BATCH_SIZE>(batchSize);
+	for (auto _ : state)
+	{
+		if constexpr (FUSED)
+			benchmark::DoNotOptimize(nnp::SoftmaxCrossEntropy<Float>::propagate(
+				*logits, *labels, *gradient, Float{0}, Float{0}));
+		else
+		{
+			nnp::SoftMaxLayer<Float>::probs(*logits, *gradient);
+			benchmark::DoNotOptimize(
+				nnp::SoftMaxLayer<Float>::loss(*gradient, *truth, Float{0}, Float{0}));
+			nnp::SoftMaxLayer<Float>::getGradient(*gradient, *truth, *gradient);
+		}
+		benchmark::DoNotOptimize(gradient->begin());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * batchSize);
+}
+
+} // namespace
+
+// Every loss benchmark is run for 10 and 1000 classes with fixed and resizeable batches of 1
+// and 256 samples, in single and double precision.
+#define NNP_LOSS_BENCHMARK(NAME, FLOAT, CLASS_C)                                            \
+	BENCHMARK_TEMPLATE(NAME, FLOAT, CLASS_C, 1);                                            \
+	BENCHMARK_TEMPLATE(NAME, FLOAT, CLASS_C, 256);                                          \
+	BENCHMARK_TEMPLATE(NAME, FLOAT, CLASS_C, nnp::RESIZEABLE)->Arg(1)->Arg(256)
+
+#define NNP_LOSS_BENCHMARKS(NAME)                                                           \
+	NNP_LOSS_BENCHMARK(NAME, float, 10);                                                    \
+	NNP_LOSS_BENCHMARK(NAME, float, 1000);                                                  \
+	NNP_LOSS_BENCHMARK(NAME, double, 10);                                                   \
+	NNP_LOSS_BENCHMARK(NAME, double, 1000)
+
+NNP_LOSS_BENCHMARKS(softmax);
+NNP_LOSS_BENCHMARKS(crossEntropy);
+NNP_LOSS_BENCHMARKS(softMaxGradient);
+
+#define NNP_LOSS_STEP_BENCHMARK(FLOAT, CLASS_C, BATCH_SIZE)                                 \
+	BENCHMARK_TEMPLATE(lossStep, FLOAT, CLASS_C, BATCH_SIZE, true)                          \
+		->Name("lossStep/fused/" #FLOAT "/" #CLASS_C "/" #BATCH_SIZE);                      \
+	BENCHMARK_TEMPLATE(lossStep, FLOAT, CLASS_C, BATCH_SIZE, false)                         \
+		->Name("lossStep/separate/" #FLOAT "/" #CLASS_C "/" #BATCH_SIZE)
+
+NNP_LOSS_STEP_BENCHMARK(float, 10, 256);
+NNP_LOSS_STEP_BENCHMARK(float, 1000, 256);
+NNP_LOSS_STEP_BENCHMARK(double, 1000, 256);
@@ -0,0 +1,452 @@
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <nnp/dynamic_network.h>
+#include <nnp/hogwild.h>
+#include <nnp/layer.h>
+#include <nnp/loss.h>
+#include <nnp/network.h>
+#include <nnp/pipeline.h>
+#include <nnp/profiler.h>
+#include <nnp/quantization.h>
+#include <nnp/thread_pool.h>
+
+#include "bench_utils.h"
+
+// Lets profiledPropagate count allocations and deepPropagate measure the peak heap usage.
+NNP_COUNT_ALLOCATIONS
+
+namespace {
+
+template <typename Float>
+using TrainingNetwork = nnp::Network<bench::Mlp<Float>&, nnp::SoftMaxLayer<Float>>;
+
+template <typename Float, size_t BATCH_SIZE>
+void networkForward(benchmark::State& state)
+{
+	const size_t batchSize = bench::batchSize<BATCH_SIZE>(state);
+	auto network = bench::makeMlp<Float>();
+	auto workspace =
+		std::make_unique<typename bench::Mlp<Float>::template Workspace<Float, BATCH_SIZE>>(
+			batchSize);
+	auto input = bench::randomTensor<Float, 256, BATCH_SIZE>(batchSize);
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(network->forward(*workspace, *input).begin());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * batchSize);
+}
+
+// Forward pass of the Mlp quantized to 8 bits, calibrated on the benchmark input, against
+// networkForward<float>.
+template <size_t BATCH_SIZE>
+void quantizedForward(benchmark::State& state)
+{
+	using Network = nnp::QuantizedNetwork<bench::Mlp<float>>;
+	const size_t batchSize = bench::batchSize<BATCH_SIZE>(state);
+	auto input = bench::randomTensor<float, 256, BATCH_SIZE>(batchSize);
+	auto network = std::make_unique<Network>(nnp::quantize(*bench::makeMlp<float>(), *input));
+	auto workspace =
+		std::make_unique<typename Network::template Workspace<BATCH_SIZE>>(batchSize);
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(network->forward(*workspace, *input).begin());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * batchSize);
+}
+
+// One training step with step size 0, so that the weights do not change between iterations.
+template <typename Float, size_t BATCH_SIZE>
+void networkPropagate(benchmark::State& state)
+{
+	const size_t batchSize = bench::batchSize<BATCH_SIZE>(state);
+	auto hiddenLayers = bench::makeMlp<Float>();
+	TrainingNetwork<Float> network{*hiddenLayers, nnp::SoftMaxLayer<Float>{}};
+	auto workspace = std::make_unique<
+		typename TrainingNetwork<Float>::template Workspace<Float, BATCH_SIZE>>(batchSize);
+	auto input = bench::randomTensor<Float, 256, BATCH_SIZE>(batchSize);
+	auto truth = bench::oneHot<Float, 10, BATCH_SIZE>(batchSize);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(
+			network.propagate(*workspace, *input, *truth, Float{0}, Float{1e-4}));
+	state.SetItemsProcessed(state.iterations() * batchSize);
+}
+
+// networkPropagate<float> through train(), which skips the loss and the L2 norm.
+template <size_t BATCH_SIZE>
+void networkTrain(benchmark::State& state)
+{
+	const size_t batchSize = bench::batchSize<BATCH_SIZE>(state);
+	auto hiddenLayers = bench::makeMlp<float>();
+	TrainingNetwork<float> network{*hiddenLayers, nnp::SoftMaxLayer<float>{}};
+	auto workspace = std::make_unique<
+		typename TrainingNetwork<float>::template Workspace<float, BATCH_SIZE>>(batchSize);
+	auto input = bench::randomTensor<float, 256, BATCH_SIZE>(batchSize);
+	auto truth = bench::oneHot<float, 10, BATCH_SIZE>(batchSize);
+	for (auto _ : state)
+	{
+		network.train(*workspace, *input, *truth, 0.f, 1e-4f);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * batchSize);
+}
+
+// networkPropagate with every phase of every layer recorded by a Profiler, which measures the
+// overhead of profiling. The counters are the share of the step time spent in each phase.
+void profiledPropagate(benchmark::State& state)
+{
+	constexpr size_t BATCH_SIZE = 256;
+	auto hiddenLayers = bench::makeMlp<float>();
+	TrainingNetwork<float> network{*hiddenLayers, nnp::SoftMaxLayer<float>{}};
+	auto workspace = std::make_unique<TrainingNetwork<float>::Workspace<float>>(BATCH_SIZE);
+	auto input = bench::randomTensor<float, 256, nnp::RESIZEABLE>(BATCH_SIZE);
+	auto truth = bench::oneHot<float, 10, nnp::RESIZEABLE>(BATCH_SIZE);
+	nnp::Profiler profiler(size_t{1} << 16);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(
+			network.propagate(*workspace, *input, *truth, 0.f, 1e-4f, profiler));
+	state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+	std::array<double, nnp::PROFILE_PHASE_C> seconds{};
+	double total = 0;
+	for (const auto& phases : profiler.total())
+		for (size_t ii = 0; ii != nnp::PROFILE_PHASE_C; ++ii)
+		{
+			seconds[ii] += phases[ii].seconds;
+			total += phases[ii].seconds;
+		}
+	for (size_t ii = 0; ii != nnp::PROFILE_PHASE_C; ++ii)
+		state.counters[nnp::profilePhaseName(static_cast<nnp::ProfilePhase>(ii))] =
+			total > 0 ? seconds[ii] / total : 0;
+}
+
+// Training step of a classifier with WIDTH inputs, two hidden ReLU layers of WIDTH nodes and
+// 10 outputs, built as a DynamicNetwork from a layer spec or as a TupleNetwork, on a batch of
+// 256 samples. A step size of 0 would let BLAS skip the updates, so the sign of the step
+// alternates instead, as in largeLayerStep.
+template <size_t WIDTH, bool DYNAMIC>
+void largePropagate(benchmark::State& state)
+{
+	constexpr size_t BATCH_SIZE = 256;
+	bench::NormalDistGenerator<float> gen;
+	auto input = bench::randomTensor<float, WIDTH, nnp::RESIZEABLE>(BATCH_SIZE);
+	auto truth = bench::oneHot<float, 10, nnp::RESIZEABLE>(BATCH_SIZE);
+	float stepSize = 1e-3f;
+	if constexpr (DYNAMIC)
+	{
+		nnp::DynamicNetwork<float> network(
+			WIDTH,
+			{{WIDTH, nnp::ActivationKind::RELU},
+			 {WIDTH, nnp::ActivationKind::RELU},
+			 {10, nnp::ActivationKind::LINEAR}},
+			gen);
+		nnp::Tensor<float, nnp::RESIZEABLE, nnp::RESIZEABLE> dynamicInput(WIDTH, BATCH_SIZE);
+		nnp::Tensor<float, nnp::RESIZEABLE, nnp::RESIZEABLE> dynamicTruth(10, BATCH_SIZE);
+		dynamicInput.data() = input->data();
+		dynamicTruth.data() = truth->data();
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(
+				network.propagate(dynamicInput, dynamicTruth, stepSize, 1e-4f));
+			stepSize = -stepSize;
+		}
+	}
+	else
+	{
+		using HiddenLayers = nnp::TupleNetwork<
+			nnp::ReluLayer<float, WIDTH, WIDTH>,
+			nnp::ReluLayer<float, WIDTH, WIDTH>,
+			nnp::LinearLayer<float, 10, WIDTH>>;
+		using Network = nnp::Network<HiddenLayers&, nnp::SoftMaxLayer<float>>;
+		// Constructs the layers in place, they are too large for the stack.
+		auto hiddenLayers = std::make_unique<HiddenLayers>(gen, gen, gen);
+		Network network{*hiddenLayers, nnp::SoftMaxLayer<float>{}};
+		typename Network::template Workspace<float> workspace(BATCH_SIZE);
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(
+				network.propagate(workspace, *input, *truth, stepSize, 1e-4f));
+			stepSize = -stepSize;
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+}
+
+// DEPTH hidden ReLU layers of WIDTH nodes and 10 outputs as Type<make_index_sequence<DEPTH>>.
+template <size_t WIDTH>
+struct DeepLayers
+{
+	template <size_t>
+	using Hidden = nnp::ReluLayer<float, WIDTH, WIDTH>;
+
+	template <typename Sequence>
+	struct TypeHelper;
+
+	template <size_t... IDX>
+	struct TypeHelper<std::index_sequence<IDX...>>
+	{
+		using Type = nnp::TupleNetwork<Hidden<IDX>..., nnp::LinearLayer<float, 10, WIDTH>>;
+	};
+
+	template <typename Sequence>
+	using Type = typename TypeHelper<Sequence>::Type;
+
+	// Constructs the layers in place, they are too large for the stack.
+	template <typename Generator, size_t... IDX>
+	static auto make(Generator& gen, std::index_sequence<IDX...> sequence)
+	{
+		return std::make_unique<Type<decltype(sequence)>>(((void)IDX, gen)..., gen);
+	}
+};
+
+// Peak of the heap bytes in use while a workspace is constructed and trained on for one step,
+// above those in use before.
+template <typename Workspace, typename Network, typename Input, typename Truth>
+double peakStepBytes(Network& network, const Input& input, const Truth& truth)
+{
+	auto& heap = nnp::details::heapUsage();
+	heap.resetPeak();
+	const uint64_t before = heap.current();
+	{
+		Workspace workspace(input.batchSize());
+		network.propagate(workspace, input, truth, 0.f, 1e-4f);
+	}
+	return static_cast<double>(heap.peak() - before);
+}
+
+// Training step of a classifier with 1024 inputs, DEPTH hidden ReLU layers of 1024 nodes and
+// 10 outputs on a batch of 256 samples. The counters are the memory of the workspace and the
+// measured peak of the heap during the construction of a workspace and one step on it.
+template <size_t DEPTH>
+void deepPropagate(benchmark::State& state)
+{
+	constexpr size_t WIDTH = 1024;
+	constexpr size_t BATCH_SIZE = 256;
+	using HiddenLayers = DeepLayers<WIDTH>::Type<std::make_index_sequence<DEPTH>>;
+	using Network = nnp::Network<HiddenLayers&, nnp::SoftMaxLayer<float>>;
+	bench::NormalDistGenerator<float> gen;
+	auto hiddenLayers = DeepLayers<WIDTH>::make(gen, std::make_index_sequence<DEPTH>());
+	Network network{*hiddenLayers, nnp::SoftMaxLayer<float>{}};
+	typename Network::template Workspace<float> workspace(BATCH_SIZE);
+	auto input = bench::randomTensor<float, WIDTH, nnp::RESIZEABLE>(BATCH_SIZE);
+	auto truth = bench::oneHot<float, 10, nnp::RESIZEABLE>(BATCH_SIZE);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(network.propagate(workspace, *input, *truth, 0.f, 1e-4f));
+	state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+	state.counters["workspaceBytes"] = workspace.bytes();
+	state.counters["peakBytes"] =
+		peakStepBytes<typename Network::template Workspace<float>>(network, *input, *truth);
+}
+
+// deepPropagate<16> on a workspace that keeps the outputs of every INTERVAL-th layer and
+// recomputes the others during back propagation. The counters are the memory of the workspace,
+// its measured peak as in deepPropagate and the FLOPs of the recomputation relative to the
+// rest of a step, from one profiled step.
+template <size_t INTERVAL>
+void checkpointedPropagate(benchmark::State& state)
+{
+	constexpr size_t DEPTH = 16;
+	constexpr size_t WIDTH = 1024;
+	constexpr size_t BATCH_SIZE = 256;
+	using HiddenLayers = DeepLayers<WIDTH>::Type<std::make_index_sequence<DEPTH>>;
+	using Network = nnp::Network<HiddenLayers&, nnp::SoftMaxLayer<float>>;
+	using Workspace = typename Network::template Workspace<float, nnp::RESIZEABLE, INTERVAL>;
+	bench::NormalDistGenerator<float> gen;
+	auto hiddenLayers = DeepLayers<WIDTH>::make(gen, std::make_index_sequence<DEPTH>());
+	Network network{*hiddenLayers, nnp::SoftMaxLayer<float>{}};
+	Workspace workspace(BATCH_SIZE);
+	auto input = bench::randomTensor<float, WIDTH, nnp::RESIZEABLE>(BATCH_SIZE);
+	auto truth = bench::oneHot<float, 10, nnp::RESIZEABLE>(BATCH_SIZE);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(network.propagate(workspace, *input, *truth, 0.f, 1e-4f));
+	state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+
+	nnp::Profiler profiler;
+	network.propagate(workspace, *input, *truth, 0.f, 1e-4f, profiler);
+	constexpr size_t RECOMPUTE = static_cast<size_t>(nnp::ProfilePhase::RECOMPUTE);
+	double recomputed = 0;
+	double total = 0;
+	for (const auto& phases : profiler.lastStep())
+		for (size_t ii = 0; ii != nnp::PROFILE_PHASE_C; ++ii)
+			(ii == RECOMPUTE ? recomputed : total) += phases[ii].flops;
+	state.counters["workspaceBytes"] = workspace.bytes();
+	state.counters["peakBytes"] = peakStepBytes<Workspace>(network, *input, *truth);
+	state.counters["extraFlops"] = total > 0 ? recomputed / total : 0;
+}
+
+// Data-parallel training step on a batch of 1024 samples with the thread count in the first
+// argument.
+void parallelPropagate(benchmark::State& state)
+{
+	constexpr size_t BATCH_SIZE = 1024;
+	auto hiddenLayers = bench::makeMlp<float>();
+	TrainingNetwork<float> network{*hiddenLayers, nnp::SoftMaxLayer<float>{}};
+	nnp::ThreadPool pool(state.range(0));
+	TrainingNetwork<float>::ParallelWorkspace<float> workspace(pool, BATCH_SIZE);
+	auto input = bench::randomTensor<float, 256, nnp::RESIZEABLE>(BATCH_SIZE);
+	auto truth = bench::oneHot<float, 10, nnp::RESIZEABLE>(BATCH_SIZE);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(network.propagate(workspace, *input, *truth, 0.f, 1e-4f));
+	state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+}
+
+// Epochs of 64 batches of 32 samples whose class is the largest of their first 10 inputs,
+// trained with the thread count in the first argument, asynchronously if the second is 1 or
+// one batch after the other otherwise. Every run trains for the same number of epochs, so the
+// loss counter, the mean loss of the last epoch, compares convergence next to throughput.
+void hogwildTraining(benchmark::State& state)
+{
+	constexpr size_t BATCH_SIZE = 32;
+	constexpr size_t BATCH_C = 64;
+	using Network = nnp::Network<bench::Mlp<float>&, nnp::SoftmaxCrossEntropy<float>>;
+	using Trainer = nnp::HogwildTrainer<Network, float, uint32_t>;
+	auto hiddenLayers = bench::makeMlp<float>();
+	Network network{*hiddenLayers, nnp::SoftmaxCrossEntropy<float>{}};
+	nnp::ThreadPool pool(state.range(0));
+	Trainer trainer(network, pool, BATCH_SIZE, state.range(1) != 0);
+	auto inputs = bench::randomTensor<float, 256, nnp::RESIZEABLE>(BATCH_C * BATCH_SIZE);
+	auto loadBatch = [&](size_t batch, Trainer::Input& input, Trainer::GroundTruth& labels) {
+		nnp::details::copyColumns(
+			*inputs, batch * BATCH_SIZE, (batch + 1) * BATCH_SIZE, input);
+		for (size_t ii = 0; ii != BATCH_SIZE; ++ii)
+			labels(0, ii) = nnp::details::argmax(&input(0, ii), &input(0, ii) + 10);
+	};
+	float loss = 0;
+	for (auto _ : state)
+		loss = trainer.train(BATCH_C, loadBatch, 0.05f, 1e-4f);
+	state.counters["loss"] = loss;
+	state.SetItemsProcessed(state.iterations() * BATCH_C * BATCH_SIZE);
+}
+
+// GPipe training step on a batch of 1024 samples split into 16 micro-batches, with the Mlp
+// layers spread over the stage count in the first argument. Reports the utilization of each
+// stage.
+void pipelinePropagate(benchmark::State& state)
+{
+	constexpr size_t BATCH_SIZE = 1024;
+	auto hiddenLayers = bench::makeMlp<float>();
+	nnp::PipelineNetwork<bench::Mlp<float>, nnp::SoftMaxLayer<float>> network(
+		*hiddenLayers, nnp::SoftMaxLayer<float>{}, BATCH_SIZE, 16, state.range(0));
+	auto input = bench::randomTensor<float, 256, nnp::RESIZEABLE>(BATCH_SIZE);
+	auto truth = bench::oneHot<float, 10, nnp::RESIZEABLE>(BATCH_SIZE);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(network.propagate(*input, *truth, 0.f, 1e-4f));
+	state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+	const auto stats = network.stageStats();
+	for (size_t ii = 0; ii != stats.size(); ++ii)
+		state.counters["stage" + std::to_string(ii)] = stats[ii].utilization;
+}
+
+// Times every single-sample infer() call to report the latency distribution, in
+// nanoseconds, next to the mean. Includes the overhead of reading the clock.
+template <typename Network>
+void inferLatency(benchmark::State& state, const Network& network)
+{
+	std::array<float, Network::inputCount()> input;
+	bench::NormalDistGenerator<float> gen;
+	for (auto& f : input)
+		f = gen();
+	std::array<float, Network::outputCount()> output;
+	std::vector<double> latencies;
+	latencies.reserve(1 << 20);
+	for (auto _ : state)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		network.infer(input.data(), output.data());
+		benchmark::DoNotOptimize(output.data());
+		benchmark::ClobberMemory();
+		if (latencies.size() != latencies.capacity())
+			latencies.push_back(bench::nanoseconds(std::chrono::steady_clock::now() - start));
+	}
+	bench::setLatencyCounters(state, std::move(latencies));
+}
+
+void inferIris(benchmark::State& state)
+{
+	bench::NormalDistGenerator<float> gen;
+	const nnp::TupleNetwork<nnp::ReluLayer<float, 5, 4>, nnp::LinearLayer<float, 3, 5>>
+		network{nnp::ReluLayer<float, 5, 4>(gen), nnp::LinearLayer<float, 3, 5>(gen)};
+	inferLatency(state, network);
+}
+
+void inferMlp(benchmark::State& state) { inferLatency(state, *bench::makeMlp<float>()); }
+
+void inferQuantizedMlp(benchmark::State& state)
+{
+	auto input = bench::randomTensor<float, 256, 256>(256);
+	inferLatency(state, *std::make_unique<nnp::QuantizedNetwork<bench::Mlp<float>>>(
+		nnp::quantize(*bench::makeMlp<float>(), *input)));
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(networkForward, float, 1);
+BENCHMARK_TEMPLATE(networkForward, float, 256);
+BENCHMARK_TEMPLATE(networkForward, float, nnp::RESIZEABLE)->Arg(1)->Arg(256);
+BENCHMARK_TEMPLATE(networkForward, double, 1);
+BENCHMARK_TEMPLATE(networkForward, double, 256);
+BENCHMARK_TEMPLATE(networkForward, double, nnp::RESIZEABLE)->Arg(1)->Arg(256);
+
+BENCHMARK_TEMPLATE(quantizedForward, 1);
+BENCHMARK_TEMPLATE(quantizedForward, 256);
+BENCHMARK_TEMPLATE(quantizedForward, nnp::RESIZEABLE)->Arg(1)->Arg(256);
+
+BENCHMARK_TEMPLATE(networkPropagate, float, 32);
+BENCHMARK_TEMPLATE(networkPropagate, float, 256);
+BENCHMARK_TEMPLATE(networkPropagate, float, nnp::RESIZEABLE)->Arg(32)->Arg(256);
+BENCHMARK_TEMPLATE(networkPropagate, double, 32);
+BENCHMARK_TEMPLATE(networkPropagate, double, 256);
+BENCHMARK_TEMPLATE(networkPropagate, double, nnp::RESIZEABLE)->Arg(32)->Arg(256);
+
+BENCHMARK_TEMPLATE(networkTrain, 32);
+BENCHMARK_TEMPLATE(networkTrain, 256);
+
+BENCHMARK(profiledPropagate);
+
+#define NNP_LARGE_PROPAGATE_BENCHMARK(WIDTH)                                                \
+	BENCHMARK_TEMPLATE(largePropagate, WIDTH, false)                                        \
+		->Name("largePropagate/tuple/" #WIDTH);                                             \
+	BENCHMARK_TEMPLATE(largePropagate, WIDTH, true)                                         \
+		->Name("largePropagate/dynamic/" #WIDTH)
+
+NNP_LARGE_PROPAGATE_BENCHMARK(256);
+NNP_LARGE_PROPAGATE_BENCHMARK(1024);
+NNP_LARGE_PROPAGATE_BENCHMARK(2048);
+
+BENCHMARK_TEMPLATE(deepPropagate, 4);
+BENCHMARK_TEMPLATE(deepPropagate, 16);
+
+BENCHMARK_TEMPLATE(checkpointedPropagate, 1);
+BENCHMARK_TEMPLATE(checkpointedPropagate, 4);
+BENCHMARK_TEMPLATE(checkpointedPropagate, 8);
+
+BENCHMARK(parallelPropagate)
+	->ArgName("threads")
+	->Arg(1)
+	->Arg(2)
+	->Arg(4)
+	->Arg(8)
+	->Arg(16)
+	->UseRealTime();
+
+BENCHMARK(pipelinePropagate)->ArgName("stages")->Arg(1)->Arg(2)->Arg(3)->UseRealTime();
+
+BENCHMARK(hogwildTraining)
+	->ArgNames({"threads", "async"})
+	->Args({1, 0})
+	->Args({2, 1})
+	->Args({4, 1})
+	->Args({8, 1})
+	->Iterations(20)
+	->UseRealTime();
+
+BENCHMARK(inferIris);
+BENCHMARK(inferMlp);
+BENCHMARK(inferQuantizedMlp);
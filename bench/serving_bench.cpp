@@ -0,0 +1,64 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <nnp/batching_server.h>
+
+#include "bench_utils.h"
+
+namespace {
+
+// Closed-loop load generator: each client thread submits a request and waits for its result
+// before sending the next one. The arguments are the maximum batch size and the number of
+// clients. items_per_second is the throughput, the counters are the request latencies in
+// nanoseconds.
+void batchingServer(benchmark::State& state)
+{
+	constexpr size_t REQUESTS_PER_CLIENT = 256;
+	const size_t maxBatchSize = state.range(0);
+	const size_t clientCount = state.range(1);
+
+	auto network = bench::makeMlp<float>();
+	nnp::BatchingServer<bench::Mlp<float>> server(*network, maxBatchSize);
+	using Input = decltype(server)::Input;
+	Input input;
+	bench::NormalDistGenerator<float> gen;
+	for (auto& f : input)
+		f = gen();
+
+	std::vector<std::vector<double>> clientLatencies(clientCount);
+	for (auto& latencies : clientLatencies)
+		latencies.reserve(REQUESTS_PER_CLIENT);
+	std::vector<double> latencies;
+	for (auto _ : state)
+	{
+		std::vector<std::thread> clients;
+		for (size_t ii = 0; ii != clientCount; ++ii)
+			clients.emplace_back([&server, &input, &latencies = clientLatencies[ii]] {
+				latencies.clear();
+				for (size_t jj = 0; jj != REQUESTS_PER_CLIENT; ++jj)
+				{
+					const auto start = std::chrono::steady_clock::now();
+					benchmark::DoNotOptimize(server.submit(input).get());
+					latencies.push_back(
+						bench::nanoseconds(std::chrono::steady_clock::now() - start));
+				}
+			});
+		for (auto& client : clients)
+			client.join();
+		for (const auto& l : clientLatencies)
+			latencies.insert(latencies.end(), l.begin(), l.end());
+	}
+	state.SetItemsProcessed(state.iterations() * clientCount * REQUESTS_PER_CLIENT);
+	bench::setLatencyCounters(state, std::move(latencies));
+}
+
+} // namespace
+
+BENCHMARK(batchingServer)
+	->ArgNames({"maxBatch", "clients"})
+	->ArgsProduct({{1, 8, 32}, {1, 4, 16, 64}})
+	->UseRealTime()
+	->Unit(benchmark::kMillisecond);
@@ -2,13 +2,12 @@
 
 #include <algorithm>
 #include <array>
-#include <cstdlib>
-#include <cstring>
-#include <fstream>
-#include <iostream>
+#include <numeric>
 #include <random>
 #include <stdexcept>
+#include <string_view>
 
+#include <nnp/dataset.h>
 #include <nnp/tensor.h>
 
 namespace dset {
@@ -23,53 +22,21 @@ constexpr size_t TRAIN_SET_SIZE = DATASET_SIZE * TRAIN_RATIO;
 constexpr size_t VALIDATION_SET_SIZE = DATASET_SIZE * VALIDATION_RATIO;
 constexpr size_t TEST_SET_SIZE = DATASET_SIZE * TEST_RATIO;
 
-enum class IrisFlower : uint8_t
-{
-	SETOSA,
-	VERSICOLOR,
-	VIRGINICA
-};
+constexpr std::array<std::string_view, 3> IRIS_FLOWERS = {
+	"Iris-setosa", "Iris-versicolor", "Iris-virginica"};
 
-IrisFlower toIrisFlower(const char* str)
+// One-hot encodes the class name that ends each line of the dataset.
+inline void parseIrisFlower(std::string_view fields, float* target)
 {
-	constexpr char SETOSA_STR[] = "Iris-setosa";
-	constexpr char VERSICOLOR_STR[] = "Iris-versicolor";
-	constexpr char VIRGINICA_STR[] = "Iris-virginica";
-	if (std::strncmp(str, SETOSA_STR, sizeof(SETOSA_STR) - 1) == 0)
-		return IrisFlower::SETOSA;
-	else if (std::strncmp(str, VERSICOLOR_STR, sizeof(VERSICOLOR_STR) - 1) == 0)
-		return IrisFlower::VERSICOLOR;
-	else if (std::strncmp(str, VIRGINICA_STR, sizeof(VIRGINICA_STR) - 1) == 0)
-		return IrisFlower::VIRGINICA;
-	else
+	fields = fields.substr(0, fields.find_last_not_of(" \t\r") + 1);
+	const auto it = std::find(IRIS_FLOWERS.begin(), IRIS_FLOWERS.end(), fields);
+	if (it == IRIS_FLOWERS.end())
 		throw std::runtime_error("Failed parsing iris flower type");
+	for (size_t ii = 0; ii != IRIS_FLOWERS.size(); ++ii)
+		target[ii] = it == IRIS_FLOWERS.begin() + ii ? 1.f : 0.f;
 }
 
-struct IrisData
-{
-	std::array<float, 4> feat;
-	IrisFlower type;
-};
-
-std::array<IrisData, DATASET_SIZE> loadIrisData(const char* filePath)
-{
-	std::array<IrisData, DATASET_SIZE> data;
-	std::ifstream irisFile(filePath);
-	char buf[16]; // Length of longest string expected.
-	for (size_t ii = 0; ii != DATASET_SIZE; ++ii)
-	{
-		auto& datum = data[ii];
-		char** dummy = nullptr;
-		for (size_t ii = 0; ii != 4; ++ii)
-		{
-			irisFile.getline(buf, sizeof(buf), ',');
-			datum.feat[ii] = std::strtof(buf, dummy);
-		}
-		irisFile.getline(buf, sizeof(buf));
-		datum.type = toIrisFlower(buf);
-	}
-	return data;
-}
+using IrisData = nnp::Batch<float, 4, IRIS_FLOWERS.size()>;
 
 } // namespace details
 
@@ -78,12 +45,18 @@ class Data
 public:
 	explicit Data(const char* filePath)
 	{
-		auto data = details::loadIrisData(filePath);
-		std::shuffle(data.begin(), data.end(), std::mt19937{});
-		fillDataSet(data, m_trainingInput, m_trainingCrossVal, 0);
-		fillDataSet(data, m_validationInput, m_validationCrossVal, details::TRAIN_SET_SIZE);
+		const auto data = nnp::loadCsv<float, 4, 3>(filePath, details::parseIrisFlower);
+		if (data.size() != details::DATASET_SIZE)
+			throw std::runtime_error("Unexpected number of samples in the iris dataset");
+		std::array<size_t, details::DATASET_SIZE> order;
+		std::iota(order.begin(), order.end(), size_t{0});
+		std::shuffle(order.begin(), order.end(), std::mt19937{});
+		fillDataSet(data, order, m_trainingInput, m_trainingCrossVal, 0);
+		fillDataSet(
+			data, order, m_validationInput, m_validationCrossVal, details::TRAIN_SET_SIZE);
 		fillDataSet(
 			data,
+			order,
 			m_testInput,
 			m_testCrossVal,
 			details::TRAIN_SET_SIZE + details::VALIDATION_SET_SIZE);
@@ -111,18 +84,19 @@ private:
 
 	template <size_t SIZE>
 	void fillDataSet(
-		const std::array<details::IrisData, details::DATASET_SIZE>& data,
+		const details::IrisData& data,
+		const std::array<size_t, details::DATASET_SIZE>& order,
 		nnp::Tensor<float, 4, SIZE>& input,
 		nnp::Tensor<float, 3, SIZE>& crossVal,
 		size_t offset)
 	{
 		for (size_t ii = 0; ii != SIZE; ++ii)
 		{
-			const auto& datum = data[ii + offset];
+			const size_t sample = order[ii + offset];
 			for (size_t jj = 0; jj != 4; ++jj)
-				input(jj, ii) = datum.feat[jj];
-			for (size_t jj : {0, 1, 2})
-				crossVal(jj, ii) = jj == (size_t)datum.type ? 1.f : 0.f;
+				input(jj, ii) = data.input(jj, sample);
+			for (size_t jj = 0; jj != 3; ++jj)
+				crossVal(jj, ii) = data.target(jj, sample);
 		}
 	}
 };
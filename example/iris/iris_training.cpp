@@ -2,9 +2,11 @@
 #include <iostream>
 #include <random>
 
+#include <nnp/checkpoint.h>
 #include <nnp/details/misc.h>
 #include <nnp/loss.h>
 #include <nnp/network.h>
+#include <nnp/quantization.h>
 
 #include "dataset.h"
 
@@ -21,9 +23,9 @@ private:
 
 int main(int argc, char** argv)
 {
-	if (argc != 2)
+	if (argc != 2 && argc != 3)
 	{
-		std::cout << "Usage: " << argv[0] << " <dataset path>\n";
+		std::cout << "Usage: " << argv[0] << " <dataset path> [checkpoint path]\n";
 		return 1;
 	}
 
@@ -41,27 +43,64 @@ int main(int argc, char** argv)
 
 	TrainingNetwork trainingNetwork{baseNetwork, nnp::SoftMaxLayer<float>{}};
 
+	TrainingNetwork::Workspace<float, dset::details::TRAIN_SET_SIZE> trainingWorkspace;
+	TrainingNetwork::Workspace<float, dset::details::VALIDATION_SET_SIZE> validationWorkspace;
+	BaseNetwork::Workspace<float, dset::details::TEST_SET_SIZE> testWorkspace;
+
+	auto testAccuracy = [&data](const auto& out) {
+		size_t matchCount = 0;
+		for (size_t jj = 0; jj != out.batchSize(); ++jj)
+			matchCount +=
+				nnp::details::argmax(&out(0, jj), &out(0, jj + 1)) ==
+				nnp::details::argmax(
+					&data.testCrossVal()(0, jj), &data.testCrossVal()(0, jj + 1));
+		return static_cast<double>(matchCount) / out.batchSize();
+	};
+
 	std::cout << "Epoch      Training loss  Validation loss  Test accuracy" << std::endl;
 	std::cout << std::fixed << std::setprecision(5);
 	for (size_t ii = 0; ii != 15001; ++ii)
 	{
 		auto loss = trainingNetwork.propagate(
-			data.trainingInput(), data.trainingCrossVal(), 0.002f, 5e-5f);
+			trainingWorkspace, data.trainingInput(), data.trainingCrossVal(), 0.015f, 5e-5f);
 		if (ii % 100 == 0)
 		{
-			auto out = baseNetwork.forward(data.testInput());
-			size_t matchCount = 0;
-			for (size_t jj = 0; jj != out.batchSize(); ++jj)
-				matchCount +=
-					nnp::details::argmax(&out(0, jj), &out(0, jj + 1)) ==
-					nnp::details::argmax(
-						&data.testCrossVal()(0, jj), &data.testCrossVal()(0, jj + 1));
 			std::cout
 				<< std::setw(8) << ii << std::setw(10) << loss << std::setw(15)
 				<< trainingNetwork.propagate(
-					data.validationInput(), data.validationCrossVal(), 5e-5f)
-				<< std::setw(17) << static_cast<double>(matchCount) / out.batchSize()
+					validationWorkspace,
+					data.validationInput(),
+					data.validationCrossVal(),
+					5e-5f)
+				<< std::setw(17)
+				<< testAccuracy(baseNetwork.forward(testWorkspace, data.testInput()))
 				<< std::endl;
 		}
 	}
+
+	auto quantizedNetwork = nnp::quantize(baseNetwork, data.trainingInput());
+	nnp::QuantizedNetwork<BaseNetwork>::Workspace<dset::details::TEST_SET_SIZE>
+		quantizedWorkspace;
+	const auto& floatOut = baseNetwork.forward(testWorkspace, data.testInput());
+	const auto& quantizedOut = quantizedNetwork.forward(quantizedWorkspace, data.testInput());
+	size_t agreeCount = 0;
+	for (size_t jj = 0; jj != floatOut.batchSize(); ++jj)
+		agreeCount += nnp::details::argmax(&floatOut(0, jj), &floatOut(0, jj + 1)) ==
+			nnp::details::argmax(&quantizedOut(0, jj), &quantizedOut(0, jj + 1));
+	std::cout << "Test accuracy in float: " << testAccuracy(floatOut)
+			  << ", after int8 quantization: " << testAccuracy(quantizedOut) << " ("
+			  << agreeCount << " of " << floatOut.batchSize() << " predictions agree)"
+			  << std::endl;
+
+	if (argc == 3)
+	{
+		nnp::saveCheckpoint(baseNetwork, argv[2]);
+		nnp::Checkpoint checkpoint(argv[2]);
+		auto mappedNetwork = checkpoint.map<BaseNetwork>();
+		nnp::MappedNetwork<BaseNetwork>::Workspace<float, dset::details::TEST_SET_SIZE>
+			mappedWorkspace;
+		std::cout << "Test accuracy after reloading: "
+				  << testAccuracy(mappedNetwork.forward(mappedWorkspace, data.testInput()))
+				  << std::endl;
+	}
 }
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <type_traits>
+#include <utility>
 
 #include "common.h"
+#include "details/simd.h"
 #include "tensor.h"
 
 namespace nnp {
@@ -17,12 +21,31 @@ public:
 		return input;
 	}
 
+	template <typename Float>
+	static Float forwardElement(Float f)
+	{
+		return f;
+	}
+
+	template <typename Float>
+	static void forwardRange(Float*, Float*)
+	{}
+
+	template <typename Float, size_t INPUT_C, size_t BATCH_SIZE>
+	static void forwardInPlace(Tensor<Float, INPUT_C, BATCH_SIZE>&)
+	{}
+
 	template <typename Float, size_t INPUT_C, size_t BATCH_SIZE>
 	static Tensor<Float, INPUT_C, BATCH_SIZE> backward(
 		const Tensor<Float, INPUT_C, BATCH_SIZE>&, Tensor<Float, INPUT_C, BATCH_SIZE> gradient)
 	{
 		return gradient;
 	}
+
+	template <typename Float, size_t INPUT_C, size_t BATCH_SIZE>
+	static void backwardInPlace(
+		const Tensor<Float, INPUT_C, BATCH_SIZE>&, Tensor<Float, INPUT_C, BATCH_SIZE>&)
+	{}
 };
 
 class ReluActivation
@@ -31,25 +54,45 @@ public:
 	template <typename Float, size_t INPUT_C, size_t BATCH_SIZE>
 	static Tensor<Float, INPUT_C, BATCH_SIZE> forward(Tensor<Float, INPUT_C, BATCH_SIZE> input)
 	{
-		for (auto& ii : input)
-			ii = std::max(Float{0}, ii);
+		forwardInPlace(input);
 		return input;
 	}
 
+	template <typename Float>
+	static Float forwardElement(Float f)
+	{
+		return std::max(Float{0}, f);
+	}
+
+	template <typename Float>
+	static void forwardRange(Float* begin, Float* end)
+	{
+		details::simd::relu(begin, end);
+	}
+
+	template <typename Float, size_t INPUT_C, size_t BATCH_SIZE>
+	static void forwardInPlace(Tensor<Float, INPUT_C, BATCH_SIZE>& input)
+	{
+		forwardRange(input.begin(), input.end());
+	}
+
 	template <typename Float, size_t INPUT_C, size_t BATCH_SIZE>
 	static Tensor<Float, INPUT_C, BATCH_SIZE> backward(
 		const Tensor<Float, INPUT_C, BATCH_SIZE>& relu, Tensor<Float, INPUT_C, BATCH_SIZE> gradient)
+	{
+		backwardInPlace(relu, gradient);
+		return gradient;
+	}
+
+	template <typename Float, size_t INPUT_C, size_t BATCH_SIZE>
+	static void backwardInPlace(
+		const Tensor<Float, INPUT_C, BATCH_SIZE>& relu,
+		Tensor<Float, INPUT_C, BATCH_SIZE>& gradient)
 	{
 		assert(
 			relu.size() == gradient.size() && relu.batchSize() == gradient.batchSize());
 
-		auto reluIt = relu.begin();
-		for (auto& gg : gradient)
-		{
-			gg *= Float(*reluIt >= 0 ? 1 : 0);
-			++reluIt;
-		}
-		return gradient;
+		details::simd::reluBackward(relu.begin(), gradient.begin(), gradient.end());
 	}
 };
 
@@ -59,34 +102,64 @@ public:
 	template <typename Float, size_t INPUT_C, size_t BATCH_SIZE>
 	static Tensor<Float, INPUT_C, BATCH_SIZE> forward(Tensor<Float, INPUT_C, BATCH_SIZE> input)
 	{
-		for (auto& ii : input)
-			ii = sigmoid(ii);
+		forwardInPlace(input);
 		return input;
 	}
 
+	template <typename Float>
+	static Float forwardElement(Float f)
+	{
+		return Float{1} / (Float{1} + std::exp(-f));
+	}
+
+	template <typename Float>
+	static void forwardRange(Float* begin, Float* end)
+	{
+		details::simd::sigmoid(begin, end);
+	}
+
+	template <typename Float, size_t INPUT_C, size_t BATCH_SIZE>
+	static void forwardInPlace(Tensor<Float, INPUT_C, BATCH_SIZE>& input)
+	{
+		forwardRange(input.begin(), input.end());
+	}
+
 	template <typename Float, size_t INPUT_C, size_t BATCH_SIZE>
 	static Tensor<Float, INPUT_C, BATCH_SIZE> backward(
 		const Tensor<Float, INPUT_C, BATCH_SIZE>& sigmoid,
 		Tensor<Float, INPUT_C, BATCH_SIZE> gradient)
 	{
-		assert(
-			sigmoid.size() == gradient.size() && sigmoid.batchSize() == gradient.batchSize());
-
-		auto sigmoidIt = sigmoid.begin();
-		for (auto& gg : gradient)
-		{
-			gg *= *sigmoidIt * (Float{1} - *sigmoidIt);
-			++sigmoidIt;
-		}
+		backwardInPlace(sigmoid, gradient);
 		return gradient;
 	}
 
-private:
-	template <typename Float>
-	static Float sigmoid(Float f)
+	template <typename Float, size_t INPUT_C, size_t BATCH_SIZE>
+	static void backwardInPlace(
+		const Tensor<Float, INPUT_C, BATCH_SIZE>& sigmoid,
+		Tensor<Float, INPUT_C, BATCH_SIZE>& gradient)
 	{
-		return Float{1} / (Float{1} + std::exp(-f));
+		assert(
+			sigmoid.size() == gradient.size() && sigmoid.batchSize() == gradient.batchSize());
+
+		details::simd::sigmoidBackward(sigmoid.begin(), gradient.begin(), gradient.end());
 	}
 };
 
+namespace details {
+
+// Activations that map each element independently can be fused into the bias pass of the
+// layer.
+template <typename Activation, typename = void>
+struct IsElementwiseActivation : std::false_type
+{};
+
+template <typename Activation>
+struct IsElementwiseActivation<
+	Activation,
+	std::void_t<decltype(Activation::forwardRange(
+		std::declval<float*>(), std::declval<float*>()))>> : std::true_type
+{};
+
+} // namespace details
+
 } // namespace nnp
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "tensor.h"
+
+namespace nnp {
+
+// Collects single-sample requests from any number of threads into column-major batches and
+// runs each batch through one forward() of network on a dispatcher thread. A batch is
+// started once maxBatchSize requests are waiting or the oldest one has waited maxDelay.
+// network must outlive the server and must not be used by anything else meanwhile.
+template <typename Network, typename Float = float>
+class BatchingServer
+{
+public:
+	using Input = std::array<Float, Network::inputCount()>;
+	using Output = std::array<Float, Network::outputCount()>;
+
+	BatchingServer(
+		Network& network,
+		size_t maxBatchSize,
+		std::chrono::microseconds maxDelay = std::chrono::microseconds(100))
+		: m_network(network)
+		, m_maxBatchSize(std::max<size_t>(maxBatchSize, 1))
+		, m_maxDelay(maxDelay)
+	{
+		// Batches are padded to the next power of two, or to maxBatchSize, so that every
+		// buffer is allocated up front.
+		for (size_t size = 1;; size *= 2)
+		{
+			size = std::min(size, m_maxBatchSize);
+			m_buckets.emplace_back(std::make_unique<Bucket>(size));
+			if (size == m_maxBatchSize)
+				break;
+		}
+		m_dispatcher = std::thread([this] { dispatchLoop(); });
+	}
+
+	BatchingServer(const BatchingServer&) = delete;
+
+	BatchingServer& operator=(const BatchingServer&) = delete;
+
+	// Completes every request submitted so far before returning.
+	~BatchingServer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_one();
+		m_dispatcher.join();
+	}
+
+	// Lock-free unless the dispatcher is idle and has to be woken up.
+	std::future<Output> submit(const Input& input)
+	{
+		auto* request = new Request{input, {}, std::chrono::steady_clock::now(), nullptr};
+		std::future<Output> result = request->promise.get_future();
+		request->next = m_submitted.load(std::memory_order_relaxed);
+		while (!m_submitted.compare_exchange_weak(
+			request->next, request, std::memory_order_seq_cst, std::memory_order_relaxed))
+			;
+		if (m_sleeping.load())
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_wake.notify_one();
+		}
+		return result;
+	}
+
+	size_t maxBatchSize() const { return m_maxBatchSize; }
+
+private:
+	struct Request
+	{
+		Input input;
+		std::promise<Output> promise;
+		std::chrono::steady_clock::time_point arrival;
+		Request* next;
+	};
+
+	struct Bucket
+	{
+		explicit Bucket(size_t batchSize)
+			: workspace(batchSize)
+			, input(batchSize)
+		{
+			std::fill(input.begin(), input.end(), Float{0});
+		}
+
+		typename Network::template Workspace<Float> workspace;
+		Tensor<Float, Network::inputCount()> input;
+	};
+
+	// Moves the submitted requests to m_pending in arrival order.
+	void drainSubmitted()
+	{
+		Request* list = m_submitted.exchange(nullptr, std::memory_order_acquire);
+		const size_t oldSize = m_pending.size();
+		for (; list; list = list->next)
+			m_pending.push_back(list);
+		std::reverse(m_pending.begin() + oldSize, m_pending.end());
+	}
+
+	void dispatchLoop()
+	{
+		for (;;)
+		{
+			drainSubmitted();
+			const bool stopping = [this] {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				return m_stop;
+			}();
+			if (!m_pending.empty() &&
+				(stopping || m_pending.size() >= m_maxBatchSize ||
+				 std::chrono::steady_clock::now() >= deadline()))
+			{
+				runBatch(std::min(m_pending.size(), m_maxBatchSize));
+				continue;
+			}
+			if (stopping)
+				return;
+
+			// Paired with the seq_cst push in submit(): either the producer sees m_sleeping
+			// or the check below sees its request.
+			m_sleeping.store(true);
+			std::unique_lock<std::mutex> lock(m_mutex);
+			auto wakeUp = [this] { return m_stop || m_submitted.load() != nullptr; };
+			if (m_pending.empty())
+				m_wake.wait(lock, wakeUp);
+			else
+				m_wake.wait_until(lock, deadline(), wakeUp);
+			m_sleeping.store(false);
+		}
+	}
+
+	std::chrono::steady_clock::time_point deadline() const
+	{
+		return m_pending.front()->arrival + m_maxDelay;
+	}
+
+	void runBatch(size_t count)
+	{
+		Bucket& bucket = **std::find_if(m_buckets.begin(), m_buckets.end(), [count](auto& b) {
+			return b->workspace.batchSize() >= count;
+		});
+		for (size_t ii = 0; ii != count; ++ii)
+			std::copy(
+				m_pending[ii]->input.begin(),
+				m_pending[ii]->input.end(),
+				&bucket.input(0, ii));
+		try
+		{
+			const auto& output = m_network.forward(bucket.workspace, bucket.input);
+			for (size_t ii = 0; ii != count; ++ii)
+			{
+				Output result;
+				std::copy(&output(0, ii), &output(0, ii) + result.size(), result.begin());
+				m_pending[ii]->promise.set_value(result);
+			}
+		}
+		catch (...)
+		{
+			for (size_t ii = 0; ii != count; ++ii)
+				m_pending[ii]->promise.set_exception(std::current_exception());
+		}
+		for (size_t ii = 0; ii != count; ++ii)
+			delete m_pending[ii];
+		m_pending.erase(m_pending.begin(), m_pending.begin() + count);
+	}
+
+	Network& m_network;
+	const size_t m_maxBatchSize;
+	const std::chrono::microseconds m_maxDelay;
+	std::vector<std::unique_ptr<Bucket>> m_buckets;
+	std::atomic<Request*> m_submitted{nullptr};
+	std::atomic<bool> m_sleeping{false};
+	// Only touched by the dispatcher thread.
+	std::deque<Request*> m_pending;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_stop = false;
+	std::thread m_dispatcher;
+};
+
+} // namespace nnp
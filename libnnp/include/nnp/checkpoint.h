@@ -0,0 +1,496 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "layer.h"
+#include "network.h"
+
+namespace nnp {
+
+namespace details {
+
+namespace checkpoint {
+
+// File layout, version 2. All integers are in host byte order, byteOrderMark tells whether
+// the file was written by a host with the same one.
+//
+// Header                          64 bytes
+// LayerRecord[layerCount]         padded to ALIGNMENT
+// per layer: weights, bias        row-major, each padded to ALIGNMENT
+//
+// checksum covers every byte of the file, padding included. The header is hashed last, with
+// its checksum field set to zero. Version 1 left the header out of the checksum.
+
+constexpr char MAGIC[8] = {'N', 'N', 'P', 'C', 'K', 'P', 'T', '\0'};
+constexpr uint32_t VERSION = 2;
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+constexpr uint64_t ALIGNMENT = 64;
+
+enum class FloatType : uint32_t
+{
+	FLOAT32 = 1,
+	FLOAT64 = 2
+};
+
+enum class Layout : uint32_t
+{
+	ROW_MAJOR = 1
+};
+
+template <typename Float>
+struct FloatTypeOf;
+
+template <>
+struct FloatTypeOf<float> : std::integral_constant<FloatType, FloatType::FLOAT32>
+{};
+
+template <>
+struct FloatTypeOf<double> : std::integral_constant<FloatType, FloatType::FLOAT64>
+{};
+
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrderMark;
+	uint32_t floatType;
+	uint32_t layout;
+	uint64_t layerCount;
+	uint64_t fileSize;
+	uint64_t checksum;
+	uint64_t reserved[2];
+};
+
+struct LayerRecord
+{
+	uint64_t nodeCount;
+	uint64_t inputCount;
+	uint64_t weightOffset;
+	uint64_t biasOffset;
+};
+
+static_assert(sizeof(Header) == ALIGNMENT && std::is_trivially_copyable<Header>::value);
+static_assert(sizeof(LayerRecord) == 32 && std::is_trivially_copyable<LayerRecord>::value);
+
+constexpr uint64_t align(uint64_t offset)
+{
+	return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// Hashes whole blocks with four independent multiply-xor lanes so that the multiplications
+// pipeline. A change to any single word always changes the result.
+class Checksum
+{
+public:
+	static constexpr size_t BLOCK = 32;
+
+	void update(const unsigned char* data, size_t size)
+	{
+		assert(size % BLOCK == 0);
+		for (size_t ii = 0; ii != size; ii += BLOCK)
+			for (size_t ll = 0; ll != LANES; ++ll)
+			{
+				uint64_t word;
+				std::memcpy(&word, data + ii + ll * sizeof(word), sizeof(word));
+				m_lanes[ll] = (m_lanes[ll] ^ word) * PRIME;
+			}
+	}
+
+	uint64_t value() const
+	{
+		uint64_t hash = OFFSET;
+		for (uint64_t lane : m_lanes)
+			hash = (hash ^ lane) * PRIME;
+		return hash;
+	}
+
+private:
+	static constexpr size_t LANES = BLOCK / sizeof(uint64_t);
+	static constexpr uint64_t PRIME = 0x100000001b3;
+	static constexpr uint64_t OFFSET = 0xcbf29ce484222325;
+
+	uint64_t m_lanes[LANES] = {OFFSET, OFFSET + 1, OFFSET + 2, OFFSET + 3};
+};
+
+// Writes sections padded to ALIGNMENT and hashes them on the way.
+class Writer
+{
+public:
+	explicit Writer(const std::string& path)
+		: m_file(path, std::ios::binary | std::ios::trunc)
+	{
+		if (!m_file)
+			throw std::runtime_error("Failed opening checkpoint " + path + " for writing");
+		const char placeholder[sizeof(Header)] = {};
+		m_file.write(placeholder, sizeof(placeholder));
+	}
+
+	void write(const void* data, size_t size)
+	{
+		const auto* bytes = static_cast<const unsigned char*>(data);
+		const size_t whole = size / ALIGNMENT * ALIGNMENT;
+		m_checksum.update(bytes, whole);
+		m_file.write(reinterpret_cast<const char*>(bytes), size);
+		if (whole != size)
+		{
+			const size_t tailSize = size - whole;
+			unsigned char tail[ALIGNMENT] = {};
+			std::memcpy(tail, bytes + whole, tailSize);
+			m_checksum.update(tail, ALIGNMENT);
+			m_file.write(reinterpret_cast<const char*>(tail + tailSize), ALIGNMENT - tailSize);
+		}
+	}
+
+	uint64_t size() { return static_cast<uint64_t>(m_file.tellp()); }
+
+	void finish(Header header)
+	{
+		header.fileSize = size();
+		header.checksum = 0;
+		m_checksum.update(reinterpret_cast<const unsigned char*>(&header), sizeof(header));
+		header.checksum = m_checksum.value();
+		m_file.seekp(0);
+		m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		m_file.flush();
+		if (!m_file)
+			throw std::runtime_error("Failed writing checkpoint");
+	}
+
+private:
+	std::ofstream m_file;
+	Checksum m_checksum;
+};
+
+template <typename Layer>
+struct LayerTraits;
+
+template <
+	typename Activation,
+	typename LayerFloat,
+	size_t NODE_C,
+	size_t INPUT_C,
+	typename Optimizer,
+	typename Layout>
+struct LayerTraits<
+	ComputationalLayer<Activation, LayerFloat, NODE_C, INPUT_C, Optimizer, Layout>>
+{
+	// Reduced precision layers are saved from their full precision master weights.
+	using Float = Accumulator<LayerFloat>;
+	using Mapped = MappedLayer<Activation, Float, NODE_C, INPUT_C>;
+};
+
+template <typename Network>
+struct MappedNetworkHelper;
+
+template <typename... Layers>
+struct MappedNetworkHelper<TupleNetwork<Layers...>>
+{
+	using Type = TupleNetwork<typename LayerTraits<Layers>::Mapped...>;
+};
+
+template <typename... Layers, size_t... IDX>
+void save(
+	const TupleNetwork<Layers...>& network,
+	const std::string& path,
+	std::index_sequence<IDX...>)
+{
+	using Float = typename LayerTraits<std::tuple_element_t<0, std::tuple<Layers...>>>::Float;
+	static_assert(
+		(std::is_same<Float, typename LayerTraits<Layers>::Float>::value && ...),
+		"All layers of a checkpoint have to use the same float type");
+
+	std::array<LayerRecord, sizeof...(Layers)> records{};
+	uint64_t offset = align(sizeof(Header) + sizeof(records));
+	auto addRecord = [&offset](LayerRecord& record, const auto& layer) {
+		record.nodeCount = layer.weights().nr();
+		record.inputCount = layer.weights().nc();
+		record.weightOffset = offset;
+		offset = align(offset + record.nodeCount * record.inputCount * sizeof(Float));
+		record.biasOffset = offset;
+		offset = align(offset + record.nodeCount * sizeof(Float));
+	};
+	(addRecord(records[IDX], network.template layer<IDX>()), ...);
+
+	Writer writer(path);
+	writer.write(records.data(), sizeof(records));
+	auto writeLayer = [&writer](const auto& layer) {
+		writer.write(layer.weights().begin(), layer.weights().size() * sizeof(Float));
+		writer.write(layer.bias().begin(), layer.bias().size() * sizeof(Float));
+	};
+	(writeLayer(network.template layer<IDX>()), ...);
+
+	Header header{};
+	std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+	header.version = VERSION;
+	header.byteOrderMark = BYTE_ORDER_MARK;
+	header.floatType = static_cast<uint32_t>(FloatTypeOf<Float>::value);
+	header.layout = static_cast<uint32_t>(Layout::ROW_MAJOR);
+	header.layerCount = sizeof...(Layers);
+	assert(writer.size() == offset);
+	writer.finish(header);
+}
+
+} // namespace checkpoint
+
+} // namespace details
+
+// Inference network reading its weights from a Checkpoint, see Checkpoint::map().
+template <typename Network>
+using MappedNetwork = typename details::checkpoint::MappedNetworkHelper<Network>::Type;
+
+// Writes the weights and biases of every layer of network to path. All layers have to use
+// the same float type.
+template <typename... Layers>
+void saveCheckpoint(const TupleNetwork<Layers...>& network, const std::string& path)
+{
+	details::checkpoint::save(network, path, std::index_sequence_for<Layers...>());
+}
+
+// Read-only memory mapping of a checkpoint written by saveCheckpoint(). The constructor
+// validates the header and the layer table and throws std::runtime_error if the file is not
+// a checkpoint this version can read, or if it is truncated or corrupted. Verifying the
+// checksum reads the whole file. Skipping it leaves the weights to be paged in on first use.
+class Checkpoint
+{
+public:
+	explicit Checkpoint(const std::string& path, bool verifyChecksum = true)
+	{
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("Failed opening checkpoint " + path);
+		struct stat status;
+		if (::fstat(fd, &status) != 0 || status.st_size < 0)
+		{
+			::close(fd);
+			throw std::runtime_error("Failed reading checkpoint " + path);
+		}
+		m_size = static_cast<size_t>(status.st_size);
+		if (m_size < sizeof(details::checkpoint::Header))
+		{
+			::close(fd);
+			throw std::runtime_error("Checkpoint " + path + " is truncated");
+		}
+		void* data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+			throw std::runtime_error("Failed mapping checkpoint " + path);
+		m_data = static_cast<const unsigned char*>(data);
+		try
+		{
+			validate(verifyChecksum);
+		}
+		catch (...)
+		{
+			unmap();
+			throw;
+		}
+	}
+
+	Checkpoint(const Checkpoint&) = delete;
+
+	Checkpoint(Checkpoint&& other) noexcept
+		: m_data(std::exchange(other.m_data, nullptr))
+		, m_size(std::exchange(other.m_size, 0))
+	{}
+
+	Checkpoint& operator=(const Checkpoint&) = delete;
+
+	Checkpoint& operator=(Checkpoint&& other) noexcept
+	{
+		if (this != &other)
+		{
+			unmap();
+			m_data = std::exchange(other.m_data, nullptr);
+			m_size = std::exchange(other.m_size, 0);
+		}
+		return *this;
+	}
+
+	~Checkpoint() { unmap(); }
+
+	size_t layerCount() const { return header().layerCount; }
+
+	size_t nodeCount(size_t layer) const { return record(layer).nodeCount; }
+
+	size_t inputCount(size_t layer) const { return record(layer).inputCount; }
+
+	template <typename Float>
+	const Float* weights(size_t layer) const
+	{
+		checkFloatType<Float>();
+		return reinterpret_cast<const Float*>(m_data + record(layer).weightOffset);
+	}
+
+	template <typename Float>
+	const Float* bias(size_t layer) const
+	{
+		checkFloatType<Float>();
+		return reinterpret_cast<const Float*>(m_data + record(layer).biasOffset);
+	}
+
+	// Copies the weights into network, whose layers have to match the checkpoint.
+	template <typename... Layers>
+	void load(TupleNetwork<Layers...>& network) const
+	{
+		loadHelper(network, std::index_sequence_for<Layers...>());
+	}
+
+	// Builds an inference network whose layers use the mapped weights in place. The
+	// checkpoint has to outlive it.
+	template <typename Network>
+	MappedNetwork<Network> map() const
+	{
+		return mapHelper(
+			static_cast<Network*>(nullptr), std::make_index_sequence<Network::layerCount()>());
+	}
+
+private:
+	const details::checkpoint::Header& header() const
+	{
+		return *reinterpret_cast<const details::checkpoint::Header*>(m_data);
+	}
+
+	const details::checkpoint::LayerRecord& record(size_t layer) const
+	{
+		assert(layer < layerCount());
+		return reinterpret_cast<const details::checkpoint::LayerRecord*>(
+			m_data + sizeof(details::checkpoint::Header))[layer];
+	}
+
+	void validate(bool verifyChecksum) const
+	{
+		namespace cp = details::checkpoint;
+		const cp::Header& h = header();
+		if (std::memcmp(h.magic, cp::MAGIC, sizeof(cp::MAGIC)) != 0)
+			throw std::runtime_error("Not a checkpoint");
+		if (h.byteOrderMark != cp::BYTE_ORDER_MARK)
+			throw std::runtime_error("Checkpoint was written with a different byte order");
+		if (h.version != cp::VERSION)
+			throw std::runtime_error("Unsupported checkpoint version");
+		if (h.layout != static_cast<uint32_t>(cp::Layout::ROW_MAJOR) ||
+			(h.floatType != static_cast<uint32_t>(cp::FloatType::FLOAT32) &&
+			 h.floatType != static_cast<uint32_t>(cp::FloatType::FLOAT64)))
+			throw std::runtime_error("Unsupported checkpoint float type or layout");
+		if (h.fileSize != m_size || m_size % cp::ALIGNMENT != 0)
+			throw std::runtime_error("Checkpoint is truncated");
+		if (h.layerCount > (m_size - sizeof(cp::Header)) / sizeof(cp::LayerRecord))
+			throw std::runtime_error("Checkpoint is corrupted");
+
+		const uint64_t floatSize =
+			h.floatType == static_cast<uint32_t>(cp::FloatType::FLOAT32) ? 4 : 8;
+		const uint64_t tableEnd =
+			sizeof(cp::Header) + h.layerCount * sizeof(cp::LayerRecord);
+		auto inBounds = [&](uint64_t offset, uint64_t count) {
+			return offset % cp::ALIGNMENT == 0 && offset >= tableEnd && offset <= m_size &&
+				count <= (m_size - offset) / floatSize;
+		};
+		for (size_t ii = 0; ii != h.layerCount; ++ii)
+		{
+			const cp::LayerRecord& r = record(ii);
+			// Bounded so that the product below cannot overflow.
+			if (r.nodeCount == 0 || r.inputCount == 0 || r.nodeCount > UINT32_MAX ||
+				r.inputCount > UINT32_MAX ||
+				!inBounds(r.weightOffset, r.nodeCount * r.inputCount) ||
+				!inBounds(r.biasOffset, r.nodeCount))
+				throw std::runtime_error("Checkpoint is corrupted");
+		}
+
+		if (verifyChecksum)
+		{
+			cp::Checksum checksum;
+			checksum.update(m_data + sizeof(cp::Header), m_size - sizeof(cp::Header));
+			cp::Header unsummed = h;
+			unsummed.checksum = 0;
+			checksum.update(
+				reinterpret_cast<const unsigned char*>(&unsummed), sizeof(unsummed));
+			if (checksum.value() != h.checksum)
+				throw std::runtime_error("Checkpoint checksum mismatch");
+		}
+	}
+
+	template <typename Float>
+	void checkFloatType() const
+	{
+		if (header().floatType !=
+			static_cast<uint32_t>(details::checkpoint::FloatTypeOf<Float>::value))
+			throw std::runtime_error("Checkpoint float type does not match");
+	}
+
+	template <typename Layer>
+	void checkLayer(size_t layer) const
+	{
+		if (layer >= layerCount() ||
+			(Layer::nodeCount() != RESIZEABLE && Layer::nodeCount() != nodeCount(layer)) ||
+			(Layer::inputCount() != RESIZEABLE && Layer::inputCount() != inputCount(layer)))
+			throw std::runtime_error("Checkpoint does not match the network layers");
+	}
+
+	template <typename... Layers, size_t... IDX>
+	void loadHelper(TupleNetwork<Layers...>& network, std::index_sequence<IDX...>) const
+	{
+		if (layerCount() != sizeof...(Layers))
+			throw std::runtime_error("Checkpoint does not match the network layers");
+		(checkLayer<Layers>(IDX), ...);
+		(copyLayer(network.template layer<IDX>(), IDX), ...);
+	}
+
+	template <typename Layer>
+	void copyLayer(Layer& layer, size_t idx) const
+	{
+		using Float = typename details::checkpoint::LayerTraits<Layer>::Float;
+		const size_t nodes = nodeCount(idx);
+		const size_t inputs = inputCount(idx);
+		layer.weights().set_size(nodes, inputs);
+		layer.bias().set_size(nodes, 1);
+		const Float* w = weights<Float>(idx);
+		std::copy(w, w + nodes * inputs, layer.weights().begin());
+		const Float* b = bias<Float>(idx);
+		std::copy(b, b + nodes, layer.bias().begin());
+		layer.syncWeights();
+	}
+
+	template <typename... Layers, size_t... IDX>
+	MappedNetwork<TupleNetwork<Layers...>>
+		mapHelper(TupleNetwork<Layers...>*, std::index_sequence<IDX...>) const
+	{
+		if (layerCount() != sizeof...(Layers))
+			throw std::runtime_error("Checkpoint does not match the network layers");
+		(checkLayer<Layers>(IDX), ...);
+		return MappedNetwork<TupleNetwork<Layers...>>{mapLayer<Layers>(IDX)...};
+	}
+
+	template <typename Layer>
+	typename details::checkpoint::LayerTraits<Layer>::Mapped mapLayer(size_t idx) const
+	{
+		using Float = typename details::checkpoint::LayerTraits<Layer>::Float;
+		return {weights<Float>(idx), bias<Float>(idx), nodeCount(idx), inputCount(idx)};
+	}
+
+	void unmap()
+	{
+		if (m_data)
+			::munmap(const_cast<unsigned char*>(m_data), m_size);
+		m_data = nullptr;
+	}
+
+	const unsigned char* m_data = nullptr;
+	size_t m_size = 0;
+};
+
+} // namespace nnp
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 namespace nnp {
 
 constexpr size_t RESIZEABLE = 0;
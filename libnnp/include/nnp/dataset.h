@@ -0,0 +1,733 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "float16.h"
+#include "tensor.h"
+#include "thread_pool.h"
+
+namespace nnp {
+
+// Samples of a dataset, one tensor column per sample.
+template <typename Float, size_t INPUT_C, size_t TARGET_C>
+struct Batch
+{
+	explicit Batch(size_t batchSize = 0)
+		: input(batchSize)
+		, target(batchSize)
+	{}
+
+	size_t size() const { return input.batchSize(); }
+
+	Tensor<Float, INPUT_C> input;
+	Tensor<Float, TARGET_C> target;
+};
+
+// Fills the target of a sample from the fields of a CSV line that follow its input, for
+// example to map class names to one-hot vectors. Throws to reject the line.
+template <typename Float>
+using CsvTargetParser = std::function<void(std::string_view fields, Float* target)>;
+
+namespace details {
+
+namespace dataset {
+
+// Keeps the first count samples. Only the last batch of an epoch is ever shrunk.
+template <typename Float, size_t INPUT_C, size_t TARGET_C>
+void shrink(Batch<Float, INPUT_C, TARGET_C>& batch, size_t count)
+{
+	Batch<Float, INPUT_C, TARGET_C> shrunk(count);
+	copyColumns(batch.input, 0, count, shrunk.input);
+	copyColumns(batch.target, 0, count, shrunk.target);
+	batch = std::move(shrunk);
+}
+
+// Binary dataset layout, version 1. All integers are in host byte order. The header is
+// followed by sampleCount records of inputCount inputs and targetCount targets, so that each
+// record is one column of the input and the target tensor.
+constexpr char MAGIC[8] = {'N', 'N', 'P', 'D', 'A', 'T', 'A', '\0'};
+constexpr uint32_t VERSION = 1;
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrderMark;
+	uint32_t floatSize;
+	uint32_t reserved;
+	uint64_t inputCount;
+	uint64_t targetCount;
+	uint64_t sampleCount;
+};
+
+static_assert(sizeof(Header) == 48 && std::is_trivially_copyable<Header>::value);
+
+template <typename Source, typename Float, size_t INPUT_C, size_t TARGET_C>
+void save(
+	Source& source,
+	const std::string& path,
+	size_t batchSize,
+	Batch<Float, INPUT_C, TARGET_C>*)
+{
+	constexpr size_t RECORD_SIZE = INPUT_C + TARGET_C;
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		throw std::runtime_error("Failed opening dataset " + path + " for writing");
+	Header header{};
+	std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+	header.version = VERSION;
+	header.byteOrderMark = BYTE_ORDER_MARK;
+	header.floatSize = sizeof(Float);
+	header.inputCount = INPUT_C;
+	header.targetCount = TARGET_C;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	source.rewind();
+	Batch<Float, INPUT_C, TARGET_C> batch(batchSize);
+	std::vector<Float> records;
+	while (const size_t count = source.read(batch))
+	{
+		records.resize(count * RECORD_SIZE);
+		for (size_t ii = 0; ii != count; ++ii)
+		{
+			Float* record = records.data() + ii * RECORD_SIZE;
+			std::copy(&batch.input(0, ii), &batch.input(0, ii) + INPUT_C, record);
+			std::copy(&batch.target(0, ii), &batch.target(0, ii) + TARGET_C, record + INPUT_C);
+		}
+		file.write(
+			reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Float));
+		header.sampleCount += count;
+		if (count != batchSize)
+			batch = Batch<Float, INPUT_C, TARGET_C>(batchSize);
+	}
+	source.rewind();
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.flush();
+	if (!file)
+		throw std::runtime_error("Failed writing dataset " + path);
+}
+
+inline bool isBlank(std::string_view line)
+{
+	return line.find_first_not_of(" \t\r") == std::string_view::npos;
+}
+
+// Calls callable(line) for every line in [begin, end), the last of which does not need to
+// end in a newline.
+template <typename Callable>
+void forEachLine(const char* begin, const char* end, Callable&& callable)
+{
+	while (begin != end)
+	{
+		const char* newline = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+		const char* lineEnd = newline ? newline : end;
+		callable(std::string_view(begin, lineEnd - begin));
+		begin = newline ? newline + 1 : end;
+	}
+}
+
+// Splits a CSV line into INPUT_C input fields followed by either TARGET_C target fields or
+// whatever parseTarget makes of the rest. Can be shared between threads if parseTarget can.
+template <typename Float, size_t INPUT_C, size_t TARGET_C>
+class CsvParser
+{
+	using Parsed = Accumulator<Float>;
+
+public:
+	CsvParser(CsvTargetParser<Float> parseTarget, char delimiter)
+		: m_parseTarget(std::move(parseTarget))
+		, m_delimiter(delimiter)
+	{}
+
+	// Returns false if the line is malformed.
+	bool operator()(std::string_view line, Float* input, Float* target) const
+	{
+		const char* it = line.data();
+		const char* end = line.data() + line.size();
+		for (size_t ii = 0; ii != INPUT_C; ++ii)
+			if (!parseField(it, end, input[ii]))
+				return false;
+		if (m_parseTarget)
+		{
+			m_parseTarget(std::string_view(it, end - it), target);
+			return true;
+		}
+		for (size_t ii = 0; ii != TARGET_C; ++ii)
+			if (!parseField(it, end, target[ii]))
+				return false;
+		return isBlank(std::string_view(it, end - it));
+	}
+
+private:
+	// Parses the field starting at it and moves it past the following delimiter.
+	bool parseField(const char*& it, const char* end, Float& value) const
+	{
+		while (it != end && (*it == ' ' || *it == '\t'))
+			++it;
+		Parsed parsed;
+		const auto result = std::from_chars(it, end, parsed);
+		if (result.ec != std::errc())
+			return false;
+		value = static_cast<Float>(parsed);
+		it = result.ptr;
+		while (it != end && (*it == ' ' || *it == '\t' || *it == '\r'))
+			++it;
+		if (it == end)
+			return true;
+		if (*it != m_delimiter)
+			return false;
+		++it;
+		return true;
+	}
+
+	CsvTargetParser<Float> m_parseTarget;
+	char m_delimiter;
+};
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& path)
+	{
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("Failed opening dataset " + path);
+		struct stat status;
+		if (::fstat(fd, &status) != 0 || status.st_size < 0)
+		{
+			::close(fd);
+			throw std::runtime_error("Failed reading dataset " + path);
+		}
+		m_size = static_cast<size_t>(status.st_size);
+		void* data = m_size ? ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+		::close(fd);
+		if (data == MAP_FAILED)
+			throw std::runtime_error("Failed mapping dataset " + path);
+		m_data = static_cast<const char*>(data);
+	}
+
+	MappedFile(const MappedFile&) = delete;
+
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+		if (m_data)
+			::munmap(const_cast<char*>(m_data), m_size);
+	}
+
+	const char* begin() const { return m_data; }
+
+	const char* end() const { return m_data + m_size; }
+
+private:
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+};
+
+// Splits [begin, end) into at most chunkCount pieces of about equal size that each end after
+// a newline, or at end. Returns the chunkCount + 1 or fewer boundaries.
+inline std::vector<const char*>
+	splitLines(const char* begin, const char* end, size_t chunkCount)
+{
+	std::vector<const char*> bounds{begin};
+	for (size_t ii = 1; ii < chunkCount; ++ii)
+	{
+		const char* target = begin + (end - begin) * ii / chunkCount;
+		if (target <= bounds.back())
+			continue;
+		const char* newline =
+			static_cast<const char*>(std::memchr(target - 1, '\n', end - target + 1));
+		if (!newline || newline + 1 == end)
+			break;
+		bounds.push_back(newline + 1);
+	}
+	bounds.push_back(end);
+	return bounds;
+}
+
+} // namespace dataset
+
+} // namespace details
+
+// Reads samples from a text file with one sample per line and fields separated by delimiter.
+// The first INPUT_C fields are the input. The next TARGET_C fields are the target, unless a
+// TargetParser is given, which is passed the rest of the line instead. The file is read in
+// blocks and parsed in place, and blank lines are skipped. read() throws std::runtime_error
+// on malformed lines.
+template <typename Float, size_t INPUT_C, size_t TARGET_C>
+class CsvSource
+{
+public:
+	using Batch = nnp::Batch<Float, INPUT_C, TARGET_C>;
+	using TargetParser = CsvTargetParser<Float>;
+
+	static constexpr size_t BLOCK_SIZE = 1 << 20;
+
+	explicit CsvSource(
+		const std::string& path,
+		TargetParser parseTarget = {},
+		char delimiter = ',',
+		size_t headerLines = 0)
+		: m_path(path)
+		, m_file(path, std::ios::binary)
+		, m_parse(std::move(parseTarget), delimiter)
+		, m_headerLines(headerLines)
+		, m_buffer(BLOCK_SIZE)
+	{
+		if (!m_file)
+			throw std::runtime_error("Failed opening dataset " + path);
+		rewind();
+	}
+
+	// Fills batch with up to its batch size of samples and returns how many were read, 0 at
+	// the end of the file.
+	size_t read(Batch& batch)
+	{
+		const size_t capacity = batch.size();
+		size_t count = 0;
+		std::string_view line;
+		while (count != capacity && nextLine(line))
+		{
+			if (details::dataset::isBlank(line))
+				continue;
+			if (!m_parse(line, &batch.input(0, count), &batch.target(0, count)))
+				throw std::runtime_error(
+					"Failed parsing line " + std::to_string(m_lineNumber) + " of dataset " +
+					m_path);
+			++count;
+		}
+		if (count != capacity && count != 0)
+			details::dataset::shrink(batch, count);
+		return count;
+	}
+
+	void rewind()
+	{
+		m_file.clear();
+		m_file.seekg(0);
+		m_begin = m_end = 0;
+		m_eof = false;
+		m_lineNumber = 0;
+		std::string_view line;
+		for (size_t ii = 0; ii != m_headerLines && nextLine(line); ++ii)
+			;
+	}
+
+private:
+	// The returned line stays valid until the next call.
+	bool nextLine(std::string_view& line)
+	{
+		for (;;)
+		{
+			const char* begin = m_buffer.data() + m_begin;
+			const char* newline =
+				static_cast<const char*>(std::memchr(begin, '\n', m_end - m_begin));
+			if (newline || (m_eof && m_begin != m_end))
+			{
+				const size_t length = newline ? newline - begin : m_end - m_begin;
+				line = std::string_view(begin, length);
+				m_begin += newline ? length + 1 : length;
+				++m_lineNumber;
+				return true;
+			}
+			if (m_eof)
+				return false;
+			fill();
+		}
+	}
+
+	// Moves the partial line at the end of the buffer to its front and reads the next block
+	// after it, growing the buffer for lines longer than a block.
+	void fill()
+	{
+		const size_t remainder = m_end - m_begin;
+		std::memmove(m_buffer.data(), m_buffer.data() + m_begin, remainder);
+		m_begin = 0;
+		m_end = remainder;
+		if (m_buffer.size() - m_end < BLOCK_SIZE)
+			m_buffer.resize(m_end + BLOCK_SIZE);
+		m_file.read(m_buffer.data() + m_end, BLOCK_SIZE);
+		m_end += static_cast<size_t>(m_file.gcount());
+		m_eof = m_file.eof();
+		if (!m_eof && !m_file)
+			throw std::runtime_error("Failed reading dataset " + m_path);
+	}
+
+	std::string m_path;
+	std::ifstream m_file;
+	details::dataset::CsvParser<Float, INPUT_C, TARGET_C> m_parse;
+	size_t m_headerLines;
+	std::vector<char> m_buffer;
+	size_t m_begin = 0;
+	size_t m_end = 0;
+	bool m_eof = false;
+	size_t m_lineNumber = 0;
+};
+
+// Reads samples written by saveDataset(). Each batch takes a single read from the file and
+// no parsing. The constructor throws std::runtime_error if the file is not a dataset of this
+// shape and float type.
+template <typename Float, size_t INPUT_C, size_t TARGET_C>
+class BinarySource
+{
+public:
+	using Batch = nnp::Batch<Float, INPUT_C, TARGET_C>;
+
+	explicit BinarySource(const std::string& path)
+		: m_file(path, std::ios::binary)
+	{
+		namespace ds = details::dataset;
+		if (!m_file)
+			throw std::runtime_error("Failed opening dataset " + path);
+		ds::Header header;
+		if (!m_file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+			std::memcmp(header.magic, ds::MAGIC, sizeof(ds::MAGIC)) != 0)
+			throw std::runtime_error(path + " is not a dataset");
+		if (header.byteOrderMark != ds::BYTE_ORDER_MARK)
+			throw std::runtime_error(
+				"Dataset " + path + " was written with a different byte order");
+		if (header.version != ds::VERSION)
+			throw std::runtime_error("Unsupported version of dataset " + path);
+		if (header.floatSize != sizeof(Float) || header.inputCount != INPUT_C ||
+			header.targetCount != TARGET_C)
+			throw std::runtime_error("Dataset " + path + " has a different shape");
+		m_sampleCount = header.sampleCount;
+	}
+
+	size_t sampleCount() const { return m_sampleCount; }
+
+	// Fills batch with up to its batch size of samples and returns how many were read, 0 at
+	// the end of the file.
+	size_t read(Batch& batch)
+	{
+		const size_t count = std::min<size_t>(batch.size(), m_sampleCount - m_position);
+		if (count == 0)
+			return 0;
+		m_records.resize(count * RECORD_SIZE);
+		const size_t bytes = count * RECORD_SIZE * sizeof(Float);
+		if (!m_file.read(reinterpret_cast<char*>(m_records.data()), bytes))
+			throw std::runtime_error("Dataset is truncated");
+		m_position += count;
+		if (count != batch.size())
+			batch = Batch(count);
+		for (size_t ii = 0; ii != count; ++ii)
+		{
+			const Float* record = m_records.data() + ii * RECORD_SIZE;
+			std::copy(record, record + INPUT_C, &batch.input(0, ii));
+			std::copy(record + INPUT_C, record + RECORD_SIZE, &batch.target(0, ii));
+		}
+		return count;
+	}
+
+	void rewind()
+	{
+		m_file.clear();
+		m_file.seekg(sizeof(details::dataset::Header));
+		m_position = 0;
+	}
+
+private:
+	static constexpr size_t RECORD_SIZE = INPUT_C + TARGET_C;
+
+	std::ifstream m_file;
+	uint64_t m_sampleCount = 0;
+	uint64_t m_position = 0;
+	std::vector<Float> m_records;
+};
+
+// Writes every sample of source to path in the format read by BinarySource, for example to
+// parse a CSV file once ahead of training.
+template <typename Source>
+void saveDataset(Source& source, const std::string& path, size_t batchSize = 1024)
+{
+	details::dataset::save(
+		source, path, batchSize, static_cast<typename Source::Batch*>(nullptr));
+}
+
+// Parses a whole CSV file, in the format read by CsvSource, into a single batch. The file is
+// memory mapped and split into newline-aligned chunks, whose samples the threads of pool
+// first count and then parse straight into their columns, so parseTarget is called from
+// several threads at once. Throws std::runtime_error naming a malformed line if there is one.
+template <typename Float, size_t INPUT_C, size_t TARGET_C>
+Batch<Float, INPUT_C, TARGET_C> loadCsv(
+	const std::string& path,
+	ThreadPool& pool,
+	CsvTargetParser<Float> parseTarget = {},
+	char delimiter = ',',
+	size_t headerLines = 0)
+{
+	namespace ds = details::dataset;
+	const ds::MappedFile file(path);
+	const char* begin = file.begin();
+	for (size_t ii = 0; ii != headerLines && begin != file.end(); ++ii)
+	{
+		const char* newline =
+			static_cast<const char*>(std::memchr(begin, '\n', file.end() - begin));
+		begin = newline ? newline + 1 : file.end();
+	}
+
+	// Several chunks per thread even out the load, but each should be long enough to amortize
+	// scheduling it.
+	constexpr size_t MIN_CHUNK_SIZE = 1 << 16;
+	const size_t chunkCount = std::clamp<size_t>(
+		(file.end() - begin) / MIN_CHUNK_SIZE, 1, 4 * pool.threadCount());
+	const std::vector<const char*> bounds = ds::splitLines(begin, file.end(), chunkCount);
+
+	struct Chunk
+	{
+		size_t lineCount = 0;
+		size_t sampleCount = 0;
+		size_t firstLine = 0;
+		size_t firstSample = 0;
+		std::exception_ptr error;
+	};
+	std::vector<Chunk> chunks(bounds.size() - 1);
+	pool.run(chunks.size(), [&](size_t job) {
+		Chunk& chunk = chunks[job];
+		ds::forEachLine(bounds[job], bounds[job + 1], [&chunk](std::string_view line) {
+			++chunk.lineCount;
+			chunk.sampleCount += !ds::isBlank(line);
+		});
+	});
+	size_t lineCount = headerLines;
+	size_t sampleCount = 0;
+	for (Chunk& chunk : chunks)
+	{
+		chunk.firstLine = lineCount + 1;
+		chunk.firstSample = sampleCount;
+		lineCount += chunk.lineCount;
+		sampleCount += chunk.sampleCount;
+	}
+
+	Batch<Float, INPUT_C, TARGET_C> batch(sampleCount);
+	const ds::CsvParser<Float, INPUT_C, TARGET_C> parse(std::move(parseTarget), delimiter);
+	pool.run(chunks.size(), [&](size_t job) {
+		Chunk& chunk = chunks[job];
+		size_t lineNumber = chunk.firstLine;
+		size_t sample = chunk.firstSample;
+		try
+		{
+			ds::forEachLine(bounds[job], bounds[job + 1], [&](std::string_view line) {
+				if (!ds::isBlank(line))
+				{
+					if (!parse(line, &batch.input(0, sample), &batch.target(0, sample)))
+						throw std::runtime_error(
+							"Failed parsing line " + std::to_string(lineNumber) +
+							" of dataset " + path);
+					++sample;
+				}
+				++lineNumber;
+			});
+		}
+		catch (...)
+		{
+			chunk.error = std::current_exception();
+		}
+	});
+	for (const Chunk& chunk : chunks)
+		if (chunk.error)
+			std::rethrow_exception(chunk.error);
+	return batch;
+}
+
+// Same as above on a pool of one thread per core.
+template <typename Float, size_t INPUT_C, size_t TARGET_C>
+Batch<Float, INPUT_C, TARGET_C> loadCsv(
+	const std::string& path,
+	CsvTargetParser<Float> parseTarget = {},
+	char delimiter = ',',
+	size_t headerLines = 0)
+{
+	ThreadPool pool;
+	return loadCsv<Float, INPUT_C, TARGET_C>(
+		path, pool, std::move(parseTarget), delimiter, headerLines);
+}
+
+// Time spent by a BatchPrefetcher reading batches and by its caller waiting for them.
+struct PrefetchStats
+{
+	std::chrono::nanoseconds loadTime{0};
+	std::chrono::nanoseconds waitTime{0};
+	size_t batchCount = 0;
+	size_t sampleCount = 0;
+
+	// Fraction of the load time hidden behind the caller's work, 1 if the caller never
+	// waited.
+	double overlap() const
+	{
+		if (loadTime.count() == 0)
+			return 1;
+		return 1 - std::min(1.0, static_cast<double>(waitTime.count()) / loadTime.count());
+	}
+};
+
+// Reads batches of batchSize samples from source on a background thread, up to depth - 1
+// batches ahead of the one the caller holds, so that I/O and parsing overlap with training.
+// The default depth of 2 is double buffering. next() returns nullptr once after the last
+// batch of every epoch, and the source is rewound for the next one without waiting for the
+// caller. Exceptions thrown by the source are rethrown by next().
+template <typename Source>
+class BatchPrefetcher
+{
+public:
+	using Batch = typename Source::Batch;
+
+	BatchPrefetcher(Source source, size_t batchSize, size_t depth = 2)
+		: m_source(std::move(source))
+		, m_batchSize(std::max<size_t>(batchSize, 1))
+	{
+		for (size_t ii = 0; ii != std::max<size_t>(depth, 2); ++ii)
+			m_slots.emplace_back(std::make_unique<Slot>(m_batchSize));
+		m_loader = std::thread([this] { loadLoop(); });
+	}
+
+	BatchPrefetcher(const BatchPrefetcher&) = delete;
+
+	BatchPrefetcher& operator=(const BatchPrefetcher&) = delete;
+
+	~BatchPrefetcher()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_changed.notify_all();
+		m_loader.join();
+	}
+
+	// Releases the batch returned by the previous call and returns the next one, which stays
+	// valid until the next call. An error of the source is rethrown by every later call.
+	const Batch* next()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_held)
+		{
+			m_held = false;
+			m_head = (m_head + 1) % m_slots.size();
+			--m_ready;
+			m_changed.notify_all();
+		}
+		if (m_ready == 0)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			m_changed.wait(lock, [this] { return m_ready != 0; });
+			m_stats.waitTime += std::chrono::steady_clock::now() - start;
+		}
+		Slot& slot = *m_slots[m_head];
+		if (slot.error)
+			std::rethrow_exception(slot.error);
+		m_held = true;
+		return slot.endOfEpoch ? nullptr : &slot.batch;
+	}
+
+	size_t batchSize() const { return m_batchSize; }
+
+	PrefetchStats stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+private:
+	struct Slot
+	{
+		explicit Slot(size_t batchSize)
+			: batch(batchSize)
+		{}
+
+		Batch batch;
+		bool endOfEpoch = false;
+		std::exception_ptr error;
+	};
+
+	void loadLoop()
+	{
+		size_t tail = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_changed.wait(lock, [this] {
+					return m_stop || m_ready != m_slots.size();
+				});
+				if (m_stop)
+					return;
+			}
+
+			// The slot at tail is neither ready nor held, so it is only touched here.
+			Slot& slot = *m_slots[tail];
+			const auto start = std::chrono::steady_clock::now();
+			size_t count = 0;
+			try
+			{
+				if (slot.batch.size() != m_batchSize)
+					slot.batch = Batch(m_batchSize);
+				count = m_source.read(slot.batch);
+				slot.endOfEpoch = count == 0;
+				if (slot.endOfEpoch)
+					m_source.rewind();
+			}
+			catch (...)
+			{
+				slot.error = std::current_exception();
+			}
+			const auto loadTime = std::chrono::steady_clock::now() - start;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stats.loadTime += loadTime;
+				m_stats.batchCount += count != 0;
+				m_stats.sampleCount += count;
+				++m_ready;
+			}
+			m_changed.notify_all();
+			if (slot.error)
+				return;
+			tail = (tail + 1) % m_slots.size();
+		}
+	}
+
+	Source m_source;
+	const size_t m_batchSize;
+	std::vector<std::unique_ptr<Slot>> m_slots;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_changed;
+	// m_ready slots starting at m_head are filled, the first of them is held by the caller
+	// while m_held is set.
+	size_t m_head = 0;
+	size_t m_ready = 0;
+	bool m_held = false;
+	bool m_stop = false;
+	PrefetchStats m_stats;
+	std::thread m_loader;
+};
+
+} // namespace nnp
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "simd.h"
+
+namespace nnp {
+
+namespace details {
+
+// A rows x depth matrix cut into tiles of PACKED_ROWS rows and up to TILE_DEPTH steps of
+// depth, for products with column-major operands. A tile is stored depth-major, so the product
+// kernel reads one contiguous vector of rows per step, and the tiles of one depth block follow
+// each other, so the whole matrix streams from memory once per COLUMN_BLOCK columns of the
+// other operand. A tile of floats takes 16 KiB of L1 and a block of the other operand 128 KiB
+// of L2.
+template <typename Float>
+class PackedMatrix
+{
+public:
+	static constexpr size_t TILE_ROWS = simd::PACKED_ROWS;
+	static constexpr size_t TILE_DEPTH = 256;
+	static constexpr size_t COLUMN_BLOCK = 128;
+
+	// Packs the matrix with element (r, k) at data[r * rowStride + k * depthStride], which
+	// reads a row-major matrix or, with the strides swapped, its transpose.
+	void pack(
+		const Float* data,
+		size_t rows,
+		size_t depth,
+		size_t rowStride,
+		size_t depthStride)
+	{
+		m_rows = rows;
+		m_depth = depth;
+		m_tiles.assign(panelCount() * TILE_ROWS * depth, Float{0});
+		Float* tile = m_tiles.data();
+		for (size_t kb = 0; kb < depth; kb += TILE_DEPTH)
+		{
+			const size_t tileDepth = std::min(TILE_DEPTH, depth - kb);
+			for (size_t rb = 0; rb < rows; rb += TILE_ROWS, tile += tileDepth * TILE_ROWS)
+			{
+				const size_t tileRows = std::min(TILE_ROWS, rows - rb);
+				for (size_t kk = 0; kk != tileDepth; ++kk)
+				{
+					const Float* src = data + rb * rowStride + (kb + kk) * depthStride;
+					for (size_t rr = 0; rr != tileRows; ++rr)
+						tile[kk * TILE_ROWS + rr] = src[rr * rowStride];
+				}
+			}
+		}
+	}
+
+	// out = matrix * x for cols columns of depth() elements. out has rows() rows and must not
+	// alias x.
+	void multiply(const Float* x, size_t cols, Float* out) const
+	{
+		const Float* tile = m_tiles.data();
+		for (size_t kb = 0; kb < m_depth; kb += TILE_DEPTH)
+		{
+			const size_t tileDepth = std::min(TILE_DEPTH, m_depth - kb);
+			for (size_t cb = 0; cb < cols; cb += COLUMN_BLOCK)
+			{
+				const size_t blockCols = std::min(COLUMN_BLOCK, cols - cb);
+				const Float* panel = tile;
+				for (size_t rb = 0; rb < m_rows; rb += TILE_ROWS)
+				{
+					simd::packedGemm(
+						panel,
+						x + cb * m_depth + kb,
+						m_depth,
+						out + cb * m_rows + rb,
+						m_rows,
+						tileDepth,
+						std::min(TILE_ROWS, m_rows - rb),
+						blockCols,
+						kb != 0);
+					panel += tileDepth * TILE_ROWS;
+				}
+			}
+			tile += panelCount() * tileDepth * TILE_ROWS;
+		}
+	}
+
+	size_t rows() const { return m_rows; }
+
+	size_t depth() const { return m_depth; }
+
+private:
+	size_t panelCount() const { return (m_rows + TILE_ROWS - 1) / TILE_ROWS; }
+
+	std::vector<Float> m_tiles;
+	size_t m_rows = 0;
+	size_t m_depth = 0;
+};
+
+} // namespace details
+
+} // namespace nnp
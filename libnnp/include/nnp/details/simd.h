@@ -0,0 +1,1518 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define NNP_SIMD_X86 1
+#include <immintrin.h>
+#define NNP_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define NNP_TARGET_AVX512 __attribute__((target("avx512f")))
+#define NNP_TARGET_AVX512_VNNI __attribute__((target("avx512f,avx512bw,avx512vnni")))
+#endif
+
+namespace nnp {
+
+namespace details {
+
+// Element-wise kernels over contiguous ranges. The float overloads dispatch at runtime to
+// AVX-512 or AVX2 implementations when the CPU supports them, every other type uses the
+// scalar templates.
+namespace simd {
+
+enum class Isa
+{
+	SCALAR,
+	AVX2,
+	AVX512
+};
+
+inline Isa detectIsa()
+{
+#ifdef NNP_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return Isa::AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return Isa::AVX2;
+#endif
+	return Isa::SCALAR;
+}
+
+inline Isa& activeIsa()
+{
+	static Isa isa = detectIsa();
+	return isa;
+}
+
+inline Isa isa() { return activeIsa(); }
+
+// 8-bit dot products. Only used on top of Isa::AVX512, so setIsa() lower disables them too.
+inline bool hasVnni()
+{
+#ifdef NNP_SIMD_X86
+	static const bool vnni = [] {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni");
+	}();
+	return vnni;
+#else
+	return false;
+#endif
+}
+
+// Restricts dispatch to isa, or to what the CPU supports if that is lower. Used to compare
+// the kernels against each other.
+inline void setIsa(Isa isa) { activeIsa() = std::min(isa, detectIsa()); }
+
+// Coefficients of one Adam step. decay is added to the gradient as L2 regularization,
+// decoupledDecay shrinks the parameters directly. The corrections are 1 / (1 - beta^t).
+template <typename Float>
+struct AdamStep
+{
+	Float stepSize;
+	Float decay;
+	Float decoupledDecay;
+	Float beta1;
+	Float beta2;
+	Float epsilon;
+	Float meanCorrection;
+	Float varianceCorrection;
+};
+
+// Rows of the tiles read by packedGemm(), one AVX-512 register of floats.
+constexpr size_t PACKED_ROWS = 16;
+
+namespace scalar {
+
+template <typename Float>
+void relu(Float* begin, Float* end)
+{
+	for (; begin != end; ++begin)
+		*begin = std::max(Float{0}, *begin);
+}
+
+template <typename Float>
+void reluBackward(const Float* relu, Float* begin, Float* end)
+{
+	for (; begin != end; ++begin, ++relu)
+		*begin = *relu > Float{0} ? *begin : Float{0};
+}
+
+template <typename Float>
+void sigmoid(Float* begin, Float* end)
+{
+	for (; begin != end; ++begin)
+		*begin = Float{1} / (Float{1} + std::exp(-*begin));
+}
+
+template <typename Float>
+void sigmoidBackward(const Float* sigmoid, Float* begin, Float* end)
+{
+	for (; begin != end; ++begin, ++sigmoid)
+		*begin *= *sigmoid * (Float{1} - *sigmoid);
+}
+
+// Replaces a non-empty range by scale times its softmax and returns its log-sum-exp.
+template <typename Float>
+Float scaledSoftmax(Float* begin, Float* end, Float scale)
+{
+	Float max = *std::max_element(begin, end);
+	Float sum{0};
+	for (Float* it = begin; it != end; ++it)
+	{
+		*it = std::exp(*it - max);
+		sum += *it;
+	}
+	const Float factor = scale / sum;
+	for (Float* it = begin; it != end; ++it)
+		*it *= factor;
+	return max + std::log(sum);
+}
+
+template <typename Float>
+void softmax(Float* begin, Float* end)
+{
+	if (begin != end)
+		scaledSoftmax(begin, end, Float{1});
+}
+
+template <typename Float>
+void sgd(Float* params, const Float* gradient, size_t size, Float stepSize, Float decay)
+{
+	for (size_t ii = 0; ii != size; ++ii)
+		params[ii] -= stepSize * (gradient[ii] + decay * params[ii]);
+}
+
+template <typename Float>
+Float sumSquares(const Float* data, size_t size)
+{
+	Float sum{0};
+	for (size_t ii = 0; ii != size; ++ii)
+		sum += data[ii] * data[ii];
+	return sum;
+}
+
+template <typename Float>
+void momentum(
+	Float* params,
+	const Float* gradient,
+	Float* velocity,
+	size_t size,
+	Float stepSize,
+	Float decay,
+	Float mu)
+{
+	for (size_t ii = 0; ii != size; ++ii)
+	{
+		velocity[ii] = mu * velocity[ii] + gradient[ii] + decay * params[ii];
+		params[ii] -= stepSize * velocity[ii];
+	}
+}
+
+template <typename Float>
+void rmsProp(
+	Float* params,
+	const Float* gradient,
+	Float* meanSquare,
+	size_t size,
+	Float stepSize,
+	Float decay,
+	Float rho,
+	Float epsilon)
+{
+	for (size_t ii = 0; ii != size; ++ii)
+	{
+		Float g = gradient[ii] + decay * params[ii];
+		meanSquare[ii] = rho * meanSquare[ii] + (Float{1} - rho) * g * g;
+		params[ii] -= stepSize * g / (std::sqrt(meanSquare[ii]) + epsilon);
+	}
+}
+
+template <typename Float>
+void adam(
+	Float* params,
+	const Float* gradient,
+	Float* mean,
+	Float* variance,
+	size_t size,
+	const AdamStep<Float>& s)
+{
+	for (size_t ii = 0; ii != size; ++ii)
+	{
+		Float g = gradient[ii] + s.decay * params[ii];
+		mean[ii] = s.beta1 * mean[ii] + (Float{1} - s.beta1) * g;
+		variance[ii] = s.beta2 * variance[ii] + (Float{1} - s.beta2) * g * g;
+		Float update = mean[ii] * s.meanCorrection /
+			(std::sqrt(variance[ii] * s.varianceCorrection) + s.epsilon);
+		params[ii] -= s.stepSize * (update + s.decoupledDecay * params[ii]);
+	}
+}
+
+// y = matrix * x + bias for a row-major rows x cols matrix. y must not alias x. The matrix
+// may be stored in a narrower type than Float, the products are summed in Float.
+template <typename Matrix, typename Float>
+void gemv(
+	const Matrix* matrix,
+	const Float* x,
+	const Float* bias,
+	Float* y,
+	size_t rows,
+	size_t cols)
+{
+	for (size_t rr = 0; rr != rows; ++rr, matrix += cols)
+	{
+		Float sum = bias[rr];
+		for (size_t cc = 0; cc != cols; ++cc)
+			sum += static_cast<Float>(matrix[cc]) * x[cc];
+		y[rr] = sum;
+	}
+}
+
+// out = tile * x, plus out if accumulate, for cols columns. tile holds depth steps of
+// PACKED_ROWS contiguous elements, the columns of x are ldx apart and those of out ldo
+// apart. Only the first rows elements of every column of out are written.
+template <typename Float>
+void packedGemm(
+	const Float* tile,
+	const Float* x,
+	size_t ldx,
+	Float* out,
+	size_t ldo,
+	size_t depth,
+	size_t rows,
+	size_t cols,
+	bool accumulate)
+{
+	for (size_t cc = 0; cc != cols; ++cc, x += ldx, out += ldo)
+	{
+		Float acc[PACKED_ROWS] = {};
+		if (accumulate)
+			std::copy(out, out + rows, acc);
+		for (size_t kk = 0; kk != depth; ++kk)
+			for (size_t rr = 0; rr != PACKED_ROWS; ++rr)
+				acc[rr] += tile[kk * PACKED_ROWS + rr] * x[kk];
+		std::copy(acc, acc + rows, out);
+	}
+}
+
+// y = matrix * x + bias for a row-major rows x cols matrix of signed 8-bit weights and
+// unsigned 8-bit inputs. The products are summed exactly in 32 bits.
+inline void gemvU8S8(
+	const int8_t* matrix,
+	const uint8_t* x,
+	const int32_t* bias,
+	int32_t* y,
+	size_t rows,
+	size_t cols)
+{
+	for (size_t rr = 0; rr != rows; ++rr, matrix += cols)
+	{
+		int32_t sum = bias[rr];
+		for (size_t cc = 0; cc != cols; ++cc)
+			sum += int32_t{matrix[cc]} * int32_t{x[cc]};
+		y[rr] = sum;
+	}
+}
+
+// out = clamp(round(acc * multiplier) + zeroPoint, 0, 255), rounding half to even. With a
+// zero point of 0 the clamp is a ReLU.
+inline void requantize(
+	const int32_t* acc,
+	const float* multiplier,
+	uint8_t* out,
+	size_t size,
+	int32_t zeroPoint)
+{
+	const float offset = static_cast<float>(zeroPoint);
+	for (size_t ii = 0; ii != size; ++ii)
+	{
+		float q = std::nearbyint(static_cast<float>(acc[ii]) * multiplier[ii]) + offset;
+		out[ii] = static_cast<uint8_t>(std::clamp(q, 0.f, 255.f));
+	}
+}
+
+// out = clamp(round(x * scale) + zeroPoint, 0, 255), rounding half to even.
+inline void quantize(const float* x, uint8_t* out, size_t size, float scale, int32_t zeroPoint)
+{
+	const float offset = static_cast<float>(zeroPoint);
+	for (size_t ii = 0; ii != size; ++ii)
+	{
+		float q = std::nearbyint(x[ii] * scale) + offset;
+		out[ii] = static_cast<uint8_t>(std::clamp(q, 0.f, 255.f));
+	}
+}
+
+} // namespace scalar
+
+#ifdef NNP_SIMD_X86
+
+namespace avx2 {
+
+constexpr size_t WIDTH = 8;
+
+// Cephes style range reduction and polynomial. Inputs are clamped to [-87, 88], inside which
+// the relative error stays below 3e-7.
+NNP_TARGET_AVX2 inline __m256 exp(__m256 x)
+{
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.f)), _mm256_set1_ps(88.f));
+	__m256 n = _mm256_round_ps(
+		_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)),
+		_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+	r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+	__m256 p = _mm256_set1_ps(1.9875691500e-4f);
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+	p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.f)));
+	__m256i exponent = _mm256_slli_epi32(
+		_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+}
+
+NNP_TARGET_AVX2 inline float horizontalMax(__m256 v)
+{
+	__m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+	m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+	return _mm_cvtss_f32(m);
+}
+
+NNP_TARGET_AVX2 inline float horizontalSum(__m256 v)
+{
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+NNP_TARGET_AVX2 inline void relu(float* begin, float* end)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	for (; end - begin >= static_cast<ptrdiff_t>(WIDTH); begin += WIDTH)
+		_mm256_storeu_ps(begin, _mm256_max_ps(_mm256_loadu_ps(begin), zero));
+	scalar::relu(begin, end);
+}
+
+NNP_TARGET_AVX2 inline void reluBackward(const float* relu, float* begin, float* end)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	for (; end - begin >= static_cast<ptrdiff_t>(WIDTH); begin += WIDTH, relu += WIDTH)
+	{
+		__m256 mask = _mm256_cmp_ps(_mm256_loadu_ps(relu), zero, _CMP_GT_OQ);
+		_mm256_storeu_ps(begin, _mm256_and_ps(_mm256_loadu_ps(begin), mask));
+	}
+	scalar::reluBackward(relu, begin, end);
+}
+
+NNP_TARGET_AVX2 inline void sigmoid(float* begin, float* end)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	for (; end - begin >= static_cast<ptrdiff_t>(WIDTH); begin += WIDTH)
+	{
+		__m256 e = exp(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(begin)));
+		_mm256_storeu_ps(begin, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+	}
+	scalar::sigmoid(begin, end);
+}
+
+NNP_TARGET_AVX2 inline void sigmoidBackward(const float* sigmoid, float* begin, float* end)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	for (; end - begin >= static_cast<ptrdiff_t>(WIDTH); begin += WIDTH, sigmoid += WIDTH)
+	{
+		__m256 s = _mm256_loadu_ps(sigmoid);
+		__m256 derivative = _mm256_mul_ps(s, _mm256_sub_ps(one, s));
+		_mm256_storeu_ps(begin, _mm256_mul_ps(_mm256_loadu_ps(begin), derivative));
+	}
+	scalar::sigmoidBackward(sigmoid, begin, end);
+}
+
+NNP_TARGET_AVX2 inline float scaledSoftmax(float* begin, float* end, float scale)
+{
+	const size_t size = end - begin;
+	if (size < WIDTH)
+		return scalar::scaledSoftmax(begin, end, scale);
+	const size_t vecEnd = size - size % WIDTH;
+
+	__m256 maxVec = _mm256_loadu_ps(begin);
+	for (size_t ii = WIDTH; ii != vecEnd; ii += WIDTH)
+		maxVec = _mm256_max_ps(maxVec, _mm256_loadu_ps(begin + ii));
+	float max = horizontalMax(maxVec);
+	for (size_t ii = vecEnd; ii != size; ++ii)
+		max = std::max(max, begin[ii]);
+
+	const __m256 maxBroadcast = _mm256_set1_ps(max);
+	__m256 sumVec = _mm256_setzero_ps();
+	for (size_t ii = 0; ii != vecEnd; ii += WIDTH)
+	{
+		__m256 e = exp(_mm256_sub_ps(_mm256_loadu_ps(begin + ii), maxBroadcast));
+		_mm256_storeu_ps(begin + ii, e);
+		sumVec = _mm256_add_ps(sumVec, e);
+	}
+	float sum = horizontalSum(sumVec);
+	for (size_t ii = vecEnd; ii != size; ++ii)
+	{
+		begin[ii] = std::exp(begin[ii] - max);
+		sum += begin[ii];
+	}
+
+	const float factor = scale / sum;
+	const __m256 factorVec = _mm256_set1_ps(factor);
+	for (size_t ii = 0; ii != vecEnd; ii += WIDTH)
+		_mm256_storeu_ps(begin + ii, _mm256_mul_ps(_mm256_loadu_ps(begin + ii), factorVec));
+	for (size_t ii = vecEnd; ii != size; ++ii)
+		begin[ii] *= factor;
+	return max + std::log(sum);
+}
+
+NNP_TARGET_AVX2 inline void softmax(float* begin, float* end)
+{
+	if (begin != end)
+		scaledSoftmax(begin, end, 1.f);
+}
+
+NNP_TARGET_AVX2 inline void sgd(
+	float* params,
+	const float* gradient,
+	size_t size,
+	float stepSize,
+	float decay)
+{
+	const __m256 lr = _mm256_set1_ps(stepSize);
+	const __m256 l2 = _mm256_set1_ps(decay);
+	size_t ii = 0;
+	for (; ii + WIDTH <= size; ii += WIDTH)
+	{
+		__m256 p = _mm256_loadu_ps(params + ii);
+		__m256 g = _mm256_fmadd_ps(l2, p, _mm256_loadu_ps(gradient + ii));
+		_mm256_storeu_ps(params + ii, _mm256_fnmadd_ps(lr, g, p));
+	}
+	scalar::sgd(params + ii, gradient + ii, size - ii, stepSize, decay);
+}
+
+// Four accumulators hide the latency of the FMAs.
+NNP_TARGET_AVX2 inline float sumSquares(const float* data, size_t size)
+{
+	__m256 acc[4];
+	for (auto& a : acc)
+		a = _mm256_setzero_ps();
+	size_t ii = 0;
+	for (; ii + 4 * WIDTH <= size; ii += 4 * WIDTH)
+		for (size_t kk = 0; kk != 4; ++kk)
+		{
+			const __m256 x = _mm256_loadu_ps(data + ii + kk * WIDTH);
+			acc[kk] = _mm256_fmadd_ps(x, x, acc[kk]);
+		}
+	for (; ii + WIDTH <= size; ii += WIDTH)
+	{
+		const __m256 x = _mm256_loadu_ps(data + ii);
+		acc[0] = _mm256_fmadd_ps(x, x, acc[0]);
+	}
+	const __m256 sum =
+		_mm256_add_ps(_mm256_add_ps(acc[0], acc[1]), _mm256_add_ps(acc[2], acc[3]));
+	return horizontalSum(sum) + scalar::sumSquares(data + ii, size - ii);
+}
+
+NNP_TARGET_AVX2 inline void momentum(
+	float* params,
+	const float* gradient,
+	float* velocity,
+	size_t size,
+	float stepSize,
+	float decay,
+	float mu)
+{
+	const __m256 lr = _mm256_set1_ps(stepSize);
+	const __m256 l2 = _mm256_set1_ps(decay);
+	const __m256 m = _mm256_set1_ps(mu);
+	size_t ii = 0;
+	for (; ii + WIDTH <= size; ii += WIDTH)
+	{
+		__m256 p = _mm256_loadu_ps(params + ii);
+		__m256 g = _mm256_fmadd_ps(l2, p, _mm256_loadu_ps(gradient + ii));
+		__m256 v = _mm256_fmadd_ps(m, _mm256_loadu_ps(velocity + ii), g);
+		_mm256_storeu_ps(velocity + ii, v);
+		_mm256_storeu_ps(params + ii, _mm256_fnmadd_ps(lr, v, p));
+	}
+	scalar::momentum(
+		params + ii, gradient + ii, velocity + ii, size - ii, stepSize, decay, mu);
+}
+
+NNP_TARGET_AVX2 inline void rmsProp(
+	float* params,
+	const float* gradient,
+	float* meanSquare,
+	size_t size,
+	float stepSize,
+	float decay,
+	float rho,
+	float epsilon)
+{
+	const __m256 lr = _mm256_set1_ps(stepSize);
+	const __m256 l2 = _mm256_set1_ps(decay);
+	const __m256 r = _mm256_set1_ps(rho);
+	const __m256 oneMinusR = _mm256_set1_ps(1.f - rho);
+	const __m256 eps = _mm256_set1_ps(epsilon);
+	size_t ii = 0;
+	for (; ii + WIDTH <= size; ii += WIDTH)
+	{
+		__m256 p = _mm256_loadu_ps(params + ii);
+		__m256 g = _mm256_fmadd_ps(l2, p, _mm256_loadu_ps(gradient + ii));
+		__m256 square = _mm256_mul_ps(oneMinusR, _mm256_mul_ps(g, g));
+		__m256 s = _mm256_fmadd_ps(r, _mm256_loadu_ps(meanSquare + ii), square);
+		_mm256_storeu_ps(meanSquare + ii, s);
+		__m256 update = _mm256_div_ps(g, _mm256_add_ps(_mm256_sqrt_ps(s), eps));
+		_mm256_storeu_ps(params + ii, _mm256_fnmadd_ps(lr, update, p));
+	}
+	scalar::rmsProp(
+		params + ii, gradient + ii, meanSquare + ii, size - ii, stepSize, decay, rho, epsilon);
+}
+
+NNP_TARGET_AVX2 inline void adam(
+	float* params,
+	const float* gradient,
+	float* mean,
+	float* variance,
+	size_t size,
+	const AdamStep<float>& s)
+{
+	const __m256 lr = _mm256_set1_ps(s.stepSize);
+	const __m256 l2 = _mm256_set1_ps(s.decay);
+	const __m256 wd = _mm256_set1_ps(s.decoupledDecay);
+	const __m256 b1 = _mm256_set1_ps(s.beta1);
+	const __m256 oneMinusB1 = _mm256_set1_ps(1.f - s.beta1);
+	const __m256 b2 = _mm256_set1_ps(s.beta2);
+	const __m256 oneMinusB2 = _mm256_set1_ps(1.f - s.beta2);
+	const __m256 eps = _mm256_set1_ps(s.epsilon);
+	const __m256 c1 = _mm256_set1_ps(s.meanCorrection);
+	const __m256 c2 = _mm256_set1_ps(s.varianceCorrection);
+	size_t ii = 0;
+	for (; ii + WIDTH <= size; ii += WIDTH)
+	{
+		__m256 p = _mm256_loadu_ps(params + ii);
+		__m256 g = _mm256_fmadd_ps(l2, p, _mm256_loadu_ps(gradient + ii));
+		__m256 m =
+			_mm256_fmadd_ps(b1, _mm256_loadu_ps(mean + ii), _mm256_mul_ps(oneMinusB1, g));
+		__m256 square = _mm256_mul_ps(oneMinusB2, _mm256_mul_ps(g, g));
+		__m256 v = _mm256_fmadd_ps(b2, _mm256_loadu_ps(variance + ii), square);
+		_mm256_storeu_ps(mean + ii, m);
+		_mm256_storeu_ps(variance + ii, v);
+		__m256 update = _mm256_div_ps(
+			_mm256_mul_ps(m, c1), _mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(v, c2)), eps));
+		update = _mm256_fmadd_ps(wd, p, update);
+		_mm256_storeu_ps(params + ii, _mm256_fnmadd_ps(lr, update, p));
+	}
+	scalar::adam(params + ii, gradient + ii, mean + ii, variance + ii, size - ii, s);
+}
+
+// Blocks of ROWS rows share each load of x.
+NNP_TARGET_AVX2 inline void gemv(
+	const float* matrix,
+	const float* x,
+	const float* bias,
+	float* y,
+	size_t rows,
+	size_t cols)
+{
+	constexpr size_t ROWS = 4;
+	const size_t vecEnd = cols - cols % WIDTH;
+	size_t rr = 0;
+	for (; rr + ROWS <= rows; rr += ROWS)
+	{
+		const float* row = matrix + rr * cols;
+		__m256 acc[ROWS];
+		for (size_t kk = 0; kk != ROWS; ++kk)
+			acc[kk] = _mm256_setzero_ps();
+		for (size_t cc = 0; cc != vecEnd; cc += WIDTH)
+		{
+			const __m256 xv = _mm256_loadu_ps(x + cc);
+			for (size_t kk = 0; kk != ROWS; ++kk)
+				acc[kk] = _mm256_fmadd_ps(_mm256_loadu_ps(row + kk * cols + cc), xv, acc[kk]);
+		}
+		for (size_t kk = 0; kk != ROWS; ++kk)
+		{
+			float sum = bias[rr + kk] + horizontalSum(acc[kk]);
+			for (size_t cc = vecEnd; cc != cols; ++cc)
+				sum += row[kk * cols + cc] * x[cc];
+			y[rr + kk] = sum;
+		}
+	}
+	for (; rr != rows; ++rr)
+	{
+		const float* row = matrix + rr * cols;
+		__m256 acc = _mm256_setzero_ps();
+		for (size_t cc = 0; cc != vecEnd; cc += WIDTH)
+			acc = _mm256_fmadd_ps(_mm256_loadu_ps(row + cc), _mm256_loadu_ps(x + cc), acc);
+		float sum = bias[rr] + horizontalSum(acc);
+		for (size_t cc = vecEnd; cc != cols; ++cc)
+			sum += row[cc] * x[cc];
+		y[rr] = sum;
+	}
+}
+
+// COLS columns of packedGemm(), each kept in two registers for the whole depth so that every
+// load of the tile is shared by COLS broadcasts of x.
+template <size_t COLS>
+NNP_TARGET_AVX2 inline void packedGemmBlock(
+	const float* tile,
+	const float* x,
+	size_t ldx,
+	float* out,
+	size_t ldo,
+	size_t depth,
+	__m256i lowMask,
+	__m256i highMask,
+	bool accumulate)
+{
+	__m256 low[COLS];
+	__m256 high[COLS];
+	for (size_t cc = 0; cc != COLS; ++cc)
+	{
+		low[cc] = _mm256_setzero_ps();
+		high[cc] = _mm256_setzero_ps();
+		if (accumulate)
+		{
+			low[cc] = _mm256_maskload_ps(out + cc * ldo, lowMask);
+			high[cc] = _mm256_maskload_ps(out + cc * ldo + WIDTH, highMask);
+		}
+	}
+	for (size_t kk = 0; kk != depth; ++kk)
+	{
+		const __m256 lowTile = _mm256_loadu_ps(tile + kk * PACKED_ROWS);
+		const __m256 highTile = _mm256_loadu_ps(tile + kk * PACKED_ROWS + WIDTH);
+		for (size_t cc = 0; cc != COLS; ++cc)
+		{
+			const __m256 xv = _mm256_broadcast_ss(x + cc * ldx + kk);
+			low[cc] = _mm256_fmadd_ps(lowTile, xv, low[cc]);
+			high[cc] = _mm256_fmadd_ps(highTile, xv, high[cc]);
+		}
+	}
+	for (size_t cc = 0; cc != COLS; ++cc)
+	{
+		_mm256_maskstore_ps(out + cc * ldo, lowMask, low[cc]);
+		_mm256_maskstore_ps(out + cc * ldo + WIDTH, highMask, high[cc]);
+	}
+}
+
+// Lanes below count set.
+NNP_TARGET_AVX2 inline __m256i laneMask(size_t count)
+{
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	return _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(count)), lanes);
+}
+
+// Blocks of six columns take 12 of the 16 registers as accumulators.
+NNP_TARGET_AVX2 inline void packedGemm(
+	const float* tile,
+	const float* x,
+	size_t ldx,
+	float* out,
+	size_t ldo,
+	size_t depth,
+	size_t rows,
+	size_t cols,
+	bool accumulate)
+{
+	constexpr size_t COLS = 6;
+	const __m256i lowMask = laneMask(rows);
+	const __m256i highMask = laneMask(rows > WIDTH ? rows - WIDTH : 0);
+	size_t cc = 0;
+	for (; cc + COLS <= cols; cc += COLS)
+		packedGemmBlock<COLS>(
+			tile, x + cc * ldx, ldx, out + cc * ldo, ldo, depth, lowMask, highMask,
+			accumulate);
+	for (; cc != cols; ++cc)
+		packedGemmBlock<1>(
+			tile, x + cc * ldx, ldx, out + cc * ldo, ldo, depth, lowMask, highMask,
+			accumulate);
+}
+
+NNP_TARGET_AVX2 inline int32_t horizontalSum(__m256i v)
+{
+	__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sum);
+}
+
+// Both operands are widened to 16 bits, so _mm256_madd_epi16 cannot saturate the way
+// _mm256_maddubs_epi16 would. Blocks of ROWS rows share each load of x.
+NNP_TARGET_AVX2 inline void gemvU8S8(
+	const int8_t* matrix,
+	const uint8_t* x,
+	const int32_t* bias,
+	int32_t* y,
+	size_t rows,
+	size_t cols)
+{
+	constexpr size_t ROWS = 4;
+	constexpr size_t BYTES = 16;
+	const size_t vecEnd = cols - cols % BYTES;
+	auto load = [](const void* p) {
+		return _mm_loadu_si128(static_cast<const __m128i*>(p));
+	};
+	const size_t blockEnd = rows - rows % ROWS;
+	size_t rr = 0;
+	for (; rr != blockEnd; rr += ROWS)
+	{
+		const int8_t* row = matrix + rr * cols;
+		__m256i acc[ROWS];
+		for (size_t kk = 0; kk != ROWS; ++kk)
+			acc[kk] = _mm256_setzero_si256();
+		for (size_t cc = 0; cc != vecEnd; cc += BYTES)
+		{
+			const __m256i xv = _mm256_cvtepu8_epi16(load(x + cc));
+			for (size_t kk = 0; kk != ROWS; ++kk)
+			{
+				__m256i wv = _mm256_cvtepi8_epi16(load(row + kk * cols + cc));
+				acc[kk] = _mm256_add_epi32(acc[kk], _mm256_madd_epi16(xv, wv));
+			}
+		}
+		for (size_t kk = 0; kk != ROWS; ++kk)
+		{
+			int32_t sum = bias[rr + kk] + horizontalSum(acc[kk]);
+			scalar::gemvU8S8(
+				row + kk * cols + vecEnd, x + vecEnd, &sum, y + rr + kk, 1, cols - vecEnd);
+		}
+	}
+	for (; rr != rows; ++rr)
+	{
+		const int8_t* row = matrix + rr * cols;
+		__m256i acc = _mm256_setzero_si256();
+		for (size_t cc = 0; cc != vecEnd; cc += BYTES)
+			acc = _mm256_add_epi32(
+				acc,
+				_mm256_madd_epi16(
+					_mm256_cvtepu8_epi16(load(x + cc)), _mm256_cvtepi8_epi16(load(row + cc))));
+		int32_t sum = bias[rr] + horizontalSum(acc);
+		scalar::gemvU8S8(row + vecEnd, x + vecEnd, &sum, y + rr, 1, cols - vecEnd);
+	}
+}
+
+// Rounds and clamps in float, so out of range values saturate exactly as in scalar.
+NNP_TARGET_AVX2 inline void requantize(
+	const int32_t* acc,
+	const float* multiplier,
+	uint8_t* out,
+	size_t size,
+	int32_t zeroPoint)
+{
+	const __m256 offset = _mm256_set1_ps(static_cast<float>(zeroPoint));
+	const __m256 low = _mm256_setzero_ps();
+	const __m256 high = _mm256_set1_ps(255.f);
+	// Gathers byte 0 of each 32-bit lane of both halves into the low 8 bytes.
+	const __m256i gather = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+	size_t ii = 0;
+	for (; ii + WIDTH <= size; ii += WIDTH)
+	{
+		__m256 q = _mm256_cvtepi32_ps(
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + ii)));
+		q = _mm256_round_ps(
+			_mm256_mul_ps(q, _mm256_loadu_ps(multiplier + ii)),
+			_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		q = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(q, offset), low), high);
+		__m256i words = _mm256_packs_epi32(_mm256_cvttps_epi32(q), _mm256_setzero_si256());
+		__m256i bytes = _mm256_packus_epi16(words, _mm256_setzero_si256());
+		bytes = _mm256_permutevar8x32_epi32(bytes, gather);
+		_mm_storel_epi64(
+			reinterpret_cast<__m128i*>(out + ii), _mm256_castsi256_si128(bytes));
+	}
+	scalar::requantize(acc + ii, multiplier + ii, out + ii, size - ii, zeroPoint);
+}
+
+} // namespace avx2
+
+// GCC 12 reports the _mm512_undefined_ps() placeholders inside its own AVX-512 intrinsics as
+// uninitialized.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+namespace avx512 {
+
+constexpr size_t WIDTH = 16;
+
+// Same approximation as avx2::exp.
+NNP_TARGET_AVX512 inline __m512 exp(__m512 x)
+{
+	x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-87.f)), _mm512_set1_ps(88.f));
+	__m512 n = _mm512_roundscale_ps(
+		_mm512_mul_ps(x, _mm512_set1_ps(1.44269504088896341f)),
+		_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(0.693359375f), x);
+	r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-2.12194440e-4f), r);
+	__m512 p = _mm512_set1_ps(1.9875691500e-4f);
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.3981999507e-3f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(8.3334519073e-3f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(4.1665795894e-2f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.6666665459e-1f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(5.0000001201e-1f));
+	p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.f)));
+	__m512i exponent = _mm512_slli_epi32(
+		_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23);
+	return _mm512_mul_ps(p, _mm512_castsi512_ps(exponent));
+}
+
+NNP_TARGET_AVX512 inline float horizontalMax(__m512 v)
+{
+	alignas(64) float lanes[WIDTH];
+	_mm512_store_ps(lanes, v);
+	return *std::max_element(lanes, lanes + WIDTH);
+}
+
+NNP_TARGET_AVX512 inline float horizontalSum(__m512 v)
+{
+	alignas(64) float lanes[WIDTH];
+	_mm512_store_ps(lanes, v);
+	float sum = 0.f;
+	for (float lane : lanes)
+		sum += lane;
+	return sum;
+}
+
+NNP_TARGET_AVX512 inline void relu(float* begin, float* end)
+{
+	const __m512 zero = _mm512_setzero_ps();
+	for (; end - begin >= static_cast<ptrdiff_t>(WIDTH); begin += WIDTH)
+		_mm512_storeu_ps(begin, _mm512_max_ps(_mm512_loadu_ps(begin), zero));
+	scalar::relu(begin, end);
+}
+
+NNP_TARGET_AVX512 inline void reluBackward(const float* relu, float* begin, float* end)
+{
+	const __m512 zero = _mm512_setzero_ps();
+	for (; end - begin >= static_cast<ptrdiff_t>(WIDTH); begin += WIDTH, relu += WIDTH)
+	{
+		__mmask16 mask = _mm512_cmp_ps_mask(_mm512_loadu_ps(relu), zero, _CMP_GT_OQ);
+		_mm512_storeu_ps(begin, _mm512_maskz_mov_ps(mask, _mm512_loadu_ps(begin)));
+	}
+	scalar::reluBackward(relu, begin, end);
+}
+
+NNP_TARGET_AVX512 inline void sigmoid(float* begin, float* end)
+{
+	const __m512 one = _mm512_set1_ps(1.f);
+	for (; end - begin >= static_cast<ptrdiff_t>(WIDTH); begin += WIDTH)
+	{
+		__m512 e = exp(_mm512_sub_ps(_mm512_setzero_ps(), _mm512_loadu_ps(begin)));
+		_mm512_storeu_ps(begin, _mm512_div_ps(one, _mm512_add_ps(one, e)));
+	}
+	scalar::sigmoid(begin, end);
+}
+
+NNP_TARGET_AVX512 inline void sigmoidBackward(const float* sigmoid, float* begin, float* end)
+{
+	const __m512 one = _mm512_set1_ps(1.f);
+	for (; end - begin >= static_cast<ptrdiff_t>(WIDTH); begin += WIDTH, sigmoid += WIDTH)
+	{
+		__m512 s = _mm512_loadu_ps(sigmoid);
+		__m512 derivative = _mm512_mul_ps(s, _mm512_sub_ps(one, s));
+		_mm512_storeu_ps(begin, _mm512_mul_ps(_mm512_loadu_ps(begin), derivative));
+	}
+	scalar::sigmoidBackward(sigmoid, begin, end);
+}
+
+NNP_TARGET_AVX512 inline float scaledSoftmax(float* begin, float* end, float scale)
+{
+	const size_t size = end - begin;
+	if (size < WIDTH)
+		return avx2::scaledSoftmax(begin, end, scale);
+	const size_t vecEnd = size - size % WIDTH;
+
+	__m512 maxVec = _mm512_loadu_ps(begin);
+	for (size_t ii = WIDTH; ii != vecEnd; ii += WIDTH)
+		maxVec = _mm512_max_ps(maxVec, _mm512_loadu_ps(begin + ii));
+	float max = horizontalMax(maxVec);
+	for (size_t ii = vecEnd; ii != size; ++ii)
+		max = std::max(max, begin[ii]);
+
+	const __m512 maxBroadcast = _mm512_set1_ps(max);
+	__m512 sumVec = _mm512_setzero_ps();
+	for (size_t ii = 0; ii != vecEnd; ii += WIDTH)
+	{
+		__m512 e = exp(_mm512_sub_ps(_mm512_loadu_ps(begin + ii), maxBroadcast));
+		_mm512_storeu_ps(begin + ii, e);
+		sumVec = _mm512_add_ps(sumVec, e);
+	}
+	float sum = horizontalSum(sumVec);
+	for (size_t ii = vecEnd; ii != size; ++ii)
+	{
+		begin[ii] = std::exp(begin[ii] - max);
+		sum += begin[ii];
+	}
+
+	const float factor = scale / sum;
+	const __m512 factorVec = _mm512_set1_ps(factor);
+	for (size_t ii = 0; ii != vecEnd; ii += WIDTH)
+		_mm512_storeu_ps(begin + ii, _mm512_mul_ps(_mm512_loadu_ps(begin + ii), factorVec));
+	for (size_t ii = vecEnd; ii != size; ++ii)
+		begin[ii] *= factor;
+	return max + std::log(sum);
+}
+
+NNP_TARGET_AVX512 inline void softmax(float* begin, float* end)
+{
+	if (begin != end)
+		scaledSoftmax(begin, end, 1.f);
+}
+
+NNP_TARGET_AVX512 inline void sgd(
+	float* params,
+	const float* gradient,
+	size_t size,
+	float stepSize,
+	float decay)
+{
+	const __m512 lr = _mm512_set1_ps(stepSize);
+	const __m512 l2 = _mm512_set1_ps(decay);
+	size_t ii = 0;
+	for (; ii + WIDTH <= size; ii += WIDTH)
+	{
+		__m512 p = _mm512_loadu_ps(params + ii);
+		__m512 g = _mm512_fmadd_ps(l2, p, _mm512_loadu_ps(gradient + ii));
+		_mm512_storeu_ps(params + ii, _mm512_fnmadd_ps(lr, g, p));
+	}
+	scalar::sgd(params + ii, gradient + ii, size - ii, stepSize, decay);
+}
+
+NNP_TARGET_AVX512 inline float sumSquares(const float* data, size_t size)
+{
+	__m512 acc[4];
+	for (auto& a : acc)
+		a = _mm512_setzero_ps();
+	size_t ii = 0;
+	for (; ii + 4 * WIDTH <= size; ii += 4 * WIDTH)
+		for (size_t kk = 0; kk != 4; ++kk)
+		{
+			const __m512 x = _mm512_loadu_ps(data + ii + kk * WIDTH);
+			acc[kk] = _mm512_fmadd_ps(x, x, acc[kk]);
+		}
+	for (; ii + WIDTH <= size; ii += WIDTH)
+	{
+		const __m512 x = _mm512_loadu_ps(data + ii);
+		acc[0] = _mm512_fmadd_ps(x, x, acc[0]);
+	}
+	const __m512 sum =
+		_mm512_add_ps(_mm512_add_ps(acc[0], acc[1]), _mm512_add_ps(acc[2], acc[3]));
+	return horizontalSum(sum) + scalar::sumSquares(data + ii, size - ii);
+}
+
+NNP_TARGET_AVX512 inline void momentum(
+	float* params,
+	const float* gradient,
+	float* velocity,
+	size_t size,
+	float stepSize,
+	float decay,
+	float mu)
+{
+	const __m512 lr = _mm512_set1_ps(stepSize);
+	const __m512 l2 = _mm512_set1_ps(decay);
+	const __m512 m = _mm512_set1_ps(mu);
+	size_t ii = 0;
+	for (; ii + WIDTH <= size; ii += WIDTH)
+	{
+		__m512 p = _mm512_loadu_ps(params + ii);
+		__m512 g = _mm512_fmadd_ps(l2, p, _mm512_loadu_ps(gradient + ii));
+		__m512 v = _mm512_fmadd_ps(m, _mm512_loadu_ps(velocity + ii), g);
+		_mm512_storeu_ps(velocity + ii, v);
+		_mm512_storeu_ps(params + ii, _mm512_fnmadd_ps(lr, v, p));
+	}
+	scalar::momentum(
+		params + ii, gradient + ii, velocity + ii, size - ii, stepSize, decay, mu);
+}
+
+NNP_TARGET_AVX512 inline void rmsProp(
+	float* params,
+	const float* gradient,
+	float* meanSquare,
+	size_t size,
+	float stepSize,
+	float decay,
+	float rho,
+	float epsilon)
+{
+	const __m512 lr = _mm512_set1_ps(stepSize);
+	const __m512 l2 = _mm512_set1_ps(decay);
+	const __m512 r = _mm512_set1_ps(rho);
+	const __m512 oneMinusR = _mm512_set1_ps(1.f - rho);
+	const __m512 eps = _mm512_set1_ps(epsilon);
+	size_t ii = 0;
+	for (; ii + WIDTH <= size; ii += WIDTH)
+	{
+		__m512 p = _mm512_loadu_ps(params + ii);
+		__m512 g = _mm512_fmadd_ps(l2, p, _mm512_loadu_ps(gradient + ii));
+		__m512 square = _mm512_mul_ps(oneMinusR, _mm512_mul_ps(g, g));
+		__m512 s = _mm512_fmadd_ps(r, _mm512_loadu_ps(meanSquare + ii), square);
+		_mm512_storeu_ps(meanSquare + ii, s);
+		__m512 update = _mm512_div_ps(g, _mm512_add_ps(_mm512_sqrt_ps(s), eps));
+		_mm512_storeu_ps(params + ii, _mm512_fnmadd_ps(lr, update, p));
+	}
+	scalar::rmsProp(
+		params + ii, gradient + ii, meanSquare + ii, size - ii, stepSize, decay, rho, epsilon);
+}
+
+NNP_TARGET_AVX512 inline void adam(
+	float* params,
+	const float* gradient,
+	float* mean,
+	float* variance,
+	size_t size,
+	const AdamStep<float>& s)
+{
+	const __m512 lr = _mm512_set1_ps(s.stepSize);
+	const __m512 l2 = _mm512_set1_ps(s.decay);
+	const __m512 wd = _mm512_set1_ps(s.decoupledDecay);
+	const __m512 b1 = _mm512_set1_ps(s.beta1);
+	const __m512 oneMinusB1 = _mm512_set1_ps(1.f - s.beta1);
+	const __m512 b2 = _mm512_set1_ps(s.beta2);
+	const __m512 oneMinusB2 = _mm512_set1_ps(1.f - s.beta2);
+	const __m512 eps = _mm512_set1_ps(s.epsilon);
+	const __m512 c1 = _mm512_set1_ps(s.meanCorrection);
+	const __m512 c2 = _mm512_set1_ps(s.varianceCorrection);
+	size_t ii = 0;
+	for (; ii + WIDTH <= size; ii += WIDTH)
+	{
+		__m512 p = _mm512_loadu_ps(params + ii);
+		__m512 g = _mm512_fmadd_ps(l2, p, _mm512_loadu_ps(gradient + ii));
+		__m512 m =
+			_mm512_fmadd_ps(b1, _mm512_loadu_ps(mean + ii), _mm512_mul_ps(oneMinusB1, g));
+		__m512 square = _mm512_mul_ps(oneMinusB2, _mm512_mul_ps(g, g));
+		__m512 v = _mm512_fmadd_ps(b2, _mm512_loadu_ps(variance + ii), square);
+		_mm512_storeu_ps(mean + ii, m);
+		_mm512_storeu_ps(variance + ii, v);
+		__m512 update = _mm512_div_ps(
+			_mm512_mul_ps(m, c1), _mm512_add_ps(_mm512_sqrt_ps(_mm512_mul_ps(v, c2)), eps));
+		update = _mm512_fmadd_ps(wd, p, update);
+		_mm512_storeu_ps(params + ii, _mm512_fnmadd_ps(lr, update, p));
+	}
+	scalar::adam(params + ii, gradient + ii, mean + ii, variance + ii, size - ii, s);
+}
+
+// Blocks of ROWS rows share each load of x.
+NNP_TARGET_AVX512 inline void gemv(
+	const float* matrix,
+	const float* x,
+	const float* bias,
+	float* y,
+	size_t rows,
+	size_t cols)
+{
+	constexpr size_t ROWS = 4;
+	const size_t vecEnd = cols - cols % WIDTH;
+	size_t rr = 0;
+	for (; rr + ROWS <= rows; rr += ROWS)
+	{
+		const float* row = matrix + rr * cols;
+		__m512 acc[ROWS];
+		for (size_t kk = 0; kk != ROWS; ++kk)
+			acc[kk] = _mm512_setzero_ps();
+		for (size_t cc = 0; cc != vecEnd; cc += WIDTH)
+		{
+			const __m512 xv = _mm512_loadu_ps(x + cc);
+			for (size_t kk = 0; kk != ROWS; ++kk)
+				acc[kk] = _mm512_fmadd_ps(_mm512_loadu_ps(row + kk * cols + cc), xv, acc[kk]);
+		}
+		for (size_t kk = 0; kk != ROWS; ++kk)
+		{
+			float sum = bias[rr + kk] + horizontalSum(acc[kk]);
+			for (size_t cc = vecEnd; cc != cols; ++cc)
+				sum += row[kk * cols + cc] * x[cc];
+			y[rr + kk] = sum;
+		}
+	}
+	for (; rr != rows; ++rr)
+	{
+		const float* row = matrix + rr * cols;
+		__m512 acc = _mm512_setzero_ps();
+		for (size_t cc = 0; cc != vecEnd; cc += WIDTH)
+			acc = _mm512_fmadd_ps(_mm512_loadu_ps(row + cc), _mm512_loadu_ps(x + cc), acc);
+		float sum = bias[rr] + horizontalSum(acc);
+		for (size_t cc = vecEnd; cc != cols; ++cc)
+			sum += row[cc] * x[cc];
+		y[rr] = sum;
+	}
+}
+
+// COLS columns of packedGemm(), each kept in one register for the whole depth so that every
+// load of the tile is shared by COLS broadcasts of x.
+template <size_t COLS>
+NNP_TARGET_AVX512 inline void packedGemmBlock(
+	const float* tile,
+	const float* x,
+	size_t ldx,
+	float* out,
+	size_t ldo,
+	size_t depth,
+	__mmask16 mask,
+	bool accumulate)
+{
+	__m512 acc[COLS];
+	for (size_t cc = 0; cc != COLS; ++cc)
+		acc[cc] =
+			accumulate ? _mm512_maskz_loadu_ps(mask, out + cc * ldo) : _mm512_setzero_ps();
+	for (size_t kk = 0; kk != depth; ++kk)
+	{
+		const __m512 tileRow = _mm512_loadu_ps(tile + kk * PACKED_ROWS);
+		for (size_t cc = 0; cc != COLS; ++cc)
+			acc[cc] = _mm512_fmadd_ps(tileRow, _mm512_set1_ps(x[cc * ldx + kk]), acc[cc]);
+	}
+	for (size_t cc = 0; cc != COLS; ++cc)
+		_mm512_mask_storeu_ps(out + cc * ldo, mask, acc[cc]);
+}
+
+// Blocks of twelve columns leave registers free for the tile and the broadcasts.
+NNP_TARGET_AVX512 inline void packedGemm(
+	const float* tile,
+	const float* x,
+	size_t ldx,
+	float* out,
+	size_t ldo,
+	size_t depth,
+	size_t rows,
+	size_t cols,
+	bool accumulate)
+{
+	constexpr size_t COLS = 12;
+	const __mmask16 mask = static_cast<__mmask16>((1u << rows) - 1);
+	size_t cc = 0;
+	for (; cc + COLS <= cols; cc += COLS)
+		packedGemmBlock<COLS>(
+			tile, x + cc * ldx, ldx, out + cc * ldo, ldo, depth, mask, accumulate);
+	for (; cc + 4 <= cols; cc += 4)
+		packedGemmBlock<4>(
+			tile, x + cc * ldx, ldx, out + cc * ldo, ldo, depth, mask, accumulate);
+	for (; cc != cols; ++cc)
+		packedGemmBlock<1>(
+			tile, x + cc * ldx, ldx, out + cc * ldo, ldo, depth, mask, accumulate);
+}
+
+// _mm512_dpbusd_epi32 multiplies unsigned by signed bytes and adds groups of four products
+// to 32-bit lanes without saturation. Row tails use masked loads. Blocks of ROWS rows share
+// each load of x.
+NNP_TARGET_AVX512_VNNI inline void gemvU8S8(
+	const int8_t* matrix,
+	const uint8_t* x,
+	const int32_t* bias,
+	int32_t* y,
+	size_t rows,
+	size_t cols)
+{
+	constexpr size_t ROWS = 4;
+	constexpr size_t BYTES = 64;
+	const size_t vecEnd = cols - cols % BYTES;
+	const __mmask64 tailMask = (__mmask64{1} << (cols - vecEnd)) - 1;
+	const size_t blockEnd = rows - rows % ROWS;
+	size_t rr = 0;
+	for (; rr != blockEnd; rr += ROWS)
+	{
+		const int8_t* row = matrix + rr * cols;
+		__m512i acc[ROWS];
+		for (size_t kk = 0; kk != ROWS; ++kk)
+			acc[kk] = _mm512_setzero_si512();
+		for (size_t cc = 0; cc != vecEnd; cc += BYTES)
+		{
+			const __m512i xv = _mm512_loadu_si512(x + cc);
+			for (size_t kk = 0; kk != ROWS; ++kk)
+				acc[kk] =
+					_mm512_dpbusd_epi32(acc[kk], xv, _mm512_loadu_si512(row + kk * cols + cc));
+		}
+		if (tailMask)
+		{
+			const __m512i xv = _mm512_maskz_loadu_epi8(tailMask, x + vecEnd);
+			for (size_t kk = 0; kk != ROWS; ++kk)
+				acc[kk] = _mm512_dpbusd_epi32(
+					acc[kk], xv, _mm512_maskz_loadu_epi8(tailMask, row + kk * cols + vecEnd));
+		}
+		for (size_t kk = 0; kk != ROWS; ++kk)
+			y[rr + kk] = bias[rr + kk] + _mm512_reduce_add_epi32(acc[kk]);
+	}
+	for (; rr != rows; ++rr)
+	{
+		const int8_t* row = matrix + rr * cols;
+		__m512i acc = _mm512_setzero_si512();
+		for (size_t cc = 0; cc != vecEnd; cc += BYTES)
+			acc = _mm512_dpbusd_epi32(
+				acc, _mm512_loadu_si512(x + cc), _mm512_loadu_si512(row + cc));
+		acc = _mm512_dpbusd_epi32(
+			acc,
+			_mm512_maskz_loadu_epi8(tailMask, x + vecEnd),
+			_mm512_maskz_loadu_epi8(tailMask, row + vecEnd));
+		y[rr] = bias[rr] + _mm512_reduce_add_epi32(acc);
+	}
+}
+
+// Same rounding and clamping as avx2::requantize.
+NNP_TARGET_AVX512 inline void requantize(
+	const int32_t* acc,
+	const float* multiplier,
+	uint8_t* out,
+	size_t size,
+	int32_t zeroPoint)
+{
+	const __m512 offset = _mm512_set1_ps(static_cast<float>(zeroPoint));
+	const __m512 low = _mm512_setzero_ps();
+	const __m512 high = _mm512_set1_ps(255.f);
+	size_t ii = 0;
+	for (; ii + WIDTH <= size; ii += WIDTH)
+	{
+		__m512 q = _mm512_cvtepi32_ps(_mm512_loadu_si512(acc + ii));
+		q = _mm512_roundscale_ps(
+			_mm512_mul_ps(q, _mm512_loadu_ps(multiplier + ii)),
+			_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		q = _mm512_min_ps(_mm512_max_ps(_mm512_add_ps(q, offset), low), high);
+		__m128i bytes = _mm512_cvtepi32_epi8(_mm512_cvttps_epi32(q));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + ii), bytes);
+	}
+	scalar::requantize(acc + ii, multiplier + ii, out + ii, size - ii, zeroPoint);
+}
+
+} // namespace avx512
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#define NNP_SIMD_DISPATCH(KERNEL, ...) \
+	switch (isa()) \
+	{ \
+		case Isa::AVX512: \
+			return avx512::KERNEL(__VA_ARGS__); \
+		case Isa::AVX2: \
+			return avx2::KERNEL(__VA_ARGS__); \
+		default: \
+			return scalar::KERNEL(__VA_ARGS__); \
+	}
+
+#else
+
+#define NNP_SIMD_DISPATCH(KERNEL, ...) return scalar::KERNEL(__VA_ARGS__);
+
+#endif
+
+template <typename Float>
+void relu(Float* begin, Float* end)
+{
+	scalar::relu(begin, end);
+}
+
+inline void relu(float* begin, float* end) { NNP_SIMD_DISPATCH(relu, begin, end) }
+
+template <typename Float>
+void reluBackward(const Float* relu, Float* begin, Float* end)
+{
+	scalar::reluBackward(relu, begin, end);
+}
+
+inline void reluBackward(const float* relu, float* begin, float* end)
+{
+	NNP_SIMD_DISPATCH(reluBackward, relu, begin, end)
+}
+
+template <typename Float>
+void sigmoid(Float* begin, Float* end)
+{
+	scalar::sigmoid(begin, end);
+}
+
+inline void sigmoid(float* begin, float* end) { NNP_SIMD_DISPATCH(sigmoid, begin, end) }
+
+template <typename Float>
+void sigmoidBackward(const Float* sigmoid, Float* begin, Float* end)
+{
+	scalar::sigmoidBackward(sigmoid, begin, end);
+}
+
+inline void sigmoidBackward(const float* sigmoid, float* begin, float* end)
+{
+	NNP_SIMD_DISPATCH(sigmoidBackward, sigmoid, begin, end)
+}
+
+template <typename Float>
+void softmax(Float* begin, Float* end)
+{
+	scalar::softmax(begin, end);
+}
+
+inline void softmax(float* begin, float* end) { NNP_SIMD_DISPATCH(softmax, begin, end) }
+
+template <typename Float>
+Float scaledSoftmax(Float* begin, Float* end, Float scale)
+{
+	return scalar::scaledSoftmax(begin, end, scale);
+}
+
+inline float scaledSoftmax(float* begin, float* end, float scale)
+{
+	NNP_SIMD_DISPATCH(scaledSoftmax, begin, end, scale)
+}
+
+// Replaces a column of logits by scale times the gradient of its cross-entropy with label,
+// softmax minus the one-hot label, and returns the cross-entropy. It is computed as the
+// log-sum-exp minus the logit of the label, which stays finite when the probability of the
+// label underflows.
+template <typename Float>
+Float softmaxCrossEntropy(Float* begin, Float* end, size_t label, Float scale)
+{
+	const Float logit = begin[label];
+	const Float logSumExp = scaledSoftmax(begin, end, scale);
+	begin[label] -= scale;
+	return logSumExp - logit;
+}
+
+template <typename Float>
+void sgd(Float* params, const Float* gradient, size_t size, Float stepSize, Float decay)
+{
+	scalar::sgd(params, gradient, size, stepSize, decay);
+}
+
+inline void sgd(float* params, const float* gradient, size_t size, float stepSize, float decay)
+{
+	NNP_SIMD_DISPATCH(sgd, params, gradient, size, stepSize, decay)
+}
+
+template <typename Float>
+Float sumSquares(const Float* data, size_t size)
+{
+	return scalar::sumSquares(data, size);
+}
+
+inline float sumSquares(const float* data, size_t size)
+{
+	NNP_SIMD_DISPATCH(sumSquares, data, size)
+}
+
+template <typename Float>
+void momentum(
+	Float* params,
+	const Float* gradient,
+	Float* velocity,
+	size_t size,
+	Float stepSize,
+	Float decay,
+	Float mu)
+{
+	scalar::momentum(params, gradient, velocity, size, stepSize, decay, mu);
+}
+
+inline void momentum(
+	float* params,
+	const float* gradient,
+	float* velocity,
+	size_t size,
+	float stepSize,
+	float decay,
+	float mu)
+{
+	NNP_SIMD_DISPATCH(momentum, params, gradient, velocity, size, stepSize, decay, mu)
+}
+
+template <typename Float>
+void rmsProp(
+	Float* params,
+	const Float* gradient,
+	Float* meanSquare,
+	size_t size,
+	Float stepSize,
+	Float decay,
+	Float rho,
+	Float epsilon)
+{
+	scalar::rmsProp(params, gradient, meanSquare, size, stepSize, decay, rho, epsilon);
+}
+
+inline void rmsProp(
+	float* params,
+	const float* gradient,
+	float* meanSquare,
+	size_t size,
+	float stepSize,
+	float decay,
+	float rho,
+	float epsilon)
+{
+	NNP_SIMD_DISPATCH(
+		rmsProp, params, gradient, meanSquare, size, stepSize, decay, rho, epsilon)
+}
+
+template <typename Float>
+void adam(
+	Float* params,
+	const Float* gradient,
+	Float* mean,
+	Float* variance,
+	size_t size,
+	const AdamStep<Float>& step)
+{
+	scalar::adam(params, gradient, mean, variance, size, step);
+}
+
+inline void adam(
+	float* params,
+	const float* gradient,
+	float* mean,
+	float* variance,
+	size_t size,
+	const AdamStep<float>& step)
+{
+	NNP_SIMD_DISPATCH(adam, params, gradient, mean, variance, size, step)
+}
+
+template <typename Matrix, typename Float>
+void gemv(
+	const Matrix* matrix,
+	const Float* x,
+	const Float* bias,
+	Float* y,
+	size_t rows,
+	size_t cols)
+{
+	scalar::gemv(matrix, x, bias, y, rows, cols);
+}
+
+inline void gemv(
+	const float* matrix,
+	const float* x,
+	const float* bias,
+	float* y,
+	size_t rows,
+	size_t cols)
+{
+	NNP_SIMD_DISPATCH(gemv, matrix, x, bias, y, rows, cols)
+}
+
+template <typename Float>
+void packedGemm(
+	const Float* tile,
+	const Float* x,
+	size_t ldx,
+	Float* out,
+	size_t ldo,
+	size_t depth,
+	size_t rows,
+	size_t cols,
+	bool accumulate)
+{
+	scalar::packedGemm(tile, x, ldx, out, ldo, depth, rows, cols, accumulate);
+}
+
+inline void packedGemm(
+	const float* tile,
+	const float* x,
+	size_t ldx,
+	float* out,
+	size_t ldo,
+	size_t depth,
+	size_t rows,
+	size_t cols,
+	bool accumulate)
+{
+	NNP_SIMD_DISPATCH(packedGemm, tile, x, ldx, out, ldo, depth, rows, cols, accumulate)
+}
+
+inline void gemvU8S8(
+	const int8_t* matrix,
+	const uint8_t* x,
+	const int32_t* bias,
+	int32_t* y,
+	size_t rows,
+	size_t cols)
+{
+#ifdef NNP_SIMD_X86
+	if (isa() == Isa::AVX512 && hasVnni())
+		return avx512::gemvU8S8(matrix, x, bias, y, rows, cols);
+	if (isa() != Isa::SCALAR)
+		return avx2::gemvU8S8(matrix, x, bias, y, rows, cols);
+#endif
+	scalar::gemvU8S8(matrix, x, bias, y, rows, cols);
+}
+
+inline void requantize(
+	const int32_t* acc,
+	const float* multiplier,
+	uint8_t* out,
+	size_t size,
+	int32_t zeroPoint)
+{
+	NNP_SIMD_DISPATCH(requantize, acc, multiplier, out, size, zeroPoint)
+}
+
+inline void quantize(const float* x, uint8_t* out, size_t size, float scale, int32_t zeroPoint)
+{
+	scalar::quantize(x, out, size, scale, zeroPoint);
+}
+
+#undef NNP_SIMD_DISPATCH
+
+} // namespace simd
+
+} // namespace details
+
+} // namespace nnp
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#include "../common.h"
+
+// The unrolled loops are lambdas called once per index, which compilers only flatten into
+// straight-line code when forced to.
+#if defined(__GNUC__) || defined(__clang__)
+#define NNP_INLINE __attribute__((always_inline))
+#else
+#define NNP_INLINE
+#endif
+
+namespace nnp {
+
+namespace details {
+
+// Kernels for layers whose sizes are small and known at compile time, where dlib's general
+// matrix products cost more in dispatch and temporaries than in arithmetic. Every loop over a
+// layer dimension is unrolled completely and COLUMNS samples are computed together, so that
+// each weight is loaded once per block of samples. Partial sums are kept in LANES independent
+// accumulators along the contiguous dimension, which compilers map to vector registers.
+// Tensors are column-major and weight matrices row-major, as everywhere else.
+namespace unrolled {
+
+constexpr size_t MAX_SIZE = 64;
+constexpr size_t COLUMNS = 4;
+constexpr size_t LANES = 8;
+
+template <size_t NODE_C, size_t INPUT_C>
+constexpr bool enabled()
+{
+	return NODE_C != RESIZEABLE && INPUT_C != RESIZEABLE && NODE_C <= MAX_SIZE &&
+		INPUT_C <= MAX_SIZE;
+}
+
+template <typename Callable, size_t... IDX>
+NNP_INLINE inline void unrollHelper(Callable&& callable, std::index_sequence<IDX...>)
+{
+	(callable(std::integral_constant<size_t, IDX>()), ...);
+}
+
+// Calls callable(integral_constant<size_t, i>) for every i in [0, N), without a loop.
+template <size_t N, typename Callable>
+NNP_INLINE inline void unroll(Callable&& callable)
+{
+	unrollHelper(callable, std::make_index_sequence<N>());
+}
+
+// Adds the dot products of row with COLS columns of SIZE elements, stride apart, to sums.
+template <size_t SIZE, size_t COLS, typename Float>
+void dotBlock(const Float* row, const Float* columns, size_t stride, Float (&sums)[COLS])
+{
+	constexpr size_t VECTOR_END = SIZE / LANES * LANES;
+	Float acc[COLS][LANES] = {};
+	unroll<VECTOR_END / LANES>([&](auto vv) NNP_INLINE {
+		unroll<LANES>([&](auto ll) NNP_INLINE {
+			const Float w = row[vv * LANES + ll];
+			unroll<COLS>([&](auto cc) NNP_INLINE {
+				acc[cc][ll] += w * columns[cc * stride + vv * LANES + ll];
+			});
+		});
+	});
+	unroll<COLS>([&](auto cc) NNP_INLINE {
+		unroll<LANES>([&](auto ll) NNP_INLINE { sums[cc] += acc[cc][ll]; });
+		unroll<SIZE - VECTOR_END>([&](auto ii) NNP_INLINE {
+			sums[cc] += row[VECTOR_END + ii] * columns[cc * stride + VECTOR_END + ii];
+		});
+	});
+}
+
+template <typename Activation, size_t NODE_C, size_t INPUT_C, size_t COLS, typename Float>
+void forwardBlock(const Float* weights, const Float* bias, const Float* input, Float* output)
+{
+	for (size_t jj = 0; jj != NODE_C; ++jj)
+	{
+		Float sums[COLS];
+		unroll<COLS>([&](auto cc) NNP_INLINE { sums[cc] = bias ? bias[jj] : Float{0}; });
+		dotBlock<INPUT_C>(weights + jj * INPUT_C, input, INPUT_C, sums);
+		unroll<COLS>([&](auto cc) NNP_INLINE { output[cc * NODE_C + jj] = sums[cc]; });
+	}
+	Activation::forwardRange(output, output + COLS * NODE_C);
+}
+
+// output = activation(weights * input + bias) for batchSize samples. bias may be null.
+template <typename Activation, size_t NODE_C, size_t INPUT_C, typename Float>
+void forward(
+	const Float* weights,
+	const Float* bias,
+	const Float* input,
+	Float* output,
+	size_t batchSize)
+{
+	const size_t blockEnd = batchSize - batchSize % COLUMNS;
+	size_t cc = 0;
+	for (; cc != blockEnd; cc += COLUMNS)
+		forwardBlock<Activation, NODE_C, INPUT_C, COLUMNS>(
+			weights, bias, input + cc * INPUT_C, output + cc * NODE_C);
+	for (; cc != batchSize; ++cc)
+		forwardBlock<Activation, NODE_C, INPUT_C, 1>(
+			weights, bias, input + cc * INPUT_C, output + cc * NODE_C);
+}
+
+// Computes inputs [BEGIN, BEGIN + WIDTH) of COLS columns of trans(weights) * gradient. Rows of
+// weights are contiguous in the inputs, so every gradient element is broadcast over WIDTH.
+template <
+	size_t NODE_C,
+	size_t INPUT_C,
+	size_t COLS,
+	size_t BEGIN,
+	size_t WIDTH,
+	typename Float>
+void backwardChunk(const Float* weights, const Float* gradient, Float* inputGradient)
+{
+	Float acc[COLS][WIDTH] = {};
+	unroll<NODE_C>([&](auto jj) NNP_INLINE {
+		const Float* row = weights + jj * INPUT_C + BEGIN;
+		unroll<COLS>([&](auto cc) NNP_INLINE {
+			const Float g = gradient[cc * NODE_C + jj];
+			unroll<WIDTH>([&](auto ii) NNP_INLINE { acc[cc][ii] += g * row[ii]; });
+		});
+	});
+	unroll<COLS>([&](auto cc) NNP_INLINE {
+		unroll<WIDTH>([&](auto ii) NNP_INLINE {
+			inputGradient[cc * INPUT_C + BEGIN + ii] = acc[cc][ii];
+		});
+	});
+}
+
+template <size_t NODE_C, size_t INPUT_C, size_t COLS, typename Float>
+void backwardBlock(const Float* weights, const Float* gradient, Float* inputGradient)
+{
+	constexpr size_t VECTOR_END = INPUT_C / LANES * LANES;
+	unroll<VECTOR_END / LANES>([&](auto vv) NNP_INLINE {
+		backwardChunk<NODE_C, INPUT_C, COLS, vv * LANES, LANES>(
+			weights, gradient, inputGradient);
+	});
+	if constexpr (VECTOR_END != INPUT_C)
+		backwardChunk<NODE_C, INPUT_C, COLS, VECTOR_END, INPUT_C - VECTOR_END>(
+			weights, gradient, inputGradient);
+}
+
+// inputGradient = trans(weights) * gradient for batchSize samples.
+template <size_t NODE_C, size_t INPUT_C, typename Float>
+void backward(
+	const Float* weights,
+	const Float* gradient,
+	Float* inputGradient,
+	size_t batchSize)
+{
+	const size_t blockEnd = batchSize - batchSize % COLUMNS;
+	size_t cc = 0;
+	for (; cc != blockEnd; cc += COLUMNS)
+		backwardBlock<NODE_C, INPUT_C, COLUMNS>(
+			weights, gradient + cc * NODE_C, inputGradient + cc * INPUT_C);
+	for (; cc != batchSize; ++cc)
+		backwardBlock<NODE_C, INPUT_C, 1>(
+			weights, gradient + cc * NODE_C, inputGradient + cc * INPUT_C);
+}
+
+// matrix = decay * matrix + scale * gradient * trans(input) over batchSize samples. A decay of
+// 0 overwrites matrix, whatever it held.
+template <size_t NODE_C, size_t INPUT_C, typename Float>
+void outerProduct(
+	const Float* gradient,
+	const Float* input,
+	size_t batchSize,
+	Float* matrix,
+	Float decay,
+	Float scale)
+{
+	for (size_t jj = 0; jj != NODE_C; ++jj)
+	{
+		Float acc[INPUT_C] = {};
+		for (size_t cc = 0; cc != batchSize; ++cc)
+		{
+			const Float g = gradient[cc * NODE_C + jj];
+			const Float* x = input + cc * INPUT_C;
+			unroll<INPUT_C>([&](auto ii) NNP_INLINE { acc[ii] += g * x[ii]; });
+		}
+		Float* row = matrix + jj * INPUT_C;
+		if (decay == Float{0})
+			unroll<INPUT_C>([&](auto ii) NNP_INLINE { row[ii] = scale * acc[ii]; });
+		else
+			unroll<INPUT_C>(
+				[&](auto ii) NNP_INLINE { row[ii] = decay * row[ii] + scale * acc[ii]; });
+	}
+}
+
+} // namespace unrolled
+
+} // namespace details
+
+} // namespace nnp
+
+#undef NNP_INLINE
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+#include <dlib/matrix/matrix.h>
+#include <dlib/matrix/matrix_mat.h>
+#include <dlib/matrix/matrix_subexp.h>
+
+#include "activation.h"
+#include "common.h"
+#include "details/simd.h"
+#include "float16.h"
+#include "layer.h"
+#include "loss.h"
+#include "tensor.h"
+
+namespace nnp {
+
+enum class ActivationKind
+{
+	LINEAR,
+	RELU,
+	SIGMOID
+};
+
+// Width and activation of a layer of a DynamicNetwork.
+struct DynamicLayerSpec
+{
+	size_t nodeCount;
+	ActivationKind activation;
+};
+
+// Feedforward network whose depth, layer widths and activations are only known at run time,
+// for example when they come from a configuration file. The weights and biases of all layers
+// live in one contiguous arena, each layer's weights row-major as in ComputationalLayer. The
+// passes run the same kernels as the dense layers of a TupleNetwork: dlib products on views of
+// the arena, biasActivate(), the SIMD activations and the SGD update of LayerWeights, so large
+// layers train at the same speed. The activation of a layer is dispatched once per pass, not
+// per element.
+//
+// The network owns the activation and gradient buffers of every layer. They are resized when
+// the batch size changes and reused otherwise, so a network is used by one thread at a time.
+// As in TupleNetwork::Workspace, layers two apart with the same width share a gradient buffer.
+template <typename Float = float, typename LossLayer = SoftMaxLayer<Float>>
+class DynamicNetwork
+{
+	static_assert(
+		!details::IsReducedFloat<Float>::value,
+		"Dynamic networks do not support reduced precision");
+
+	using Accumulator = details::Accumulator<Float>;
+
+public:
+	using Input = Tensor<Float, RESIZEABLE, RESIZEABLE>;
+	using Output = Tensor<Float, RESIZEABLE, RESIZEABLE>;
+
+	// One-hot outputs, or a class label per sample for fused losses.
+	template <typename GFloat>
+	using GroundTruth = Tensor<
+		GFloat,
+		details::IsFusedLoss<LossLayer>::value ? 1 : RESIZEABLE,
+		RESIZEABLE>;
+
+	template <typename Generator>
+	DynamicNetwork(
+		size_t inputCount,
+		const std::vector<DynamicLayerSpec>& specs,
+		Generator&& gen,
+		const LossLayer& lossLayer = LossLayer())
+		: m_inputCount(inputCount)
+		, m_lossLayer(lossLayer)
+	{
+		if (specs.empty())
+			throw std::runtime_error("There must be at least one layer in a DynamicNetwork");
+		size_t layerInputCount = inputCount;
+		size_t parameterCount = 0;
+		m_layers.reserve(specs.size());
+		for (const auto& spec : specs)
+		{
+			if (spec.nodeCount == 0 || layerInputCount == 0)
+				throw std::runtime_error("Layers of a DynamicNetwork cannot be empty");
+			Layer layer;
+			layer.nodeCount = spec.nodeCount;
+			layer.inputCount = layerInputCount;
+			layer.activation = spec.activation;
+			layer.weightOffset = parameterCount;
+			layer.biasOffset = parameterCount + spec.nodeCount * layerInputCount;
+			layer.output.setSize(spec.nodeCount);
+			layer.gradientOwner = m_layers.size();
+			parameterCount = layer.biasOffset + spec.nodeCount;
+			layerInputCount = spec.nodeCount;
+			m_layers.push_back(std::move(layer));
+		}
+		for (size_t ii = m_layers.size(); ii-- != 0;)
+		{
+			auto& layer = m_layers[ii];
+			if (ii + 2 < m_layers.size() && m_layers[ii + 2].nodeCount == layer.nodeCount)
+				layer.gradientOwner = m_layers[ii + 2].gradientOwner;
+			else
+				layer.gradient.setSize(layer.nodeCount);
+		}
+
+		m_parameters.resize(parameterCount);
+		for (const auto& layer : m_layers)
+		{
+			Float* w = weights(layer);
+			for (size_t ii = 0; ii != layer.nodeCount * layer.inputCount; ++ii)
+				w[ii] = gen();
+			std::fill(bias(layer), bias(layer) + layer.nodeCount, Float{0});
+		}
+	}
+
+	size_t layerCount() const { return m_layers.size(); }
+
+	size_t inputCount() const { return m_inputCount; }
+
+	size_t outputCount() const { return m_layers.back().nodeCount; }
+
+	// Rows of the ground truth, the one-hot outputs or a class label for fused losses.
+	size_t groundTruthCount() const
+	{
+		return details::IsFusedLoss<LossLayer>::value ? 1 : outputCount();
+	}
+
+	size_t nodeCount(size_t layerIdx) const { return m_layers[layerIdx].nodeCount; }
+
+	// The nodeCount(layerIdx) x inputCount row-major weights of a layer in the arena.
+	Float* weights(size_t layerIdx) { return weights(m_layers[layerIdx]); }
+
+	const Float* weights(size_t layerIdx) const { return weights(m_layers[layerIdx]); }
+
+	Float* bias(size_t layerIdx) { return bias(m_layers[layerIdx]); }
+
+	const Float* bias(size_t layerIdx) const { return bias(m_layers[layerIdx]); }
+
+	// Every weight and bias of the network, layer after layer.
+	const std::vector<Float>& parameters() const { return m_parameters; }
+
+	// Sum of the squared weights, without the biases as in ComputationalLayer.
+	Accumulator l2Norm() const
+	{
+		Accumulator sum{0};
+		for (const auto& layer : m_layers)
+		{
+			const size_t size = layer.nodeCount * layer.inputCount;
+			sum += details::simd::sumSquares(weights(layer), size);
+		}
+		return sum;
+	}
+
+	// The returned tensor is overwritten by the next pass.
+	const Output& forward(const Input& input)
+	{
+		assert(input.size() == m_inputCount);
+		const Input* layerInput = &input;
+		for (auto& layer : m_layers)
+		{
+			forwardLayer(layer, *layerInput);
+			layerInput = &layer.output;
+		}
+		return *layerInput;
+	}
+
+	// Trains the network a single iteration and returns the loss.
+	template <typename GFloat>
+	Accumulator propagate(
+		const Input& input,
+		const GroundTruth<GFloat>& groundTruth,
+		Accumulator stepSize,
+		Accumulator regularization)
+	{
+		return trainStep(input, groundTruth, stepSize, regularization, true);
+	}
+
+	// Same update as propagate() without computing the loss, see Network::train().
+	template <typename GFloat>
+	void train(
+		const Input& input,
+		const GroundTruth<GFloat>& groundTruth,
+		Accumulator stepSize,
+		Accumulator regularization)
+	{
+		trainStep(input, groundTruth, stepSize, regularization, false);
+	}
+
+	// Returns the loss without back propagation, to use with a validation set.
+	template <typename GFloat>
+	Accumulator propagate(
+		const Input& input, const GroundTruth<GFloat>& groundTruth, Accumulator regularization)
+	{
+		assert(groundTruth.batchSize() == input.batchSize());
+		forward(input);
+		const Output& output = m_layers.back().output;
+		Output& scratch = gradient(m_layers.size() - 1);
+		// The gradient buffer is unused without back propagation, so the loss layer can use
+		// it as scratch space. As in Network, the weights are not added to the loss here.
+		const Accumulator totalL2Norm{0};
+		if constexpr (details::IsFusedLoss<LossLayer>::value)
+			return m_lossLayer.propagate(
+				output, groundTruth, scratch, totalL2Norm, regularization);
+		else
+		{
+			m_lossLayer.probs(output, scratch);
+			return m_lossLayer.loss(scratch, groundTruth, totalL2Norm, regularization);
+		}
+	}
+
+private:
+	struct Layer
+	{
+		size_t nodeCount;
+		size_t inputCount;
+		ActivationKind activation;
+		size_t weightOffset;
+		size_t biasOffset;
+		Output output;
+		// Empty unless the layer owns the gradient buffer it uses, see gradient().
+		Output gradient;
+		size_t gradientOwner;
+	};
+
+	template <typename GFloat>
+	Accumulator trainStep(
+		const Input& input,
+		const GroundTruth<GFloat>& groundTruth,
+		Accumulator stepSize,
+		Accumulator regularization,
+		bool computeLoss)
+	{
+		assert(groundTruth.batchSize() == input.batchSize());
+		const Accumulator totalL2Norm =
+			computeLoss && regularization != 0 ? l2Norm() : Accumulator{0};
+		forward(input);
+		const Accumulator loss = details::lossGradient(
+			m_lossLayer,
+			m_layers.back().output,
+			groundTruth,
+			gradient(m_layers.size() - 1),
+			totalL2Norm,
+			regularization,
+			Accumulator{1},
+			computeLoss);
+
+		for (size_t ii = m_layers.size(); ii-- != 0;)
+		{
+			auto& layer = m_layers[ii];
+			const Input& layerInput = ii ? m_layers[ii - 1].output : input;
+			Output& layerGradient = gradient(ii);
+			withActivation(layer.activation, [&](auto activation) {
+				decltype(activation)::backwardInPlace(layer.output, layerGradient);
+			});
+			// The input gradient needs the weights from before the update. The first layer
+			// has no use for it.
+			if (ii)
+				gradient(ii - 1).data() = trans(weightMatrix(layer)) * layerGradient.data();
+			update(layer, layerInput, layerGradient, stepSize, regularization);
+		}
+		return loss;
+	}
+
+	Output& gradient(size_t layerIdx)
+	{
+		return m_layers[m_layers[layerIdx].gradientOwner].gradient;
+	}
+
+	template <typename Function>
+	static void withActivation(ActivationKind kind, Function&& function)
+	{
+		switch (kind)
+		{
+		case ActivationKind::LINEAR:
+			function(LinearActivation());
+			break;
+		case ActivationKind::RELU:
+			function(ReluActivation());
+			break;
+		case ActivationKind::SIGMOID:
+			function(SigmoidActivation());
+			break;
+		}
+	}
+
+	Float* weights(const Layer& layer) { return &m_parameters[layer.weightOffset]; }
+
+	const Float* weights(const Layer& layer) const
+	{
+		return &m_parameters[layer.weightOffset];
+	}
+
+	Float* bias(const Layer& layer) { return &m_parameters[layer.biasOffset]; }
+
+	const Float* bias(const Layer& layer) const { return &m_parameters[layer.biasOffset]; }
+
+	auto weightMatrix(const Layer& layer) const
+	{
+		return dlib::mat(weights(layer), layer.nodeCount, layer.inputCount);
+	}
+
+	void forwardLayer(Layer& layer, const Input& input) const
+	{
+		assert(input.size() == layer.inputCount);
+		layer.output.data() = weightMatrix(layer) * input.data();
+		withActivation(layer.activation, [&](auto activation) {
+			details::biasActivate<decltype(activation)>(bias(layer), layer.output);
+		});
+	}
+
+	void update(
+		Layer& layer,
+		const Input& input,
+		const Output& layerGradient,
+		Accumulator stepSize,
+		Accumulator regularization)
+	{
+		// As in LayerWeights::update(), the decay is a pass of its own so that dlib can bind
+		// the product to one BLAS call that updates the arena in place, without a temporary
+		// for the weight gradient.
+		if (regularization != 0)
+		{
+			const Float decay = Float(1 - stepSize * regularization);
+			Float* w = weights(layer);
+			std::for_each(w, w + layer.nodeCount * layer.inputCount, [decay](Float& f) {
+				f *= decay;
+			});
+		}
+		dlib::set_ptrm(weights(layer), layer.nodeCount, layer.inputCount) -=
+			Float(stepSize) * layerGradient.data() * trans(input.data());
+		Float* b = bias(layer);
+		for (size_t jj = 0; jj != layer.nodeCount; ++jj)
+		{
+			Float sum{0};
+			for (size_t ii = 0; ii != layerGradient.batchSize(); ++ii)
+				sum += layerGradient(jj, ii);
+			b[jj] -= Float(stepSize) * sum;
+		}
+	}
+
+	size_t m_inputCount;
+	LossLayer m_lossLayer;
+	std::vector<Layer> m_layers;
+	std::vector<Float> m_parameters;
+};
+
+} // namespace nnp
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace nnp {
+
+namespace details {
+
+inline uint32_t floatBits(float f)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+inline float bitsFloat(uint32_t bits)
+{
+	float f;
+	std::memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+} // namespace details
+
+// 16-bit storage types for activations and weights. Neither has hardware arithmetic on the
+// CPU, every operation converts to float and rounds the result back to nearest even. They
+// convert implicitly in both directions, so the scalar kernels work on them unchanged.
+
+// IEEE 754 binary16: 5 exponent and 10 mantissa bits. Values above 65504 overflow to
+// infinity, which is what loss scaling guards against.
+class Half
+{
+public:
+	Half() = default;
+
+	Half(float f)
+		: m_bits(fromFloat(f))
+	{}
+
+	operator float() const { return toFloat(m_bits); }
+
+	Half& operator+=(float f) { return *this = Half(float(*this) + f); }
+
+	Half& operator-=(float f) { return *this = Half(float(*this) - f); }
+
+	Half& operator*=(float f) { return *this = Half(float(*this) * f); }
+
+	Half& operator/=(float f) { return *this = Half(float(*this) / f); }
+
+	uint16_t bits() const { return m_bits; }
+
+	static Half fromBits(uint16_t bits)
+	{
+		Half h;
+		h.m_bits = bits;
+		return h;
+	}
+
+private:
+	static uint16_t fromFloat(float f)
+	{
+		uint32_t x = details::floatBits(f);
+		const uint32_t sign = x & 0x80000000u;
+		x ^= sign;
+		uint32_t h;
+		if (x >= 0x47800000u) // Overflows, or already infinity or NaN.
+			h = x > 0x7f800000u ? 0x7e00u : 0x7c00u;
+		else if (x < 0x38800000u) // Subnormal or zero. Adding 0.5 rounds the mantissa.
+			h = details::floatBits(details::bitsFloat(x) + 0.5f) - 0x3f000000u;
+		else
+		{
+			const uint32_t odd = (x >> 13) & 1;
+			h = (x + (static_cast<uint32_t>(15 - 127) << 23) + 0xfff + odd) >> 13;
+		}
+		return static_cast<uint16_t>((sign >> 16) | h);
+	}
+
+	static float toFloat(uint16_t h)
+	{
+		constexpr uint32_t EXPONENT = 0x7c00u << 13;
+		uint32_t x = (h & 0x7fffu) << 13;
+		const uint32_t exponent = x & EXPONENT;
+		x += static_cast<uint32_t>(127 - 15) << 23;
+		if (exponent == EXPONENT) // Infinity or NaN.
+			x += static_cast<uint32_t>(128 - 16) << 23;
+		else if (exponent == 0) // Subnormal or zero, renormalized by the subtraction.
+			x = details::floatBits(
+				details::bitsFloat(x + (1u << 23)) - details::bitsFloat(113u << 23));
+		return details::bitsFloat(x | (static_cast<uint32_t>(h & 0x8000u) << 16));
+	}
+
+	uint16_t m_bits;
+};
+
+// The upper half of a float: the range of float with 8 mantissa bits. Does not need loss
+// scaling.
+class BFloat16
+{
+public:
+	BFloat16() = default;
+
+	BFloat16(float f)
+		: m_bits(fromFloat(f))
+	{}
+
+	operator float() const { return details::bitsFloat(static_cast<uint32_t>(m_bits) << 16); }
+
+	BFloat16& operator+=(float f) { return *this = BFloat16(float(*this) + f); }
+
+	BFloat16& operator-=(float f) { return *this = BFloat16(float(*this) - f); }
+
+	BFloat16& operator*=(float f) { return *this = BFloat16(float(*this) * f); }
+
+	BFloat16& operator/=(float f) { return *this = BFloat16(float(*this) / f); }
+
+	uint16_t bits() const { return m_bits; }
+
+	static BFloat16 fromBits(uint16_t bits)
+	{
+		BFloat16 b;
+		b.m_bits = bits;
+		return b;
+	}
+
+private:
+	static uint16_t fromFloat(float f)
+	{
+		const uint32_t x = details::floatBits(f);
+		if ((x & 0x7fffffffu) > 0x7f800000u) // Keep NaNs quiet instead of rounding them.
+			return static_cast<uint16_t>((x >> 16) | 0x40u);
+		return static_cast<uint16_t>((x + 0x7fffu + ((x >> 16) & 1)) >> 16);
+	}
+
+	uint16_t m_bits;
+};
+
+namespace details {
+
+// Storage types that are computed in a wider type.
+template <typename Float>
+struct IsReducedFloat : std::false_type
+{};
+
+template <>
+struct IsReducedFloat<Half> : std::true_type
+{};
+
+template <>
+struct IsReducedFloat<BFloat16> : std::true_type
+{};
+
+// The type that products, sums and parameters of Float are kept in.
+template <typename Float>
+struct AccumulatorOf
+{
+	using Type = Float;
+};
+
+template <>
+struct AccumulatorOf<Half>
+{
+	using Type = float;
+};
+
+template <>
+struct AccumulatorOf<BFloat16>
+{
+	using Type = float;
+};
+
+template <typename Float>
+using Accumulator = typename AccumulatorOf<Float>::Type;
+
+template <typename Src, typename Dst>
+void convert(const Src* begin, const Src* end, Dst* out)
+{
+	std::transform(begin, end, out, [](Src value) { return static_cast<Dst>(value); });
+}
+
+} // namespace details
+
+} // namespace nnp
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <atomic>
+#include <type_traits>
+#include <vector>
+
+#include "common.h"
+#include "float16.h"
+#include "layer.h"
+#include "network.h"
+#include "optimizer.h"
+#include "tensor.h"
+#include "thread_pool.h"
+
+namespace nnp {
+
+namespace details {
+
+// Layers whose step() changes each parameter by its own gradient only. Stateful optimizers
+// count their steps, and packed and reduced precision layers rewrite whole copies of their
+// weights, which would race with the other workers.
+template <typename Layer>
+struct IsHogwildLayer : std::false_type
+{};
+
+template <typename Activation, typename Float, size_t NODE_C, size_t INPUT_C>
+struct IsHogwildLayer<ComputationalLayer<Activation, Float, NODE_C, INPUT_C, Sgd, DenseLayout>>
+	: std::bool_constant<!IsReducedFloat<Float>::value>
+{};
+
+template <typename Network>
+struct IsHogwildNetwork : std::false_type
+{};
+
+template <typename... Layers>
+struct IsHogwildNetwork<TupleNetwork<Layers...>>
+	: std::conjunction<IsHogwildLayer<Layers>...>
+{};
+
+template <typename HiddenLayers, typename LossLayer>
+struct IsHogwildNetwork<Network<HiddenLayers, LossLayer>>
+	: IsHogwildNetwork<std::decay_t<HiddenLayers>>
+{};
+
+} // namespace details
+
+// Asynchronous SGD in the style of Hogwild!. Every thread of a pool loads batches and trains
+// the shared network on them, and updates go straight to the weights without any locking or
+// gradient exchange. Each worker owns its workspace and gradients and applies them with
+// Network::step(), whose updates are element-wise, so workers only race on the weights
+// themselves: a concurrent update of the same weight may be lost or read half way. SGD
+// tolerates that when the updates of different batches are small or rarely overlap, as in
+// wide sparse models, and the threads never wait for each other. Only networks of dense,
+// full precision layers trained with Sgd have such updates, which a static_assert checks.
+//
+// With setAsynchronous(false), train() goes through the batches in order on the calling
+// thread with Network::propagate(), which is plain SGD.
+template <
+	typename Network,
+	typename Float,
+	typename GFloat = Float,
+	size_t BATCH_SIZE = RESIZEABLE>
+class HogwildTrainer
+{
+	static_assert(
+		details::IsHogwildNetwork<Network>::value,
+		"Asynchronous training needs dense, full precision layers using the Sgd optimizer");
+
+	using Accumulator = details::Accumulator<Float>;
+
+public:
+	using Input = Tensor<Float, Network::inputCount(), BATCH_SIZE>;
+	using GroundTruth = Tensor<GFloat, Network::groundTruthCount(), BATCH_SIZE>;
+
+	HogwildTrainer(
+		Network& network,
+		ThreadPool& pool,
+		size_t batchSize = BATCH_SIZE,
+		bool asynchronous = true)
+		: m_network(&network)
+		, m_pool(&pool)
+		, m_asynchronous(asynchronous)
+	{
+		m_workers.reserve(pool.threadCount());
+		for (size_t ii = 0; ii != pool.threadCount(); ++ii)
+			m_workers.emplace_back(batchSize);
+	}
+
+	bool asynchronous() const { return m_asynchronous; }
+
+	void setAsynchronous(bool asynchronous) { m_asynchronous = asynchronous; }
+
+	// Trains on batches [0, batchCount) and returns their mean loss. loadBatch(ii, input,
+	// groundTruth) fills in batch ii. It is called from every thread of the pool at once when
+	// training asynchronously, and batches are then trained on in no particular order.
+	template <typename LoadBatch>
+	Accumulator train(
+		size_t batchCount,
+		LoadBatch&& loadBatch,
+		Accumulator stepSize,
+		Accumulator regularization)
+	{
+		for (auto& worker : m_workers)
+			worker.loss = 0;
+		std::atomic<size_t> nextBatch{0};
+		auto work = [&](size_t workerIdx) {
+			Worker& worker = m_workers[workerIdx];
+			auto claimBatch = [&] {
+				return nextBatch.fetch_add(1, std::memory_order_relaxed);
+			};
+			for (size_t ii = claimBatch(); ii < batchCount; ii = claimBatch())
+			{
+				loadBatch(ii, worker.input, worker.groundTruth);
+				if (m_asynchronous)
+				{
+					worker.gradients.setZero();
+					worker.loss += m_network->backward(
+						worker.workspace,
+						worker.gradients,
+						worker.input,
+						worker.groundTruth,
+						regularization);
+					m_network->step(worker.gradients, stepSize, regularization);
+				}
+				else
+					worker.loss += m_network->propagate(
+						worker.workspace,
+						worker.input,
+						worker.groundTruth,
+						stepSize,
+						regularization);
+			}
+		};
+		if (m_asynchronous)
+			m_pool->run(m_workers.size(), work);
+		else
+			work(0);
+
+		Accumulator loss{0};
+		for (const auto& worker : m_workers)
+			loss += worker.loss;
+		return batchCount ? loss / batchCount : loss;
+	}
+
+private:
+	struct Worker
+	{
+		explicit Worker(size_t batchSize)
+			: workspace(batchSize)
+		{
+			if constexpr (BATCH_SIZE == RESIZEABLE)
+			{
+				input.setBatchSize(batchSize);
+				groundTruth.setBatchSize(batchSize);
+			}
+		}
+
+		typename Network::template Workspace<Float, BATCH_SIZE> workspace;
+		typename Network::Gradients gradients;
+		Input input;
+		GroundTruth groundTruth;
+		Accumulator loss{0};
+	};
+
+	Network* m_network;
+	ThreadPool* m_pool;
+	bool m_asynchronous;
+	std::vector<Worker> m_workers;
+};
+
+} // namespace nnp
@@ -1,22 +1,108 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <tuple>
+#include <type_traits>
+
 #include <dlib/matrix/matrix.h>
+#include <dlib/matrix/matrix_mat.h>
 #include <dlib/matrix/matrix_utilities.h>
 
 #include "activation.h"
 #include "common.h"
+#include "details/packed.h"
+#include "details/unrolled.h"
+#include "float16.h"
+#include "optimizer.h"
 #include "tensor.h"
 
 namespace nnp {
 
+// Weight storage of ComputationalLayer. DenseLayout keeps the row-major weights only.
+// PackedLayout adds copies of the weights and of their transpose cut into cache-sized tiles,
+// so that both products read memory contiguously without BLAS, at the cost of three times the
+// weight memory and a repack after every update. Where dlib calls BLAS, DenseLayout is faster,
+// see the largeLayerStep benchmark.
+struct DenseLayout
+{};
+
+struct PackedLayout
+{};
+
 namespace details {
 
-template <typename Float = float, size_t NODE_C = RESIZEABLE, size_t INPUT_C = RESIZEABLE>
+// Applies the bias and the activation column by column while each column of the GEMM output
+// is still in cache, instead of one pass over the whole output each.
+template <typename Activation, typename Float, size_t NODE_C, size_t BATCH_SIZE>
+void biasActivate(const Float* bias, Tensor<Float, NODE_C, BATCH_SIZE>& output)
+{
+	const size_t nodeCount = output.size();
+	for (size_t ii = 0; ii != output.batchSize(); ++ii)
+	{
+		Float* column = &output(0, ii);
+		for (size_t jj = 0; jj != nodeCount; ++jj)
+			column[jj] += bias[jj];
+		Activation::forwardRange(column, column + nodeCount);
+	}
+}
+
+// Value derived from the weights, such as their squared norm, that is computed when it is
+// first read after the weights changed. Shards reading it concurrently may each compute it
+// once, and they store the same result. Writers invalidate it after changing the weights, so
+// that a value computed from weights read half way through a change is dropped too. That is
+// enough for the trainers that never change the weights while they are read, and for
+// HogwildTrainer, whose workers read it in backward() and then invalidate it in step(): its
+// losses may include the norm of weights being updated, but once train() returns the cache
+// matches the weights.
+template <typename Float>
+class WeightsCache
+{
+public:
+	WeightsCache() = default;
+
+	WeightsCache(const WeightsCache& other) { *this = other; }
+
+	WeightsCache& operator=(const WeightsCache& other)
+	{
+		const bool valid = other.m_valid.load(std::memory_order_acquire);
+		const Float value = other.m_value.load(std::memory_order_relaxed);
+		m_value.store(value, std::memory_order_relaxed);
+		m_valid.store(valid, std::memory_order_release);
+		return *this;
+	}
+
+	void invalidate() { m_valid.store(false, std::memory_order_relaxed); }
+
+	template <typename Compute>
+	Float get(Compute&& compute) const
+	{
+		if (m_valid.load(std::memory_order_acquire))
+			return m_value.load(std::memory_order_relaxed);
+		const Float value = compute();
+		m_value.store(value, std::memory_order_relaxed);
+		m_valid.store(true, std::memory_order_release);
+		return value;
+	}
+
+private:
+	mutable std::atomic<Float> m_value{0};
+	mutable std::atomic<bool> m_valid{false};
+};
+
+template <
+	typename Float = float,
+	size_t NODE_C = RESIZEABLE,
+	size_t INPUT_C = RESIZEABLE,
+	typename Optimizer = Sgd>
 class LayerWeights
 {
 public:
 	template <typename Generator>
-	explicit LayerWeights(Generator&& gen)
+	explicit LayerWeights(Generator&& gen, const Optimizer& optimizer = Optimizer())
+		: m_optimizer(optimizer)
 	{
 		for (auto& w : m_weights)
 			w = gen();
@@ -30,7 +116,51 @@ public:
 	Tensor<Float, NODE_C, BATCH_SIZE>
 		forward(const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input) const
 	{
-		return typename Tensor<Float, NODE_C, BATCH_SIZE>::Data(m_weights * input.data());
+		if constexpr (UNROLLED)
+		{
+			Tensor<Float, NODE_C, BATCH_SIZE> output;
+			forward(input, output);
+			return output;
+		}
+		else
+			return typename Tensor<Float, NODE_C, BATCH_SIZE>::Data(m_weights * input.data());
+	}
+
+	template <
+		typename InputFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		// Requirement from dlib. Matrix types have to be the same.
+		typename = std::enable_if_t<std::is_same<Float, InputFloat>::value>>
+	void forward(
+		const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input,
+		Tensor<Float, NODE_C, BATCH_SIZE>& output) const
+	{
+		forward<LinearActivation>(input, output, nullptr);
+	}
+
+	// output = activation(weights * input + bias). bias may be null. The activation is fused
+	// into the product on the unrolled path only.
+	template <typename Activation, typename InputFloat, size_t BATCH_SIZE>
+	void forward(
+		const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input,
+		Tensor<Float, NODE_C, BATCH_SIZE>& output,
+		const Float* bias) const
+	{
+		if constexpr (UNROLLED)
+		{
+			if constexpr (BATCH_SIZE == RESIZEABLE)
+				output.setBatchSize(input.batchSize());
+			unrolled::forward<Activation, NODE_C, INPUT_C>(
+				m_weights.begin(), bias, input.begin(), output.begin(), input.batchSize());
+		}
+		else
+		{
+			output.data() = m_weights * input.data();
+			if (bias)
+				biasActivate<Activation>(bias, output);
+			else
+				Activation::forwardInPlace(output);
+		}
 	}
 
 	template <
@@ -41,8 +171,38 @@ public:
 	Tensor<Float, INPUT_C, BATCH_SIZE>
 		backward(const Tensor<GradFloat, NODE_C, BATCH_SIZE>& gradient) const
 	{
-		return typename Tensor<Float, INPUT_C, BATCH_SIZE>::Data(
-			trans(m_weights) * gradient.data());
+		if constexpr (UNROLLED)
+		{
+			Tensor<Float, INPUT_C, BATCH_SIZE> inputGradient;
+			backward(gradient, inputGradient);
+			return inputGradient;
+		}
+		else
+			return typename Tensor<Float, INPUT_C, BATCH_SIZE>::Data(
+				trans(m_weights) * gradient.data());
+	}
+
+	template <
+		typename GradFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		// Requirement from dlib. Matrix types have to be the same.
+		typename = std::enable_if_t<std::is_same<Float, GradFloat>::value>>
+	void backward(
+		const Tensor<GradFloat, NODE_C, BATCH_SIZE>& gradient,
+		Tensor<Float, INPUT_C, BATCH_SIZE>& inputGradient) const
+	{
+		if constexpr (UNROLLED)
+		{
+			if constexpr (BATCH_SIZE == RESIZEABLE)
+				inputGradient.setBatchSize(gradient.batchSize());
+			unrolled::backward<NODE_C, INPUT_C>(
+				m_weights.begin(),
+				gradient.begin(),
+				inputGradient.begin(),
+				gradient.batchSize());
+		}
+		else
+			inputGradient.data() = trans(m_weights) * gradient.data();
 	}
 
 	template <
@@ -58,33 +218,183 @@ public:
 		Float stepSize,
 		Float regularization)
 	{
-		m_weights -=
-			stepSize * (gradient.data() * trans(input.data()) + regularization * m_weights);
+		if constexpr (UNROLLED && std::is_same<Optimizer, Sgd>::value)
+			unrolled::outerProduct<NODE_C, INPUT_C>(
+				gradient.begin(),
+				input.begin(),
+				input.batchSize(),
+				m_weights.begin(),
+				Float{1} - stepSize * regularization,
+				-stepSize);
+		else if constexpr (std::is_same<Optimizer, Sgd>::value)
+		{
+			// Split so that dlib can bind both steps to in-place BLAS calls instead of
+			// evaluating the aliased expression into a temporary.
+			m_weights *= Float{1} - stepSize * regularization;
+			m_weights -= stepSize * gradient.data() * trans(input.data());
+		}
+		else
+		{
+			if constexpr (UNROLLED)
+				unrolled::outerProduct<NODE_C, INPUT_C>(
+					gradient.begin(),
+					input.begin(),
+					input.batchSize(),
+					m_gradient.begin(),
+					Float{0},
+					Float{1});
+			else
+				m_gradient = gradient.data() * trans(input.data());
+			step(m_gradient, stepSize, regularization);
+		}
+		m_l2Norm.invalidate();
 	}
 
+	template <
+		typename InputFloat,
+		typename GradFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		// Requirement from dlib. Matrix types have to be the same.
+		typename = std::enable_if_t<
+			std::is_same<Float, InputFloat>::value && std::is_same<Float, GradFloat>::value>>
+	void accumulateGradient(
+		const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input,
+		const Tensor<GradFloat, NODE_C, BATCH_SIZE>& gradient,
+		dlib::matrix<Float, NODE_C, INPUT_C>& weightGradient) const
+	{
+		if constexpr (UNROLLED)
+			unrolled::outerProduct<NODE_C, INPUT_C>(
+				gradient.begin(),
+				input.begin(),
+				input.batchSize(),
+				weightGradient.begin(),
+				Float{1},
+				Float{1});
+		else
+			weightGradient += gradient.data() * trans(input.data());
+	}
+
+	void step(
+		const dlib::matrix<Float, NODE_C, INPUT_C>& weightGradient,
+		Float stepSize,
+		Float regularization)
+	{
+		m_optimizer.step(m_weights, weightGradient, m_state, stepSize, regularization);
+		m_l2Norm.invalidate();
+	}
+
+	// Assumes that the weights are changed through the returned reference, see syncWeights().
+	dlib::matrix<Float, NODE_C, INPUT_C>& weights()
+	{
+		m_l2Norm.invalidate();
+		return m_weights;
+	}
+
+	const dlib::matrix<Float, NODE_C, INPUT_C>& weights() const { return m_weights; }
+
+	const Optimizer& optimizer() const { return m_optimizer; }
+
+	// Cached until the weights change.
 	Float l2Norm() const
 	{
-		Float sum{0};
-		for (Float w : m_weights)
-			sum += w * w;
-		return sum;
+		return m_l2Norm.get([this] {
+			return simd::sumSquares(m_weights.begin(), size_t(m_weights.size()));
+		});
 	}
 
+	// Call after changing the weights through a reference kept from weights().
+	void syncWeights() { m_l2Norm.invalidate(); }
+
 	static constexpr size_t nodeCount() { return NODE_C; }
 
 	static constexpr size_t inputCount() { return INPUT_C; }
 
 private:
+	// Small layers with sizes known at compile time skip dlib for fully unrolled kernels.
+	static constexpr bool UNROLLED = unrolled::enabled<NODE_C, INPUT_C>();
+
 	dlib::matrix<Float, NODE_C, INPUT_C> m_weights;
+	Optimizer m_optimizer;
+	typename Optimizer::template State<Float, NODE_C, INPUT_C> m_state;
+	// Only SGD can fold the product of update() into the weights directly.
+	std::conditional_t<
+		std::is_same<Optimizer, Sgd>::value,
+		std::tuple<>,
+		dlib::matrix<Float, NODE_C, INPUT_C>>
+		m_gradient;
+	WeightsCache<Float> m_l2Norm;
 };
 
 template <typename Float = float, size_t NODE_C = RESIZEABLE, size_t INPUT_C = RESIZEABLE>
+class BiasedLayerGradient
+{
+public:
+	BiasedLayerGradient() { setZero(); }
+
+	dlib::matrix<Float, NODE_C, INPUT_C>& weights() { return m_weights; }
+
+	const dlib::matrix<Float, NODE_C, INPUT_C>& weights() const { return m_weights; }
+
+	dlib::matrix<Float, NODE_C, 1>& bias() { return m_bias; }
+
+	const dlib::matrix<Float, NODE_C, 1>& bias() const { return m_bias; }
+
+	void setZero()
+	{
+		std::fill(m_weights.begin(), m_weights.end(), Float{0});
+		std::fill(m_bias.begin(), m_bias.end(), Float{0});
+	}
+
+	// Adds the part-th of partCount equal slices of other, so that several threads can reduce
+	// disjoint slices of the same gradient.
+	void add(const BiasedLayerGradient& other, size_t part = 0, size_t partCount = 1)
+	{
+		addPart(m_weights, other.m_weights, part, partCount);
+		addPart(m_bias, other.m_bias, part, partCount);
+	}
+
+	void scale(Float factor)
+	{
+		m_weights *= factor;
+		m_bias *= factor;
+	}
+
+	bool isFinite() const
+	{
+		auto finite = [](Float f) { return std::isfinite(f); };
+		return std::all_of(m_weights.begin(), m_weights.end(), finite) &&
+			std::all_of(m_bias.begin(), m_bias.end(), finite);
+	}
+
+private:
+	template <typename Matrix>
+	static void addPart(Matrix& dst, const Matrix& src, size_t part, size_t partCount)
+	{
+		const size_t size = dst.end() - dst.begin();
+		const size_t begin = size * part / partCount;
+		const size_t end = size * (part + 1) / partCount;
+		auto srcIt = src.begin() + begin;
+		for (auto dstIt = dst.begin() + begin; dstIt != dst.begin() + end; ++dstIt, ++srcIt)
+			*dstIt += *srcIt;
+	}
+
+	dlib::matrix<Float, NODE_C, INPUT_C> m_weights;
+	dlib::matrix<Float, NODE_C, 1> m_bias;
+};
+
+template <
+	typename Float = float,
+	size_t NODE_C = RESIZEABLE,
+	size_t INPUT_C = RESIZEABLE,
+	typename Optimizer = Sgd>
 class BiasedLayerWeights
 {
 public:
+	using Gradient = BiasedLayerGradient<Float, NODE_C, INPUT_C>;
+
 	template <typename Generator>
-	explicit BiasedLayerWeights(Generator&& gen)
-		: m_weights(gen)
+	explicit BiasedLayerWeights(Generator&& gen, const Optimizer& optimizer = Optimizer())
+		: m_weights(gen, optimizer)
 	{
 		for (auto& b : m_bias)
 			b = 0;
@@ -105,6 +415,42 @@ public:
 		return ret;
 	}
 
+	template <
+		typename InputFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		// Requirement from dlib. Matrix types have to be the same.
+		typename = std::enable_if_t<std::is_same<Float, InputFloat>::value>>
+	void forward(
+		const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input,
+		Tensor<Float, NODE_C, BATCH_SIZE>& output) const
+	{
+		m_weights.template forward<LinearActivation>(input, output, &m_bias(0));
+	}
+
+	template <
+		typename Activation,
+		typename InputFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		// Requirement from dlib. Matrix types have to be the same.
+		typename = std::enable_if_t<std::is_same<Float, InputFloat>::value>>
+	void forward(
+		const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input,
+		Tensor<Float, NODE_C, BATCH_SIZE>& output,
+		const Activation&) const
+	{
+		m_weights.template forward<Activation>(input, output, &m_bias(0));
+	}
+
+	// Computes a single sample with a GEMV on raw buffers. output must not alias input.
+	void infer(const Float* input, Float* output) const
+	{
+		static_assert(
+			NODE_C != RESIZEABLE && INPUT_C != RESIZEABLE,
+			"infer() needs layer sizes known at compile time");
+		details::simd::gemv(
+			m_weights.weights().begin(), input, m_bias.begin(), output, NODE_C, INPUT_C);
+	}
+
 	template <
 		typename GradFloat,
 		size_t BATCH_SIZE = RESIZEABLE,
@@ -116,6 +462,18 @@ public:
 		return m_weights.backward(gradient);
 	}
 
+	template <
+		typename GradFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		// Requirement from dlib. Matrix types have to be the same.
+		typename = std::enable_if_t<std::is_same<Float, GradFloat>::value>>
+	void backward(
+		const Tensor<GradFloat, NODE_C, BATCH_SIZE>& gradient,
+		Tensor<Float, INPUT_C, BATCH_SIZE>& inputGradient) const
+	{
+		m_weights.backward(gradient, inputGradient);
+	}
+
 	template <
 		typename InputFloat,
 		typename GradFloat,
@@ -135,19 +493,343 @@ public:
 			GradFloat sum{0};
 			for (size_t ii = 0; ii != gradient.batchSize(); ++ii)
 				sum += gradient(jj, ii);
-			m_bias(jj) -= stepSize * sum;
+			m_biasGradient(jj) = sum;
+		}
+		m_weights.optimizer().step(m_bias, m_biasGradient, m_biasState, stepSize, Float{0});
+	}
+
+	template <
+		typename InputFloat,
+		typename GradFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		// Requirement from dlib. Matrix types have to be the same.
+		typename = std::enable_if_t<
+			std::is_same<Float, InputFloat>::value && std::is_same<Float, GradFloat>::value>>
+	void accumulateGradient(
+		const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input,
+		const Tensor<GradFloat, NODE_C, BATCH_SIZE>& gradient,
+		Gradient& layerGradient) const
+	{
+		m_weights.accumulateGradient(input, gradient, layerGradient.weights());
+		for (size_t jj = 0; jj != gradient.size(); ++jj)
+		{
+			GradFloat sum{0};
+			for (size_t ii = 0; ii != gradient.batchSize(); ++ii)
+				sum += gradient(jj, ii);
+			layerGradient.bias()(jj) += sum;
 		}
 	}
 
+	void step(const Gradient& layerGradient, Float stepSize, Float regularization)
+	{
+		m_weights.step(layerGradient.weights(), stepSize, regularization);
+		m_weights.optimizer().step(
+			m_bias, layerGradient.bias(), m_biasState, stepSize, Float{0});
+	}
+
 	Float l2Norm() const { return m_weights.l2Norm(); }
 
+	void syncWeights() { m_weights.syncWeights(); }
+
+	dlib::matrix<Float, NODE_C, INPUT_C>& weights() { return m_weights.weights(); }
+
+	const dlib::matrix<Float, NODE_C, INPUT_C>& weights() const { return m_weights.weights(); }
+
+	dlib::matrix<Float, NODE_C, 1>& bias() { return m_bias; }
+
+	const dlib::matrix<Float, NODE_C, 1>& bias() const { return m_bias; }
+
 	static constexpr size_t nodeCount() { return NODE_C; }
 
 	static constexpr size_t inputCount() { return INPUT_C; }
 
 private:
-	LayerWeights<Float, NODE_C, INPUT_C> m_weights;
+	LayerWeights<Float, NODE_C, INPUT_C, Optimizer> m_weights;
 	dlib::matrix<Float, NODE_C, 1> m_bias;
+	typename Optimizer::template State<Float, NODE_C, 1> m_biasState;
+	dlib::matrix<Float, NODE_C, 1> m_biasGradient;
+};
+
+// Weights of a layer that multiply through PackedMatrix copies of the weights and of their
+// transpose, so that the forward and backward products both read memory contiguously. The
+// row-major weights stay the master copy. The packed copies are refreshed by update(), step()
+// and syncWeights() instead of lazily in the passes, which keeps the passes read-only for
+// concurrent shards.
+template <typename Float, size_t NODE_C, size_t INPUT_C, typename Optimizer = Sgd>
+class PackedLayerWeights
+{
+	static_assert(
+		NODE_C != RESIZEABLE && INPUT_C != RESIZEABLE,
+		"Packed weights need layer sizes known at compile time");
+
+public:
+	using Gradient = BiasedLayerGradient<Float, NODE_C, INPUT_C>;
+
+	template <typename Generator>
+	explicit PackedLayerWeights(Generator&& gen, const Optimizer& optimizer = Optimizer())
+		: m_master(gen, optimizer)
+	{
+		syncWeights();
+	}
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	Tensor<Float, NODE_C, BATCH_SIZE>
+		forward(const Tensor<Float, INPUT_C, BATCH_SIZE>& input) const
+	{
+		Tensor<Float, NODE_C, BATCH_SIZE> output;
+		forward(input, output);
+		return output;
+	}
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	void forward(
+		const Tensor<Float, INPUT_C, BATCH_SIZE>& input,
+		Tensor<Float, NODE_C, BATCH_SIZE>& output) const
+	{
+		forward(input, output, LinearActivation());
+	}
+
+	template <typename Activation, size_t BATCH_SIZE = RESIZEABLE>
+	void forward(
+		const Tensor<Float, INPUT_C, BATCH_SIZE>& input,
+		Tensor<Float, NODE_C, BATCH_SIZE>& output,
+		const Activation&) const
+	{
+		if constexpr (BATCH_SIZE == RESIZEABLE)
+			output.setBatchSize(input.batchSize());
+		m_weights.multiply(input.begin(), input.batchSize(), output.begin());
+		biasActivate<Activation>(&m_master.bias()(0), output);
+	}
+
+	void infer(const Float* input, Float* output) const { m_master.infer(input, output); }
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	Tensor<Float, INPUT_C, BATCH_SIZE>
+		backward(const Tensor<Float, NODE_C, BATCH_SIZE>& gradient) const
+	{
+		Tensor<Float, INPUT_C, BATCH_SIZE> inputGradient;
+		backward(gradient, inputGradient);
+		return inputGradient;
+	}
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	void backward(
+		const Tensor<Float, NODE_C, BATCH_SIZE>& gradient,
+		Tensor<Float, INPUT_C, BATCH_SIZE>& inputGradient) const
+	{
+		if constexpr (BATCH_SIZE == RESIZEABLE)
+			inputGradient.setBatchSize(gradient.batchSize());
+		m_transposed.multiply(gradient.begin(), gradient.batchSize(), inputGradient.begin());
+	}
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	void update(
+		const Tensor<Float, INPUT_C, BATCH_SIZE>& input,
+		const Tensor<Float, NODE_C, BATCH_SIZE>& gradient,
+		Float stepSize,
+		Float regularization)
+	{
+		m_master.update(input, gradient, stepSize, regularization);
+		syncWeights();
+	}
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	void accumulateGradient(
+		const Tensor<Float, INPUT_C, BATCH_SIZE>& input,
+		const Tensor<Float, NODE_C, BATCH_SIZE>& gradient,
+		Gradient& layerGradient) const
+	{
+		m_master.accumulateGradient(input, gradient, layerGradient);
+	}
+
+	void step(const Gradient& layerGradient, Float stepSize, Float regularization)
+	{
+		m_master.step(layerGradient, stepSize, regularization);
+		syncWeights();
+	}
+
+	// Repacks both copies from the master weights.
+	void syncWeights()
+	{
+		const Float* weights = m_master.weights().begin();
+		m_weights.pack(weights, NODE_C, INPUT_C, INPUT_C, 1);
+		m_transposed.pack(weights, INPUT_C, NODE_C, 1, INPUT_C);
+	}
+
+	Float l2Norm() const { return m_master.l2Norm(); }
+
+	dlib::matrix<Float, NODE_C, INPUT_C>& weights() { return m_master.weights(); }
+
+	const dlib::matrix<Float, NODE_C, INPUT_C>& weights() const { return m_master.weights(); }
+
+	dlib::matrix<Float, NODE_C, 1>& bias() { return m_master.bias(); }
+
+	const dlib::matrix<Float, NODE_C, 1>& bias() const { return m_master.bias(); }
+
+	static constexpr size_t nodeCount() { return NODE_C; }
+
+	static constexpr size_t inputCount() { return INPUT_C; }
+
+private:
+	BiasedLayerWeights<Float, NODE_C, INPUT_C, Optimizer> m_master;
+	PackedMatrix<Float> m_weights;
+	PackedMatrix<Float> m_transposed;
+};
+
+// Weights of a layer whose activations are stored in the reduced precision type Storage. The
+// master weights, the bias, the optimizer state and the gradients stay in full precision and
+// a copy of the weights rounded to Storage is what the forward and backward passes read.
+// Every product is summed in full precision and rounded to Storage once.
+template <typename Storage, size_t NODE_C, size_t INPUT_C, typename Optimizer = Sgd>
+class MixedPrecisionLayerWeights
+{
+	static_assert(
+		NODE_C != RESIZEABLE && INPUT_C != RESIZEABLE,
+		"Reduced precision layers need layer sizes known at compile time");
+
+	using Master = Accumulator<Storage>;
+
+public:
+	using Gradient = BiasedLayerGradient<Master, NODE_C, INPUT_C>;
+
+	template <typename Generator>
+	explicit MixedPrecisionLayerWeights(
+		Generator&& gen, const Optimizer& optimizer = Optimizer())
+		: m_master(gen, optimizer)
+	{
+		syncWeights();
+	}
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	void forward(
+		const Tensor<Storage, INPUT_C, BATCH_SIZE>& input,
+		Tensor<Storage, NODE_C, BATCH_SIZE>& output) const
+	{
+		forward(input, output, LinearActivation());
+	}
+
+	template <typename Activation, size_t BATCH_SIZE = RESIZEABLE>
+	void forward(
+		const Tensor<Storage, INPUT_C, BATCH_SIZE>& input,
+		Tensor<Storage, NODE_C, BATCH_SIZE>& output,
+		const Activation& activation) const
+	{
+		if constexpr (BATCH_SIZE == RESIZEABLE)
+			output.setBatchSize(input.batchSize());
+		for (size_t ii = 0; ii != input.batchSize(); ++ii)
+			infer(&input(0, ii), &output(0, ii), activation);
+	}
+
+	template <typename Activation>
+	void infer(const Storage* input, Storage* output, const Activation&) const
+	{
+		std::array<Master, INPUT_C> x;
+		std::array<Master, NODE_C> y;
+		convert(input, input + INPUT_C, x.data());
+		simd::gemv(
+			m_weights.begin(), x.data(), m_master.bias().begin(), y.data(), NODE_C, INPUT_C);
+		Activation::forwardRange(y.data(), y.data() + NODE_C);
+		convert(y.data(), y.data() + NODE_C, output);
+	}
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	Tensor<Storage, INPUT_C, BATCH_SIZE>
+		backward(const Tensor<Storage, NODE_C, BATCH_SIZE>& gradient) const
+	{
+		Tensor<Storage, INPUT_C, BATCH_SIZE> inputGradient;
+		backward(gradient, inputGradient);
+		return inputGradient;
+	}
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	void backward(
+		const Tensor<Storage, NODE_C, BATCH_SIZE>& gradient,
+		Tensor<Storage, INPUT_C, BATCH_SIZE>& inputGradient) const
+	{
+		if constexpr (BATCH_SIZE == RESIZEABLE)
+			inputGradient.setBatchSize(gradient.batchSize());
+		std::array<Master, INPUT_C> dx;
+		for (size_t ii = 0; ii != gradient.batchSize(); ++ii)
+		{
+			std::fill(dx.begin(), dx.end(), Master{0});
+			for (size_t jj = 0; jj != NODE_C; ++jj)
+			{
+				const Master g = gradient(jj, ii);
+				if (g == Master{0})
+					continue;
+				const Storage* row = m_weights.begin() + jj * INPUT_C;
+				for (size_t kk = 0; kk != INPUT_C; ++kk)
+					dx[kk] += g * static_cast<Master>(row[kk]);
+			}
+			convert(dx.data(), dx.data() + INPUT_C, &inputGradient(0, ii));
+		}
+	}
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	void update(
+		const Tensor<Storage, INPUT_C, BATCH_SIZE>& input,
+		const Tensor<Storage, NODE_C, BATCH_SIZE>& gradient,
+		Master stepSize,
+		Master regularization)
+	{
+		m_gradient.setZero();
+		accumulateGradient(input, gradient, m_gradient);
+		step(m_gradient, stepSize, regularization);
+	}
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	void accumulateGradient(
+		const Tensor<Storage, INPUT_C, BATCH_SIZE>& input,
+		const Tensor<Storage, NODE_C, BATCH_SIZE>& gradient,
+		Gradient& layerGradient) const
+	{
+		std::array<Master, INPUT_C> x;
+		for (size_t ii = 0; ii != gradient.batchSize(); ++ii)
+		{
+			convert(&input(0, ii), &input(0, ii) + INPUT_C, x.data());
+			for (size_t jj = 0; jj != NODE_C; ++jj)
+			{
+				const Master g = gradient(jj, ii);
+				if (g == Master{0})
+					continue;
+				layerGradient.bias()(jj) += g;
+				Master* row = layerGradient.weights().begin() + jj * INPUT_C;
+				for (size_t kk = 0; kk != INPUT_C; ++kk)
+					row[kk] += g * x[kk];
+			}
+		}
+	}
+
+	void step(const Gradient& layerGradient, Master stepSize, Master regularization)
+	{
+		m_master.step(layerGradient, stepSize, regularization);
+		syncWeights();
+	}
+
+	// Rounds the master weights to the copy used by the forward and backward passes.
+	void syncWeights()
+	{
+		convert(m_master.weights().begin(), m_master.weights().end(), m_weights.begin());
+	}
+
+	Master l2Norm() const { return m_master.l2Norm(); }
+
+	dlib::matrix<Master, NODE_C, INPUT_C>& weights() { return m_master.weights(); }
+
+	const dlib::matrix<Master, NODE_C, INPUT_C>& weights() const { return m_master.weights(); }
+
+	dlib::matrix<Master, NODE_C, 1>& bias() { return m_master.bias(); }
+
+	const dlib::matrix<Master, NODE_C, 1>& bias() const { return m_master.bias(); }
+
+	static constexpr size_t nodeCount() { return NODE_C; }
+
+	static constexpr size_t inputCount() { return INPUT_C; }
+
+private:
+	BiasedLayerWeights<Master, NODE_C, INPUT_C, Optimizer> m_master;
+	dlib::matrix<Storage, NODE_C, INPUT_C> m_weights;
+	Gradient m_gradient;
 };
 
 } // namespace details
@@ -156,21 +838,68 @@ template <
 	typename Activation,
 	typename Float = float,
 	size_t NODE_C = RESIZEABLE,
-	size_t INPUT_C = RESIZEABLE>
+	size_t INPUT_C = RESIZEABLE,
+	typename Optimizer = Sgd,
+	typename Layout = DenseLayout>
 class ComputationalLayer
 {
-	using Weights = details::BiasedLayerWeights<Float, NODE_C, INPUT_C>;
+	static constexpr bool PACKED = std::is_same<Layout, PackedLayout>::value;
+	static_assert(
+		!(PACKED && details::IsReducedFloat<Float>::value),
+		"Reduced precision layers cannot use packed weights");
+
+	// Reduced precision storage types keep their parameters in Master precision.
+	using Master = details::Accumulator<Float>;
+	using Weights = std::conditional_t<
+		details::IsReducedFloat<Float>::value,
+		details::MixedPrecisionLayerWeights<Float, NODE_C, INPUT_C, Optimizer>,
+		std::conditional_t<
+			PACKED,
+			details::PackedLayerWeights<Float, NODE_C, INPUT_C, Optimizer>,
+			details::BiasedLayerWeights<Float, NODE_C, INPUT_C, Optimizer>>>;
 
 public:
+	using Gradient = typename Weights::Gradient;
+
 	template <typename Generator>
-	explicit ComputationalLayer(Generator&& gen)
-		: m_weights(gen) {}
+	explicit ComputationalLayer(Generator&& gen, const Optimizer& optimizer = Optimizer())
+		: m_weights(gen, optimizer)
+	{}
 
 	template <typename InputFloat, size_t BATCH_SIZE = RESIZEABLE>
 	Tensor<Float, NODE_C, BATCH_SIZE>
 		forward(const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input) const
 	{
-		return m_activation.forward(m_weights.forward(input));
+		Tensor<Float, NODE_C, BATCH_SIZE> output;
+		forward(input, output);
+		return output;
+	}
+
+	template <typename InputFloat, size_t BATCH_SIZE = RESIZEABLE>
+	void forward(
+		const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input,
+		Tensor<Float, NODE_C, BATCH_SIZE>& output) const
+	{
+		if constexpr (details::IsElementwiseActivation<Activation>::value)
+			m_weights.forward(input, output, m_activation);
+		else
+		{
+			m_weights.forward(input, output);
+			m_activation.forwardInPlace(output);
+		}
+	}
+
+	// Forward pass of a single sample from inputCount() to nodeCount() elements, without
+	// allocating.
+	void infer(const Float* input, Float* output) const
+	{
+		if constexpr (details::IsReducedFloat<Float>::value)
+			m_weights.infer(input, output, m_activation);
+		else
+		{
+			m_weights.infer(input, output);
+			Activation::forwardRange(output, output + NODE_C);
+		}
 	}
 
 	template <typename GradFloat, size_t BATCH_SIZE = RESIZEABLE>
@@ -181,17 +910,59 @@ public:
 		return m_weights.backward(m_activation.backward(output, gradient));
 	}
 
+	// Overwrites gradient with the gradient w.r.t. the pre-activation values, which is what
+	// update() expects to receive afterwards.
+	template <typename GradFloat, size_t BATCH_SIZE = RESIZEABLE>
+	void backward(
+		const Tensor<GradFloat, NODE_C, BATCH_SIZE>& output,
+		Tensor<GradFloat, NODE_C, BATCH_SIZE>& gradient,
+		Tensor<Float, INPUT_C, BATCH_SIZE>& inputGradient) const
+	{
+		m_activation.backwardInPlace(output, gradient);
+		m_weights.backward(gradient, inputGradient);
+	}
+
 	template <typename InputFloat, typename GradFloat, size_t BATCH_SIZE = RESIZEABLE>
 	void update(
 		const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input,
 		const Tensor<GradFloat, NODE_C, BATCH_SIZE>& gradient,
-		Float stepSize,
-		Float regularization)
+		Master stepSize,
+		Master regularization)
 	{
 		m_weights.update(input, gradient, stepSize, regularization);
 	}
 
-	Float l2Norm() const { return m_weights.l2Norm(); }
+	// Adds the parameter gradients for the batch to layerGradient instead of applying them.
+	template <typename InputFloat, typename GradFloat, size_t BATCH_SIZE = RESIZEABLE>
+	void accumulateGradient(
+		const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input,
+		const Tensor<GradFloat, NODE_C, BATCH_SIZE>& gradient,
+		Gradient& layerGradient) const
+	{
+		m_weights.accumulateGradient(input, gradient, layerGradient);
+	}
+
+	void step(const Gradient& layerGradient, Master stepSize, Master regularization)
+	{
+		m_weights.step(layerGradient, stepSize, regularization);
+	}
+
+	Master l2Norm() const { return m_weights.l2Norm(); }
+
+	dlib::matrix<Master, NODE_C, INPUT_C>& weights() { return m_weights.weights(); }
+
+	const dlib::matrix<Master, NODE_C, INPUT_C>& weights() const
+	{
+		return m_weights.weights();
+	}
+
+	dlib::matrix<Master, NODE_C, 1>& bias() { return m_weights.bias(); }
+
+	const dlib::matrix<Master, NODE_C, 1>& bias() const { return m_weights.bias(); }
+
+	// Reduced precision and packed layers read a copy of the weights, and every layer caches
+	// l2Norm(). Call after changing weights() directly.
+	void syncWeights() { m_weights.syncWeights(); }
 
 	static constexpr size_t nodeCount() { return Weights::nodeCount(); }
 
@@ -202,13 +973,99 @@ private:
 	Weights m_weights;
 };
 
-template <typename Float = float, size_t NODE_C = RESIZEABLE, size_t INPUT_C = RESIZEABLE>
-using LinearLayer = ComputationalLayer<LinearActivation, Float, NODE_C, INPUT_C>;
+// Inference only counterpart of ComputationalLayer that reads row-major weights and the bias
+// from memory it does not own, such as a mapped checkpoint. The memory has to outlive the
+// layer.
+template <
+	typename Activation,
+	typename Float = float,
+	size_t NODE_C = RESIZEABLE,
+	size_t INPUT_C = RESIZEABLE>
+class MappedLayer
+{
+public:
+	MappedLayer(
+		const Float* weights,
+		const Float* bias,
+		size_t nodeCount = NODE_C,
+		size_t inputCount = INPUT_C)
+		: m_weights(weights)
+		, m_bias(bias)
+		, m_nodeCount(nodeCount)
+		, m_inputCount(inputCount)
+	{}
 
-template <typename Float = float, size_t NODE_C = RESIZEABLE, size_t INPUT_C = RESIZEABLE>
-using ReluLayer = ComputationalLayer<ReluActivation, Float, NODE_C, INPUT_C>;
+	template <typename InputFloat, size_t BATCH_SIZE = RESIZEABLE>
+	Tensor<Float, NODE_C, BATCH_SIZE>
+		forward(const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input) const
+	{
+		Tensor<Float, NODE_C, BATCH_SIZE> output;
+		forward(input, output);
+		return output;
+	}
 
-template <typename Float = float, size_t NODE_C = RESIZEABLE, size_t INPUT_C = RESIZEABLE>
-using SigmoidLayer = ComputationalLayer<SigmoidActivation, Float, NODE_C, INPUT_C>;
+	template <typename InputFloat, size_t BATCH_SIZE = RESIZEABLE>
+	void forward(
+		const Tensor<InputFloat, INPUT_C, BATCH_SIZE>& input,
+		Tensor<Float, NODE_C, BATCH_SIZE>& output) const
+	{
+		static_assert(
+			std::is_same<Float, InputFloat>::value,
+			"Requirement from dlib. Matrix types have to be the same.");
+		output.data() = dlib::mat(m_weights, m_nodeCount, m_inputCount) * input.data();
+		if constexpr (details::IsElementwiseActivation<Activation>::value)
+			details::biasActivate<Activation>(m_bias, output);
+		else
+		{
+			for (size_t ii = 0; ii != output.batchSize(); ++ii)
+				for (size_t jj = 0; jj != output.size(); ++jj)
+					output(jj, ii) += m_bias[jj];
+			Activation::forwardInPlace(output);
+		}
+	}
+
+	void infer(const Float* input, Float* output) const
+	{
+		details::simd::gemv(m_weights, input, m_bias, output, m_nodeCount, m_inputCount);
+		Activation::forwardRange(output, output + m_nodeCount);
+	}
+
+	static constexpr size_t nodeCount() { return NODE_C; }
+
+	static constexpr size_t inputCount() { return INPUT_C; }
+
+private:
+	const Float* m_weights;
+	const Float* m_bias;
+	size_t m_nodeCount;
+	size_t m_inputCount;
+};
+
+template <
+	typename Float = float,
+	size_t NODE_C = RESIZEABLE,
+	size_t INPUT_C = RESIZEABLE,
+	typename Optimizer = Sgd,
+	typename Layout = DenseLayout>
+using LinearLayer =
+	ComputationalLayer<LinearActivation, Float, NODE_C, INPUT_C, Optimizer, Layout>;
+
+template <
+	typename Float = float,
+	size_t NODE_C = RESIZEABLE,
+	size_t INPUT_C = RESIZEABLE,
+	typename Optimizer = Sgd,
+	typename Layout = DenseLayout>
+using ReluLayer =
+	ComputationalLayer<ReluActivation, Float, NODE_C, INPUT_C, Optimizer, Layout>;
+
+template <
+	typename Float = float,
+	size_t NODE_C = RESIZEABLE,
+	size_t INPUT_C = RESIZEABLE,
+	typename Optimizer = Sgd,
+	typename Layout = DenseLayout>
+using SigmoidLayer =
+	ComputationalLayer<SigmoidActivation, Float, NODE_C, INPUT_C, Optimizer, Layout>;
 
 } // namespace nnp
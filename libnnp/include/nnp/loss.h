@@ -3,37 +3,43 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
-#include <numeric>
+#include <type_traits>
+#include <utility>
 
 #include "details/misc.h"
+#include "details/simd.h"
+#include "float16.h"
 #include "tensor.h"
 
 namespace nnp {
 
+template <typename Float, size_t SIZE, size_t BATCH_SIZE>
+void softmax(
+	const Tensor<Float, SIZE, BATCH_SIZE>& input, Tensor<Float, SIZE, BATCH_SIZE>& output)
+{
+	if (&output != &input)
+		output.data() = input.data();
+	for (size_t ii = 0; ii != output.batchSize(); ++ii)
+		details::simd::softmax(&output(0, ii), &output(0, ii) + output.size());
+}
+
 template <typename Float, size_t SIZE, size_t BATCH_SIZE>
 Tensor<Float, SIZE, BATCH_SIZE> softmax(Tensor<Float, SIZE, BATCH_SIZE> input)
 {
-	for (size_t ii = 0; ii != input.batchSize(); ++ii)
-	{
-		auto max = *std::max_element(&input(0, ii), &(input(0, ii + 1)));
-		for (size_t jj = 0; jj != input.size(); ++jj)
-			input(jj, ii) = std::exp(input(jj, ii) - max);
-		auto sum = std::accumulate(&input(0, ii), &(input(0, ii + 1)), Float{0});
-		for (size_t jj = 0; jj != input.size(); ++jj)
-			input(jj, ii) /= sum;
-	}
+	softmax(input, input);
 	return input;
 }
 
 template <
 	typename Float,
+	typename GFloat,
 	size_t SIZE_E,
 	size_t BATCH_SIZE_E,
 	size_t SIZE_G,
 	size_t BATCH_SIZE_G>
 Float crossEntropy(
 	const Tensor<Float, SIZE_E, BATCH_SIZE_E>& estimation,
-	const Tensor<Float, SIZE_G, BATCH_SIZE_G>& groundTruth)
+	const Tensor<GFloat, SIZE_G, BATCH_SIZE_G>& groundTruth)
 {
 	assert(
 		estimation.size() == groundTruth.size() &&
@@ -58,6 +64,14 @@ public:
 		return softmax(input);
 	}
 
+	template <size_t SIZE, size_t BATCH_SIZE>
+	static void probs(
+		const Tensor<Float, SIZE, BATCH_SIZE>& input,
+		Tensor<Float, SIZE, BATCH_SIZE>& probs)
+	{
+		softmax(input, probs);
+	}
+
 	template <typename PFloat, typename GFloat, size_t SIZE, size_t BATCH_SIZE>
 	static Float loss(
 		const Tensor<PFloat, SIZE, BATCH_SIZE>& probs,
@@ -73,15 +87,136 @@ public:
 		Tensor<PFloat, SIZE, BATCH_SIZE> probs,
 		const Tensor<GFloat, SIZE, BATCH_SIZE>& groundTruth)
 	{
-		for (size_t ii = 0; ii != probs.batchSize(); ++ii)
+		getGradient(probs, groundTruth, probs);
+		return probs;
+	}
+
+	// gradient may refer to the same tensor as probs.
+	template <typename GFloat, size_t SIZE, size_t BATCH_SIZE>
+	static void getGradient(
+		const Tensor<Float, SIZE, BATCH_SIZE>& probs,
+		const Tensor<GFloat, SIZE, BATCH_SIZE>& groundTruth,
+		Tensor<Float, SIZE, BATCH_SIZE>& gradient)
+	{
+		if (&gradient != &probs)
+			gradient.data() = probs.data();
+		for (size_t ii = 0; ii != gradient.batchSize(); ++ii)
 		{
-			probs(details::argmax(&groundTruth(0, ii), &(groundTruth(0, ii + 1))), ii) -=
+			gradient(details::argmax(&groundTruth(0, ii), &(groundTruth(0, ii + 1))), ii) -=
 				Float{1};
-			for (size_t jj = 0; jj != probs.size(); ++jj)
-				probs(jj, ii) /= probs.batchSize();
+			for (size_t jj = 0; jj != gradient.size(); ++jj)
+				gradient(jj, ii) /= gradient.batchSize();
 		}
-		return probs;
 	}
 };
 
+// Softmax and cross-entropy fused into one kernel per column, on integer class labels instead
+// of one-hot tensors. The loss is computed through log-sum-exp, so it stays finite when the
+// probability of a label underflows, and the gradient overwrites the logits.
+template <typename Float>
+class SoftmaxCrossEntropy
+{
+public:
+	// Class labels, one per column.
+	template <typename Label, size_t BATCH_SIZE = RESIZEABLE>
+	using Labels = Tensor<Label, 1, BATCH_SIZE>;
+
+	// Writes gradientScale times the gradient of the mean loss over the batch to gradient and
+	// returns the regularized loss. gradient may refer to the same tensor as logits.
+	template <typename LFloat, typename Label, size_t SIZE, size_t BATCH_SIZE>
+	static Float propagate(
+		const Tensor<LFloat, SIZE, BATCH_SIZE>& logits,
+		const Labels<Label, BATCH_SIZE>& labels,
+		Tensor<LFloat, SIZE, BATCH_SIZE>& gradient,
+		Float totalL2Norm,
+		Float regularization,
+		Float gradientScale = Float{1})
+	{
+		assert(logits.batchSize() == labels.batchSize());
+		if (&gradient != &logits)
+			gradient.data() = logits.data();
+		const size_t batchSize = gradient.batchSize();
+		const LFloat scale = gradientScale / batchSize;
+		LFloat sum{0};
+		for (size_t ii = 0; ii != batchSize; ++ii)
+		{
+			const size_t label = static_cast<size_t>(labels(0, ii));
+			assert(label < gradient.size());
+			sum += details::simd::softmaxCrossEntropy(
+				&gradient(0, ii), &gradient(0, ii) + gradient.size(), label, scale);
+		}
+		return sum / batchSize + 0.5 * regularization * totalL2Norm;
+	}
+};
+
+namespace details {
+
+// Whether a loss layer computes its loss and gradient in one propagate() call on class labels.
+template <typename LossLayer>
+struct IsFusedLoss : std::false_type
+{};
+
+template <typename Float>
+struct IsFusedLoss<SoftmaxCrossEntropy<Float>> : std::true_type
+{};
+
+// Whether the loss of a propagation is used. The L2 norm of the weights, which only enters the
+// loss, is then skipped. Loss layers without a needsLoss() member always need it.
+template <typename Next, typename = void>
+struct NeedsLoss
+{
+	static bool get(const Next&) { return true; }
+};
+
+template <typename Next>
+struct NeedsLoss<Next, std::void_t<decltype(std::declval<const Next&>().needsLoss())>>
+{
+	static bool get(const Next& next) { return next.needsLoss(); }
+};
+
+template <typename Next>
+bool needsLoss(const Next& next)
+{
+	return NeedsLoss<std::decay_t<Next>>::get(next);
+}
+
+// Writes scale times the gradient of the loss of output to gradient and returns the loss,
+// with one call to a fused loss layer or the three passes of the others. Without computeLoss
+// the separate loss pass is skipped and 0 is returned. Fused losses come at no extra cost.
+template <
+	typename LossLayer,
+	typename Float,
+	typename GFloat,
+	size_t SIZE,
+	size_t GROUND_TRUTH_C,
+	size_t BATCH_SIZE>
+auto lossGradient(
+	LossLayer& lossLayer,
+	const Tensor<Float, SIZE, BATCH_SIZE>& output,
+	const Tensor<GFloat, GROUND_TRUTH_C, BATCH_SIZE>& groundTruth,
+	Tensor<Float, SIZE, BATCH_SIZE>& gradient,
+	Accumulator<Float> totalL2Norm,
+	Accumulator<Float> regularization,
+	Accumulator<Float> scale,
+	bool computeLoss = true)
+{
+	if constexpr (IsFusedLoss<LossLayer>::value)
+		return lossLayer.propagate(
+			output, groundTruth, gradient, totalL2Norm, regularization, scale);
+	else
+	{
+		lossLayer.probs(output, gradient);
+		const auto loss = computeLoss
+			? lossLayer.loss(gradient, groundTruth, totalL2Norm, regularization)
+			: decltype(lossLayer.loss(gradient, groundTruth, totalL2Norm, regularization)){0};
+		lossLayer.getGradient(gradient, groundTruth, gradient);
+		if (scale != Accumulator<Float>{1})
+			for (auto& gg : gradient)
+				gg *= scale;
+		return loss;
+	}
+}
+
+} // namespace details
+
 } // namespace nnp
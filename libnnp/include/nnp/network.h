@@ -1,10 +1,21 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
 #include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "common.h"
 #include "details/tuple.h"
+#include "float16.h"
 #include "layer.h"
+#include "loss.h"
+#include "profiler.h"
+#include "thread_pool.h"
 
 namespace nnp {
 
@@ -27,24 +38,422 @@ public:
 
 	static constexpr size_t inputCount() { return LayerType<0>::inputCount(); }
 
+	template <size_t IDX>
+	LayerType<IDX>& layer()
+	{
+		return std::get<IDX>(m_layers);
+	}
+
+	template <size_t IDX>
+	const LayerType<IDX>& layer() const
+	{
+		return std::get<IDX>(m_layers);
+	}
+
+	// Owns every activation and gradient buffer that propagate() and forward() need, so that
+	// a training loop reusing the same workspace does not allocate after construction.
+	//
+	// Activations are computed in place on the output of each layer's product, and back
+	// propagation only reads the outputs, so a layer keeps no other copy of them. Back
+	// propagation also only needs the gradients of two adjacent layers at a time, so a layer
+	// shares its gradient buffer with the layer two above it when they have the same width,
+	// and the input gradient uses the buffer of the second layer when it has the width of the
+	// input. Deep networks of uniform width then keep two gradient buffers instead of one per
+	// layer. They still keep the output of every layer, the input of the weight gradient of
+	// the layer above it, so only checkpoints bring their workspace below half of what a pass
+	// without one took. After a pass, gradient() only holds the gradients of the two lowest
+	// layers, or of the lowest one when the second one holds the input gradient.
+	//
+	// With a CHECKPOINT_INTERVAL k above 1, the training passes only keep the output of every
+	// k-th layer and of the last one. The layers in between form segments whose outputs are
+	// recomputed from the output before them during back propagation, one segment at a time,
+	// so a layer shares its output buffer with the layer k above it when they have the same
+	// width. Activation memory then grows with depth / k + k instead of depth, for one more
+	// forward pass of the layers in between. After a training pass, output() only holds the
+	// outputs of the first segment and of every k-th layer.
+	template <typename Float, size_t BATCH_SIZE = RESIZEABLE, size_t CHECKPOINT_INTERVAL = 1>
+	class Workspace
+	{
+		static_assert(CHECKPOINT_INTERVAL > 0, "The checkpoint interval cannot be zero");
+
+	public:
+		static constexpr size_t checkpointInterval() { return CHECKPOINT_INTERVAL; }
+
+		// Whether the output of a layer is kept through a training pass.
+		static constexpr bool isCheckpoint(size_t layerIdx)
+		{
+			return (layerIdx + 1) % CHECKPOINT_INTERVAL == 0 || layerIdx + 1 == layerCount();
+		}
+
+	private:
+		template <size_t IDX>
+		using LayerTensor = Tensor<Float, LayerType<IDX>::nodeCount(), BATCH_SIZE>;
+
+		static constexpr bool sameWidth(size_t idx, size_t other)
+		{
+			constexpr std::array<size_t, layerCount()> nodeCounts{Layers::nodeCount()...};
+			return other < layerCount() && nodeCounts[idx] != RESIZEABLE
+				&& nodeCounts[other] == nodeCounts[idx];
+		}
+
+		// A layer uses the buffer of the highest layer it shares one with.
+		static constexpr size_t gradientOwner(size_t idx)
+		{
+			while (sameWidth(idx, idx + 2))
+				idx += 2;
+			return idx;
+		}
+
+		// The first layer writes the input gradient after the second one is done with its
+		// gradient.
+		static constexpr bool sharesInputGradient()
+		{
+			constexpr std::array<size_t, layerCount()> nodeCounts{Layers::nodeCount()...};
+			return layerCount() > 1 && inputCount() != RESIZEABLE
+				&& nodeCounts[layerCount() > 1 ? 1 : 0] == inputCount();
+		}
+
+		static constexpr size_t outputOwner(size_t idx)
+		{
+			while (!isCheckpoint(idx) && sameWidth(idx, idx + CHECKPOINT_INTERVAL)
+				   && !isCheckpoint(idx + CHECKPOINT_INTERVAL))
+				idx += CHECKPOINT_INTERVAL;
+			return idx;
+		}
+
+		// Layers that use the buffer of another one leave an empty slot.
+		template <size_t IDX>
+		using OutputSlot =
+			std::conditional_t<outputOwner(IDX) == IDX, LayerTensor<IDX>, std::tuple<>>;
+
+		template <size_t IDX>
+		using GradientSlot =
+			std::conditional_t<gradientOwner(IDX) == IDX, LayerTensor<IDX>, std::tuple<>>;
+
+		template <typename Slot>
+		static constexpr bool IS_TENSOR =
+			!std::is_same<std::decay_t<Slot>, std::tuple<>>::value;
+
+		template <typename Sequence>
+		struct TensorTupleHelper;
+
+		template <size_t... IDX>
+		struct TensorTupleHelper<std::index_sequence<IDX...>>
+		{
+			using OutputType = std::tuple<OutputSlot<IDX>...>;
+			using GradientType = std::tuple<GradientSlot<IDX>...>;
+		};
+
+		using Sequence = std::make_index_sequence<layerCount()>;
+		using OutputTuple = typename TensorTupleHelper<Sequence>::OutputType;
+		using GradientTuple = typename TensorTupleHelper<Sequence>::GradientType;
+		using InputTensor = Tensor<Float, inputCount(), BATCH_SIZE>;
+		using InputGradientSlot =
+			std::conditional_t<sharesInputGradient(), std::tuple<>, InputTensor>;
+
+	public:
+		explicit Workspace(size_t batchSize = BATCH_SIZE)
+		{
+			if constexpr (BATCH_SIZE == RESIZEABLE)
+			{
+				auto setBatchSize = [batchSize](auto&... slots) {
+					auto set = [batchSize](auto& slot) {
+						if constexpr (IS_TENSOR<decltype(slot)>)
+							slot.setBatchSize(batchSize);
+					};
+					(set(slots), ...);
+				};
+				std::apply(setBatchSize, m_outputs);
+				std::apply(setBatchSize, m_gradients);
+				setBatchSize(m_inputGradient);
+				if constexpr (details::IsReducedFloat<Float>::value)
+					m_lossInput.setBatchSize(batchSize);
+			}
+			else
+				assert(batchSize == BATCH_SIZE);
+		}
+
+		size_t batchSize() const { return output<layerCount() - 1>().batchSize(); }
+
+		template <size_t IDX>
+		LayerTensor<IDX>& output()
+		{
+			return std::get<outputOwner(IDX)>(m_outputs);
+		}
+
+		template <size_t IDX>
+		const LayerTensor<IDX>& output() const
+		{
+			return std::get<outputOwner(IDX)>(m_outputs);
+		}
+
+		template <size_t IDX>
+		LayerTensor<IDX>& gradient()
+		{
+			return std::get<gradientOwner(IDX)>(m_gradients);
+		}
+
+		template <size_t IDX>
+		const LayerTensor<IDX>& gradient() const
+		{
+			return std::get<gradientOwner(IDX)>(m_gradients);
+		}
+
+		InputTensor& inputGradient() { return inputGradientHelper(*this); }
+
+		const InputTensor& inputGradient() const { return inputGradientHelper(*this); }
+
+		// Full precision copy of the network output that the loss is computed on when Float is
+		// a reduced precision storage type.
+		using LossInput = std::conditional_t<
+			details::IsReducedFloat<Float>::value,
+			Tensor<details::Accumulator<Float>, outputCount(), BATCH_SIZE>,
+			std::tuple<>>;
+
+		LossInput& lossInput() { return m_lossInput; }
+
+		// Memory held by the activation and gradient buffers.
+		size_t bytes() const
+		{
+			size_t count = 0;
+			auto add = [&count](const auto& slot) {
+				if constexpr (IS_TENSOR<decltype(slot)>)
+					count += slot.size() * slot.batchSize();
+			};
+			auto addAll = [&add](const auto&... slots) { (add(slots), ...); };
+			std::apply(addAll, m_outputs);
+			std::apply(addAll, m_gradients);
+			add(m_inputGradient);
+			return count * sizeof(Float);
+		}
+
+	private:
+		template <typename Self>
+		static auto& inputGradientHelper(Self& self)
+		{
+			if constexpr (sharesInputGradient())
+				return std::get<gradientOwner(std::min<size_t>(1, layerCount() - 1))>(
+					self.m_gradients);
+			else
+				return self.m_inputGradient;
+		}
+
+		OutputTuple m_outputs;
+		GradientTuple m_gradients;
+		InputGradientSlot m_inputGradient;
+		LossInput m_lossInput;
+	};
+
+	// Parameter gradients of every layer. backward() adds to them and step() applies them.
+	class Gradients
+	{
+	public:
+		template <size_t IDX>
+		typename LayerType<IDX>::Gradient& layer()
+		{
+			return std::get<IDX>(m_gradients);
+		}
+
+		template <size_t IDX>
+		const typename LayerType<IDX>::Gradient& layer() const
+		{
+			return std::get<IDX>(m_gradients);
+		}
+
+		void setZero()
+		{
+			std::apply([](auto&... gradients) { (gradients.setZero(), ...); }, m_gradients);
+		}
+
+		// Adds the part-th of partCount slices of every layer gradient in other.
+		void add(const Gradients& other, size_t part = 0, size_t partCount = 1)
+		{
+			addHelper(other, part, partCount, std::index_sequence_for<Layers...>());
+		}
+
+		template <typename Float>
+		void scale(Float factor)
+		{
+			std::apply(
+				[factor](auto&... gradients) { (gradients.scale(factor), ...); }, m_gradients);
+		}
+
+		bool isFinite() const
+		{
+			return std::apply(
+				[](const auto&... gradients) { return (gradients.isFinite() && ...); },
+				m_gradients);
+		}
+
+	private:
+		template <size_t... IDX>
+		void addHelper(
+			const Gradients& other,
+			size_t part,
+			size_t partCount,
+			std::index_sequence<IDX...>)
+		{
+			(std::get<IDX>(m_gradients).add(std::get<IDX>(other.m_gradients), part, partCount),
+			 ...);
+		}
+
+		std::tuple<typename Layers::Gradient...> m_gradients;
+	};
+
+	// Every pass that takes a workspace also takes an optional profiler, see Profiler. The
+	// default NullProfiler compiles away.
+	template <
+		typename Next,
+		typename InputFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		size_t CHECKPOINT_INTERVAL = 1,
+		typename Profiler = NullProfiler,
+		typename = details::EnableIfProfiler<Profiler>>
+	const Tensor<InputFloat, inputCount(), BATCH_SIZE>& propagate(
+		Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+		Next&& next,
+		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
+		details::Accumulator<InputFloat> stepSize,
+		details::Accumulator<InputFloat> regularization,
+		Profiler&& profiler = Profiler())
+	{
+		assert(workspace.batchSize() == input.batchSize());
+		auto step = profiler.step();
+		auto update = [this, stepSize, regularization](
+						  auto layerIdx, const auto& layerInput, const auto& gradient) {
+			this->getLayer<decltype(layerIdx)::value>().update(
+				layerInput, gradient, stepSize, regularization);
+		};
+		if constexpr (CHECKPOINT_INTERVAL > 1)
+			checkpointedPropagate(workspace, profiler, next, update, input, regularization);
+		else
+			PropagateHelper<0>()(
+				this,
+				workspace,
+				profiler,
+				next,
+				update,
+				input,
+				workspace.inputGradient(),
+				details::Accumulator<InputFloat>{0},
+				regularization);
+		return workspace.inputGradient();
+	}
+
+	// Same as the training propagate(), but adds the parameter gradients to gradients instead
+	// of updating the weights. Apply them with step().
+	template <
+		typename Next,
+		typename InputFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		size_t CHECKPOINT_INTERVAL = 1,
+		typename Profiler = NullProfiler,
+		typename = details::EnableIfProfiler<Profiler>>
+	const Tensor<InputFloat, inputCount(), BATCH_SIZE>& backward(
+		Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+		Gradients& gradients,
+		Next&& next,
+		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
+		details::Accumulator<InputFloat> regularization,
+		Profiler&& profiler = Profiler())
+	{
+		assert(workspace.batchSize() == input.batchSize());
+		auto step = profiler.step();
+		auto accumulate = [this, &gradients](
+							  auto layerIdx, const auto& layerInput, const auto& gradient) {
+			constexpr size_t IDX = decltype(layerIdx)::value;
+			this->getLayer<IDX>().accumulateGradient(
+				layerInput, gradient, gradients.template layer<IDX>());
+		};
+		if constexpr (CHECKPOINT_INTERVAL > 1)
+			checkpointedPropagate(
+				workspace, profiler, next, accumulate, input, regularization);
+		else
+			PropagateHelper<0>()(
+				this,
+				workspace,
+				profiler,
+				next,
+				accumulate,
+				input,
+				workspace.inputGradient(),
+				details::Accumulator<InputFloat>{0},
+				regularization);
+		return workspace.inputGradient();
+	}
+
+	template <typename Float>
+	void step(const Gradients& gradients, Float stepSize, Float regularization)
+	{
+		stepHelper(
+			gradients, stepSize, regularization, std::make_index_sequence<layerCount()>());
+	}
+
+	// Sum of the squared weights of all layers. Each layer caches its share until its weights
+	// change, so this is cheap between updates.
+	auto l2Norm() const { return l2NormHelper(std::make_index_sequence<layerCount()>()); }
+
+	template <
+		typename Next,
+		typename InputFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		size_t CHECKPOINT_INTERVAL = 1,
+		typename Profiler = NullProfiler,
+		typename = details::EnableIfProfiler<Profiler>>
+	void propagate(
+		Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+		Next&& next,
+		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
+		details::Accumulator<InputFloat> regularization,
+		Profiler&& profiler = Profiler())
+	{
+		assert(workspace.batchSize() == input.batchSize());
+		auto step = profiler.step();
+		PropagateHelper<0>()(
+			this,
+			workspace,
+			profiler,
+			next,
+			input,
+			details::Accumulator<InputFloat>{0},
+			regularization);
+	}
+
 	template <typename Next, typename InputFloat, size_t BATCH_SIZE = RESIZEABLE>
 	Tensor<InputFloat, inputCount(), BATCH_SIZE> propagate(
 		Next&& next,
 		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
-		InputFloat stepSize,
-		InputFloat regularization)
+		details::Accumulator<InputFloat> stepSize,
+		details::Accumulator<InputFloat> regularization)
 	{
-		return PropagateHelper<0>()(
-			this, next, input, InputFloat{0}, stepSize, regularization);
+		Workspace<InputFloat, BATCH_SIZE> workspace(input.batchSize());
+		return propagate(workspace, next, input, stepSize, regularization);
 	}
 
 	template <typename Next, typename InputFloat, size_t BATCH_SIZE = RESIZEABLE>
 	void propagate(
 		Next&& next,
 		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
-		InputFloat regularization)
+		details::Accumulator<InputFloat> regularization)
+	{
+		Workspace<InputFloat, BATCH_SIZE> workspace(input.batchSize());
+		propagate(workspace, next, input, regularization);
+	}
+
+	template <
+		typename InputFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		size_t CHECKPOINT_INTERVAL = 1,
+		typename Profiler = NullProfiler,
+		typename = details::EnableIfProfiler<Profiler>>
+	const Tensor<InputFloat, outputCount(), BATCH_SIZE>& forward(
+		Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
+		Profiler&& profiler = Profiler())
 	{
-		PropagateHelper<0>()(this, next, input, InputFloat{0}, regularization);
+		assert(workspace.batchSize() == input.batchSize());
+		auto step = profiler.step();
+		return ForwardHelper<layerCount() - 1>()(this, workspace, profiler, input);
 	}
 
 	template <typename InputFloat, size_t BATCH_SIZE = RESIZEABLE>
@@ -54,79 +463,349 @@ public:
 		return ForwardHelper<layerCount() - 1>()(this, input);
 	}
 
+	// Forward pass of a single sample that keeps the intermediate activations on the stack,
+	// for latency sensitive callers. Every layer size has to be known at compile time.
+	template <typename Float>
+	void infer(const Float* input, Float* output) const
+	{
+		InferHelper<0>()(this, input, output);
+	}
+
+	template <typename Float>
+	std::array<Float, outputCount()> infer(const std::array<Float, inputCount()>& input) const
+	{
+		std::array<Float, outputCount()> output;
+		infer(input.data(), output.data());
+		return output;
+	}
+
 private:
 	static_assert(layerCount() > 0, "There must be at least one layer in a TupleNetwork");
 
+	// Opens a profiler scope for a phase of layer IDX, or of the loss after the last layer, on
+	// a batch like input.
+	template <size_t IDX, typename Profiler, typename Float, size_t SIZE, size_t BATCH_SIZE>
+	static auto profile(
+		Profiler& profiler, ProfilePhase phase, const Tensor<Float, SIZE, BATCH_SIZE>& input)
+	{
+		const size_t batchSize = input.batchSize();
+		if constexpr (IDX == layerCount())
+			return profiler.scope(
+				IDX, phase, details::phaseCost<Float>(phase, outputCount(), 0, batchSize));
+		else
+		{
+			using Layer = LayerType<IDX>;
+			return profiler.scope(
+				IDX,
+				phase,
+				details::phaseCost<Float>(
+					phase, Layer::nodeCount(), Layer::inputCount(), batchSize));
+		}
+	}
+
+	template <size_t IDX, typename WorkspaceType, typename Input>
+	static const auto& inputOf(const WorkspaceType& workspace, const Input& input)
+	{
+		if constexpr (IDX == 0)
+			return input;
+		else
+			return workspace.template output<IDX - 1>();
+	}
+
+	template <size_t IDX, typename WorkspaceType>
+	static auto& inputGradientOf(WorkspaceType& workspace)
+	{
+		if constexpr (IDX == 0)
+			return workspace.inputGradient();
+		else
+			return workspace.template gradient<IDX - 1>();
+	}
+
+	// Training pass on a workspace that only keeps the outputs of checkpoints. The forward
+	// pass runs through all layers, and back propagation then goes through the segments
+	// between checkpoints from the top, recomputing the outputs of each one first.
+	template <
+		typename WorkspaceType,
+		typename Profiler,
+		typename Next,
+		typename Update,
+		typename InputFloat,
+		size_t BATCH_SIZE>
+	void checkpointedPropagate(
+		WorkspaceType& workspace,
+		Profiler& profiler,
+		Next& next,
+		Update& update,
+		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
+		details::Accumulator<InputFloat> regularization)
+	{
+		constexpr size_t LAST = layerCount() - 1;
+		constexpr size_t INTERVAL = WorkspaceType::checkpointInterval();
+		forwardLayers<0, layerCount()>(workspace, profiler, ProfilePhase::FORWARD, input);
+		details::Accumulator<InputFloat> totalL2Norm{0};
+		if (regularization != 0 && details::needsLoss(next))
+			profiledL2Norm(
+				profiler, input, totalL2Norm, std::make_index_sequence<layerCount()>());
+		{
+			auto scope = profile<layerCount()>(profiler, ProfilePhase::LOSS, input);
+			next.propagate(
+				workspace.template output<LAST>(),
+				workspace.template gradient<LAST>(),
+				totalL2Norm,
+				regularization);
+		}
+		backwardSegments<LAST / INTERVAL * INTERVAL>(workspace, profiler, update, input);
+	}
+
+	template <typename Profiler, typename Input, typename Accumulator, size_t... IDX>
+	void profiledL2Norm(
+		Profiler& profiler,
+		const Input& input,
+		Accumulator& totalL2Norm,
+		std::index_sequence<IDX...>) const
+	{
+		auto add = [&](auto layerIdx) {
+			constexpr size_t LAYER_IDX = decltype(layerIdx)::value;
+			auto scope = profile<LAYER_IDX>(profiler, ProfilePhase::L2_NORM, input);
+			totalL2Norm += getLayer<LAYER_IDX>().l2Norm();
+		};
+		(add(std::integral_constant<size_t, IDX>()), ...);
+	}
+
+	// Forward pass of layers [BEGIN, END).
+	template <
+		size_t BEGIN,
+		size_t END,
+		typename WorkspaceType,
+		typename Profiler,
+		typename Input>
+	void forwardLayers(
+		WorkspaceType& workspace, Profiler& profiler, ProfilePhase phase, const Input& input)
+	{
+		if constexpr (BEGIN < END)
+		{
+			{
+				auto scope = profile<BEGIN>(profiler, phase, input);
+				getLayer<BEGIN>().forward(
+					inputOf<BEGIN>(workspace, input), workspace.template output<BEGIN>());
+			}
+			forwardLayers<BEGIN + 1, END>(workspace, profiler, phase, input);
+		}
+	}
+
+	// Back propagation and update of layers [BEGIN, END), from the top.
+	template <
+		size_t BEGIN,
+		size_t END,
+		typename WorkspaceType,
+		typename Profiler,
+		typename Update,
+		typename Input>
+	void backwardLayers(
+		WorkspaceType& workspace, Profiler& profiler, Update& update, const Input& input)
+	{
+		if constexpr (BEGIN < END)
+		{
+			constexpr size_t IDX = END - 1;
+			auto& gradient = workspace.template gradient<IDX>();
+			{
+				auto scope = profile<IDX>(profiler, ProfilePhase::BACKWARD, input);
+				getLayer<IDX>().backward(
+					workspace.template output<IDX>(),
+					gradient,
+					inputGradientOf<IDX>(workspace));
+			}
+			{
+				auto scope = profile<IDX>(profiler, ProfilePhase::UPDATE, input);
+				update(
+					std::integral_constant<size_t, IDX>(),
+					inputOf<IDX>(workspace, input),
+					gradient);
+			}
+			backwardLayers<BEGIN, IDX>(workspace, profiler, update, input);
+		}
+	}
+
+	// Back propagates the segment that starts at layer BEGIN and the ones below it. The
+	// outputs of the last segment are still in the workspace after the forward pass.
+	template <
+		size_t BEGIN,
+		typename WorkspaceType,
+		typename Profiler,
+		typename Update,
+		typename Input>
+	void backwardSegments(
+		WorkspaceType& workspace, Profiler& profiler, Update& update, const Input& input)
+	{
+		constexpr size_t INTERVAL = WorkspaceType::checkpointInterval();
+		constexpr size_t END = std::min(BEGIN + INTERVAL, layerCount());
+		if constexpr (END != layerCount())
+			forwardLayers<BEGIN, END - 1>(
+				workspace, profiler, ProfilePhase::RECOMPUTE, input);
+		backwardLayers<BEGIN, END>(workspace, profiler, update, input);
+		if constexpr (BEGIN != 0)
+			backwardSegments<BEGIN - INTERVAL>(workspace, profiler, update, input);
+	}
+
 	template <size_t LAYER_IDX, typename Dummy = void> // Only partial specializations are
 	                                                   // allowed in class scope.
 	struct PropagateHelper
 	{
-		template <typename Next, typename InputFloat, size_t BATCH_SIZE>
-		Tensor<InputFloat, LayerType<LAYER_IDX>::inputCount(), BATCH_SIZE> operator()(
+		// update(layerIdx, input, gradient) consumes the gradient of each layer once it has
+		// been propagated to the layer below.
+		template <
+			typename Profiler,
+			typename Next,
+			typename Update,
+			typename InputFloat,
+			size_t BATCH_SIZE,
+			size_t CHECKPOINT_INTERVAL>
+		void operator()(
 			TupleNetwork* object,
+			Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+			Profiler& profiler,
 			Next&& next,
+			Update&& update,
 			const Tensor<InputFloat, LayerType<LAYER_IDX>::inputCount(), BATCH_SIZE>& input,
-			InputFloat totalL2Norm,
-			InputFloat stepSize,
-			InputFloat regularization) const
+			Tensor<InputFloat, LayerType<LAYER_IDX>::inputCount(), BATCH_SIZE>& inputGradient,
+			details::Accumulator<InputFloat> totalL2Norm,
+			details::Accumulator<InputFloat> regularization) const
 		{
 			auto& thisLayer = object->getLayer<LAYER_IDX>();
-			auto output = thisLayer.forward(input);
-			totalL2Norm += thisLayer.l2Norm();
-			auto gradient = PropagateHelper<LAYER_IDX + 1, Dummy>()(
-				object, next, output, totalL2Norm, stepSize, regularization);
-			auto nextGrad = thisLayer.backward(output, gradient);
-			thisLayer.update(input, gradient, stepSize, regularization);
-			return nextGrad;
+			auto& output = workspace.template output<LAYER_IDX>();
+			auto& gradient = workspace.template gradient<LAYER_IDX>();
+			{
+				auto scope = profile<LAYER_IDX>(profiler, ProfilePhase::FORWARD, input);
+				thisLayer.forward(input, output);
+			}
+			if (regularization != 0 && details::needsLoss(next))
+			{
+				auto scope = profile<LAYER_IDX>(profiler, ProfilePhase::L2_NORM, input);
+				totalL2Norm += thisLayer.l2Norm();
+			}
+			PropagateHelper<LAYER_IDX + 1, Dummy>()(
+				object,
+				workspace,
+				profiler,
+				next,
+				update,
+				output,
+				gradient,
+				totalL2Norm,
+				regularization);
+			{
+				auto scope = profile<LAYER_IDX>(profiler, ProfilePhase::BACKWARD, input);
+				thisLayer.backward(output, gradient, inputGradient);
+			}
+			auto scope = profile<LAYER_IDX>(profiler, ProfilePhase::UPDATE, input);
+			update(std::integral_constant<size_t, LAYER_IDX>(), input, gradient);
 		}
 
-		template <typename Next, typename InputFloat, size_t BATCH_SIZE>
+		template <
+			typename Profiler,
+			typename Next,
+			typename InputFloat,
+			size_t BATCH_SIZE,
+			size_t CHECKPOINT_INTERVAL>
 		void operator()(
 			TupleNetwork* object,
+			Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+			Profiler& profiler,
 			Next&& next,
 			const Tensor<InputFloat, LayerType<LAYER_IDX>::inputCount(), BATCH_SIZE>& input,
-			InputFloat totalL2Norm,
-			InputFloat regularization) const
+			details::Accumulator<InputFloat> totalL2Norm,
+			details::Accumulator<InputFloat> regularization) const
 		{
 			auto& thisLayer = object->getLayer<LAYER_IDX>();
+			auto& output = workspace.template output<LAYER_IDX>();
+			{
+				auto scope = profile<LAYER_IDX>(profiler, ProfilePhase::FORWARD, input);
+				thisLayer.forward(input, output);
+			}
 			PropagateHelper<LAYER_IDX + 1, Dummy>()(
-				object, next, thisLayer.forward(input), totalL2Norm, regularization);
+				object, workspace, profiler, next, output, totalL2Norm, regularization);
 		}
 	};
 
 	template <typename Dummy>
 	struct PropagateHelper<layerCount() - 1, Dummy>
 	{
-		template <typename Next, typename InputFloat, size_t BATCH_SIZE>
-		Tensor<InputFloat, LayerType<layerCount() - 1>::inputCount(), BATCH_SIZE> operator()(
+		template <
+			typename Profiler,
+			typename Next,
+			typename Update,
+			typename InputFloat,
+			size_t BATCH_SIZE,
+			size_t CHECKPOINT_INTERVAL>
+		void operator()(
 			TupleNetwork* object,
+			Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+			Profiler& profiler,
 			Next&& next,
+			Update&& update,
 			const Tensor<InputFloat, LayerType<layerCount() - 1>::inputCount(), BATCH_SIZE>&
 				input,
-			InputFloat totalL2Norm,
-			InputFloat stepSize,
-			InputFloat regularization) const
+			Tensor<InputFloat, LayerType<layerCount() - 1>::inputCount(), BATCH_SIZE>&
+				inputGradient,
+			details::Accumulator<InputFloat> totalL2Norm,
+			details::Accumulator<InputFloat> regularization) const
 		{
-			auto& thisLayer = object->getLayer<layerCount() - 1>();
-			auto output = thisLayer.forward(input);
-			totalL2Norm += thisLayer.l2Norm();
-			auto gradient = next.propagate(output, totalL2Norm, stepSize, regularization);
-			auto nextGrad = thisLayer.backward(output, gradient);
-			thisLayer.update(input, gradient, stepSize, regularization);
-			return nextGrad;
+			constexpr size_t LAYER_IDX = layerCount() - 1;
+			auto& thisLayer = object->getLayer<LAYER_IDX>();
+			auto& output = workspace.template output<LAYER_IDX>();
+			auto& gradient = workspace.template gradient<LAYER_IDX>();
+			{
+				auto scope = profile<LAYER_IDX>(profiler, ProfilePhase::FORWARD, input);
+				thisLayer.forward(input, output);
+			}
+			if (regularization != 0 && details::needsLoss(next))
+			{
+				auto scope = profile<LAYER_IDX>(profiler, ProfilePhase::L2_NORM, input);
+				totalL2Norm += thisLayer.l2Norm();
+			}
+			{
+				auto scope = profile<layerCount()>(profiler, ProfilePhase::LOSS, input);
+				next.propagate(output, gradient, totalL2Norm, regularization);
+			}
+			{
+				auto scope = profile<LAYER_IDX>(profiler, ProfilePhase::BACKWARD, input);
+				thisLayer.backward(output, gradient, inputGradient);
+			}
+			auto scope = profile<LAYER_IDX>(profiler, ProfilePhase::UPDATE, input);
+			update(std::integral_constant<size_t, LAYER_IDX>(), input, gradient);
 		}
 
-		template <typename Next, typename InputFloat, size_t BATCH_SIZE>
+		template <
+			typename Profiler,
+			typename Next,
+			typename InputFloat,
+			size_t BATCH_SIZE,
+			size_t CHECKPOINT_INTERVAL>
 		void operator()(
 			TupleNetwork* object,
+			Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+			Profiler& profiler,
 			Next&& next,
 			const Tensor<InputFloat, LayerType<layerCount() - 1>::inputCount(), BATCH_SIZE>&
 				input,
-			InputFloat totalL2Norm,
-			InputFloat regularization) const
+			details::Accumulator<InputFloat> totalL2Norm,
+			details::Accumulator<InputFloat> regularization) const
 		{
-			auto& thisLayer = object->getLayer<layerCount() - 1>();
-			next.propagate(thisLayer.forward(input), totalL2Norm, regularization);
+			constexpr size_t LAYER_IDX = layerCount() - 1;
+			auto& thisLayer = object->getLayer<LAYER_IDX>();
+			auto& output = workspace.template output<LAYER_IDX>();
+			{
+				auto scope = profile<LAYER_IDX>(profiler, ProfilePhase::FORWARD, input);
+				thisLayer.forward(input, output);
+			}
+			// The gradient buffer is unused without back propagation, so the loss layer can
+			// use it as scratch space.
+			auto scope = profile<layerCount()>(profiler, ProfilePhase::LOSS, input);
+			next.evaluate(
+				output,
+				workspace.template gradient<LAYER_IDX>(),
+				totalL2Norm,
+				regularization);
 		}
 	};
 
@@ -142,6 +821,26 @@ private:
 			auto& thisLayer = object->getLayer<LAYER_IDX>();
 			return thisLayer.forward(ForwardHelper<LAYER_IDX - 1, Dummy>()(object, input));
 		}
+
+		template <
+			typename Profiler,
+			typename InputFloat,
+			size_t BATCH_SIZE,
+			size_t CHECKPOINT_INTERVAL>
+		const Tensor<InputFloat, LayerType<LAYER_IDX>::nodeCount(), BATCH_SIZE>& operator()(
+			TupleNetwork* object,
+			Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+			Profiler& profiler,
+			const Tensor<InputFloat, TupleNetwork::inputCount(), BATCH_SIZE>& input) const
+		{
+			auto& thisLayer = object->getLayer<LAYER_IDX>();
+			auto& output = workspace.template output<LAYER_IDX>();
+			const auto& layerInput =
+				ForwardHelper<LAYER_IDX - 1, Dummy>()(object, workspace, profiler, input);
+			auto scope = profile<LAYER_IDX>(profiler, ProfilePhase::FORWARD, input);
+			thisLayer.forward(layerInput, output);
+			return output;
+		}
 	};
 
 	template <typename Dummy>
@@ -155,6 +854,47 @@ private:
 			auto& thisLayer = object->getLayer<0>();
 			return thisLayer.forward(input);
 		}
+
+		template <
+			typename Profiler,
+			typename InputFloat,
+			size_t BATCH_SIZE,
+			size_t CHECKPOINT_INTERVAL>
+		const Tensor<InputFloat, LayerType<0>::nodeCount(), BATCH_SIZE>& operator()(
+			TupleNetwork* object,
+			Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+			Profiler& profiler,
+			const Tensor<InputFloat, TupleNetwork::inputCount(), BATCH_SIZE>& input) const
+		{
+			auto& thisLayer = object->getLayer<0>();
+			auto& output = workspace.template output<0>();
+			auto scope = profile<0>(profiler, ProfilePhase::FORWARD, input);
+			thisLayer.forward(input, output);
+			return output;
+		}
+	};
+
+	template <size_t LAYER_IDX, typename Dummy = void> // Only partial specializations are
+	                                                   // allowed in class scope.
+	struct InferHelper
+	{
+		template <typename Float>
+		void operator()(const TupleNetwork* object, const Float* input, Float* output) const
+		{
+			alignas(64) std::array<Float, LayerType<LAYER_IDX>::nodeCount()> layerOutput;
+			object->getLayer<LAYER_IDX>().infer(input, layerOutput.data());
+			InferHelper<LAYER_IDX + 1, Dummy>()(object, layerOutput.data(), output);
+		}
+	};
+
+	template <typename Dummy>
+	struct InferHelper<layerCount() - 1, Dummy>
+	{
+		template <typename Float>
+		void operator()(const TupleNetwork* object, const Float* input, Float* output) const
+		{
+			object->getLayer<layerCount() - 1>().infer(input, output);
+		}
 	};
 
 	LayerTuple m_layers;
@@ -170,6 +910,22 @@ private:
 	{
 		return std::get<IDX>(m_layers);
 	}
+
+	template <typename Float, size_t... IDX>
+	void stepHelper(
+		const Gradients& gradients,
+		Float stepSize,
+		Float regularization,
+		std::index_sequence<IDX...>)
+	{
+		(getLayer<IDX>().step(gradients.template layer<IDX>(), stepSize, regularization), ...);
+	}
+
+	template <size_t... IDX>
+	auto l2NormHelper(std::index_sequence<IDX...>) const
+	{
+		return (... + getLayer<IDX>().l2Norm());
+	}
 };
 
 template <typename HiddenLayers, typename LossLayer>
@@ -187,68 +943,344 @@ public:
 
 	static constexpr size_t inputCount() { return HLayers::inputCount(); }
 
-	template <typename InputFloat, typename GFloat, size_t BATCH_SIZE = RESIZEABLE>
+	// Rows of the ground truth, the one-hot outputs or a class label for fused losses.
+	static constexpr size_t groundTruthCount()
+	{
+		return details::IsFusedLoss<LossLayer>::value ? 1 : HLayers::outputCount();
+	}
+
+	template <typename Float, size_t BATCH_SIZE = RESIZEABLE, size_t CHECKPOINT_INTERVAL = 1>
+	using Workspace =
+		typename HLayers::template Workspace<Float, BATCH_SIZE, CHECKPOINT_INTERVAL>;
+
+	using Gradients = typename HLayers::Gradients;
+
+	// Splits each batch column-wise into shards that are propagated concurrently on a thread
+	// pool. Owns a workspace, an input slice and a gradient buffer per shard. The batch size
+	// must not be zero.
+	template <typename Float>
+	class ParallelWorkspace
+	{
+	public:
+		ParallelWorkspace(ThreadPool& pool, size_t batchSize, size_t shardCount = 0)
+			: m_pool(&pool)
+			, m_batchSize(batchSize)
+		{
+			assert(batchSize > 0);
+			shardCount = std::min(shardCount ? shardCount : pool.threadCount(), batchSize);
+			m_shards.reserve(shardCount);
+			for (size_t ii = 0; ii != shardCount; ++ii)
+				m_shards.emplace_back(
+					batchSize * ii / shardCount, batchSize * (ii + 1) / shardCount);
+		}
+
+		size_t batchSize() const { return m_batchSize; }
+
+		size_t shardCount() const { return m_shards.size(); }
+
+	private:
+		friend class Network;
+
+		using GroundTruthFloat =
+			std::conditional_t<details::IsFusedLoss<LossLayer>::value, uint32_t, Float>;
+
+		struct Shard
+		{
+			Shard(size_t begin, size_t end)
+				: workspace(end - begin)
+				, input(end - begin)
+				, groundTruth(end - begin)
+				, begin(begin)
+				, end(end)
+			{}
+
+			Workspace<Float> workspace;
+			Tensor<Float, inputCount()> input;
+			Tensor<GroundTruthFloat, groundTruthCount()> groundTruth;
+			typename HLayers::Gradients gradients;
+			details::Accumulator<Float> loss;
+			size_t begin;
+			size_t end;
+		};
+
+		ThreadPool* m_pool;
+		size_t m_batchSize;
+		std::vector<Shard> m_shards;
+	};
+
+	// The passes that take a workspace also take an optional profiler, see Profiler.
+	template <
+		typename InputFloat,
+		typename GFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		size_t CHECKPOINT_INTERVAL = 1,
+		typename Profiler = NullProfiler,
+		typename = details::EnableIfProfiler<Profiler>>
 	auto propagate(
+		Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
 		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
-		const Tensor<GFloat, HLayers::outputCount(), BATCH_SIZE>& groundTruth,
-		InputFloat stepSize,
-		InputFloat regularization)
+		const Tensor<GFloat, groundTruthCount(), BATCH_SIZE>& groundTruth,
+		details::Accumulator<InputFloat> stepSize,
+		details::Accumulator<InputFloat> regularization,
+		Profiler&& profiler = Profiler())
 	{
-		LossLayerHelper<InputFloat, BATCH_SIZE> helper(lossLayer(), groundTruth);
-		hiddenLayers().propagate(helper, input, stepSize, regularization);
+		LossLayerHelper<InputFloat, GFloat, BATCH_SIZE> helper(
+			lossLayer(), groundTruth, workspace);
+		hiddenLayers().propagate(
+			workspace, helper, input, stepSize, regularization, profiler);
 		return helper.loss();
 	}
 
-	template <typename InputFloat, typename GFloat, size_t BATCH_SIZE = RESIZEABLE>
+	// Same update as propagate() without computing the loss or the L2 norm of the weights,
+	// for the training steps whose loss is not looked at. Fused losses still compute it.
+	template <
+		typename InputFloat,
+		typename GFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		size_t CHECKPOINT_INTERVAL = 1,
+		typename Profiler = NullProfiler,
+		typename = details::EnableIfProfiler<Profiler>>
+	void train(
+		Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
+		const Tensor<GFloat, groundTruthCount(), BATCH_SIZE>& groundTruth,
+		details::Accumulator<InputFloat> stepSize,
+		details::Accumulator<InputFloat> regularization,
+		Profiler&& profiler = Profiler())
+	{
+		LossLayerHelper<InputFloat, GFloat, BATCH_SIZE> helper(
+			lossLayer(), groundTruth, workspace, details::Accumulator<InputFloat>{1}, false);
+		hiddenLayers().propagate(
+			workspace, helper, input, stepSize, regularization, profiler);
+	}
+
+	template <
+		typename InputFloat,
+		typename GFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		size_t CHECKPOINT_INTERVAL = 1,
+		typename Profiler = NullProfiler,
+		typename = details::EnableIfProfiler<Profiler>>
 	auto propagate(
+		Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
+		const Tensor<GFloat, groundTruthCount(), BATCH_SIZE>& groundTruth,
+		details::Accumulator<InputFloat> regularization,
+		Profiler&& profiler = Profiler())
+	{
+		LossLayerHelper<InputFloat, GFloat, BATCH_SIZE> helper(
+			lossLayer(), groundTruth, workspace);
+		hiddenLayers().propagate(workspace, helper, input, regularization, profiler);
+		return helper.loss();
+	}
+
+	// Adds the parameter gradients of a batch to gradients without changing the weights and
+	// returns the loss. batchFraction is the share of the effective batch this batch makes
+	// up. When the fractions of all batches accumulated before a step() add up to one, the
+	// gradients are the mean over the effective batch, so batches that do not fit in memory
+	// at once can be processed in parts with a bounded working set.
+	// The gradients are multiplied by lossScale, see LossScaler.
+	template <
+		typename InputFloat,
+		typename GFloat,
+		size_t BATCH_SIZE = RESIZEABLE,
+		size_t CHECKPOINT_INTERVAL = 1,
+		typename Profiler = NullProfiler,
+		typename = details::EnableIfProfiler<Profiler>>
+	auto backward(
+		Workspace<InputFloat, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+		Gradients& gradients,
 		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
-		const Tensor<GFloat, HLayers::outputCount(), BATCH_SIZE>& groundTruth,
-		InputFloat regularization)
+		const Tensor<GFloat, groundTruthCount(), BATCH_SIZE>& groundTruth,
+		details::Accumulator<InputFloat> regularization,
+		details::Accumulator<InputFloat> batchFraction = 1,
+		details::Accumulator<InputFloat> lossScale = 1,
+		Profiler&& profiler = Profiler())
 	{
-		LossLayerHelper<InputFloat, BATCH_SIZE> helper(lossLayer(), groundTruth);
-		hiddenLayers().propagate(helper, input, regularization);
+		LossLayerHelper<InputFloat, GFloat, BATCH_SIZE> helper(
+			lossLayer(), groundTruth, workspace, batchFraction * lossScale);
+		hiddenLayers().backward(
+			workspace, gradients, helper, input, regularization, profiler);
 		return helper.loss();
 	}
 
+	// Applies the accumulated gradients. They are left unchanged, call
+	// Gradients::setZero() before accumulating the next effective batch.
+	template <typename Float>
+	void step(const Gradients& gradients, Float stepSize, Float regularization)
+	{
+		hiddenLayers().step(gradients, stepSize, regularization);
+	}
+
+	// Data-parallel training step. Every shard runs forward and back propagation on its own
+	// columns, the parameter gradients are summed across shards and applied in one update.
+	template <typename InputFloat, typename GFloat, size_t BATCH_SIZE = RESIZEABLE>
+	auto propagate(
+		ParallelWorkspace<InputFloat>& workspace,
+		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
+		const Tensor<GFloat, groundTruthCount(), BATCH_SIZE>& groundTruth,
+		details::Accumulator<InputFloat> stepSize,
+		details::Accumulator<InputFloat> regularization)
+	{
+		assert(workspace.batchSize() == input.batchSize());
+		auto& shards = workspace.m_shards;
+		if (shards.empty())
+			return details::Accumulator<InputFloat>{0};
+		const details::Accumulator<InputFloat> batchSize = input.batchSize();
+		// Fills the cached norms of the layers before the shards read them concurrently.
+		if (regularization != 0)
+			hiddenLayers().l2Norm();
+		workspace.m_pool->run(shards.size(), [&](size_t shardIdx) {
+			auto& shard = shards[shardIdx];
+			details::copyColumns(input, shard.begin, shard.end, shard.input);
+			details::copyColumns(groundTruth, shard.begin, shard.end, shard.groundTruth);
+			shard.gradients.setZero();
+			shard.loss = backward(
+				shard.workspace,
+				shard.gradients,
+				shard.input,
+				shard.groundTruth,
+				regularization,
+				shard.groundTruth.batchSize() / batchSize);
+		});
+
+		auto& gradients = shards.front().gradients;
+		const size_t partCount = workspace.m_pool->threadCount();
+		workspace.m_pool->run(partCount, [&](size_t part) {
+			for (size_t ii = 1; ii < shards.size(); ++ii)
+				gradients.add(shards[ii].gradients, part, partCount);
+		});
+		step(gradients, stepSize, regularization);
+
+		details::Accumulator<InputFloat> loss{0};
+		for (const auto& shard : shards)
+			loss += shard.loss * (shard.groundTruth.batchSize() / batchSize);
+		return loss;
+	}
+
+	template <typename InputFloat, typename GFloat, size_t BATCH_SIZE = RESIZEABLE>
+	auto propagate(
+		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
+		const Tensor<GFloat, groundTruthCount(), BATCH_SIZE>& groundTruth,
+		details::Accumulator<InputFloat> stepSize,
+		details::Accumulator<InputFloat> regularization)
+	{
+		Workspace<InputFloat, BATCH_SIZE> workspace(input.batchSize());
+		return propagate(workspace, input, groundTruth, stepSize, regularization);
+	}
+
+	template <typename InputFloat, typename GFloat, size_t BATCH_SIZE = RESIZEABLE>
+	auto propagate(
+		const Tensor<InputFloat, inputCount(), BATCH_SIZE>& input,
+		const Tensor<GFloat, groundTruthCount(), BATCH_SIZE>& groundTruth,
+		details::Accumulator<InputFloat> regularization)
+	{
+		Workspace<InputFloat, BATCH_SIZE> workspace(input.batchSize());
+		return propagate(workspace, input, groundTruth, regularization);
+	}
+
 private:
-	template <typename Float, size_t BATCH_SIZE>
+	template <typename Float, typename GFloat, size_t BATCH_SIZE>
 	class LossLayerHelper
 	{
-		using GroundTruth = Tensor<Float, HLayers::outputCount(), BATCH_SIZE>;
+		using Accumulator = details::Accumulator<Float>;
+		using GroundTruth = Tensor<GFloat, groundTruthCount(), BATCH_SIZE>;
+		using LossInput = typename Workspace<Float, BATCH_SIZE>::LossInput;
 
 	public:
-		LossLayerHelper(LossLayer& lossLayer, const GroundTruth& groundTruth)
+		template <size_t CHECKPOINT_INTERVAL>
+		LossLayerHelper(
+			LossLayer& lossLayer,
+			const GroundTruth& groundTruth,
+			Workspace<Float, BATCH_SIZE, CHECKPOINT_INTERVAL>& workspace,
+			Accumulator gradientScale = Accumulator{1},
+			bool needsLoss = true)
 			: m_lossLayer(&lossLayer)
-			, m_groundTruth(&groundTruth) {}
+			, m_groundTruth(&groundTruth)
+			, m_lossInput(&workspace.lossInput())
+			, m_gradientScale(gradientScale)
+			, m_needsLoss(needsLoss) {}
 
+		// Reduced precision outputs are converted to full precision first. The gradient is
+		// scaled before it is rounded back, so that small values survive with loss scaling.
+		void propagate(
+			const Tensor<Float, HLayers::outputCount(), BATCH_SIZE>& input,
+			Tensor<Float, HLayers::outputCount(), BATCH_SIZE>& gradient,
+			Accumulator totalL2Norm,
+			Accumulator regularization)
+		{
+			if constexpr (details::IsReducedFloat<Float>::value)
+			{
+				details::convert(input.begin(), input.end(), m_lossInput->begin());
+				propagateHelper(*m_lossInput, *m_lossInput, totalL2Norm, regularization);
+				details::convert(m_lossInput->begin(), m_lossInput->end(), gradient.begin());
+			}
+			else
+				propagateHelper(input, gradient, totalL2Norm, regularization);
+		}
+
+		void evaluate(
+			const Tensor<Float, HLayers::outputCount(), BATCH_SIZE>& input,
+			Tensor<Float, HLayers::outputCount(), BATCH_SIZE>& probs,
+			Accumulator totalL2Norm,
+			Accumulator regularization)
+		{
+			if constexpr (details::IsReducedFloat<Float>::value)
+			{
+				details::convert(input.begin(), input.end(), m_lossInput->begin());
+				evaluateHelper(*m_lossInput, *m_lossInput, totalL2Norm, regularization);
+			}
+			else
+				evaluateHelper(input, probs, totalL2Norm, regularization);
+		}
+
+		Accumulator loss() const { return m_loss; }
+
+		bool needsLoss() const { return m_needsLoss; }
+
+	private:
 		template <typename InputFloat>
-		auto propagate(
+		void propagateHelper(
 			const Tensor<InputFloat, HLayers::outputCount(), BATCH_SIZE>& input,
-			InputFloat totalL2Norm,
-			InputFloat,
-			InputFloat regularization)
+			Tensor<InputFloat, HLayers::outputCount(), BATCH_SIZE>& gradient,
+			Accumulator totalL2Norm,
+			Accumulator regularization)
 		{
-			auto probs = m_lossLayer->probs(input);
-			m_loss = m_lossLayer->loss(probs, *m_groundTruth, totalL2Norm, regularization);
-			return m_lossLayer->getGradient(probs, *m_groundTruth);
+			m_loss = details::lossGradient(
+				*m_lossLayer,
+				input,
+				*m_groundTruth,
+				gradient,
+				totalL2Norm,
+				regularization,
+				m_gradientScale,
+				m_needsLoss);
 		}
 
 		template <typename InputFloat>
-		void propagate(
+		void evaluateHelper(
 			const Tensor<InputFloat, HLayers::outputCount(), BATCH_SIZE>& input,
-			InputFloat totalL2Norm,
-			InputFloat regularization)
+			Tensor<InputFloat, HLayers::outputCount(), BATCH_SIZE>& probs,
+			Accumulator totalL2Norm,
+			Accumulator regularization)
 		{
-			auto probs = m_lossLayer->probs(input);
-			m_loss = m_lossLayer->loss(probs, *m_groundTruth, totalL2Norm, regularization);
+			// A fused loss leaves its gradient in probs, which is scratch space here.
+			if constexpr (details::IsFusedLoss<LossLayer>::value)
+				m_loss = m_lossLayer->propagate(
+					input, *m_groundTruth, probs, totalL2Norm, regularization);
+			else
+			{
+				m_lossLayer->probs(input, probs);
+				m_loss = m_lossLayer->loss(probs, *m_groundTruth, totalL2Norm, regularization);
+			}
 		}
 
-		Float loss() const { return m_loss; }
-
-	private:
 		LossLayer* m_lossLayer;
 		const GroundTruth* m_groundTruth;
-		Float m_loss;
+		LossInput* m_lossInput;
+		Accumulator m_gradientScale;
+		bool m_needsLoss;
+		Accumulator m_loss;
 	};
 
 	Layers m_layers;
@@ -262,4 +1294,44 @@ private:
 	constexpr const auto& lossLayer() const { return std::get<1>(m_layers); }
 };
 
+// Dynamic loss scaling for training with Half activations, whose gradients would otherwise
+// underflow. Pass scale() as the lossScale of Network::backward() and call unscale() before
+// step(). A step whose gradients overflowed has to be skipped, and the scale is halved. After
+// growthInterval steps without overflow the scale is doubled.
+class LossScaler
+{
+public:
+	explicit LossScaler(float initialScale = 65536.f, size_t growthInterval = 2000)
+		: m_scale(initialScale)
+		, m_growthInterval(growthInterval)
+	{}
+
+	float scale() const { return m_scale; }
+
+	// Divides gradients by the scale. Returns false, leaving gradients unusable, if any of
+	// them is not finite.
+	template <typename Gradients>
+	bool unscale(Gradients& gradients)
+	{
+		if (!gradients.isFinite())
+		{
+			m_scale = std::max(m_scale / 2, 1.f);
+			m_cleanSteps = 0;
+			return false;
+		}
+		gradients.scale(1 / m_scale);
+		if (++m_cleanSteps == m_growthInterval)
+		{
+			m_scale *= 2;
+			m_cleanSteps = 0;
+		}
+		return true;
+	}
+
+private:
+	float m_scale;
+	size_t m_growthInterval;
+	size_t m_cleanSteps = 0;
+};
+
 } // namespace nnp
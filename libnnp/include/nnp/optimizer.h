@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include <dlib/matrix/matrix.h>
+
+#include "common.h"
+#include "details/simd.h"
+
+namespace nnp {
+
+namespace details {
+
+// Per-element optimizer state shaped like the parameter tensor it belongs to. Starts at zero
+// and follows the shape of resizeable parameters on first use.
+template <typename Float, size_t NR, size_t NC>
+class Moment
+{
+public:
+	Moment() { std::fill(m_data.begin(), m_data.end(), Float{0}); }
+
+	template <typename Matrix>
+	Float* data(const Matrix& params)
+	{
+		if (m_data.nr() != params.nr() || m_data.nc() != params.nc())
+		{
+			m_data.set_size(params.nr(), params.nc());
+			std::fill(m_data.begin(), m_data.end(), Float{0});
+		}
+		return m_data.begin();
+	}
+
+private:
+	dlib::matrix<Float, NR, NC> m_data;
+};
+
+} // namespace details
+
+// Optimizers are policies of ComputationalLayer. Each one declares the State it keeps for a
+// parameter tensor, which the layer stores next to that tensor, and updates parameters and
+// state in a single pass over them. regularization is the L2 coefficient the network adds to
+// its loss.
+
+// Plain gradient descent. Keeps no state.
+class Sgd
+{
+public:
+	template <typename Float, size_t NR, size_t NC>
+	struct State
+	{};
+
+	template <typename Matrix, typename TensorState, typename Float>
+	void step(
+		Matrix& params,
+		const Matrix& gradient,
+		TensorState&,
+		Float stepSize,
+		Float regularization) const
+	{
+		details::simd::sgd(
+			params.begin(), gradient.begin(), params.size(), stepSize, regularization);
+	}
+};
+
+// Gradient descent with heavy-ball momentum.
+class Momentum
+{
+public:
+	explicit Momentum(double momentum = 0.9)
+		: m_momentum(momentum)
+	{}
+
+	template <typename Float, size_t NR, size_t NC>
+	struct State
+	{
+		details::Moment<Float, NR, NC> velocity;
+	};
+
+	template <typename Matrix, typename TensorState, typename Float>
+	void step(
+		Matrix& params,
+		const Matrix& gradient,
+		TensorState& state,
+		Float stepSize,
+		Float regularization) const
+	{
+		details::simd::momentum(
+			params.begin(),
+			gradient.begin(),
+			state.velocity.data(params),
+			params.size(),
+			stepSize,
+			regularization,
+			static_cast<Float>(m_momentum));
+	}
+
+private:
+	double m_momentum;
+};
+
+class RmsProp
+{
+public:
+	explicit RmsProp(double rho = 0.9, double epsilon = 1e-8)
+		: m_rho(rho)
+		, m_epsilon(epsilon)
+	{}
+
+	template <typename Float, size_t NR, size_t NC>
+	struct State
+	{
+		details::Moment<Float, NR, NC> meanSquare;
+	};
+
+	template <typename Matrix, typename TensorState, typename Float>
+	void step(
+		Matrix& params,
+		const Matrix& gradient,
+		TensorState& state,
+		Float stepSize,
+		Float regularization) const
+	{
+		details::simd::rmsProp(
+			params.begin(),
+			gradient.begin(),
+			state.meanSquare.data(params),
+			params.size(),
+			stepSize,
+			regularization,
+			static_cast<Float>(m_rho),
+			static_cast<Float>(m_epsilon));
+	}
+
+private:
+	double m_rho;
+	double m_epsilon;
+};
+
+// Adds regularization to the gradient before the moment estimates, like the other
+// optimizers. See AdamW for decoupled weight decay.
+class Adam
+{
+public:
+	explicit Adam(double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8)
+		: Adam(beta1, beta2, epsilon, false)
+	{}
+
+	template <typename Float, size_t NR, size_t NC>
+	struct State
+	{
+		details::Moment<Float, NR, NC> mean;
+		details::Moment<Float, NR, NC> variance;
+		size_t steps = 0;
+	};
+
+	template <typename Matrix, typename TensorState, typename Float>
+	void step(
+		Matrix& params,
+		const Matrix& gradient,
+		TensorState& state,
+		Float stepSize,
+		Float regularization) const
+	{
+		const double steps = static_cast<double>(++state.steps);
+		const details::simd::AdamStep<Float> coefficients{
+			stepSize,
+			m_decoupled ? Float{0} : regularization,
+			m_decoupled ? regularization : Float{0},
+			static_cast<Float>(m_beta1),
+			static_cast<Float>(m_beta2),
+			static_cast<Float>(m_epsilon),
+			static_cast<Float>(1 / (1 - std::pow(m_beta1, steps))),
+			static_cast<Float>(1 / (1 - std::pow(m_beta2, steps)))};
+		details::simd::adam(
+			params.begin(),
+			gradient.begin(),
+			state.mean.data(params),
+			state.variance.data(params),
+			params.size(),
+			coefficients);
+	}
+
+protected:
+	Adam(double beta1, double beta2, double epsilon, bool decoupled)
+		: m_beta1(beta1)
+		, m_beta2(beta2)
+		, m_epsilon(epsilon)
+		, m_decoupled(decoupled)
+	{}
+
+private:
+	double m_beta1;
+	double m_beta2;
+	double m_epsilon;
+	bool m_decoupled;
+};
+
+// Adam that shrinks the parameters by stepSize * regularization directly instead of passing
+// the regularization through the moment estimates.
+class AdamW : public Adam
+{
+public:
+	explicit AdamW(double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8)
+		: Adam(beta1, beta2, epsilon, true)
+	{}
+};
+
+} // namespace nnp
@@ -0,0 +1,534 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "float16.h"
+#include "loss.h"
+#include "tensor.h"
+
+namespace nnp {
+
+namespace details {
+
+// Bounded lock-free queue from one producer thread to one consumer thread.
+template <typename T>
+class SpscQueue
+{
+public:
+	explicit SpscQueue(size_t capacity)
+		: m_items(capacity + 1)
+	{}
+
+	// Returns false if the queue is full.
+	bool tryPush(const T& item)
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		const size_t next = tail + 1 == m_items.size() ? 0 : tail + 1;
+		if (next == m_head.load(std::memory_order_acquire))
+			return false;
+		m_items[tail] = item;
+		m_tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// Returns false if the queue is empty.
+	bool tryPop(T& item)
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+		item = m_items[head];
+		m_head.store(head + 1 == m_items.size() ? 0 : head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const
+	{
+		return m_head.load(std::memory_order_acquire) ==
+			m_tail.load(std::memory_order_acquire);
+	}
+
+private:
+	std::vector<T> m_items;
+	// On separate cache lines, so that the producer and the consumer do not contend.
+	alignas(64) std::atomic<size_t> m_head{0};
+	alignas(64) std::atomic<size_t> m_tail{0};
+};
+
+// Puts the consumer of some queues to sleep while they are all empty.
+class Doorbell
+{
+public:
+	// Call after pushing. Taking the lock orders the push before the wait of a consumer that
+	// has just found the queues empty, so the wake-up cannot be lost.
+	void ring()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+		}
+		m_wake.notify_one();
+	}
+
+	template <typename Predicate>
+	void wait(Predicate&& ready)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_wake.wait(lock, ready);
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+};
+
+} // namespace details
+
+struct PipelineStageStats
+{
+	size_t firstLayer;
+	size_t layerCount;
+	// Share of the time spent in forward(), backward() and propagate() that the stage was
+	// computing rather than waiting for its neighbours.
+	double utilization;
+};
+
+// Pipeline-parallel execution of a TupleNetwork. The layers are split into stages of
+// consecutive layers, each run by a thread of its own, and a batch into micro-batches that
+// flow through bounded queues from stage to stage, so that a stage computes a micro-batch
+// while the next stage computes the one before. Training is synchronous as in GPipe: the
+// gradients of all micro-batches are accumulated before the weights are updated once, which
+// gives the same result as training on the whole batch. Every activation and gradient buffer
+// is allocated up front for batchSize samples. Layers must not be reduced precision.
+template <typename HiddenLayers, typename LossLayer, typename Float = float>
+class PipelineNetwork
+{
+	static_assert(
+		!details::IsReducedFloat<Float>::value,
+		"Pipelines do not support reduced precision");
+
+	using Accumulator = details::Accumulator<Float>;
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr size_t LAYER_C = HiddenLayers::layerCount();
+
+	template <size_t IDX>
+	using LayerType =
+		std::decay_t<decltype(std::declval<HiddenLayers&>().template layer<IDX>())>;
+
+	template <size_t IDX>
+	using LayerTensors = std::vector<Tensor<Float, LayerType<IDX>::nodeCount()>>;
+
+	template <typename Sequence>
+	struct TensorTupleHelper;
+
+	template <size_t... IDX>
+	struct TensorTupleHelper<std::index_sequence<IDX...>>
+	{
+		using Type = std::tuple<LayerTensors<IDX>...>;
+	};
+
+	using TensorTuple = typename TensorTupleHelper<std::make_index_sequence<LAYER_C>>::Type;
+
+	using GroundTruthFloat =
+		std::conditional_t<details::IsFusedLoss<LossLayer>::value, uint32_t, Float>;
+
+public:
+	using Gradients = typename HiddenLayers::Gradients;
+
+	static constexpr size_t inputCount() { return HiddenLayers::inputCount(); }
+
+	static constexpr size_t outputCount() { return HiddenLayers::outputCount(); }
+
+	static constexpr size_t groundTruthCount()
+	{
+		return details::IsFusedLoss<LossLayer>::value ? 1 : outputCount();
+	}
+
+	// stageCount is capped to the number of layers, which is also the default.
+	PipelineNetwork(
+		HiddenLayers& hiddenLayers,
+		LossLayer lossLayer,
+		size_t batchSize,
+		size_t microBatchCount,
+		size_t stageCount = LAYER_C)
+		: m_hiddenLayers(&hiddenLayers)
+		, m_lossLayer(std::move(lossLayer))
+		, m_batchSize(batchSize)
+		, m_output(batchSize)
+		, m_forwardDone(batchSize)
+		, m_backwardDone(batchSize)
+	{
+		microBatchCount = std::max<size_t>(std::min(microBatchCount, batchSize), 1);
+		for (size_t ii = 0; ii != microBatchCount; ++ii)
+			m_microBatches.push_back(batchSize * ii / microBatchCount);
+		m_microBatches.push_back(batchSize);
+		for (size_t ii = 0; ii != microBatchCount; ++ii)
+		{
+			const size_t columns = microBatchSize(ii);
+			m_inputs.emplace_back(columns);
+			m_groundTruth.emplace_back(columns);
+			allocate(columns, std::make_index_sequence<LAYER_C>());
+		}
+		m_losses.resize(microBatchCount);
+		m_inputGradient.setBatchSize(m_microBatches[1]);
+
+		stageCount = std::max<size_t>(std::min(stageCount, LAYER_C), 1);
+		for (size_t ii = 0; ii != stageCount; ++ii)
+			m_stages.push_back(std::make_unique<Stage>(
+				LAYER_C * ii / stageCount, LAYER_C * (ii + 1) / stageCount, microBatchCount));
+		for (size_t ii = 0; ii != stageCount; ++ii)
+			m_stages[ii]->thread = std::thread([this, ii] { stageLoop(ii); });
+	}
+
+	PipelineNetwork(const PipelineNetwork&) = delete;
+	PipelineNetwork& operator=(const PipelineNetwork&) = delete;
+
+	~PipelineNetwork()
+	{
+		m_stop.store(true);
+		for (auto& stage : m_stages)
+		{
+			stage->doorbell.ring();
+			stage->thread.join();
+		}
+	}
+
+	size_t batchSize() const { return m_batchSize; }
+
+	size_t microBatchCount() const { return m_microBatches.size() - 1; }
+
+	size_t stageCount() const { return m_stages.size(); }
+
+	// Forward pass of a batch of batchSize() samples. The output stays valid until the next
+	// call.
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	const Tensor<Float, outputCount()>& forward(
+		const Tensor<Float, inputCount(), BATCH_SIZE>& input)
+	{
+		assert(input.batchSize() == m_batchSize);
+		const auto start = Clock::now();
+		m_training = false;
+		for (size_t ii = 0; ii != microBatchCount(); ++ii)
+		{
+			const size_t begin = m_microBatches[ii];
+			details::copyColumns(input, begin, m_microBatches[ii + 1], m_inputs[ii]);
+			push(*m_stages.front(), m_stages.front()->forward, ii);
+		}
+		for (size_t done = 0; done != microBatchCount(); ++done)
+		{
+			const size_t ii = pop(m_forwardDone);
+			const auto& output = std::get<LAYER_C - 1>(m_outputs)[ii];
+			std::copy(
+				output.begin(),
+				output.end(),
+				m_output.begin() + m_microBatches[ii] * outputCount());
+		}
+		m_wallTime += Clock::now() - start;
+		return m_output;
+	}
+
+	// Adds the parameter gradients of a batch of batchSize() samples to gradients and returns
+	// the loss, like Network::backward().
+	template <typename GFloat, size_t BATCH_SIZE = RESIZEABLE>
+	Accumulator backward(
+		Gradients& gradients,
+		const Tensor<Float, inputCount(), BATCH_SIZE>& input,
+		const Tensor<GFloat, groundTruthCount(), BATCH_SIZE>& groundTruth,
+		Accumulator regularization)
+	{
+		assert(input.batchSize() == m_batchSize && groundTruth.batchSize() == m_batchSize);
+		const auto start = Clock::now();
+		m_training = true;
+		m_gradients = &gradients;
+		m_regularization = regularization;
+		m_totalL2Norm = regularization != 0 ? Accumulator(m_hiddenLayers->l2Norm()) : 0;
+		for (size_t ii = 0; ii != microBatchCount(); ++ii)
+		{
+			const size_t begin = m_microBatches[ii];
+			const size_t end = m_microBatches[ii + 1];
+			details::copyColumns(input, begin, end, m_inputs[ii]);
+			details::copyColumns(groundTruth, begin, end, m_groundTruth[ii]);
+			push(*m_stages.front(), m_stages.front()->forward, ii);
+		}
+		Accumulator loss{0};
+		for (size_t done = 0; done != microBatchCount(); ++done)
+		{
+			const size_t ii = pop(m_backwardDone);
+			loss += m_losses[ii] * microBatchSize(ii) / m_batchSize;
+		}
+		m_wallTime += Clock::now() - start;
+		return loss;
+	}
+
+	// One training step on a batch of batchSize() samples, like Network::propagate().
+	template <typename GFloat, size_t BATCH_SIZE = RESIZEABLE>
+	Accumulator propagate(
+		const Tensor<Float, inputCount(), BATCH_SIZE>& input,
+		const Tensor<GFloat, groundTruthCount(), BATCH_SIZE>& groundTruth,
+		Accumulator stepSize,
+		Accumulator regularization)
+	{
+		m_stepGradients.setZero();
+		const Accumulator loss = backward(m_stepGradients, input, groundTruth, regularization);
+		m_hiddenLayers->step(m_stepGradients, stepSize, regularization);
+		return loss;
+	}
+
+	std::vector<PipelineStageStats> stageStats() const
+	{
+		const double wallTime = std::chrono::duration<double>(m_wallTime).count();
+		std::vector<PipelineStageStats> stats;
+		for (const auto& stage : m_stages)
+		{
+			const double busyTime = stage->busyNanoseconds.load() * 1e-9;
+			stats.push_back(
+				{stage->firstLayer,
+				 stage->endLayer - stage->firstLayer,
+				 wallTime > 0 ? busyTime / wallTime : 0.0});
+		}
+		return stats;
+	}
+
+	void resetStats()
+	{
+		m_wallTime = Clock::duration::zero();
+		for (auto& stage : m_stages)
+			stage->busyNanoseconds.store(0);
+	}
+
+private:
+	// Micro-batches enter a stage from the stage before on forward and leave it for the
+	// stage before on backward. The last stage computes the loss of a micro-batch and goes
+	// on with its backward pass right away.
+	struct Stage
+	{
+		Stage(size_t firstLayer, size_t endLayer, size_t capacity)
+			: firstLayer(firstLayer)
+			, endLayer(endLayer)
+			, forward(capacity)
+			, backward(capacity)
+		{}
+
+		size_t firstLayer;
+		size_t endLayer;
+		details::SpscQueue<size_t> forward;
+		details::SpscQueue<size_t> backward;
+		details::Doorbell doorbell;
+		std::atomic<uint64_t> busyNanoseconds{0};
+		std::thread thread;
+	};
+
+	size_t microBatchSize(size_t microBatch) const
+	{
+		return m_microBatches[microBatch + 1] - m_microBatches[microBatch];
+	}
+
+	template <size_t... IDX>
+	void allocate(size_t columns, std::index_sequence<IDX...>)
+	{
+		(std::get<IDX>(m_outputs).emplace_back(columns), ...);
+		(std::get<IDX>(m_layerGradients).emplace_back(columns), ...);
+	}
+
+	void push(Stage& stage, details::SpscQueue<size_t>& queue, size_t microBatch)
+	{
+		while (!queue.tryPush(microBatch))
+			std::this_thread::yield();
+		stage.doorbell.ring();
+	}
+
+	void pushDone(details::SpscQueue<size_t>& queue, size_t microBatch)
+	{
+		while (!queue.tryPush(microBatch))
+			std::this_thread::yield();
+		m_doneDoorbell.ring();
+	}
+
+	size_t pop(details::SpscQueue<size_t>& queue)
+	{
+		size_t microBatch;
+		while (!queue.tryPop(microBatch))
+			m_doneDoorbell.wait([&queue] { return !queue.empty(); });
+		return microBatch;
+	}
+
+	void stageLoop(size_t stageIdx)
+	{
+		Stage& stage = *m_stages[stageIdx];
+		for (;;)
+		{
+			size_t microBatch;
+			if (stage.backward.tryPop(microBatch))
+				runBackward(stageIdx, microBatch);
+			else if (stage.forward.tryPop(microBatch))
+				runForward(stageIdx, microBatch);
+			else if (m_stop.load())
+				return;
+			else
+				stage.doorbell.wait([&stage, this] {
+					return !stage.forward.empty() || !stage.backward.empty() || m_stop.load();
+				});
+		}
+	}
+
+	void runForward(size_t stageIdx, size_t microBatch)
+	{
+		Stage& stage = *m_stages[stageIdx];
+		const bool last = stageIdx + 1 == m_stages.size();
+		const auto start = Clock::now();
+		forwardLayers(stage, microBatch, std::make_index_sequence<LAYER_C>());
+		if (last && m_training)
+		{
+			lossGradient(microBatch);
+			backwardLayers(stage, microBatch, std::make_index_sequence<LAYER_C>());
+		}
+		addBusyTime(stage, start);
+		if (!last)
+			push(*m_stages[stageIdx + 1], m_stages[stageIdx + 1]->forward, microBatch);
+		else if (!m_training)
+			pushDone(m_forwardDone, microBatch);
+		else
+			passBackward(stageIdx, microBatch);
+	}
+
+	void runBackward(size_t stageIdx, size_t microBatch)
+	{
+		Stage& stage = *m_stages[stageIdx];
+		const auto start = Clock::now();
+		backwardLayers(stage, microBatch, std::make_index_sequence<LAYER_C>());
+		addBusyTime(stage, start);
+		passBackward(stageIdx, microBatch);
+	}
+
+	void passBackward(size_t stageIdx, size_t microBatch)
+	{
+		if (stageIdx == 0)
+			pushDone(m_backwardDone, microBatch);
+		else
+			push(*m_stages[stageIdx - 1], m_stages[stageIdx - 1]->backward, microBatch);
+	}
+
+	static void addBusyTime(Stage& stage, Clock::time_point start)
+	{
+		stage.busyNanoseconds.fetch_add(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count(),
+			std::memory_order_relaxed);
+	}
+
+	template <size_t IDX>
+	const auto& layerInput(size_t microBatch) const
+	{
+		if constexpr (IDX == 0)
+			return m_inputs[microBatch];
+		else
+			return std::get<IDX - 1>(m_outputs)[microBatch];
+	}
+
+	template <size_t... IDX>
+	void forwardLayers(const Stage& stage, size_t microBatch, std::index_sequence<IDX...>)
+	{
+		((IDX >= stage.firstLayer && IDX < stage.endLayer ? forwardLayer<IDX>(microBatch)
+														  : void()),
+		 ...);
+	}
+
+	// Goes through the layers of the stage from the last to the first.
+	template <size_t... IDX>
+	void backwardLayers(const Stage& stage, size_t microBatch, std::index_sequence<IDX...>)
+	{
+		((LAYER_C - 1 - IDX >= stage.firstLayer && LAYER_C - 1 - IDX < stage.endLayer
+			  ? backwardLayer<LAYER_C - 1 - IDX>(microBatch)
+			  : void()),
+		 ...);
+	}
+
+	template <size_t IDX>
+	void forwardLayer(size_t microBatch)
+	{
+		m_hiddenLayers->template layer<IDX>().forward(
+			layerInput<IDX>(microBatch), std::get<IDX>(m_outputs)[microBatch]);
+	}
+
+	// Each stage adds to the gradients of its own layers only.
+	template <size_t IDX>
+	void backwardLayer(size_t microBatch)
+	{
+		auto& layer = m_hiddenLayers->template layer<IDX>();
+		auto& gradient = std::get<IDX>(m_layerGradients)[microBatch];
+		if constexpr (IDX == 0)
+		{
+			if (m_inputGradient.batchSize() != microBatchSize(microBatch))
+				m_inputGradient.setBatchSize(microBatchSize(microBatch));
+			layer.backward(std::get<IDX>(m_outputs)[microBatch], gradient, m_inputGradient);
+		}
+		else
+			layer.backward(
+				std::get<IDX>(m_outputs)[microBatch],
+				gradient,
+				std::get<IDX - 1>(m_layerGradients)[microBatch]);
+		layer.accumulateGradient(
+			layerInput<IDX>(microBatch), gradient, m_gradients->template layer<IDX>());
+	}
+
+	// The gradient of a micro-batch is scaled by its share of the batch, so that the
+	// accumulated gradients are the mean over the batch.
+	void lossGradient(size_t microBatch)
+	{
+		const auto& output = std::get<LAYER_C - 1>(m_outputs)[microBatch];
+		auto& gradient = std::get<LAYER_C - 1>(m_layerGradients)[microBatch];
+		const Accumulator share = Accumulator(microBatchSize(microBatch)) / m_batchSize;
+		m_losses[microBatch] = details::lossGradient(
+			m_lossLayer,
+			output,
+			m_groundTruth[microBatch],
+			gradient,
+			m_totalL2Norm,
+			m_regularization,
+			share);
+	}
+
+	HiddenLayers* m_hiddenLayers;
+	LossLayer m_lossLayer;
+	size_t m_batchSize;
+	// Micro-batch ii holds the columns [m_microBatches[ii], m_microBatches[ii + 1]).
+	std::vector<size_t> m_microBatches;
+
+	std::vector<Tensor<Float, inputCount()>> m_inputs;
+	std::vector<Tensor<GroundTruthFloat, groundTruthCount()>> m_groundTruth;
+	TensorTuple m_outputs;
+	TensorTuple m_layerGradients;
+	std::vector<Accumulator> m_losses;
+	// Only read by the stage of the first layer, which has no use for it.
+	Tensor<Float, inputCount()> m_inputGradient;
+	Tensor<Float, outputCount()> m_output;
+	Gradients m_stepGradients;
+
+	// Set before the micro-batches of a call are pushed, which orders them before their use
+	// on the stage threads.
+	bool m_training = false;
+	Gradients* m_gradients = nullptr;
+	Accumulator m_regularization{0};
+	Accumulator m_totalL2Norm{0};
+
+	std::vector<std::unique_ptr<Stage>> m_stages;
+	details::SpscQueue<size_t> m_forwardDone;
+	details::SpscQueue<size_t> m_backwardDone;
+	details::Doorbell m_doneDoorbell;
+	std::atomic<bool> m_stop{false};
+	Clock::duration m_wallTime = Clock::duration::zero();
+};
+
+} // namespace nnp
@@ -0,0 +1,562 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace nnp {
+
+// Parts of a training step that are profiled separately. The loss is profiled as an extra
+// layer after the last one. RECOMPUTE is the second forward pass of the layers between
+// checkpoints, see TupleNetwork::Workspace.
+enum class ProfilePhase
+{
+	FORWARD,
+	BACKWARD,
+	UPDATE,
+	L2_NORM,
+	LOSS,
+	RECOMPUTE
+};
+
+constexpr size_t PROFILE_PHASE_C = 6;
+
+inline const char* profilePhaseName(ProfilePhase phase)
+{
+	constexpr const char* names[PROFILE_PHASE_C] = {
+		"forward", "backward", "update", "l2Norm", "loss", "recompute"};
+	return names[static_cast<size_t>(phase)];
+}
+
+// Work of a phase, estimated from the shape of the layer.
+struct PhaseCost
+{
+	double flops;
+	double bytes;
+};
+
+namespace details {
+
+// Counts the calls of the global operator new once NNP_COUNT_ALLOCATIONS is expanded.
+inline std::atomic<uint64_t>& allocationCount()
+{
+	static std::atomic<uint64_t> count{0};
+	return count;
+}
+
+// Bytes allocated through the global operator new and not deleted yet, and their peak since
+// the last resetPeak(), once NNP_COUNT_ALLOCATIONS is expanded.
+class HeapUsage
+{
+public:
+	void allocate(uint64_t size)
+	{
+		const uint64_t current = m_current.fetch_add(size, std::memory_order_relaxed) + size;
+		uint64_t peak = m_peak.load(std::memory_order_relaxed);
+		while (current > peak &&
+			   !m_peak.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+		{}
+	}
+
+	void deallocate(uint64_t size) { m_current.fetch_sub(size, std::memory_order_relaxed); }
+
+	uint64_t current() const { return m_current.load(std::memory_order_relaxed); }
+
+	uint64_t peak() const { return m_peak.load(std::memory_order_relaxed); }
+
+	void resetPeak() { m_peak.store(current(), std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t> m_current{0};
+	std::atomic<uint64_t> m_peak{0};
+};
+
+inline HeapUsage& heapUsage()
+{
+	static HeapUsage usage;
+	return usage;
+}
+
+// The size of each allocation is kept in front of it so that deleting it can be counted. The
+// header is widened to the alignment of over-aligned allocations.
+constexpr size_t COUNTED_HEADER = alignof(std::max_align_t);
+
+inline void* allocateCounted(size_t size, size_t alignment = COUNTED_HEADER)
+{
+	allocationCount().fetch_add(1, std::memory_order_relaxed);
+	const size_t header = std::max(alignment, COUNTED_HEADER);
+	// aligned_alloc() takes a multiple of the alignment.
+	const size_t blockSize = (size + header + alignment - 1) / alignment * alignment;
+	auto* block = static_cast<unsigned char*>(
+		alignment <= COUNTED_HEADER ? std::malloc(size + header)
+									: std::aligned_alloc(alignment, blockSize));
+	if (!block)
+		throw std::bad_alloc();
+	std::memcpy(block, &size, sizeof(size));
+	heapUsage().allocate(size);
+	return block + header;
+}
+
+inline void* allocateCounted(size_t size, size_t alignment, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return allocateCounted(size, alignment);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return nullptr;
+	}
+}
+
+inline void freeCounted(void* ptr, size_t alignment = COUNTED_HEADER)
+{
+	if (!ptr)
+		return;
+	auto* block = static_cast<unsigned char*>(ptr) - std::max(alignment, COUNTED_HEADER);
+	size_t size;
+	std::memcpy(&size, block, sizeof(size));
+	heapUsage().deallocate(size);
+	std::free(block);
+}
+
+// The products dominate the forward pass, the input gradient and the weight gradient. Bytes
+// count every tensor once, and the weights twice when they are updated.
+template <typename Float>
+PhaseCost phaseCost(ProfilePhase phase, size_t nodeCount, size_t inputCount, size_t batchSize)
+{
+	const double weights = double(nodeCount) * inputCount;
+	const double inputs = double(inputCount) * batchSize;
+	const double outputs = double(nodeCount) * batchSize;
+	const double product = 2 * weights * batchSize;
+	switch (phase)
+	{
+	case ProfilePhase::FORWARD:
+	case ProfilePhase::RECOMPUTE:
+		return {
+			product + 2 * outputs, (weights + nodeCount + inputs + outputs) * sizeof(Float)};
+	case ProfilePhase::BACKWARD:
+		return {product + outputs, (weights + inputs + 2 * outputs) * sizeof(Float)};
+	case ProfilePhase::UPDATE:
+		return {
+			product + 3 * weights + outputs,
+			(2 * weights + 2 * nodeCount + inputs + outputs) * sizeof(Float)};
+	case ProfilePhase::L2_NORM:
+		return {2 * weights, weights * sizeof(Float)};
+	case ProfilePhase::LOSS:
+		return {5 * outputs, 2 * outputs * sizeof(Float)};
+	}
+	return {0, 0};
+}
+
+template <typename Profiler, typename = void>
+struct IsProfiler : std::false_type
+{};
+
+template <typename Profiler>
+struct IsProfiler<
+	Profiler,
+	std::void_t<decltype(std::declval<Profiler&>().scope(
+		size_t{}, ProfilePhase::FORWARD, std::declval<PhaseCost>()))>> : std::true_type
+{};
+
+// Keeps the overloads that take a profiler from matching arguments of other types.
+template <typename Profiler>
+using EnableIfProfiler = std::enable_if_t<IsProfiler<std::decay_t<Profiler>>::value>;
+
+} // namespace details
+
+// The default profiling policy of the network passes. Its scopes are empty and compile away.
+class NullProfiler
+{
+public:
+	struct Scope
+	{
+		// User-provided, so that unused scopes do not warn.
+		~Scope() {}
+	};
+
+	Scope scope(size_t, ProfilePhase, const PhaseCost&) { return {}; }
+
+	Scope step() { return {}; }
+};
+
+// Records the wall time, the estimated FLOPs and bytes and the allocation count of every
+// phase of every layer, and keeps a trace of each call for writeChromeTrace(). Pass one to
+// the propagate(), backward() or forward() overloads of TupleNetwork or Network that take a
+// profiler. Each of these calls is a step. A profiler must only be used by one thread.
+//
+// Allocations are counted only in programs that expand NNP_COUNT_ALLOCATIONS once.
+class Profiler
+{
+	using Clock = std::chrono::steady_clock;
+
+public:
+	struct Stats
+	{
+		double seconds = 0;
+		double flops = 0;
+		double bytes = 0;
+		uint64_t allocations = 0;
+		uint64_t calls = 0;
+
+		void add(const Stats& other)
+		{
+			seconds += other.seconds;
+			flops += other.flops;
+			bytes += other.bytes;
+			allocations += other.allocations;
+			calls += other.calls;
+		}
+	};
+
+	// Stats indexed by layer and then phase. The loss is the layer after the last one.
+	using Table = std::vector<std::array<Stats, PROFILE_PHASE_C>>;
+
+	class Scope
+	{
+	public:
+		Scope(Profiler* profiler, size_t layer, ProfilePhase phase, const PhaseCost& cost)
+			: m_profiler(profiler)
+			, m_layer(layer)
+			, m_phase(phase)
+			, m_cost(cost)
+			, m_allocations(details::allocationCount().load(std::memory_order_relaxed))
+			, m_start(Clock::now())
+		{}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+		~Scope()
+		{
+			const auto end = Clock::now();
+			const uint64_t allocations =
+				details::allocationCount().load(std::memory_order_relaxed) - m_allocations;
+			m_profiler->record(m_layer, m_phase, m_cost, allocations, m_start, end);
+		}
+
+	private:
+		Profiler* m_profiler;
+		size_t m_layer;
+		ProfilePhase m_phase;
+		PhaseCost m_cost;
+		uint64_t m_allocations;
+		Clock::time_point m_start;
+	};
+
+	class StepScope
+	{
+	public:
+		explicit StepScope(Profiler* profiler)
+			: m_profiler(profiler)
+			, m_start(Clock::now())
+		{
+			++m_profiler->m_stepDepth;
+		}
+
+		StepScope(const StepScope&) = delete;
+		StepScope& operator=(const StepScope&) = delete;
+
+		~StepScope()
+		{
+			if (--m_profiler->m_stepDepth == 0)
+				m_profiler->endStep(m_start, Clock::now());
+		}
+
+	private:
+		Profiler* m_profiler;
+		Clock::time_point m_start;
+	};
+
+	// Keeps the trace events of at most traceCapacity calls, and stops tracing after that.
+	explicit Profiler(size_t traceCapacity = size_t{1} << 20)
+		: m_traceCapacity(traceCapacity)
+		, m_origin(Clock::now())
+	{
+		m_trace.reserve(std::min(traceCapacity, size_t{1} << 16));
+	}
+
+	Scope scope(size_t layer, ProfilePhase phase, const PhaseCost& cost)
+	{
+		return Scope(this, layer, phase, cost);
+	}
+
+	// Steps may nest, only the outermost one counts.
+	StepScope step() { return StepScope(this); }
+
+	size_t stepCount() const { return m_stepCount; }
+
+	// Stats of the last complete step.
+	const Table& lastStep() const { return m_lastStep; }
+
+	// Stats summed over every step since construction or reset().
+	const Table& total() const { return m_total; }
+
+	void reset()
+	{
+		m_current.clear();
+		m_lastStep.clear();
+		m_total.clear();
+		m_trace.clear();
+		m_stepCount = 0;
+		m_lastStepSeconds = 0;
+		m_totalSeconds = 0;
+		m_origin = Clock::now();
+	}
+
+	// Writes a table of the last step next to the mean of all steps, one row per layer and
+	// phase that ran.
+	void writeSummary(std::ostream& os) const
+	{
+		const auto flags = os.flags();
+		const auto precision = os.precision();
+		const double meanSeconds = m_stepCount ? m_totalSeconds / m_stepCount : 0;
+		os << std::fixed << std::setprecision(3) << "step " << m_stepCount << ": "
+		   << m_lastStepSeconds * 1e3 << " ms, mean " << meanSeconds * 1e3 << " ms\n"
+		   << std::left << std::setw(6) << "layer" << std::setw(10) << "phase" << std::right
+		   << std::setw(10) << "ms" << std::setw(10) << "mean ms" << std::setw(10) << "GFLOP/s"
+		   << std::setw(10) << "GB/s" << std::setw(8) << "allocs" << '\n';
+		for (size_t layer = 0; layer != m_lastStep.size(); ++layer)
+			for (size_t phase = 0; phase != PROFILE_PHASE_C; ++phase)
+			{
+				const Stats& last = m_lastStep[layer][phase];
+				if (last.calls == 0)
+					continue;
+				const Stats& total = m_total[layer][phase];
+				const double seconds = last.seconds > 0 ? last.seconds : 1e-12;
+				os << std::left << std::setw(6) << layer << std::setw(10)
+				   << profilePhaseName(static_cast<ProfilePhase>(phase)) << std::right
+				   << std::setw(10) << last.seconds * 1e3 << std::setw(10)
+				   << total.seconds / m_stepCount * 1e3 << std::setw(10)
+				   << last.flops / seconds * 1e-9 << std::setw(10)
+				   << last.bytes / seconds * 1e-9 << std::setw(8) << last.allocations << '\n';
+			}
+		os.flags(flags);
+		os.precision(precision);
+	}
+
+	// Writes the traced steps and calls in the Trace Event Format of chrome://tracing and
+	// Perfetto, one complete event per call with its FLOPs, bytes and allocations as args.
+	void writeChromeTrace(std::ostream& os) const
+	{
+		const auto flags = os.flags();
+		const auto precision = os.precision();
+		os << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+		for (size_t ii = 0; ii != m_trace.size(); ++ii)
+		{
+			const TraceEvent& event = m_trace[ii];
+			os << (ii ? ",\n" : "\n") << "{\"name\":\"";
+			if (event.step)
+				os << "step\",\"cat\":\"step\"";
+			else
+			{
+				const char* phase = profilePhaseName(event.phase);
+				if (event.phase == ProfilePhase::LOSS)
+					os << "loss";
+				else
+					os << "layer " << event.layer << ' ' << phase;
+				os << "\",\"cat\":\"" << phase << '"';
+			}
+			os << ",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":" << event.start * 1e-3
+			   << ",\"dur\":" << event.duration * 1e-3;
+			if (!event.step)
+				os << std::setprecision(0) << ",\"args\":{\"flops\":" << event.flops
+				   << ",\"bytes\":" << event.bytes << ",\"allocations\":" << event.allocations
+				   << '}' << std::setprecision(3);
+			os << '}';
+		}
+		os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+		os.flags(flags);
+		os.precision(precision);
+	}
+
+	void writeChromeTrace(const std::string& path) const
+	{
+		std::ofstream file(path, std::ios::trunc);
+		if (!file)
+			throw std::runtime_error("Failed opening trace " + path + " for writing");
+		writeChromeTrace(file);
+		if (!file)
+			throw std::runtime_error("Failed writing trace " + path);
+	}
+
+private:
+	struct TraceEvent
+	{
+		bool step;
+		size_t layer;
+		ProfilePhase phase;
+		// Nanoseconds since the origin.
+		int64_t start;
+		int64_t duration;
+		double flops;
+		double bytes;
+		uint64_t allocations;
+	};
+
+	static int64_t nanoseconds(Clock::duration duration)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	}
+
+	void record(
+		size_t layer,
+		ProfilePhase phase,
+		const PhaseCost& cost,
+		uint64_t allocations,
+		Clock::time_point start,
+		Clock::time_point end)
+	{
+		if (m_current.size() <= layer)
+			m_current.resize(layer + 1);
+		Stats& stats = m_current[layer][static_cast<size_t>(phase)];
+		stats.seconds += std::chrono::duration<double>(end - start).count();
+		stats.flops += cost.flops;
+		stats.bytes += cost.bytes;
+		stats.allocations += allocations;
+		++stats.calls;
+		trace({false,
+			   layer,
+			   phase,
+			   nanoseconds(start - m_origin),
+			   nanoseconds(end - start),
+			   cost.flops,
+			   cost.bytes,
+			   allocations});
+	}
+
+	void endStep(Clock::time_point start, Clock::time_point end)
+	{
+		if (m_total.size() < m_current.size())
+			m_total.resize(m_current.size());
+		for (size_t layer = 0; layer != m_current.size(); ++layer)
+			for (size_t phase = 0; phase != PROFILE_PHASE_C; ++phase)
+				m_total[layer][phase].add(m_current[layer][phase]);
+		// Swapping keeps the memory of both tables, so steps do not allocate.
+		std::swap(m_lastStep, m_current);
+		m_current.resize(m_lastStep.size());
+		for (auto& phases : m_current)
+			phases.fill(Stats());
+		++m_stepCount;
+		m_lastStepSeconds = std::chrono::duration<double>(end - start).count();
+		m_totalSeconds += m_lastStepSeconds;
+		trace({true,
+			   0,
+			   ProfilePhase::FORWARD,
+			   nanoseconds(start - m_origin),
+			   nanoseconds(end - start),
+			   0,
+			   0,
+			   0});
+	}
+
+	void trace(const TraceEvent& event)
+	{
+		if (m_trace.size() != m_traceCapacity)
+			m_trace.push_back(event);
+	}
+
+	size_t m_traceCapacity;
+	Clock::time_point m_origin;
+	Table m_current;
+	Table m_lastStep;
+	Table m_total;
+	std::vector<TraceEvent> m_trace;
+	size_t m_stepDepth = 0;
+	size_t m_stepCount = 0;
+	double m_lastStepSeconds = 0;
+	double m_totalSeconds = 0;
+};
+
+} // namespace nnp
+
+// Replaces every global operator new and delete, array, nothrow and over-aligned ones
+// included, with ones that count allocations for Profiler and track the bytes in use for
+// heapUsage(). Placement new does not allocate and is not counted. Expand it at namespace
+// scope in exactly one source file of a program.
+#define NNP_COUNT_ALLOCATIONS                                                                 \
+	void* operator new(std::size_t size) { return nnp::details::allocateCounted(size); }      \
+	void* operator new[](std::size_t size) { return nnp::details::allocateCounted(size); }    \
+	void* operator new(std::size_t size, const std::nothrow_t& tag) noexcept                  \
+	{                                                                                         \
+		return nnp::details::allocateCounted(size, nnp::details::COUNTED_HEADER, tag);        \
+	}                                                                                         \
+	void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept                \
+	{                                                                                         \
+		return nnp::details::allocateCounted(size, nnp::details::COUNTED_HEADER, tag);        \
+	}                                                                                         \
+	void* operator new(std::size_t size, std::align_val_t al)                                 \
+	{                                                                                         \
+		return nnp::details::allocateCounted(size, static_cast<std::size_t>(al));             \
+	}                                                                                         \
+	void* operator new[](std::size_t size, std::align_val_t al)                               \
+	{                                                                                         \
+		return nnp::details::allocateCounted(size, static_cast<std::size_t>(al));             \
+	}                                                                                         \
+	void* operator new(std::size_t size, std::align_val_t al, const std::nothrow_t& tag)      \
+		noexcept                                                                              \
+	{                                                                                         \
+		return nnp::details::allocateCounted(size, static_cast<std::size_t>(al), tag);        \
+	}                                                                                         \
+	void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t& tag)    \
+		noexcept                                                                              \
+	{                                                                                         \
+		return nnp::details::allocateCounted(size, static_cast<std::size_t>(al), tag);        \
+	}                                                                                         \
+	void operator delete(void* ptr) noexcept { nnp::details::freeCounted(ptr); }              \
+	void operator delete[](void* ptr) noexcept { nnp::details::freeCounted(ptr); }            \
+	void operator delete(void* ptr, std::size_t) noexcept                                     \
+	{                                                                                         \
+		nnp::details::freeCounted(ptr);                                                       \
+	}                                                                                         \
+	void operator delete[](void* ptr, std::size_t) noexcept                                   \
+	{                                                                                         \
+		nnp::details::freeCounted(ptr);                                                       \
+	}                                                                                         \
+	void operator delete(void* ptr, const std::nothrow_t&) noexcept                           \
+	{                                                                                         \
+		nnp::details::freeCounted(ptr);                                                       \
+	}                                                                                         \
+	void operator delete[](void* ptr, const std::nothrow_t&) noexcept                         \
+	{                                                                                         \
+		nnp::details::freeCounted(ptr);                                                       \
+	}                                                                                         \
+	void operator delete(void* ptr, std::align_val_t al) noexcept                             \
+	{                                                                                         \
+		nnp::details::freeCounted(ptr, static_cast<std::size_t>(al));                         \
+	}                                                                                         \
+	void operator delete[](void* ptr, std::align_val_t al) noexcept                           \
+	{                                                                                         \
+		nnp::details::freeCounted(ptr, static_cast<std::size_t>(al));                         \
+	}                                                                                         \
+	void operator delete(void* ptr, std::size_t, std::align_val_t al) noexcept                \
+	{                                                                                         \
+		nnp::details::freeCounted(ptr, static_cast<std::size_t>(al));                         \
+	}                                                                                         \
+	void operator delete[](void* ptr, std::size_t, std::align_val_t al) noexcept              \
+	{                                                                                         \
+		nnp::details::freeCounted(ptr, static_cast<std::size_t>(al));                         \
+	}                                                                                         \
+	void operator delete(void* ptr, std::align_val_t al, const std::nothrow_t&) noexcept      \
+	{                                                                                         \
+		nnp::details::freeCounted(ptr, static_cast<std::size_t>(al));                         \
+	}                                                                                         \
+	void operator delete[](void* ptr, std::align_val_t al, const std::nothrow_t&) noexcept    \
+	{                                                                                         \
+		nnp::details::freeCounted(ptr, static_cast<std::size_t>(al));                         \
+	}
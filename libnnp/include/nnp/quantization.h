@@ -0,0 +1,432 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <dlib/matrix/matrix.h>
+
+#include "activation.h"
+#include "common.h"
+#include "details/simd.h"
+#include "layer.h"
+#include "network.h"
+#include "tensor.h"
+
+namespace nnp {
+
+// Affine mapping of unsigned bytes to real values: value = scale * (q - zeroPoint).
+struct QuantizationParams
+{
+	float scale;
+	int32_t zeroPoint;
+};
+
+// Inference layer with signed 8-bit weights, scaled per output channel, reading unsigned 8-bit
+// activations. The products are summed exactly in 32 bits. Hidden layers requantize the sums
+// to bytes and the last layer of a network returns them as floats. Linear and ReLU outputs are
+// requantized in a single pass, the clamp to the zero point being the ReLU. Other activations
+// go through float. Built by quantize().
+template <typename Activation, size_t NODE_C, size_t INPUT_C>
+class QuantizedLayer
+{
+	static_assert(
+		NODE_C != RESIZEABLE && INPUT_C != RESIZEABLE,
+		"Quantized layers need layer sizes known at compile time");
+
+	static constexpr bool FUSED = std::is_same<Activation, LinearActivation>::value ||
+		std::is_same<Activation, ReluActivation>::value;
+
+public:
+	// The weights are rounded to multiples of the largest magnitude of their row divided by
+	// 127. The bias is stored at the scale of the products, with the input zero point folded
+	// in.
+	template <typename Float>
+	QuantizedLayer(
+		const dlib::matrix<Float, NODE_C, INPUT_C>& weights,
+		const dlib::matrix<Float, NODE_C, 1>& bias,
+		QuantizationParams input,
+		QuantizationParams output)
+		: m_output(output)
+	{
+		for (size_t jj = 0; jj != NODE_C; ++jj)
+		{
+			double maxAbs = 0;
+			for (size_t ii = 0; ii != INPUT_C; ++ii)
+				maxAbs = std::max(maxAbs, std::abs(static_cast<double>(weights(jj, ii))));
+			const double weightScale = maxAbs == 0 ? 1 : maxAbs / 127;
+			int64_t rowSum = 0;
+			for (size_t ii = 0; ii != INPUT_C; ++ii)
+			{
+				m_weights(jj, ii) = static_cast<int8_t>(
+					std::nearbyint(static_cast<double>(weights(jj, ii)) / weightScale));
+				rowSum += m_weights(jj, ii);
+			}
+			const double scale = input.scale * weightScale;
+			const double q = std::nearbyint(static_cast<double>(bias(jj)) / scale) -
+				static_cast<double>(input.zeroPoint * rowSum);
+			m_bias(jj) = static_cast<int32_t>(std::clamp<double>(
+				q,
+				std::numeric_limits<int32_t>::min(),
+				std::numeric_limits<int32_t>::max()));
+			m_scale(jj) = static_cast<float>(scale);
+			m_multiplier(jj) = static_cast<float>(scale / output.scale);
+		}
+	}
+
+	template <typename OutputType, size_t BATCH_SIZE = RESIZEABLE>
+	void forward(
+		const Tensor<uint8_t, INPUT_C, BATCH_SIZE>& input,
+		Tensor<OutputType, NODE_C, BATCH_SIZE>& output) const
+	{
+		if constexpr (BATCH_SIZE == RESIZEABLE)
+			output.setBatchSize(input.batchSize());
+		for (size_t ii = 0; ii != input.batchSize(); ++ii)
+			infer(&input(0, ii), &output(0, ii));
+	}
+
+	void infer(const uint8_t* input, uint8_t* output) const
+	{
+		alignas(64) std::array<int32_t, NODE_C> acc;
+		details::simd::gemvU8S8(
+			m_weights.begin(), input, m_bias.begin(), acc.data(), NODE_C, INPUT_C);
+		if constexpr (FUSED)
+			details::simd::requantize(
+				acc.data(), m_multiplier.begin(), output, NODE_C, m_output.zeroPoint);
+		else
+		{
+			alignas(64) std::array<float, NODE_C> y;
+			dequantize(acc.data(), y.data());
+			details::simd::quantize(
+				y.data(), output, NODE_C, 1.f / m_output.scale, m_output.zeroPoint);
+		}
+	}
+
+	void infer(const uint8_t* input, float* output) const
+	{
+		alignas(64) std::array<int32_t, NODE_C> acc;
+		details::simd::gemvU8S8(
+			m_weights.begin(), input, m_bias.begin(), acc.data(), NODE_C, INPUT_C);
+		dequantize(acc.data(), output);
+	}
+
+	const QuantizationParams& outputParams() const { return m_output; }
+
+	static constexpr size_t nodeCount() { return NODE_C; }
+
+	static constexpr size_t inputCount() { return INPUT_C; }
+
+private:
+	void dequantize(const int32_t* acc, float* output) const
+	{
+		for (size_t jj = 0; jj != NODE_C; ++jj)
+			output[jj] = static_cast<float>(acc[jj]) * m_scale(jj);
+		Activation::forwardRange(output, output + NODE_C);
+	}
+
+	dlib::matrix<int8_t, NODE_C, INPUT_C> m_weights;
+	dlib::matrix<int32_t, NODE_C, 1> m_bias;
+	dlib::matrix<float, NODE_C, 1> m_scale;
+	dlib::matrix<float, NODE_C, 1> m_multiplier;
+	QuantizationParams m_output;
+};
+
+// Inference network of QuantizedLayers. Takes and returns float tensors, the input is
+// quantized with the parameters given to the constructor.
+template <typename... Layers>
+class QuantizedTupleNetwork
+{
+	using LayerTuple = std::tuple<Layers...>;
+
+	template <size_t IDX>
+	using LayerType = std::tuple_element_t<IDX, LayerTuple>;
+
+public:
+	template <typename... Types>
+	explicit QuantizedTupleNetwork(QuantizationParams input, Types&&... types)
+		: m_input(input)
+		, m_layers(std::forward<Types>(types)...)
+	{}
+
+	static constexpr size_t layerCount() { return sizeof...(Layers); }
+
+	static constexpr size_t outputCount() { return LayerType<layerCount() - 1>::nodeCount(); }
+
+	static constexpr size_t inputCount() { return LayerType<0>::inputCount(); }
+
+	template <size_t IDX>
+	const LayerType<IDX>& layer() const
+	{
+		return std::get<IDX>(m_layers);
+	}
+
+	const QuantizationParams& inputParams() const { return m_input; }
+
+	// Quantized input and activations of every layer, the last one in float.
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	class Workspace
+	{
+		template <size_t IDX>
+		using LayerTensor = Tensor<
+			std::conditional_t<IDX + 1 == layerCount(), float, uint8_t>,
+			LayerType<IDX>::nodeCount(),
+			BATCH_SIZE>;
+
+		template <typename Sequence>
+		struct TensorTupleHelper;
+
+		template <size_t... IDX>
+		struct TensorTupleHelper<std::index_sequence<IDX...>>
+		{
+			using Type = std::tuple<LayerTensor<IDX>...>;
+		};
+
+		using TensorTuple =
+			typename TensorTupleHelper<std::make_index_sequence<layerCount()>>::Type;
+
+	public:
+		explicit Workspace(size_t batchSize = BATCH_SIZE)
+		{
+			if constexpr (BATCH_SIZE == RESIZEABLE)
+			{
+				auto setBatchSize = [batchSize](auto&... tensors) {
+					(tensors.setBatchSize(batchSize), ...);
+				};
+				std::apply(setBatchSize, m_outputs);
+				m_input.setBatchSize(batchSize);
+			}
+			else
+				assert(batchSize == BATCH_SIZE);
+		}
+
+		size_t batchSize() const { return m_input.batchSize(); }
+
+		Tensor<uint8_t, inputCount(), BATCH_SIZE>& input() { return m_input; }
+
+		template <size_t IDX>
+		LayerTensor<IDX>& output()
+		{
+			return std::get<IDX>(m_outputs);
+		}
+
+		template <size_t IDX>
+		const LayerTensor<IDX>& output() const
+		{
+			return std::get<IDX>(m_outputs);
+		}
+
+	private:
+		Tensor<uint8_t, inputCount(), BATCH_SIZE> m_input;
+		TensorTuple m_outputs;
+	};
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	const Tensor<float, outputCount(), BATCH_SIZE>& forward(
+		Workspace<BATCH_SIZE>& workspace,
+		const Tensor<float, inputCount(), BATCH_SIZE>& input) const
+	{
+		assert(workspace.batchSize() == input.batchSize());
+		auto& quantized = workspace.input();
+		for (size_t ii = 0; ii != input.batchSize(); ++ii)
+			quantizeInput(&input(0, ii), &quantized(0, ii));
+		return forwardHelper<0>(workspace, quantized);
+	}
+
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	Tensor<float, outputCount(), BATCH_SIZE>
+		forward(const Tensor<float, inputCount(), BATCH_SIZE>& input) const
+	{
+		Workspace<BATCH_SIZE> workspace(input.batchSize());
+		return forward(workspace, input);
+	}
+
+	// Forward pass of a single sample that keeps the intermediate activations on the stack.
+	void infer(const float* input, float* output) const
+	{
+		alignas(64) std::array<uint8_t, inputCount()> quantized;
+		quantizeInput(input, quantized.data());
+		inferHelper<0>(quantized.data(), output);
+	}
+
+	std::array<float, outputCount()> infer(const std::array<float, inputCount()>& input) const
+	{
+		std::array<float, outputCount()> output;
+		infer(input.data(), output.data());
+		return output;
+	}
+
+private:
+	static_assert(layerCount() > 0, "There must be at least one layer in a network");
+
+	void quantizeInput(const float* input, uint8_t* output) const
+	{
+		details::simd::quantize(
+			input, output, inputCount(), 1.f / m_input.scale, m_input.zeroPoint);
+	}
+
+	template <size_t IDX, size_t BATCH_SIZE>
+	const Tensor<float, outputCount(), BATCH_SIZE>& forwardHelper(
+		Workspace<BATCH_SIZE>& workspace,
+		const Tensor<uint8_t, LayerType<IDX>::inputCount(), BATCH_SIZE>& input) const
+	{
+		auto& output = workspace.template output<IDX>();
+		std::get<IDX>(m_layers).forward(input, output);
+		if constexpr (IDX + 1 == layerCount())
+			return output;
+		else
+			return forwardHelper<IDX + 1>(workspace, output);
+	}
+
+	template <size_t IDX>
+	void inferHelper(const uint8_t* input, float* output) const
+	{
+		if constexpr (IDX + 1 == layerCount())
+			std::get<IDX>(m_layers).infer(input, output);
+		else
+		{
+			alignas(64) std::array<uint8_t, LayerType<IDX>::nodeCount()> layerOutput;
+			std::get<IDX>(m_layers).infer(input, layerOutput.data());
+			inferHelper<IDX + 1>(layerOutput.data(), output);
+		}
+	}
+
+	QuantizationParams m_input;
+	LayerTuple m_layers;
+};
+
+namespace details {
+
+namespace quantization {
+
+template <typename Activation>
+struct IsNonNegative
+	: std::bool_constant<
+		  std::is_same<Activation, ReluActivation>::value ||
+		  std::is_same<Activation, SigmoidActivation>::value>
+{};
+
+// Non-negative ranges use all 256 levels from a zero point of 0, others are symmetric around
+// 128.
+inline QuantizationParams paramsFor(float range, bool nonNegative)
+{
+	if (!(range > 0))
+		range = 1;
+	if (nonNegative)
+		return {range / 255, 0};
+	return {range / 127, 128};
+}
+
+struct Range
+{
+	float min = 0;
+	float max = 0;
+};
+
+template <typename Float, size_t SIZE, size_t BATCH_SIZE>
+Range rangeOf(const Tensor<Float, SIZE, BATCH_SIZE>& tensor)
+{
+	Range range;
+	for (size_t ii = 0; ii != tensor.batchSize(); ++ii)
+		for (size_t jj = 0; jj != tensor.size(); ++jj)
+		{
+			const float value = static_cast<float>(tensor(jj, ii));
+			range.min = std::min(range.min, value);
+			range.max = std::max(range.max, value);
+		}
+	return range;
+}
+
+template <typename Layer>
+struct LayerTraits;
+
+template <
+	typename Activation_,
+	typename Float,
+	size_t NODE_C,
+	size_t INPUT_C,
+	typename Optimizer,
+	typename Layout>
+struct LayerTraits<ComputationalLayer<Activation_, Float, NODE_C, INPUT_C, Optimizer, Layout>>
+{
+	using Activation = Activation_;
+	using Quantized = QuantizedLayer<Activation, NODE_C, INPUT_C>;
+};
+
+template <typename Network>
+struct QuantizedNetworkHelper;
+
+template <typename... Layers>
+struct QuantizedNetworkHelper<TupleNetwork<Layers...>>
+{
+	using Type = QuantizedTupleNetwork<typename LayerTraits<Layers>::Quantized...>;
+};
+
+// Runs the float network layer by layer and records the range of every layer output.
+template <size_t IDX, typename Network, typename Float, size_t SIZE, size_t BATCH_SIZE>
+void calibrate(
+	const Network& network,
+	const Tensor<Float, SIZE, BATCH_SIZE>& input,
+	std::array<Range, Network::layerCount()>& ranges)
+{
+	const auto output = network.template layer<IDX>().forward(input);
+	ranges[IDX] = rangeOf(output);
+	if constexpr (IDX + 1 != Network::layerCount())
+		calibrate<IDX + 1>(network, output, ranges);
+}
+
+template <typename... Layers, typename Float, size_t BATCH_SIZE, size_t... IDX>
+typename QuantizedNetworkHelper<TupleNetwork<Layers...>>::Type quantize(
+	const TupleNetwork<Layers...>& network,
+	const Tensor<Float, TupleNetwork<Layers...>::inputCount(), BATCH_SIZE>& calibration,
+	std::index_sequence<IDX...>)
+{
+	std::array<Range, sizeof...(Layers)> ranges;
+	calibrate<0>(network, calibration, ranges);
+
+	// params[IDX] is the input of layer IDX. The input range is symmetric unless the whole
+	// calibration set is non-negative.
+	std::array<QuantizationParams, sizeof...(Layers) + 1> params;
+	const Range inputRange = rangeOf(calibration);
+	params[0] = paramsFor(
+		std::max(inputRange.max, -inputRange.min), inputRange.min >= 0);
+	((params[IDX + 1] = paramsFor(
+		  std::max(ranges[IDX].max, -ranges[IDX].min),
+		  IsNonNegative<typename LayerTraits<Layers>::Activation>::value)),
+	 ...);
+
+	return typename QuantizedNetworkHelper<TupleNetwork<Layers...>>::Type(
+		params[0],
+		typename LayerTraits<Layers>::Quantized(
+			network.template layer<IDX>().weights(),
+			network.template layer<IDX>().bias(),
+			params[IDX],
+			params[IDX + 1])...);
+}
+
+} // namespace quantization
+
+} // namespace details
+
+// 8-bit inference network for a TupleNetwork, see quantize().
+template <typename Network>
+using QuantizedNetwork = typename details::quantization::QuantizedNetworkHelper<Network>::Type;
+
+// Post-training quantization. The ranges of the input and of every layer output are taken
+// from a forward pass of the float network over calibration, which should be representative
+// of the inputs the quantized network will see. Values outside of them saturate.
+template <typename... Layers, typename Float, size_t BATCH_SIZE>
+QuantizedNetwork<TupleNetwork<Layers...>> quantize(
+	const TupleNetwork<Layers...>& network,
+	const Tensor<Float, TupleNetwork<Layers...>::inputCount(), BATCH_SIZE>& calibration)
+{
+	return details::quantization::quantize(
+		network, calibration, std::index_sequence_for<Layers...>());
+}
+
+} // namespace nnp
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include <dlib/matrix/matrix.h>
+
+#include "activation.h"
+#include "common.h"
+#include "float16.h"
+#include "tensor.h"
+
+namespace nnp {
+
+// Batch of sparse samples in compressed sparse column form, the counterpart of a column-major
+// Tensor for inputs with many dimensions and few non-zeros, such as one-hot or hashed
+// features. Column ii has the value values(ii)[kk] at row indices(ii)[kk] for every kk below
+// nonZeroCount(ii), and every other row is zero.
+template <typename Float, size_t SIZE>
+class SparseTensor
+{
+public:
+	// Appends a column of count non-zeros. Indices may be unsorted and repeated.
+	void addColumn(const uint32_t* indices, const Float* values, size_t count)
+	{
+		assert(std::all_of(indices, indices + count, [](uint32_t ii) { return ii < SIZE; }));
+		m_indices.insert(m_indices.end(), indices, indices + count);
+		m_values.insert(m_values.end(), values, values + count);
+		m_offsets.push_back(m_indices.size());
+	}
+
+	// Appends a column whose non-zeros are all 1.
+	void addColumn(const uint32_t* indices, size_t count)
+	{
+		assert(std::all_of(indices, indices + count, [](uint32_t ii) { return ii < SIZE; }));
+		m_indices.insert(m_indices.end(), indices, indices + count);
+		m_values.insert(m_values.end(), count, Float{1});
+		m_offsets.push_back(m_indices.size());
+	}
+
+	void reserve(size_t batchSize, size_t nonZeroCount)
+	{
+		m_indices.reserve(nonZeroCount);
+		m_values.reserve(nonZeroCount);
+		m_offsets.reserve(batchSize + 1);
+	}
+
+	// Removes every column and keeps the memory.
+	void clear()
+	{
+		m_indices.clear();
+		m_values.clear();
+		m_offsets.resize(1);
+	}
+
+	static constexpr size_t size() { return SIZE; }
+
+	size_t batchSize() const { return m_offsets.size() - 1; }
+
+	size_t nonZeroCount() const { return m_indices.size(); }
+
+	size_t nonZeroCount(size_t column) const
+	{
+		return m_offsets[column + 1] - m_offsets[column];
+	}
+
+	const uint32_t* indices(size_t column) const { return &m_indices[m_offsets[column]]; }
+
+	const Float* values(size_t column) const { return &m_values[m_offsets[column]]; }
+
+private:
+	std::vector<uint32_t> m_indices;
+	std::vector<Float> m_values;
+	std::vector<size_t> m_offsets{0};
+};
+
+// First layer of a network on SparseTensor inputs. The weights are a table with the NODE_C
+// weights of each input next to each other, so the forward pass sums the rows of the
+// non-zero inputs, like an embedding bag, and update() only touches those rows. Both cost
+// O(nonZeroCount() * NODE_C) whatever INPUT_C is.
+//
+// The layer trains in front of a Network: forward() its output, propagate that through the
+// network with a workspace, then pass workspace.inputGradient() to backward() and update().
+// Updates are SGD with lazy L2 regularization, see update().
+template <typename Activation, typename Float, size_t NODE_C, size_t INPUT_C>
+class SparseLayer
+{
+	static_assert(
+		NODE_C != RESIZEABLE && INPUT_C != RESIZEABLE,
+		"Sparse layers need sizes known at compile time");
+	static_assert(
+		!details::IsReducedFloat<Float>::value,
+		"Sparse layers do not support reduced precision");
+
+public:
+	template <typename Generator>
+	explicit SparseLayer(Generator&& gen)
+		: m_table(NODE_C * INPUT_C)
+	{
+		for (auto& w : m_table)
+			w = gen();
+		for (auto& b : m_bias)
+			b = 0;
+		syncWeights();
+	}
+
+	template <typename InputFloat, size_t BATCH_SIZE = RESIZEABLE>
+	Tensor<Float, NODE_C, BATCH_SIZE>
+		forward(const SparseTensor<InputFloat, INPUT_C>& input) const
+	{
+		Tensor<Float, NODE_C, BATCH_SIZE> output;
+		forward(input, output);
+		return output;
+	}
+
+	template <typename InputFloat, size_t BATCH_SIZE = RESIZEABLE>
+	void forward(
+		const SparseTensor<InputFloat, INPUT_C>& input,
+		Tensor<Float, NODE_C, BATCH_SIZE>& output) const
+	{
+		if constexpr (BATCH_SIZE == RESIZEABLE)
+			output.setBatchSize(input.batchSize());
+		assert(output.batchSize() == input.batchSize());
+		for (size_t ii = 0; ii != input.batchSize(); ++ii)
+		{
+			Float* column = &output(0, ii);
+			std::copy(m_bias.begin(), m_bias.end(), column);
+			const uint32_t* indices = input.indices(ii);
+			const InputFloat* values = input.values(ii);
+			for (size_t kk = 0; kk != input.nonZeroCount(ii); ++kk)
+			{
+				const Float* weights = row(indices[kk]);
+				const Float value = values[kk];
+				for (size_t jj = 0; jj != NODE_C; ++jj)
+					column[jj] += value * weights[jj];
+			}
+			if constexpr (details::IsElementwiseActivation<Activation>::value)
+				Activation::forwardRange(column, column + NODE_C);
+		}
+		if constexpr (!details::IsElementwiseActivation<Activation>::value)
+			m_activation.forwardInPlace(output);
+	}
+
+	// Overwrites gradient with the gradient w.r.t. the pre-activation values, which is what
+	// update() expects. Sparse inputs have no gradient.
+	template <size_t BATCH_SIZE = RESIZEABLE>
+	void backward(
+		const Tensor<Float, NODE_C, BATCH_SIZE>& output,
+		Tensor<Float, NODE_C, BATCH_SIZE>& gradient) const
+	{
+		m_activation.backwardInPlace(output, gradient);
+	}
+
+	// SGD step on the rows of the inputs that are non-zero in the batch and on the bias. The
+	// L2 decay of 1 - stepSize * regularization is lazy: it only scales the rows that are
+	// updated, once per call, and every other row keeps its weights. A dense layer decays
+	// every weight on every step, so the two only take the same step without
+	// regularization. The bias is not decayed, as in the dense layers.
+	template <typename InputFloat, size_t BATCH_SIZE = RESIZEABLE>
+	void update(
+		const SparseTensor<InputFloat, INPUT_C>& input,
+		const Tensor<Float, NODE_C, BATCH_SIZE>& gradient,
+		Float stepSize,
+		Float regularization)
+	{
+		assert(gradient.batchSize() == input.batchSize());
+		// Sorted by input, the non-zeros of a repeated input add up to a single row update.
+		m_nonZeros.clear();
+		for (size_t ii = 0; ii != input.batchSize(); ++ii)
+			for (size_t kk = 0; kk != input.nonZeroCount(ii); ++kk)
+				m_nonZeros.push_back(
+					{input.indices(ii)[kk], ii, static_cast<Float>(input.values(ii)[kk])});
+		std::sort(m_nonZeros.begin(), m_nonZeros.end(), [](const auto& a, const auto& b) {
+			return a.index < b.index;
+		});
+
+		const Float decay = Float{1} - stepSize * regularization;
+		for (auto it = m_nonZeros.begin(); it != m_nonZeros.end();)
+		{
+			const uint32_t index = it->index;
+			std::array<Float, NODE_C> rowGradient{};
+			for (; it != m_nonZeros.end() && it->index == index; ++it)
+			{
+				const Float* columnGradient = &gradient(0, it->column);
+				for (size_t jj = 0; jj != NODE_C; ++jj)
+					rowGradient[jj] += it->value * columnGradient[jj];
+			}
+			Float* weights = row(index);
+			Float before{0};
+			Float after{0};
+			for (size_t jj = 0; jj != NODE_C; ++jj)
+			{
+				before += weights[jj] * weights[jj];
+				weights[jj] = decay * weights[jj] - stepSize * rowGradient[jj];
+				after += weights[jj] * weights[jj];
+			}
+			m_l2Norm += after - before;
+		}
+
+		for (size_t jj = 0; jj != NODE_C; ++jj)
+		{
+			Float sum{0};
+			for (size_t ii = 0; ii != gradient.batchSize(); ++ii)
+				sum += gradient(jj, ii);
+			m_bias(jj) -= stepSize * sum;
+		}
+	}
+
+	// Kept up to date by update() instead of summing every weight.
+	Float l2Norm() const { return static_cast<Float>(m_l2Norm); }
+
+	// The NODE_C weights of an input.
+	Float* row(size_t input) { return &m_table[input * NODE_C]; }
+
+	const Float* row(size_t input) const { return &m_table[input * NODE_C]; }
+
+	dlib::matrix<Float, NODE_C, 1>& bias() { return m_bias; }
+
+	const dlib::matrix<Float, NODE_C, 1>& bias() const { return m_bias; }
+
+	// Recomputes l2Norm(). Call after changing the weights through row().
+	void syncWeights()
+	{
+		m_l2Norm = 0;
+		for (Float w : m_table)
+			m_l2Norm += w * w;
+	}
+
+	static constexpr size_t nodeCount() { return NODE_C; }
+
+	static constexpr size_t inputCount() { return INPUT_C; }
+
+private:
+	struct NonZero
+	{
+		uint32_t index;
+		size_t column;
+		Float value;
+	};
+
+	Activation m_activation;
+	std::vector<Float> m_table;
+	dlib::matrix<Float, NODE_C, 1> m_bias;
+	// Accumulated in double, so that rounding errors do not build up over many updates.
+	double m_l2Norm = 0;
+	std::vector<NonZero> m_nonZeros;
+};
+
+} // namespace nnp
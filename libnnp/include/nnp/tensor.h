@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+
 #include <dlib/matrix/matrix.h>
 
 #include "common.h"
@@ -76,7 +79,7 @@ public:
 	}
 
 	template <
-		size_t BATCH_SIZE_D = SIZE,
+		size_t BATCH_SIZE_D = BATCH_SIZE,
 		typename = std::enable_if_t<BATCH_SIZE_D == RESIZEABLE>>
 	void setBatchSize(size_t newSize)
 	{
@@ -91,4 +94,25 @@ private:
 	Data m_data;
 };
 
+namespace details {
+
+// Copies columns [begin, end) of src into dst, which must already have end - begin columns.
+template <
+	typename SrcFloat,
+	typename DstFloat,
+	size_t SIZE,
+	size_t SRC_BATCH_SIZE,
+	size_t DST_BATCH_SIZE>
+void copyColumns(
+	const Tensor<SrcFloat, SIZE, SRC_BATCH_SIZE>& src,
+	size_t begin,
+	size_t end,
+	Tensor<DstFloat, SIZE, DST_BATCH_SIZE>& dst)
+{
+	assert(dst.size() == src.size() && dst.batchSize() == end - begin);
+	std::copy(src.begin() + begin * src.size(), src.begin() + end * src.size(), dst.begin());
+}
+
+} // namespace details
+
 } // namespace nnp
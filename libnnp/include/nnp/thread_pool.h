@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace nnp {
+
+// Fixed set of worker threads that run batches of indexed jobs. The thread calling run()
+// takes part in the work, so a pool of threadCount() threads starts threadCount() - 1
+// workers.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency())
+	{
+		threadCount = std::max<size_t>(threadCount, 1);
+		m_workers.reserve(threadCount - 1);
+		for (size_t ii = 1; ii != threadCount; ++ii)
+			m_workers.emplace_back([this] { workerLoop(); });
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (auto& worker : m_workers)
+			worker.join();
+	}
+
+	size_t threadCount() const { return m_workers.size() + 1; }
+
+	// Calls callable(job) for every job in [0, jobCount) and returns once all of them have
+	// finished. callable must not throw.
+	template <typename Callable>
+	void run(size_t jobCount, Callable&& callable)
+	{
+		using CallableType = std::remove_reference_t<Callable>;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_invoke = [](void* c, size_t job) { (*static_cast<CallableType*>(c))(job); };
+			m_callable = const_cast<void*>(static_cast<const void*>(std::addressof(callable)));
+			m_jobCount = jobCount;
+			m_nextJob = 0;
+			m_pendingWorkers = m_workers.size();
+			++m_generation;
+		}
+		m_wake.notify_all();
+		runJobs();
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this] { return m_pendingWorkers == 0; });
+	}
+
+private:
+	void workerLoop()
+	{
+		uint64_t generation = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [&] { return m_stop || m_generation != generation; });
+				if (m_stop)
+					return;
+				generation = m_generation;
+			}
+			runJobs();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (--m_pendingWorkers == 0)
+					m_done.notify_one();
+			}
+		}
+	}
+
+	void runJobs()
+	{
+		for (size_t job = m_nextJob++; job < m_jobCount; job = m_nextJob++)
+			m_invoke(m_callable, job);
+	}
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	void (*m_invoke)(void*, size_t) = nullptr;
+	void* m_callable = nullptr;
+	size_t m_jobCount = 0;
+	std::atomic<size_t> m_nextJob{0};
+	size_t m_pendingWorkers = 0;
+	uint64_t m_generation = 0;
+	bool m_stop = false;
+};
+
+} // namespace nnp
@@ -0,0 +1,170 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+#include <nnp/checkpoint.h>
+#include <nnp/network.h>
+
+#include "test_utils.h"
+
+namespace {
+
+using Hidden = nnp::TupleNetwork<
+	nnp::ReluLayer<float, 16, 8>,
+	nnp::SigmoidLayer<float, 16, 16>,
+	nnp::LinearLayer<float, 4, 16>>;
+
+// A fresh directory under the system's temporary directory, removed by main().
+const std::filesystem::path& directory()
+{
+	static const std::filesystem::path path = [] {
+		std::string pattern =
+			(std::filesystem::temp_directory_path() / "nnp_checkpoint_XXXXXX").string();
+		if (!mkdtemp(pattern.data()))
+			throw std::runtime_error("Cannot create a temporary directory");
+		return std::filesystem::path(pattern);
+	}();
+	return path;
+}
+
+const std::string PATH = (directory() / "checkpoint.nnpc").string();
+const std::string CORRUPTED_PATH = (directory() / "corrupted.nnpc").string();
+
+Hidden makeHidden(uint32_t seed)
+{
+	test::NormalDistGenerator<float> gen(seed);
+	return Hidden{
+		nnp::ReluLayer<float, 16, 8>(gen),
+		nnp::SigmoidLayer<float, 16, 16>(gen),
+		nnp::LinearLayer<float, 4, 16>(gen)};
+}
+
+template <typename Matrix>
+bool bitIdentical(const Matrix& a, const Matrix& b)
+{
+	return a.size() == b.size()
+		&& std::memcmp(a.begin(), b.begin(), a.size() * sizeof(*a.begin())) == 0;
+}
+
+std::vector<char> readFile(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+void writeFile(const std::string& path, const std::vector<char>& bytes)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(bytes.data(), bytes.size());
+}
+
+bool rejects(const std::string& path)
+{
+	try
+	{
+		nnp::Checkpoint checkpoint(path);
+		return false;
+	}
+	catch (const std::runtime_error&)
+	{
+		return true;
+	}
+}
+
+// load() copies the saved weights bit for bit into a network initialized differently.
+void loadRoundTrip()
+{
+	const Hidden source = makeHidden(1);
+	nnp::saveCheckpoint(source, PATH);
+
+	Hidden loaded = makeHidden(2);
+	nnp::Checkpoint(PATH).load(loaded);
+	NNP_CHECK(bitIdentical(loaded.layer<0>().weights(), source.layer<0>().weights()));
+	NNP_CHECK(bitIdentical(loaded.layer<0>().bias(), source.layer<0>().bias()));
+	NNP_CHECK(bitIdentical(loaded.layer<1>().weights(), source.layer<1>().weights()));
+	NNP_CHECK(bitIdentical(loaded.layer<1>().bias(), source.layer<1>().bias()));
+	NNP_CHECK(bitIdentical(loaded.layer<2>().weights(), source.layer<2>().weights()));
+	NNP_CHECK(bitIdentical(loaded.layer<2>().bias(), source.layer<2>().bias()));
+}
+
+// A network mapped from the checkpoint computes the same outputs as the one it was saved
+// from.
+void mapRoundTrip()
+{
+	Hidden source = makeHidden(1);
+	nnp::saveCheckpoint(source, PATH);
+
+	const nnp::Checkpoint checkpoint(PATH);
+	auto mapped = checkpoint.map<Hidden>();
+	const auto input = test::randomTensor<float, 8>(9);
+	const auto expected = source.forward(input);
+	const auto output = mapped.forward(input);
+	NNP_CHECK(output.batchSize() == expected.batchSize());
+	NNP_CHECK(std::equal(
+		output.begin(), output.end(), expected.begin(), [](float a, float b) {
+			return test::near(a, b, 1e-6f);
+		}));
+}
+
+// Flipping any single byte of the header or the layer table, or the first and last byte of
+// a weight or bias blob, is detected.
+void corruptionIsDetected()
+{
+	namespace cp = nnp::details::checkpoint;
+	nnp::saveCheckpoint(makeHidden(1), PATH);
+	const std::vector<char> bytes = readFile(PATH);
+	NNP_CHECK(!rejects(PATH));
+
+	const size_t tableEnd =
+		sizeof(cp::Header) + Hidden::layerCount() * sizeof(cp::LayerRecord);
+	std::vector<size_t> offsets;
+	for (size_t ii = 0; ii != tableEnd; ++ii)
+		offsets.push_back(ii);
+	for (size_t layer = 0; layer != Hidden::layerCount(); ++layer)
+	{
+		cp::LayerRecord record;
+		std::memcpy(
+			&record,
+			bytes.data() + sizeof(cp::Header) + layer * sizeof(record),
+			sizeof(record));
+		const size_t weightBytes = record.nodeCount * record.inputCount * sizeof(float);
+		const size_t biasBytes = record.nodeCount * sizeof(float);
+		offsets.push_back(record.weightOffset);
+		offsets.push_back(record.weightOffset + weightBytes - 1);
+		offsets.push_back(record.biasOffset);
+		offsets.push_back(record.biasOffset + biasBytes - 1);
+	}
+
+	for (size_t offset : offsets)
+	{
+		std::vector<char> corrupted = bytes;
+		corrupted[offset] ^= 0x10;
+		writeFile(CORRUPTED_PATH, corrupted);
+		if (!rejects(CORRUPTED_PATH))
+		{
+			std::cerr << "Flipped byte " << offset << " was not detected\n";
+			NNP_CHECK(false);
+		}
+	}
+
+	std::vector<char> truncated(bytes.begin(), bytes.end() - cp::ALIGNMENT);
+	writeFile(CORRUPTED_PATH, truncated);
+	NNP_CHECK(rejects(CORRUPTED_PATH));
+}
+
+} // namespace
+
+int main()
+{
+	loadRoundTrip();
+	mapRoundTrip();
+	corruptionIsDetected();
+	std::filesystem::remove_all(directory());
+	return test::result();
+}
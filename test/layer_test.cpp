@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <vector>
+
+#include <nnp/layer.h>
+#include <nnp/sparse.h>
+
+#include "test_utils.h"
+
+namespace {
+
+// The kernels sum in a different order than dlib.
+constexpr float TOLERANCE = 1e-5f;
+
+using Reference = dlib::matrix<float>;
+
+template <typename Matrix, typename Expected>
+bool near(const Matrix& matrix, const Expected& expected)
+{
+	if (matrix.nr() != expected.nr() || matrix.nc() != expected.nc())
+		return false;
+	for (long ii = 0; ii != matrix.nr(); ++ii)
+		for (long jj = 0; jj != matrix.nc(); ++jj)
+			if (!test::near(matrix(ii, jj), expected(ii, jj), TOLERANCE))
+				return false;
+	return true;
+}
+
+// Every product and the update of layers small enough for the unrolled kernels, against the
+// dlib expressions that larger layers use. Batches of fewer than unrolled::COLUMNS samples and
+// the leftover of larger ones take the single column kernels.
+template <size_t NODE_C, size_t INPUT_C, size_t BATCH_SIZE>
+void unrolledMatchesDlib(size_t batchSize)
+{
+	static_assert(nnp::details::unrolled::enabled<NODE_C, INPUT_C>(), "Not unrolled");
+	test::NormalDistGenerator<float> gen(NODE_C * 100 + INPUT_C);
+	nnp::details::LayerWeights<float, NODE_C, INPUT_C> weights(gen);
+	std::vector<float> bias(NODE_C);
+	std::generate(bias.begin(), bias.end(), gen);
+	const auto input = test::randomTensor<float, INPUT_C, BATCH_SIZE>(batchSize, 2);
+	const auto gradient = test::randomTensor<float, NODE_C, BATCH_SIZE>(batchSize, 3);
+	const Reference w = weights.weights();
+	const Reference x = input.data();
+	const Reference g = gradient.data();
+
+	const Reference product = w * x;
+	nnp::Tensor<float, NODE_C, BATCH_SIZE> output;
+	weights.forward(input, output);
+	NNP_CHECK(near(output.data(), product));
+	NNP_CHECK(near(weights.forward(input).data(), product));
+
+	Reference activated = product;
+	for (long ii = 0; ii != activated.nr(); ++ii)
+		for (long jj = 0; jj != activated.nc(); ++jj)
+			activated(ii, jj) = std::max(activated(ii, jj) + bias[ii], 0.f);
+	nnp::Tensor<float, NODE_C, BATCH_SIZE> activatedOutput;
+	weights.template forward<nnp::ReluActivation>(input, activatedOutput, bias.data());
+	NNP_CHECK(near(activatedOutput.data(), activated));
+
+	const Reference inputGradient = trans(w) * g;
+	nnp::Tensor<float, INPUT_C, BATCH_SIZE> backwardOutput;
+	weights.backward(gradient, backwardOutput);
+	NNP_CHECK(near(backwardOutput.data(), inputGradient));
+	NNP_CHECK(near(weights.backward(gradient).data(), inputGradient));
+
+	dlib::matrix<float, NODE_C, INPUT_C> accumulated = weights.weights();
+	const Reference expectedAccumulated = w + g * trans(x);
+	weights.accumulateGradient(input, gradient, accumulated);
+	NNP_CHECK(near(accumulated, expectedAccumulated));
+
+	const float stepSize = 0.1f;
+	const float regularization = 0.01f;
+	Reference expectedWeights = w;
+	expectedWeights *= 1 - stepSize * regularization;
+	expectedWeights -= stepSize * g * trans(x);
+	weights.update(input, gradient, stepSize, regularization);
+	NNP_CHECK(near(weights.weights(), expectedWeights));
+}
+
+template <size_t NODE_C, size_t INPUT_C>
+void unrolledMatchesDlib()
+{
+	unrolledMatchesDlib<NODE_C, INPUT_C, 1>(1);
+	unrolledMatchesDlib<NODE_C, INPUT_C, 3>(3);
+	unrolledMatchesDlib<NODE_C, INPUT_C, 8>(8);
+	for (size_t batchSize : {1, 3, 8})
+		unrolledMatchesDlib<NODE_C, INPUT_C, nnp::RESIZEABLE>(batchSize);
+}
+
+// A layer with packed weights against the dense layout from the same seed, through forward,
+// backward, update and a forward pass on the repacked weights. Sizes that are not multiples
+// of PackedMatrix::TILE_ROWS or TILE_DEPTH leave partial tiles, and batches larger than
+// COLUMN_BLOCK leave a partial block of columns.
+template <size_t NODE_C, size_t INPUT_C, size_t BATCH_SIZE>
+void packedMatchesDense(size_t batchSize)
+{
+	using Packed = nnp::ReluLayer<float, NODE_C, INPUT_C, nnp::Sgd, nnp::PackedLayout>;
+	using Dense = nnp::ReluLayer<float, NODE_C, INPUT_C, nnp::Sgd, nnp::DenseLayout>;
+	Packed packed(test::NormalDistGenerator<float>(NODE_C * 1000 + INPUT_C));
+	Dense dense(test::NormalDistGenerator<float>(NODE_C * 1000 + INPUT_C));
+	NNP_CHECK(near(packed.weights(), dense.weights()));
+	const auto input = test::randomTensor<float, INPUT_C, BATCH_SIZE>(batchSize, 2);
+
+	nnp::Tensor<float, NODE_C, BATCH_SIZE> packedOutput;
+	nnp::Tensor<float, NODE_C, BATCH_SIZE> denseOutput;
+	packed.forward(input, packedOutput);
+	dense.forward(input, denseOutput);
+	NNP_CHECK(near(packedOutput.data(), denseOutput.data()));
+
+	auto packedGradient = test::randomTensor<float, NODE_C, BATCH_SIZE>(batchSize, 3);
+	auto denseGradient = packedGradient;
+	nnp::Tensor<float, INPUT_C, BATCH_SIZE> packedInputGradient;
+	nnp::Tensor<float, INPUT_C, BATCH_SIZE> denseInputGradient;
+	packed.backward(denseOutput, packedGradient, packedInputGradient);
+	dense.backward(denseOutput, denseGradient, denseInputGradient);
+	NNP_CHECK(near(packedGradient.data(), denseGradient.data()));
+	NNP_CHECK(near(packedInputGradient.data(), denseInputGradient.data()));
+
+	packed.update(input, denseGradient, 0.1f, 0.01f);
+	dense.update(input, denseGradient, 0.1f, 0.01f);
+	NNP_CHECK(near(packed.weights(), dense.weights()));
+	NNP_CHECK(near(packed.bias(), dense.bias()));
+	packed.forward(input, packedOutput);
+	dense.forward(input, denseOutput);
+	NNP_CHECK(near(packedOutput.data(), denseOutput.data()));
+	const auto expected = dense.backward(denseOutput, denseGradient);
+	NNP_CHECK(near(packed.backward(denseOutput, denseGradient).data(), expected.data()));
+}
+
+template <size_t NODE_C, size_t INPUT_C>
+void packedMatchesDense()
+{
+	packedMatchesDense<NODE_C, INPUT_C, 1>(1);
+	packedMatchesDense<NODE_C, INPUT_C, 5>(5);
+	packedMatchesDense<NODE_C, INPUT_C, 130>(130);
+	for (size_t batchSize : {1, 5, 130})
+		packedMatchesDense<NODE_C, INPUT_C, nnp::RESIZEABLE>(batchSize);
+}
+
+constexpr size_t SPARSE_NODE_C = 8;
+constexpr size_t SPARSE_INPUT_C = 50;
+
+using Sparse = nnp::SparseLayer<nnp::ReluActivation, float, SPARSE_NODE_C, SPARSE_INPUT_C>;
+using SparseInput = nnp::SparseTensor<float, SPARSE_INPUT_C>;
+
+// Three non-zeros per sample, one of them repeated in the second sample, among the first
+// 20 inputs only, so that the last 30 rows are never touched.
+SparseInput sparseInput(size_t batchSize, nnp::Tensor<float, SPARSE_INPUT_C>& dense)
+{
+	SparseInput input;
+	dense.setBatchSize(batchSize);
+	std::fill(dense.begin(), dense.end(), 0.f);
+	test::NormalDistGenerator<float> gen(4);
+	for (size_t ii = 0; ii != batchSize; ++ii)
+	{
+		uint32_t indices[] = {
+			uint32_t(ii % 20), uint32_t((ii * 7 + 3) % 20), uint32_t((ii * 3 + 11) % 20)};
+		if (ii == 1)
+			indices[2] = indices[0];
+		const float values[] = {gen(), gen(), gen()};
+		input.addColumn(indices, values, 3);
+		for (size_t kk = 0; kk != 3; ++kk)
+			dense(indices[kk], ii) += values[kk];
+	}
+	return input;
+}
+
+// The ReluLayer with the weights and bias of a sparse layer.
+nnp::ReluLayer<float, SPARSE_NODE_C, SPARSE_INPUT_C> denseCopy(const Sparse& sparse)
+{
+	nnp::ReluLayer<float, SPARSE_NODE_C, SPARSE_INPUT_C> dense{
+		test::NormalDistGenerator<float>()};
+	for (size_t ii = 0; ii != SPARSE_INPUT_C; ++ii)
+		for (size_t jj = 0; jj != SPARSE_NODE_C; ++jj)
+			dense.weights()(jj, ii) = sparse.row(ii)[jj];
+	dense.bias() = sparse.bias();
+	dense.syncWeights();
+	return dense;
+}
+
+template <typename Weights>
+bool sameWeights(const Sparse& sparse, const Weights& weights)
+{
+	for (size_t ii = 0; ii != SPARSE_INPUT_C; ++ii)
+		for (size_t jj = 0; jj != SPARSE_NODE_C; ++jj)
+			if (!test::near(sparse.row(ii)[jj], weights(jj, ii), TOLERANCE))
+				return false;
+	return true;
+}
+
+// Without regularization a sparse layer computes and trains like a ReluLayer with the same
+// weights on the dense form of its input, repeated indices included.
+void sparseMatchesDense()
+{
+	const size_t batchSize = 6;
+	nnp::Tensor<float, SPARSE_INPUT_C> denseInput;
+	const auto input = sparseInput(batchSize, denseInput);
+	Sparse sparse(test::NormalDistGenerator<float>(5));
+	auto dense = denseCopy(sparse);
+
+	const auto output = sparse.forward(input);
+	const auto denseOutput = dense.forward(denseInput);
+	NNP_CHECK(near(output.data(), denseOutput.data()));
+
+	auto gradient = test::randomTensor<float, SPARSE_NODE_C>(batchSize, 6);
+	auto denseGradient = gradient;
+	nnp::Tensor<float, SPARSE_INPUT_C> inputGradient;
+	sparse.backward(output, gradient);
+	dense.backward(denseOutput, denseGradient, inputGradient);
+	NNP_CHECK(near(gradient.data(), denseGradient.data()));
+
+	sparse.update(input, gradient, 0.1f, 0.f);
+	dense.update(denseInput, denseGradient, 0.1f, 0.f);
+	NNP_CHECK(sameWeights(sparse, dense.weights()));
+	NNP_CHECK(near(sparse.bias(), dense.bias()));
+	NNP_CHECK(near(sparse.forward(input).data(), dense.forward(denseInput).data()));
+}
+
+// With regularization only the rows of the inputs in the batch decay. The l2Norm() kept up to
+// date by update() matches the sum of squares of every weight.
+void sparseDecaysTouchedRows()
+{
+	const size_t batchSize = 6;
+	const float stepSize = 0.1f;
+	const float regularization = 0.5f;
+	nnp::Tensor<float, SPARSE_INPUT_C> denseInput;
+	const auto input = sparseInput(batchSize, denseInput);
+	Sparse sparse(test::NormalDistGenerator<float>(5));
+	const auto before = denseCopy(sparse).weights();
+	const auto gradient = test::randomTensor<float, SPARSE_NODE_C>(batchSize, 6);
+
+	Reference expected = before;
+	const Reference step = gradient.data() * trans(denseInput.data());
+	for (size_t ii = 0; ii != SPARSE_INPUT_C; ++ii)
+	{
+		bool touched = false;
+		for (size_t cc = 0; cc != batchSize; ++cc)
+			touched |= denseInput(ii, cc) != 0;
+		for (size_t jj = 0; jj != SPARSE_NODE_C; ++jj)
+			expected(jj, ii) = touched
+				? (1 - stepSize * regularization) * before(jj, ii) - stepSize * step(jj, ii)
+				: before(jj, ii);
+	}
+	sparse.update(input, gradient, stepSize, regularization);
+	NNP_CHECK(sameWeights(sparse, expected));
+
+	for (size_t ii = 0; ii != 10; ++ii)
+		sparse.update(input, gradient, stepSize, regularization);
+	double sumSquares = 0;
+	for (size_t ii = 0; ii != SPARSE_INPUT_C; ++ii)
+		for (size_t jj = 0; jj != SPARSE_NODE_C; ++jj)
+			sumSquares += double(sparse.row(ii)[jj]) * sparse.row(ii)[jj];
+	NNP_CHECK(test::near(sparse.l2Norm(), float(sumSquares), TOLERANCE));
+	sparse.syncWeights();
+	NNP_CHECK(test::near(sparse.l2Norm(), float(sumSquares), TOLERANCE));
+}
+
+} // namespace
+
+int main()
+{
+	unrolledMatchesDlib<1, 1>();
+	unrolledMatchesDlib<3, 5>();
+	unrolledMatchesDlib<5, 4>();
+	unrolledMatchesDlib<7, 9>();
+	unrolledMatchesDlib<64, 64>();
+	packedMatchesDense<16, 256>();
+	packedMatchesDense<17, 300>();
+	packedMatchesDense<300, 17>();
+	packedMatchesDense<40, 513>();
+	sparseMatchesDense();
+	sparseDecaysTouchedRows();
+	return test::result();
+}
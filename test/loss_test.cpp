@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include <nnp/loss.h>
+#include <nnp/network.h>
+
+#include "test_utils.h"
+
+namespace {
+
+constexpr size_t CLASS_C = 10;
+
+// The fused kernel sums the exponentials in a different order than softmax().
+constexpr float TOLERANCE = 1e-5f;
+
+using Labels = nnp::SoftmaxCrossEntropy<float>::Labels<uint32_t>;
+
+// The labels of test::oneHot().
+Labels labels(size_t batchSize)
+{
+	Labels labels(batchSize);
+	for (size_t ii = 0; ii != batchSize; ++ii)
+		labels(0, ii) = static_cast<uint32_t>(ii % CLASS_C);
+	return labels;
+}
+
+template <typename Tensor>
+bool near(const Tensor& a, const Tensor& b, float tolerance = TOLERANCE)
+{
+	return std::equal(a.begin(), a.end(), b.begin(), [tolerance](float x, float y) {
+		return test::near(x, y, tolerance);
+	});
+}
+
+// On logits of moderate size the fused loss and gradient are those of SoftMaxLayer on one-hot
+// ground truth, regularization and gradient scale included, also when the gradient
+// overwrites the logits.
+void fusedMatchesSoftMaxLayer()
+{
+	const size_t batchSize = 13;
+	const float totalL2Norm = 2.5f;
+	const float regularization = 0.01f;
+	const float scale = 0.25f;
+	const auto logits = test::randomTensor<float, CLASS_C>(batchSize);
+	const auto groundTruth = test::oneHot<float, CLASS_C>(batchSize);
+
+	nnp::Tensor<float, CLASS_C> expected(batchSize);
+	nnp::SoftMaxLayer<float>::probs(logits, expected);
+	const float expectedLoss = nnp::SoftMaxLayer<float>::loss(
+		expected, groundTruth, totalL2Norm, regularization);
+	nnp::SoftMaxLayer<float>::getGradient(expected, groundTruth, expected);
+	for (auto& g : expected)
+		g *= scale;
+
+	nnp::Tensor<float, CLASS_C> gradient(batchSize);
+	const float loss = nnp::SoftmaxCrossEntropy<float>::propagate(
+		logits, labels(batchSize), gradient, totalL2Norm, regularization, scale);
+	NNP_CHECK(test::near(loss, expectedLoss, TOLERANCE));
+	NNP_CHECK(near(gradient, expected));
+
+	auto inPlace = logits;
+	const float inPlaceLoss = nnp::SoftmaxCrossEntropy<float>::propagate(
+		inPlace, labels(batchSize), inPlace, totalL2Norm, regularization, scale);
+	NNP_CHECK(inPlaceLoss == loss);
+	NNP_CHECK(near(inPlace, gradient));
+}
+
+// Logits in the hundreds overflow exp() and make the probability of most labels underflow to
+// 0, where SoftMaxLayer's log gives an infinite loss. The fused loss stays finite and the
+// gradient is still softmax minus the one-hot label, over the batch size.
+void largeLogitsStayFinite()
+{
+	const size_t batchSize = 7;
+	auto logits = test::randomTensor<float, CLASS_C>(batchSize);
+	for (auto& f : logits)
+		f *= 400;
+	const auto groundTruth = test::oneHot<float, CLASS_C>(batchSize);
+
+	nnp::Tensor<float, CLASS_C> gradient(batchSize);
+	const float loss = nnp::SoftmaxCrossEntropy<float>::propagate(
+		logits, labels(batchSize), gradient, 0.f, 0.f);
+	NNP_CHECK(std::isfinite(loss));
+	const auto probs = nnp::SoftMaxLayer<float>::probs(logits);
+	NNP_CHECK(!std::isfinite(nnp::SoftMaxLayer<float>::loss(probs, groundTruth, 0.f, 0.f)));
+
+	double expectedLoss = 0;
+	for (size_t ii = 0; ii != batchSize; ++ii)
+	{
+		double max = logits(0, ii);
+		for (size_t jj = 0; jj != CLASS_C; ++jj)
+			max = std::max<double>(max, logits(jj, ii));
+		std::vector<double> exps(CLASS_C);
+		double sum = 0;
+		for (size_t jj = 0; jj != CLASS_C; ++jj)
+			sum += exps[jj] = std::exp(logits(jj, ii) - max);
+		expectedLoss += max + std::log(sum) - logits(ii % CLASS_C, ii);
+		for (size_t jj = 0; jj != CLASS_C; ++jj)
+		{
+			const double expected = (exps[jj] / sum - groundTruth(jj, ii)) / batchSize;
+			NNP_CHECK(std::isfinite(gradient(jj, ii)));
+			NNP_CHECK(std::abs(gradient(jj, ii) - expected) <= 1e-6);
+		}
+	}
+	NNP_CHECK(test::near(loss, float(expectedLoss / batchSize), TOLERANCE));
+}
+
+using Hidden = nnp::TupleNetwork<
+	nnp::ReluLayer<float, 16, 8>,
+	nnp::LinearLayer<float, CLASS_C, 16>>;
+
+template <typename LossLayer>
+using Training = nnp::Network<Hidden&, LossLayer>;
+
+// Like the loss helper that train() passes to the layers.
+struct NoLoss
+{
+	bool needsLoss() const { return false; }
+};
+
+// SoftMaxLayer counting the loss passes.
+struct CountingSoftMax : nnp::SoftMaxLayer<float>
+{
+	template <typename... Args>
+	static float loss(const Args&... args)
+	{
+		++lossCount;
+		return nnp::SoftMaxLayer<float>::loss(args...);
+	}
+
+	static inline size_t lossCount = 0;
+};
+
+// Fused losses take one label per sample instead of a one-hot column.
+void groundTruthCount()
+{
+	static_assert(Training<nnp::SoftmaxCrossEntropy<float>>::groundTruthCount() == 1);
+	static_assert(Training<nnp::SoftMaxLayer<float>>::groundTruthCount() == CLASS_C);
+	NNP_CHECK(nnp::details::needsLoss(nnp::SoftmaxCrossEntropy<float>()));
+	NNP_CHECK(nnp::details::needsLoss(nnp::SoftMaxLayer<float>()));
+	NNP_CHECK(!nnp::details::needsLoss(NoLoss()));
+}
+
+// train() takes the steps of propagate(), for fused and separate losses alike. Separate losses
+// skip the loss pass, which CountingSoftMax counts, and the L2 norm of the weights, which only
+// enters the loss.
+template <typename LossLayer, typename GroundTruth>
+void trainMatchesPropagate(const GroundTruth& groundTruth)
+{
+	const size_t batchSize = groundTruth.batchSize();
+	const auto input = test::randomTensor<float, 8>(batchSize);
+	test::NormalDistGenerator<float> gen;
+	Hidden propagated{gen, gen};
+	test::NormalDistGenerator<float> trainedGen;
+	Hidden trained{trainedGen, trainedGen};
+	Training<LossLayer> propagating{propagated, LossLayer{}};
+	Training<LossLayer> training{trained, LossLayer{}};
+	typename Training<LossLayer>::template Workspace<float> workspace(batchSize);
+	for (size_t ii = 0; ii != 5; ++ii)
+	{
+		propagating.propagate(workspace, input, groundTruth, 0.1f, 0.01f);
+		training.train(workspace, input, groundTruth, 0.1f, 0.01f);
+	}
+	NNP_CHECK(near(propagated.layer<0>().weights(), trained.layer<0>().weights()));
+	NNP_CHECK(near(propagated.layer<1>().weights(), trained.layer<1>().weights()));
+	NNP_CHECK(near(propagated.layer<1>().bias(), trained.layer<1>().bias()));
+	if constexpr (std::is_same<LossLayer, CountingSoftMax>::value)
+		NNP_CHECK(CountingSoftMax::lossCount == 5);
+}
+
+} // namespace
+
+int main()
+{
+	fusedMatchesSoftMaxLayer();
+	largeLogitsStayFinite();
+	groundTruthCount();
+	trainMatchesPropagate<nnp::SoftmaxCrossEntropy<float>>(labels(11));
+	trainMatchesPropagate<CountingSoftMax>(test::oneHot<float, CLASS_C>(11));
+	return test::result();
+}
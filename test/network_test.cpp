@@ -0,0 +1,471 @@
+#include <utility>
+#include <vector>
+
+#include <nnp/dynamic_network.h>
+#include <nnp/hogwild.h>
+#include <nnp/loss.h>
+#include <nnp/network.h>
+#include <nnp/pipeline.h>
+#include <nnp/thread_pool.h>
+
+#include "test_utils.h"
+
+namespace {
+
+using Hidden = nnp::TupleNetwork<
+	nnp::ReluLayer<float, 16, 8>,
+	nnp::SigmoidLayer<float, 16, 16>,
+	nnp::LinearLayer<float, 4, 16>>;
+
+using Training = nnp::Network<Hidden&, nnp::SoftMaxLayer<float>>;
+
+// Different orders of summation only change the last bits.
+constexpr float TOLERANCE = 1e-5f;
+
+Hidden makeHidden()
+{
+	test::NormalDistGenerator<float> gen;
+	return Hidden{
+		nnp::ReluLayer<float, 16, 8>(gen),
+		nnp::SigmoidLayer<float, 16, 16>(gen),
+		nnp::LinearLayer<float, 4, 16>(gen)};
+}
+
+template <typename MatrixA, typename MatrixB>
+bool near(const MatrixA& a, const MatrixB& b)
+{
+	return std::equal(a.begin(), a.end(), b.begin(), [](float x, float y) {
+		return test::near(x, y, TOLERANCE);
+	});
+}
+
+bool sameWeights(const Hidden& a, const Hidden& b)
+{
+	return near(a.layer<0>().weights(), b.layer<0>().weights())
+		&& near(a.layer<0>().bias(), b.layer<0>().bias())
+		&& near(a.layer<1>().weights(), b.layer<1>().weights())
+		&& near(a.layer<1>().bias(), b.layer<1>().bias())
+		&& near(a.layer<2>().weights(), b.layer<2>().weights())
+		&& near(a.layer<2>().bias(), b.layer<2>().bias());
+}
+
+// Sharding the batch across threads gives the same losses and weights as one thread, also
+// when the batch does not divide evenly.
+void parallelMatchesSequential(size_t threadCount)
+{
+	const size_t batchSize = 37;
+	const auto input = test::randomTensor<float, 8>(batchSize);
+	const auto groundTruth = test::oneHot<float, 4>(batchSize);
+
+	Hidden sequential = makeHidden();
+	Hidden parallel = makeHidden();
+	Training sequentialTraining{sequential, nnp::SoftMaxLayer<float>{}};
+	Training parallelTraining{parallel, nnp::SoftMaxLayer<float>{}};
+
+	nnp::ThreadPool pool(threadCount);
+	Training::Workspace<float> workspace(batchSize);
+	Training::ParallelWorkspace<float> parallelWorkspace(pool, batchSize);
+	NNP_CHECK(parallelWorkspace.shardCount() == threadCount);
+
+	for (size_t ii = 0; ii != 20; ++ii)
+	{
+		const float loss =
+			sequentialTraining.propagate(workspace, input, groundTruth, 0.1f, 1e-3f);
+		const float parallelLoss =
+			parallelTraining.propagate(parallelWorkspace, input, groundTruth, 0.1f, 1e-3f);
+		NNP_CHECK(test::near(parallelLoss, loss, TOLERANCE));
+	}
+	NNP_CHECK(sameWeights(sequential, parallel));
+}
+
+// Accumulating the gradients of three micro-batches, each a third of the batch, and applying
+// them once gives the same step as propagating the whole batch.
+void accumulationMatchesFullBatch()
+{
+	const size_t batchSize = 36;
+	const size_t microBatchSize = batchSize / 3;
+	const auto input = test::randomTensor<float, 8>(batchSize);
+	const auto groundTruth = test::oneHot<float, 4>(batchSize);
+
+	Hidden full = makeHidden();
+	Hidden accumulated = makeHidden();
+	Training fullTraining{full, nnp::SoftMaxLayer<float>{}};
+	Training accumulatedTraining{accumulated, nnp::SoftMaxLayer<float>{}};
+
+	Training::Workspace<float> workspace(batchSize);
+	Training::Workspace<float> microWorkspace(microBatchSize);
+	nnp::Tensor<float, 8> microInput(microBatchSize);
+	nnp::Tensor<float, 4> microGroundTruth(microBatchSize);
+	Training::Gradients gradients;
+
+	for (size_t ii = 0; ii != 20; ++ii)
+	{
+		const float loss = fullTraining.propagate(workspace, input, groundTruth, 0.1f, 1e-3f);
+
+		gradients.setZero();
+		float accumulatedLoss = 0;
+		for (size_t begin = 0; begin != batchSize; begin += microBatchSize)
+		{
+			nnp::details::copyColumns(input, begin, begin + microBatchSize, microInput);
+			nnp::details::copyColumns(
+				groundTruth, begin, begin + microBatchSize, microGroundTruth);
+			accumulatedLoss += accumulatedTraining.backward(
+				microWorkspace, gradients, microInput, microGroundTruth, 1e-3f, 1.f / 3);
+		}
+		accumulatedTraining.step(gradients, 0.1f, 1e-3f);
+		NNP_CHECK(test::near(accumulatedLoss / 3, loss, TOLERANCE));
+	}
+	NNP_CHECK(sameWeights(full, accumulated));
+}
+
+// Squared norm of the weights, summed in double.
+template <typename Matrix>
+float sumSquares(const Matrix& weights)
+{
+	double sum = 0;
+	for (float w : weights)
+		sum += double(w) * w;
+	return float(sum);
+}
+
+// The workers of HogwildTrainer read the cached norms of the weights while others update
+// them. Once train() returns, the caches match the weights.
+void hogwildNormsMatchWeights()
+{
+	const size_t batchSize = 8;
+	const size_t batchCount = 64;
+	using Trainer = nnp::HogwildTrainer<Training, float>;
+	const auto inputs = test::randomTensor<float, 8>(batchSize * batchCount);
+	const auto groundTruths = test::oneHot<float, 4>(batchSize * batchCount);
+	auto loadBatch = [&](size_t batch, Trainer::Input& input, Trainer::GroundTruth& labels) {
+		const size_t begin = batch * batchSize;
+		nnp::details::copyColumns(inputs, begin, begin + batchSize, input);
+		nnp::details::copyColumns(groundTruths, begin, begin + batchSize, labels);
+	};
+
+	Hidden hidden = makeHidden();
+	Training training{hidden, nnp::SoftMaxLayer<float>{}};
+	nnp::ThreadPool pool(4);
+	Trainer trainer(training, pool, batchSize);
+	for (size_t ii = 0; ii != 10; ++ii)
+	{
+		trainer.train(batchCount, loadBatch, 0.1f, 1e-3f);
+		NNP_CHECK(test::near(
+			hidden.layer<0>().l2Norm(), sumSquares(hidden.layer<0>().weights()), TOLERANCE));
+		NNP_CHECK(test::near(
+			hidden.layer<1>().l2Norm(), sumSquares(hidden.layer<1>().weights()), TOLERANCE));
+		NNP_CHECK(test::near(
+			hidden.layer<2>().l2Norm(), sumSquares(hidden.layer<2>().weights()), TOLERANCE));
+	}
+}
+
+// A pipeline takes the same steps as Network::propagate() on the whole batch, for any number
+// of stages and for micro-batches that do and do not divide the batch. Its forward pass
+// matches the trained network's.
+void pipelineMatchesNetwork(size_t stageCount, size_t microBatchCount)
+{
+	const size_t batchSize = 36;
+	const auto input = test::randomTensor<float, 8>(batchSize);
+	const auto groundTruth = test::oneHot<float, 4>(batchSize);
+
+	Hidden sequential = makeHidden();
+	Hidden pipelined = makeHidden();
+	Training training{sequential, nnp::SoftMaxLayer<float>{}};
+	nnp::PipelineNetwork<Hidden, nnp::SoftMaxLayer<float>> pipeline(
+		pipelined, nnp::SoftMaxLayer<float>{}, batchSize, microBatchCount, stageCount);
+	NNP_CHECK(pipeline.stageCount() == stageCount);
+	NNP_CHECK(pipeline.microBatchCount() == microBatchCount);
+
+	Training::Workspace<float> workspace(batchSize);
+	for (size_t ii = 0; ii != 10; ++ii)
+	{
+		const float loss = training.propagate(workspace, input, groundTruth, 0.1f, 1e-3f);
+		const float pipelineLoss = pipeline.propagate(input, groundTruth, 0.1f, 1e-3f);
+		NNP_CHECK(test::near(pipelineLoss, loss, TOLERANCE));
+	}
+	NNP_CHECK(sameWeights(sequential, pipelined));
+	NNP_CHECK(near(pipeline.forward(input).data(), sequential.forward(input).data()));
+}
+
+using Dynamic = nnp::DynamicNetwork<float>;
+using DynamicTensor = nnp::Tensor<float, nnp::RESIZEABLE, nnp::RESIZEABLE>;
+
+template <typename Layer>
+void copyLayer(const Layer& layer, Dynamic& dynamic, size_t layerIdx)
+{
+	std::copy(layer.weights().begin(), layer.weights().end(), dynamic.weights(layerIdx));
+	std::copy(layer.bias().begin(), layer.bias().end(), dynamic.bias(layerIdx));
+}
+
+template <typename Layer>
+bool sameLayer(const Layer& layer, const Dynamic& dynamic, size_t layerIdx)
+{
+	auto near = [](float a, float b) { return test::near(a, b, TOLERANCE); };
+	return std::equal(
+			   layer.weights().begin(), layer.weights().end(), dynamic.weights(layerIdx), near)
+		&& std::equal(layer.bias().begin(), layer.bias().end(), dynamic.bias(layerIdx), near);
+}
+
+// A DynamicNetwork with the shape and weights of a TupleNetwork gives the same outputs, losses
+// and updates.
+void dynamicMatchesTuple()
+{
+	const size_t batchSize = 19;
+	const auto input = test::randomTensor<float, 8>(batchSize);
+	const auto groundTruth = test::oneHot<float, 4>(batchSize);
+	DynamicTensor dynamicInput(8, batchSize);
+	DynamicTensor dynamicGroundTruth(4, batchSize);
+	dynamicInput.data() = input.data();
+	dynamicGroundTruth.data() = groundTruth.data();
+
+	Hidden hidden = makeHidden();
+	test::NormalDistGenerator<float> gen(7);
+	Dynamic dynamic(
+		8,
+		{{16, nnp::ActivationKind::RELU},
+		 {16, nnp::ActivationKind::SIGMOID},
+		 {4, nnp::ActivationKind::LINEAR}},
+		gen);
+	copyLayer(hidden.layer<0>(), dynamic, 0);
+	copyLayer(hidden.layer<1>(), dynamic, 1);
+	copyLayer(hidden.layer<2>(), dynamic, 2);
+	NNP_CHECK(test::near(dynamic.l2Norm(), hidden.l2Norm(), TOLERANCE));
+	NNP_CHECK(near(dynamic.forward(dynamicInput).data(), hidden.forward(input).data()));
+
+	Training training{hidden, nnp::SoftMaxLayer<float>{}};
+	Training::Workspace<float> workspace(batchSize);
+	for (size_t ii = 0; ii != 10; ++ii)
+	{
+		const float loss = training.propagate(workspace, input, groundTruth, 0.1f, 1e-3f);
+		const float dynamicLoss =
+			dynamic.propagate(dynamicInput, dynamicGroundTruth, 0.1f, 1e-3f);
+		NNP_CHECK(test::near(dynamicLoss, loss, TOLERANCE));
+	}
+	NNP_CHECK(sameLayer(hidden.layer<0>(), dynamic, 0));
+	NNP_CHECK(sameLayer(hidden.layer<1>(), dynamic, 1));
+	NNP_CHECK(sameLayer(hidden.layer<2>(), dynamic, 2));
+	NNP_CHECK(near(dynamic.forward(dynamicInput).data(), hidden.forward(input).data()));
+}
+
+// Forward passes without a workspace size the outputs of 16-bit layers to the batch, and
+// match a full precision network with the same weights up to the rounding of the
+// activations.
+template <typename Reduced>
+void reducedForwardMatchesFloat()
+{
+	using ReducedHidden = nnp::TupleNetwork<
+		nnp::ReluLayer<Reduced, 16, 8>,
+		nnp::SigmoidLayer<Reduced, 16, 16>,
+		nnp::LinearLayer<Reduced, 4, 16>>;
+	test::NormalDistGenerator<Reduced> gen;
+	ReducedHidden reduced{
+		nnp::ReluLayer<Reduced, 16, 8>(gen),
+		nnp::SigmoidLayer<Reduced, 16, 16>(gen),
+		nnp::LinearLayer<Reduced, 4, 16>(gen)};
+	Hidden full = makeHidden();
+	full.layer<0>().weights() = reduced.template layer<0>().weights();
+	full.layer<0>().bias() = reduced.template layer<0>().bias();
+	full.layer<1>().weights() = reduced.template layer<1>().weights();
+	full.layer<1>().bias() = reduced.template layer<1>().bias();
+	full.layer<2>().weights() = reduced.template layer<2>().weights();
+	full.layer<2>().bias() = reduced.template layer<2>().bias();
+	full.layer<0>().syncWeights();
+	full.layer<1>().syncWeights();
+	full.layer<2>().syncWeights();
+
+	const size_t batchSize = 13;
+	const auto reducedInput = test::randomTensor<Reduced, 8>(batchSize);
+	nnp::Tensor<float, 8> input(batchSize);
+	std::transform(reducedInput.begin(), reducedInput.end(), input.begin(), [](Reduced f) {
+		return static_cast<float>(f);
+	});
+
+	const auto expected = full.forward(input);
+	const auto output = reduced.forward(reducedInput);
+	NNP_CHECK(output.batchSize() == batchSize);
+	NNP_CHECK(std::equal(
+		expected.begin(), expected.end(), output.begin(), [](float a, Reduced b) {
+			return test::near(static_cast<float>(b), a, 0.05f);
+		}));
+}
+
+// Seven layers of uneven widths, so that no checkpoint interval from 2 to 4 divides the depth
+// and with every interval some layers share their output buffer with the layer k above them.
+// The input gradient shares the buffer of the second layer.
+using Checkpointed = nnp::TupleNetwork<
+	nnp::ReluLayer<float, 6, 12>,
+	nnp::SigmoidLayer<float, 12, 6>,
+	nnp::ReluLayer<float, 6, 12>,
+	nnp::SigmoidLayer<float, 6, 6>,
+	nnp::ReluLayer<float, 6, 6>,
+	nnp::LinearLayer<float, 10, 6>,
+	nnp::LinearLayer<float, 6, 10>>;
+
+using CheckpointedTraining = nnp::Network<Checkpointed&, nnp::SoftMaxLayer<float>>;
+
+template <typename Matrix>
+bool identical(const Matrix& a, const Matrix& b)
+{
+	return std::equal(a.begin(), a.end(), b.begin());
+}
+
+template <size_t... IDX>
+bool identicalLayers(
+	const Checkpointed& a, const Checkpointed& b, std::index_sequence<IDX...>)
+{
+	return (... && (identical(a.layer<IDX>().weights(), b.layer<IDX>().weights())
+					&& identical(a.layer<IDX>().bias(), b.layer<IDX>().bias())));
+}
+
+template <size_t... IDX>
+bool identicalGradients(
+	const Checkpointed::Gradients& a,
+	const Checkpointed::Gradients& b,
+	std::index_sequence<IDX...>)
+{
+	return (... && (identical(a.layer<IDX>().weights(), b.layer<IDX>().weights())
+					&& identical(a.layer<IDX>().bias(), b.layer<IDX>().bias())));
+}
+
+struct CheckpointedRun
+{
+	Checkpointed network;
+	std::vector<float> losses;
+	Checkpointed::Gradients gradients;
+};
+
+// Trains for a few steps and then accumulates the gradients of one more batch.
+template <size_t INTERVAL>
+CheckpointedRun trainCheckpointed()
+{
+	const size_t batchSize = 11;
+	const auto input = test::randomTensor<float, 12>(batchSize);
+	const auto groundTruth = test::oneHot<float, 6>(batchSize);
+
+	test::NormalDistGenerator<float> gen;
+	CheckpointedRun run{Checkpointed{gen, gen, gen, gen, gen, gen, gen}, {}, {}};
+	CheckpointedTraining training{run.network, nnp::SoftMaxLayer<float>{}};
+	CheckpointedTraining::Workspace<float, nnp::RESIZEABLE, INTERVAL> workspace(batchSize);
+	for (size_t ii = 0; ii != 10; ++ii)
+		run.losses.push_back(
+			training.propagate(workspace, input, groundTruth, 0.1f, 1e-3f));
+	run.gradients.setZero();
+	run.losses.push_back(
+		training.backward(workspace, run.gradients, input, groundTruth, 1e-3f));
+	return run;
+}
+
+// Recomputing the outputs between checkpoints repeats the same operations on the same
+// inputs, so every interval gives bit-identical losses, weights and gradients.
+template <size_t INTERVAL>
+void checkpointingMatchesFullPass(const CheckpointedRun& expected)
+{
+	const auto run = trainCheckpointed<INTERVAL>();
+	constexpr auto layers = std::make_index_sequence<Checkpointed::layerCount()>();
+	NNP_CHECK(run.losses == expected.losses);
+	NNP_CHECK(identicalLayers(run.network, expected.network, layers));
+	NNP_CHECK(identicalGradients(run.gradients, expected.gradients, layers));
+}
+
+using Checked = nnp::TupleNetwork<
+	nnp::ReluLayer<double, 6, 5>,
+	nnp::SigmoidLayer<double, 6, 6>,
+	nnp::LinearLayer<double, 3, 6>>;
+
+using CheckedTraining = nnp::Network<Checked&, nnp::SoftMaxLayer<double>>;
+
+// Compares the gradient of every weight and bias of layer IDX with central differences of
+// the loss, in double so that the differences are accurate to about 1e-9.
+template <size_t IDX>
+void checkLayerGradient(
+	Checked& network,
+	const Checked::Gradients& gradients,
+	const nnp::Tensor<double, 5>& input,
+	const nnp::Tensor<double, 3>& groundTruth)
+{
+	constexpr double EPSILON = 1e-5;
+	CheckedTraining training{network, nnp::SoftMaxLayer<double>{}};
+	CheckedTraining::Workspace<double> workspace(input.batchSize());
+	auto check = [&](auto& values, const auto& gradient) {
+		for (long ii = 0; ii != values.size(); ++ii)
+		{
+			const double value = values(ii);
+			values(ii) = value + EPSILON;
+			network.layer<IDX>().syncWeights();
+			const double above = training.propagate(workspace, input, groundTruth, 0.);
+			values(ii) = value - EPSILON;
+			network.layer<IDX>().syncWeights();
+			const double below = training.propagate(workspace, input, groundTruth, 0.);
+			values(ii) = value;
+			network.layer<IDX>().syncWeights();
+			NNP_CHECK(test::near(gradient(ii), (above - below) / (2 * EPSILON), 1e-6));
+		}
+	};
+	check(network.layer<IDX>().weights(), gradients.layer<IDX>().weights());
+	check(network.layer<IDX>().bias(), gradients.layer<IDX>().bias());
+}
+
+// The gradients from backward() are those of the loss that propagate() returns, through ReLU,
+// sigmoid and linear layers and the softmax loss.
+void gradientMatchesFiniteDifferences()
+{
+	const size_t batchSize = 7;
+	const auto input = test::randomTensor<double, 5>(batchSize);
+	const auto groundTruth = test::oneHot<double, 3>(batchSize);
+	test::NormalDistGenerator<double> gen(2);
+	Checked network{gen, gen, gen};
+	CheckedTraining training{network, nnp::SoftMaxLayer<double>{}};
+	CheckedTraining::Workspace<double> workspace(batchSize);
+	Checked::Gradients gradients;
+	gradients.setZero();
+	training.backward(workspace, gradients, input, groundTruth, 0.);
+	checkLayerGradient<0>(network, gradients, input, groundTruth);
+	checkLayerGradient<1>(network, gradients, input, groundTruth);
+	checkLayerGradient<2>(network, gradients, input, groundTruth);
+}
+
+// Hidden ReLU layers of 1024 nodes, one per index, and 10 outputs.
+template <typename Sequence>
+struct DeepHidden;
+
+template <size_t... IDX>
+struct DeepHidden<std::index_sequence<IDX...>>
+{
+	template <size_t>
+	using Hidden = nnp::ReluLayer<float, 1024, 1024>;
+
+	using Type = nnp::TupleNetwork<Hidden<IDX>..., nnp::LinearLayer<float, 10, 1024>>;
+};
+
+// Workspace memory per sample of 16 hidden layers, as the checkpointedPropagate benchmark
+// reports it, with and without checkpoints every 4 layers.
+void checkpointedWorkspaceBytes()
+{
+	using Deep = DeepHidden<std::make_index_sequence<16>>::Type;
+	NNP_CHECK(Deep::Workspace<float>(1).bytes() == 18452 * sizeof(float));
+	NNP_CHECK(
+		(Deep::Workspace<float, nnp::RESIZEABLE, 4>(1).bytes() == 9236 * sizeof(float)));
+}
+
+} // namespace
+
+int main()
+{
+	for (size_t threadCount : {1, 2, 4, 8})
+		parallelMatchesSequential(threadCount);
+	accumulationMatchesFullBatch();
+	hogwildNormsMatchWeights();
+	for (size_t stageCount : {1, 2, 3})
+		for (size_t microBatchCount : {1, 4, 5, 7})
+			pipelineMatchesNetwork(stageCount, microBatchCount);
+	dynamicMatchesTuple();
+	gradientMatchesFiniteDifferences();
+	reducedForwardMatchesFloat<nnp::BFloat16>();
+	reducedForwardMatchesFloat<nnp::Half>();
+	const auto fullPass = trainCheckpointed<1>();
+	checkpointingMatchesFullPass<2>(fullPass);
+	checkpointingMatchesFullPass<3>(fullPass);
+	checkpointingMatchesFullPass<4>(fullPass);
+	checkpointedWorkspaceBytes();
+	return test::result();
+}
@@ -0,0 +1,111 @@
+#include <cstddef>
+
+#include <nnp/layer.h>
+#include <nnp/optimizer.h>
+
+#include "test_utils.h"
+
+namespace {
+
+constexpr float STEP_SIZE = 0.1f;
+constexpr float REGULARIZATION = 0.01f;
+// The kernels compute in single precision.
+constexpr float TOLERANCE = 1e-5f;
+
+// The parameters after each of two steps with the same gradient.
+struct Expected
+{
+	float weights[2][2];
+	float bias[2];
+};
+
+// A layer with weights [1, -2] and bias 0.5.
+template <typename Optimizer>
+nnp::LinearLayer<float, 1, 2, Optimizer> makeLayer()
+{
+	nnp::LinearLayer<float, 1, 2, Optimizer> layer{test::NormalDistGenerator<float>()};
+	layer.weights()(0, 0) = 1;
+	layer.weights()(0, 1) = -2;
+	layer.syncWeights();
+	layer.bias()(0) = 0.5f;
+	return layer;
+}
+
+// Takes two steps with the weight gradient [0.5, 0.25] and the bias gradient 1 and compares
+// both with steps computed by hand in double precision. The bias is not regularized.
+template <typename Optimizer>
+void checkSteps(const Expected& expected)
+{
+	auto layer = makeLayer<Optimizer>();
+	typename decltype(layer)::Gradient gradient;
+	gradient.weights()(0, 0) = 0.5f;
+	gradient.weights()(0, 1) = 0.25f;
+	gradient.bias()(0) = 1;
+	for (size_t ii = 0; ii != 2; ++ii)
+	{
+		layer.step(gradient, STEP_SIZE, REGULARIZATION);
+		NNP_CHECK(test::near(layer.weights()(0, 0), expected.weights[ii][0], TOLERANCE));
+		NNP_CHECK(test::near(layer.weights()(0, 1), expected.weights[ii][1], TOLERANCE));
+		NNP_CHECK(test::near(layer.bias()(0), expected.bias[ii], TOLERANCE));
+	}
+}
+
+// v = 0.9 * v + g + regularization * w, w -= stepSize * v.
+void momentum()
+{
+	checkSteps<nnp::Momentum>({{{0.949f, -2.023f}, {0.852151f, -2.066677f}}, {0.4f, 0.21f}});
+}
+
+// The gradient with regularization over the root of its running mean square.
+void rmsProp()
+{
+	checkSteps<nnp::RmsProp>(
+		{{{0.68377225f, -2.31622772f}, {0.45503366f, -2.54413298f}},
+		 {0.18377224f, -0.04564348f}});
+}
+
+// Without bias correction the first two updates would be 1 - 0.9 and 1 - 0.81 times smaller
+// than the normalized gradient. Corrected, each step moves every parameter by about stepSize
+// whatever the gradient's scale.
+void adam()
+{
+	checkSteps<nnp::Adam>(
+		{{{0.90000000f, -2.10000000f}, {0.80000517f, -2.19998840f}}, {0.4f, 0.3f}});
+}
+
+// The Adam steps at regularization 0, with w shrunk by stepSize * regularization * w on top.
+void adamW()
+{
+	checkSteps<nnp::AdamW>(
+		{{{0.89900000f, -2.09800000f}, {0.79810100f, -2.19590199f}}, {0.4f, 0.3f}});
+}
+
+// The decoupled decay does not go through the moments, so it shrinks the weights by the same
+// factor whatever the gradient, even with none.
+void adamWDecayIgnoresGradient()
+{
+	auto layer = makeLayer<nnp::AdamW>();
+	const typename decltype(layer)::Gradient gradient;
+	float expected[] = {1, -2};
+	for (size_t ii = 0; ii != 2; ++ii)
+	{
+		layer.step(gradient, STEP_SIZE, REGULARIZATION);
+		for (auto& w : expected)
+			w *= 1 - STEP_SIZE * REGULARIZATION;
+		NNP_CHECK(test::near(layer.weights()(0, 0), expected[0], TOLERANCE));
+		NNP_CHECK(test::near(layer.weights()(0, 1), expected[1], TOLERANCE));
+		NNP_CHECK(layer.bias()(0) == 0.5f);
+	}
+}
+
+} // namespace
+
+int main()
+{
+	momentum();
+	rmsProp();
+	adam();
+	adamW();
+	adamWDecayIgnoresGradient();
+	return test::result();
+}
@@ -0,0 +1,175 @@
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <nnp/details/simd.h>
+
+#include "test_utils.h"
+
+namespace simd = nnp::details::simd;
+
+namespace {
+
+// Covers empty ranges, ranges shorter than a register and remainders of either width.
+constexpr size_t SIZES[] = {0, 1, 7, 8, 15, 16, 17, 37, 100, 1031};
+
+// Bounds of the vectorized exp, measured against std::exp, with some headroom.
+constexpr float SIGMOID_TOLERANCE = 1e-6f;
+constexpr float SOFTMAX_TOLERANCE = 2e-6f;
+
+std::vector<float> randomValues(size_t size, float range, uint32_t seed)
+{
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<float> dis(-range, range);
+	std::vector<float> values(size);
+	for (auto& v : values)
+		v = dis(gen);
+	// Exact zeros are where ReLU and its derivative are easiest to get wrong.
+	for (size_t ii = 0; ii < size; ii += 5)
+		values[ii] = 0.f;
+	return values;
+}
+
+bool near(const std::vector<float>& a, const std::vector<float>& b, float tolerance)
+{
+	for (size_t ii = 0; ii != a.size(); ++ii)
+		if (!test::near(a[ii], b[ii], tolerance))
+			return false;
+	return true;
+}
+
+void relu()
+{
+	for (size_t size : SIZES)
+	{
+		auto x = randomValues(size, 10.f, 1);
+		auto expected = x;
+		simd::scalar::relu(expected.data(), expected.data() + size);
+		simd::relu(x.data(), x.data() + size);
+		NNP_CHECK(x == expected);
+	}
+}
+
+// The derivative is zero wherever the input was not positive, so the gradient only passes
+// where the output is positive.
+void reluBackward()
+{
+	for (size_t size : SIZES)
+	{
+		const auto x = randomValues(size, 10.f, 2);
+		auto y = x;
+		simd::relu(y.data(), y.data() + size);
+		std::vector<float> gradient(size, 1.f), expected(size);
+		for (size_t ii = 0; ii != size; ++ii)
+			expected[ii] = x[ii] > 0.f ? 1.f : 0.f;
+
+		auto scalarGradient = gradient;
+		simd::scalar::reluBackward(
+			y.data(), scalarGradient.data(), scalarGradient.data() + size);
+		NNP_CHECK(scalarGradient == expected);
+
+		simd::reluBackward(y.data(), gradient.data(), gradient.data() + size);
+		NNP_CHECK(gradient == expected);
+	}
+}
+
+void sigmoid()
+{
+	for (size_t size : SIZES)
+	{
+		// Past +-88 the inputs are clamped, which the scalar version matches in float.
+		auto x = randomValues(size, 100.f, 3);
+		auto expected = x;
+		simd::scalar::sigmoid(expected.data(), expected.data() + size);
+		simd::sigmoid(x.data(), x.data() + size);
+		NNP_CHECK(near(x, expected, SIGMOID_TOLERANCE));
+	}
+}
+
+void sigmoidBackward()
+{
+	for (size_t size : SIZES)
+	{
+		auto y = randomValues(size, 10.f, 4);
+		simd::scalar::sigmoid(y.data(), y.data() + size);
+		auto gradient = randomValues(size, 1.f, 5);
+		auto expected = gradient;
+		simd::scalar::sigmoidBackward(y.data(), expected.data(), expected.data() + size);
+		simd::sigmoidBackward(y.data(), gradient.data(), gradient.data() + size);
+		NNP_CHECK(near(gradient, expected, SIGMOID_TOLERANCE));
+	}
+}
+
+void softmax()
+{
+	for (float range : {1.f, 50.f})
+		for (size_t size : SIZES)
+		{
+			auto x = randomValues(size, range, 6);
+			auto expected = x;
+			simd::scalar::softmax(expected.data(), expected.data() + size);
+			simd::softmax(x.data(), x.data() + size);
+			NNP_CHECK(near(x, expected, SOFTMAX_TOLERANCE));
+			if (size == 0)
+				continue;
+
+			x = randomValues(size, range, 7);
+			expected = x;
+			const float expectedLse =
+				simd::scalar::scaledSoftmax(expected.data(), expected.data() + size, 0.5f);
+			const float lse = simd::scaledSoftmax(x.data(), x.data() + size, 0.5f);
+			NNP_CHECK(near(x, expected, SOFTMAX_TOLERANCE));
+			NNP_CHECK(test::near(lse, expectedLse, SOFTMAX_TOLERANCE));
+		}
+}
+
+// Exact in every implementation. Rows cover the blocks of 4 and their remainder. Inputs and
+// weights at the ends of their ranges would saturate a 16-bit sum of two products.
+void gemvU8S8()
+{
+	std::mt19937 gen(8);
+	std::uniform_int_distribution<int> dis(0, 255);
+	for (size_t rows : {1, 4, 7})
+		for (size_t cols : SIZES)
+		{
+			std::vector<uint8_t> x(cols);
+			std::vector<int8_t> matrix(rows * cols);
+			std::vector<int32_t> bias(rows);
+			for (auto& v : x)
+				v = static_cast<uint8_t>(dis(gen));
+			for (auto& w : matrix)
+				w = static_cast<int8_t>(dis(gen) - 128);
+			for (auto& b : bias)
+				b = dis(gen) - 128;
+			for (size_t ii = 0; ii < cols; ii += 3)
+				x[ii] = 255;
+			for (size_t ii = 0; ii < matrix.size(); ii += 4)
+				matrix[ii] = ii % 8 ? 127 : -128;
+
+			std::vector<int32_t> expected(rows), y(rows);
+			simd::scalar::gemvU8S8(
+				matrix.data(), x.data(), bias.data(), expected.data(), rows, cols);
+			simd::gemvU8S8(matrix.data(), x.data(), bias.data(), y.data(), rows, cols);
+			NNP_CHECK(y == expected);
+		}
+}
+
+} // namespace
+
+int main()
+{
+	for (auto isa : {simd::Isa::SCALAR, simd::Isa::AVX2, simd::Isa::AVX512})
+	{
+		simd::setIsa(isa);
+		// Instruction sets the CPU lacks fall back to one that was already tested.
+		if (simd::isa() != isa)
+			continue;
+		relu();
+		reluBackward();
+		sigmoid();
+		sigmoidBackward();
+		softmax();
+		gemvU8S8();
+	}
+	return test::result();
+}
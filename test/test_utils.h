@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+
+#include <nnp/float16.h>
+#include <nnp/tensor.h>
+
+namespace test {
+
+inline int& failureCount()
+{
+	static int count = 0;
+	return count;
+}
+
+// Reports a failed check and carries on, so that one run lists every failure. Tests return
+// result() from main.
+#define NNP_CHECK(condition)                                                                \
+	do                                                                                      \
+	{                                                                                       \
+		if (!(condition))                                                                   \
+		{                                                                                   \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition "\n"; \
+			++test::failureCount();                                                         \
+		}                                                                                   \
+	} while (false)
+
+inline int result() { return failureCount() ? 1 : 0; }
+
+template <typename Float>
+bool near(Float a, Float b, Float tolerance)
+{
+	return std::abs(a - b) <= tolerance * std::max(Float{1}, std::abs(b));
+}
+
+template <typename Float>
+class NormalDistGenerator
+{
+	using Accumulator = nnp::details::Accumulator<Float>;
+
+public:
+	explicit NormalDistGenerator(uint32_t seed = 0)
+		: m_gen(seed)
+	{}
+
+	Float operator()() { return static_cast<Float>(m_dis(m_gen)); }
+
+private:
+	std::mt19937 m_gen;
+	std::normal_distribution<Accumulator> m_dis{Accumulator{0}, Accumulator{0.5}};
+};
+
+template <typename Float, size_t SIZE, size_t BATCH_SIZE = nnp::RESIZEABLE>
+nnp::Tensor<Float, SIZE, BATCH_SIZE> randomTensor(size_t batchSize, uint32_t seed = 1)
+{
+	nnp::Tensor<Float, SIZE, BATCH_SIZE> tensor;
+	if constexpr (BATCH_SIZE == nnp::RESIZEABLE)
+		tensor.setBatchSize(batchSize);
+	NormalDistGenerator<Float> gen(seed);
+	for (auto& f : tensor)
+		f = gen();
+	return tensor;
+}
+
+// One-hot ground truth with the class of each sample chosen round-robin.
+template <typename Float, size_t SIZE>
+nnp::Tensor<Float, SIZE> oneHot(size_t batchSize)
+{
+	nnp::Tensor<Float, SIZE> tensor(batchSize);
+	for (size_t ii = 0; ii != batchSize; ++ii)
+		for (size_t jj = 0; jj != SIZE; ++jj)
+			tensor(jj, ii) = jj == ii % SIZE ? Float{1} : Float{0};
+	return tensor;
+}
+
+} // namespace test
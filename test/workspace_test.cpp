@@ -0,0 +1,91 @@
+#include <cstdint>
+#include <new>
+
+#include <nnp/loss.h>
+#include <nnp/network.h>
+#include <nnp/profiler.h>
+
+#include "test_utils.h"
+
+NNP_COUNT_ALLOCATIONS
+
+namespace {
+
+using Hidden = nnp::TupleNetwork<
+	nnp::ReluLayer<float, 16, 8>,
+	nnp::SigmoidLayer<float, 16, 16>,
+	nnp::LinearLayer<float, 4, 16>>;
+
+using Training = nnp::Network<Hidden&, nnp::SoftMaxLayer<float>>;
+
+uint64_t allocations() { return nnp::details::allocationCount().load(); }
+
+// Once a workspace is constructed and every layer has run once, neither training nor
+// inference allocate.
+void steadyStateDoesNotAllocate(size_t batchSize)
+{
+	test::NormalDistGenerator<float> gen;
+	Hidden hidden{
+		nnp::ReluLayer<float, 16, 8>(gen),
+		nnp::SigmoidLayer<float, 16, 16>(gen),
+		nnp::LinearLayer<float, 4, 16>(gen)};
+	Training training{hidden, nnp::SoftMaxLayer<float>{}};
+
+	const auto input = test::randomTensor<float, 8>(batchSize);
+	const auto groundTruth = test::oneHot<float, 4>(batchSize);
+	Training::Workspace<float> workspace(batchSize);
+
+	training.propagate(workspace, input, groundTruth, 0.01f, 1e-4f);
+	hidden.forward(workspace, input);
+
+	const uint64_t before = allocations();
+	for (size_t ii = 0; ii != 10; ++ii)
+	{
+		training.propagate(workspace, input, groundTruth, 0.01f, 1e-4f);
+		training.propagate(workspace, input, groundTruth, 1e-4f);
+		hidden.forward(workspace, input);
+	}
+	NNP_CHECK(allocations() == before);
+}
+
+// Every form of the global operator new is counted, and its delete gives the bytes back.
+// The operators are called directly, as the allocations of new-expressions may be elided.
+void everyOperatorIsCounted()
+{
+	auto& heap = nnp::details::heapUsage();
+	const uint64_t bytes = heap.current();
+	const uint64_t before = allocations();
+	const std::align_val_t align{128};
+	void* plain = ::operator new(24);
+	void* array = ::operator new[](24);
+	void* nothrow = ::operator new(24, std::nothrow);
+	void* nothrowArray = ::operator new[](24, std::nothrow);
+	void* aligned = ::operator new(24, align);
+	void* alignedArray = ::operator new[](24, align);
+	void* alignedNothrow = ::operator new(24, align, std::nothrow);
+	void* alignedNothrowArray = ::operator new[](24, align, std::nothrow);
+	NNP_CHECK(allocations() == before + 8);
+	NNP_CHECK(heap.current() == bytes + 8 * 24);
+	for (void* ptr : {aligned, alignedArray, alignedNothrow, alignedNothrowArray})
+		NNP_CHECK(reinterpret_cast<uintptr_t>(ptr) % 128 == 0);
+
+	::operator delete(plain, 24);
+	::operator delete[](array);
+	::operator delete(nothrow, std::nothrow);
+	::operator delete[](nothrowArray, 24);
+	::operator delete(aligned, align);
+	::operator delete[](alignedArray, 24, align);
+	::operator delete(alignedNothrow, align, std::nothrow);
+	::operator delete[](alignedNothrowArray, align, std::nothrow);
+	NNP_CHECK(heap.current() == bytes);
+}
+
+} // namespace
+
+int main()
+{
+	steadyStateDoesNotAllocate(1);
+	steadyStateDoesNotAllocate(32);
+	everyOperatorIsCounted();
+	return test::result();
+}